@@ -1,5 +1,11 @@
 #include "stdafx.h"
+#include "../../nm_ping/histogram.h"
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Largest UDP payload that fits an unfragmented 1500 byte MTU.
+#define MAX_PAYLOAD_SIZE 1472
 
 static RIO_EXTENSION_FUNCTION_TABLE gRio;
 static SOCKET gSocket;
@@ -7,8 +13,7 @@ static uint8_t gData[1024*1024];
 static RIO_BUFFERID gBufferId;
 static HANDLE gIocp;
 static LARGE_INTEGER gPerfFreq;
-static double gPerfFreqUs;
-static uint64_t gWorstCaseLatency;
+static double gPerfFreqNs;
 static RIO_RQ gRq;
 
 static RIO_CQ gSendCq;
@@ -20,7 +25,10 @@ static RIO_NOTIFICATION_COMPLETION gRecvNotify;
 static OVERLAPPED gRecvOverlapped;
 
 static int gIterations = 100000;
-static int gIterationsLeft = gIterations;
+static int gWarmup = 1000;
+static int gPayloadSize = sizeof(uint64_t);
+static const char *gCsvPath;
+static LatencyHistogram gHistogram;
 
 static void clientLoop(const char *addr);
 static void serverLoop();
@@ -31,10 +39,67 @@ static void serverLoop();
 #define dprintf(...)
 #endif
 
+static void usage(const char *progName)
+{
+    fprintf(stderr,
+        "Usage:\r\n"
+        "  %s [options]              # Starts server\r\n"
+        "  %s [options] <dest-ip>    # Starts client\r\n\r\n"
+        "Options (give the server the same -n and -w as the client):\r\n"
+        "  -n <count>  Measured iterations (default %d)\r\n"
+        "  -w <count>  Unmeasured warm-up iterations (default %d)\r\n"
+        "  -l <bytes>  Payload size, %d to %d (default %d)\r\n"
+        "  -o <file>   Write per-sample latencies to a CSV file\r\n",
+        progName, progName, gIterations, gWarmup, (int)sizeof(uint64_t),
+        MAX_PAYLOAD_SIZE, gPayloadSize);
+    exit(1);
+}
+
 int main(int argc, const char **argv)
 {
     WSADATA wsaData;
-    bool isClient = argc > 1;
+    const char *addr = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-') {
+            if (addr) {
+                usage(argv[0]);
+            }
+
+            addr = argv[i];
+            continue;
+        }
+
+        if (i + 1 >= argc || argv[i][1] == 0 || argv[i][2] != 0) {
+            usage(argv[0]);
+        }
+
+        switch (argv[i][1]) {
+        case 'n':
+            gIterations = atoi(argv[++i]);
+            break;
+        case 'w':
+            gWarmup = atoi(argv[++i]);
+            break;
+        case 'l':
+            gPayloadSize = atoi(argv[++i]);
+            break;
+        case 'o':
+            gCsvPath = argv[++i];
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (gIterations <= 0 || gWarmup < 0 ||
+        gPayloadSize < (int)sizeof(uint64_t) ||
+        gPayloadSize > MAX_PAYLOAD_SIZE) {
+
+        usage(argv[0]);
+    }
+
+    bool isClient = addr != nullptr;
 
     setvbuf(stdout, 0, _IONBF, 0);
     setvbuf(stderr, 0, _IONBF, 0);
@@ -54,7 +119,7 @@ int main(int argc, const char **argv)
         return 1;
     }
 
-    gPerfFreqUs = (double)gPerfFreq.QuadPart / 1000000.0;
+    gPerfFreqNs = (double)gPerfFreq.QuadPart / 1000000000.0;
 
     if (WSAStartup(MAKEWORD(2,2), &wsaData)) {
         fprintf(stderr, "Unable to initialize winsock.\r\n");
@@ -122,15 +187,8 @@ int main(int argc, const char **argv)
     }
 
     if (isClient) {
-        LARGE_INTEGER start, end;
         printf("Starting ping client.\r\n");
-        QueryPerformanceCounter(&start);
-        clientLoop(argv[1]);
-        QueryPerformanceCounter(&end);
-
-        printf("Average latency: %lldus\r\n", (uint64_t)(
-            (end.QuadPart - start.QuadPart) / gPerfFreqUs / gIterations));
-        printf("Worst case latency: %lldus\r\n", gWorstCaseLatency);
+        clientLoop(addr);
     } else {
         printf("Starting ping server.\r\n");
         serverLoop();
@@ -139,7 +197,7 @@ int main(int argc, const char **argv)
     return 0;
 }
 
-static bool dumpCompletions(RIO_CQ cq)
+static bool dumpCompletions(RIO_CQ cq, ULONG *bytesTransferred = nullptr)
 {
     RIORESULT results[8];
     ULONG status;
@@ -153,6 +211,10 @@ static bool dumpCompletions(RIO_CQ cq)
         }
 
         total += status;
+
+        if (bytesTransferred) {
+            *bytesTransferred = results[status - 1].BytesTransferred;
+        }
     }
 
     return total > 0;
@@ -162,12 +224,16 @@ static void clientLoop(const char *addr)
 {
     struct sockaddr_in target;
     uint64_t index = 0;
-    RIO_BUF sendData = { gBufferId, 0, sizeof(uint64_t) };
+    RIO_BUF sendData = { gBufferId, 0, (ULONG)gPayloadSize };
     RIO_BUF sendAddress = {
-        gBufferId, 2 * sizeof(uint64_t), sizeof(SOCKADDR_INET)
+        gBufferId, 2 * MAX_PAYLOAD_SIZE, sizeof(SOCKADDR_INET)
     };
-    RIO_BUF recvData = { gBufferId, sizeof(uint64_t), sizeof(uint64_t) };
-    LARGE_INTEGER startQpc, endQpc;
+    RIO_BUF recvData = { gBufferId, MAX_PAYLOAD_SIZE, MAX_PAYLOAD_SIZE };
+    LARGE_INTEGER startQpc, endQpc, loopStartQpc, loopEndQpc;
+    LatencySample *samples = nullptr;
+    size_t sampleCount = 0;
+    uint64_t worstCaseLatency = 0;
+    int total = gWarmup + gIterations;
 
     target.sin_family = AF_INET;
     target.sin_port = htons(10000);
@@ -178,24 +244,38 @@ static void clientLoop(const char *addr)
     }
 
     memcpy(gData + sendAddress.Offset, &target, sizeof(struct sockaddr_in));
+    histogramInit(&gHistogram);
+
+    // Samples are buffered so file I/O stays out of the timed loop.
+    if (gCsvPath) {
+        samples = (LatencySample *)calloc(gIterations, sizeof(LatencySample));
+    }
+
+    printf("Payload %d bytes, %d warm-up iterations, %d measured.\r\n",
+        gPayloadSize, gWarmup, gIterations);
+    QueryPerformanceCounter(&loopStartQpc);
 
-    while (gIterationsLeft--) {
+    for (int i = 0; i < total; ++i) {
         bool sendComplete = false, recvComplete = false;
 
+        if (i == gWarmup) {
+            QueryPerformanceCounter(&loopStartQpc);
+        }
+
         QueryPerformanceCounter(&startQpc);
         ++index;
         memcpy(gData + sendData.Offset, &index, sizeof(index));
 
         if (!gRio.RIOReceiveEx(gRq, &recvData, 1, 0, 0, 0, 0, 0, 0)) {
             fprintf(stderr, "Error in RIOReceiveEx.\r\n");
-            return;
+            goto out;
         }
 
         dprintf("started recv %08llX\r\n", index);
 
         if (!gRio.RIOSendEx(gRq, &sendData, 1, 0, &sendAddress, 0, 0, 0, 0)) {
             fprintf(stderr, "Error in RIOSendEx.\r\n");
-            return;
+            goto out;
         }
 
         dprintf("started send %08llX\r\n", index);
@@ -215,13 +295,6 @@ static void clientLoop(const char *addr)
                 dprintf("recv complete\r\n");
                 recvComplete = true;
                 QueryPerformanceCounter(&endQpc);
-                uint64_t latency = (uint64_t)(
-                    (endQpc.QuadPart - startQpc.QuadPart) / gPerfFreqUs);
-
-                if (latency > gWorstCaseLatency && index > 1) {
-                    printf("worst case %08llX: %lldus\r\n", index, latency);
-                    gWorstCaseLatency = latency;
-                }
             }
         }
 
@@ -232,26 +305,65 @@ static void clientLoop(const char *addr)
         if (index != rIndex) {
             fprintf(stderr, "Returned index doesn't match.\r\n");
         }
+
+        if (i < gWarmup) {
+            continue;
+        }
+
+        uint64_t latency = (uint64_t)(
+            (endQpc.QuadPart - startQpc.QuadPart) / gPerfFreqNs);
+
+        histogramRecord(&gHistogram, latency);
+
+        if (samples) {
+            samples[sampleCount].index = index;
+            samples[sampleCount].timeNs = (uint64_t)(
+                (startQpc.QuadPart - loopStartQpc.QuadPart) / gPerfFreqNs);
+            samples[sampleCount].latencyNs = latency;
+            sampleCount++;
+        }
+
+        if (latency > worstCaseLatency) {
+            printf("worst case %08llX: %lldus\r\n", index, latency / 1000);
+            worstCaseLatency = latency;
+        }
+    }
+
+    QueryPerformanceCounter(&loopEndQpc);
+    printf("Average latency: %lldus\r\n", (uint64_t)(
+        (loopEndQpc.QuadPart - loopStartQpc.QuadPart) /
+        gPerfFreqNs / 1000 / gIterations));
+    printf("Worst case latency: %lldus\r\n", worstCaseLatency / 1000);
+    histogramPrint(&gHistogram, stdout);
+
+out:
+    if (samples) {
+        if (!writeLatencyCsv(gCsvPath, samples, sampleCount, nullptr, 0)) {
+            fprintf(stderr, "Unable to write %s.\r\n", gCsvPath);
+        }
+
+        free(samples);
     }
 }
 
 static void serverLoop()
 {
-    RIO_BUF recvData = { gBufferId, 0, sizeof(uint64_t) };
-    RIO_BUF sendData = { gBufferId, sizeof(uint64_t), sizeof(uint64_t) };
+    RIO_BUF recvData = { gBufferId, 0, MAX_PAYLOAD_SIZE };
+    RIO_BUF sendData = { gBufferId, MAX_PAYLOAD_SIZE, MAX_PAYLOAD_SIZE };
     RIO_BUF recvAddress = {
         gBufferId,
-        2 * sizeof(uint64_t),
+        2 * MAX_PAYLOAD_SIZE,
         sizeof(SOCKADDR_INET)
     };
     RIO_BUF sendAddress = {
         gBufferId,
-        2 * sizeof(uint64_t) + sizeof(SOCKADDR_INET),
+        2 * MAX_PAYLOAD_SIZE + sizeof(SOCKADDR_INET),
         sizeof(SOCKADDR_INET)
     };
     bool firstIteration = true;
+    int iterationsLeft = gWarmup + gIterations;
 
-    while (gIterationsLeft--) {
+    while (iterationsLeft--) {
         bool sendComplete = false, recvComplete = false;
 
         if (firstIteration) {
@@ -269,9 +381,10 @@ static void serverLoop()
 
         while (!sendComplete || !recvComplete) {
             bool didSend = false, didRecv = false;
+            ULONG recvBytes = 0;
 
             didSend = !sendComplete && dumpCompletions(gSendCq);
-            didRecv = !recvComplete && dumpCompletions(gRecvCq);
+            didRecv = !recvComplete && dumpCompletions(gRecvCq, &recvBytes);
 
             if (didSend) {
                 dprintf("send complete\r\n");
@@ -288,6 +401,8 @@ static void serverLoop()
                 dprintf("recv %08llX complete\r\n", index);
                 recvComplete = true;
 
+                // Echo back exactly what the client sent.
+                sendData.Length = recvBytes;
                 memcpy(
                     gData + sendData.Offset,
                     gData + recvData.Offset,
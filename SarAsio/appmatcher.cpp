@@ -0,0 +1,169 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "appmatcher.h"
+
+namespace Sar {
+
+// The same folding std::regex uses for icase, so literal rules match the
+// paths they did as escaped regexes.
+static std::wstring foldCase(const std::wstring& str)
+{
+    auto& ctype = std::use_facet<std::ctype<wchar_t>>(std::locale());
+    std::wstring result(str);
+
+    ctype.tolower(&result[0], &result[0] + result.size());
+    return result;
+}
+
+static bool isQuantifier(wchar_t c)
+{
+    return c == L'*' || c == L'+' || c == L'?' || c == L'{';
+}
+
+// Returns the longest run of literal characters outside of any group or
+// alternation, which every match of the pattern contains. Anything the scan
+// doesn't understand just ends the run, or gives up on the whole pattern,
+// so the result is never more than the pattern requires.
+static std::wstring requiredLiteral(const std::wstring& pattern)
+{
+    std::wstring best, run;
+    int depth = 0;
+    bool inClass = false;
+
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        auto c = pattern[i];
+        bool literal = false;
+
+        if (c == L'\\') {
+            if (++i == pattern.size()) {
+                return std::wstring();
+            }
+
+            c = pattern[i];
+
+            // \x, \u and \c take operands that would look like literals.
+            if (c == L'x' || c == L'u' || c == L'c' || c == L'0') {
+                return std::wstring();
+            }
+
+            literal = !inClass && depth == 0 && !iswalnum(c);
+        } else if (inClass) {
+            inClass = c != L']';
+        } else if (c == L'[') {
+            inClass = true;
+        } else if (c == L'{') {
+            // skip the counts, which aren't literals.
+            while (i + 1 < pattern.size() && pattern[i] != L'}') {
+                ++i;
+            }
+        } else if (c == L'(') {
+            depth++;
+        } else if (c == L')') {
+            depth--;
+        } else if (c == L'|') {
+            if (depth == 0) {
+                return std::wstring();
+            }
+        } else if (depth == 0) {
+            literal = !wcschr(L".^$*+?{}]", c);
+        }
+
+        auto next = i + 1 < pattern.size() ? pattern[i + 1] : L'\0';
+        auto after = i + 2 < pattern.size() ? pattern[i + 2] : L'\0';
+
+        // an optional character can't be required, and a repeated one ends
+        // the run after its first occurrence.
+        if (literal && (!isQuantifier(next) ||
+            (next == L'+' && !isQuantifier(after)))) {
+
+            run += c;
+        } else {
+            literal = false;
+        }
+
+        if (!literal || isQuantifier(next)) {
+            if (run.size() > best.size()) {
+                best = run;
+            }
+
+            run.clear();
+        }
+    }
+
+    if (run.size() > best.size()) {
+        best = run;
+    }
+
+    return foldCase(best);
+}
+
+ApplicationMatcher::ApplicationMatcher(
+    const std::vector<ApplicationRule>& rules)
+{
+    for (int i = 0; i < (int)rules.size(); ++i) {
+        if (!rules[i].regexMatch) {
+            // emplace keeps the first of any duplicates.
+            _literals.emplace(foldCase(rules[i].path), i);
+            continue;
+        }
+
+        RegexRule rule;
+
+        try {
+            // TODO: UTF-8 support on Windows is very sad. This might need
+            // ICU or PCRE.
+            rule.regex = std::wregex(rules[i].path,
+                std::regex_constants::ECMAScript |
+                std::regex_constants::icase);
+        } catch (std::exception&) {
+            // rules that don't compile never match.
+            continue;
+        }
+
+        rule.required = requiredLiteral(rules[i].path);
+        rule.index = i;
+        _regexes.emplace_back(std::move(rule));
+    }
+}
+
+int ApplicationMatcher::match(const std::wstring& path) const
+{
+    auto folded = foldCase(path);
+    auto literal = _literals.find(folded);
+    int result = literal == _literals.end() ? -1 : literal->second;
+
+    for (auto& rule : _regexes) {
+        if (result >= 0 && rule.index > result) {
+            break;
+        }
+
+        if (!rule.required.empty() &&
+            folded.find(rule.required) == std::wstring::npos) {
+
+            continue;
+        }
+
+        if (std::regex_search(path, rule.regex)) {
+            return rule.index;
+        }
+    }
+
+    return result;
+}
+
+} // namespace Sar
@@ -0,0 +1,55 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_APPMATCHER_H
+#define _SAR_ASIO_APPMATCHER_H
+
+namespace Sar {
+
+struct ApplicationRule
+{
+    std::wstring path;
+    bool regexMatch = false;
+};
+
+// Finds the first rule matching a process path. Literal rules match the
+// whole path case insensitively and are looked up in a hash table. Regex
+// rules are searched anywhere in the path; each one is compiled once along
+// with the longest literal run every match of it has to contain, so most
+// rules are ruled out by a substring search without running the regex.
+struct ApplicationMatcher
+{
+    ApplicationMatcher() {}
+    explicit ApplicationMatcher(const std::vector<ApplicationRule>& rules);
+    // Returns the index of the first matching rule, or -1.
+    int match(const std::wstring& path) const;
+
+private:
+    struct RegexRule
+    {
+        std::wregex regex;
+        // case folded; empty if the rule has no required literal.
+        std::wstring required;
+        int index;
+    };
+
+    std::unordered_map<std::wstring, int> _literals;
+    std::vector<RegexRule> _regexes;
+};
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_APPMATCHER_H
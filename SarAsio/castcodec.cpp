@@ -0,0 +1,328 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "castcodec.h"
+
+#include <algorithm>
+
+namespace Sar {
+
+static const int MAX_ORDER = 3;
+// Quotients this large are written as an escape followed by the raw value,
+// which bounds the cost of a single outlier.
+static const int RICE_ESCAPE = 32;
+
+struct BitWriter
+{
+    BitWriter(uint8_t *out, size_t size): _out(out), _size(size) {}
+
+    // bits must be at most 32.
+    void put(uint64_t value, int bits)
+    {
+        _acc = (_acc << bits) | (value & ((1ULL << bits) - 1));
+        _count += bits;
+
+        while (_count >= 8) {
+            _count -= 8;
+            emit((uint8_t)(_acc >> _count));
+        }
+    }
+
+    void putWide(uint64_t value, int bits)
+    {
+        if (bits > 32) {
+            put(value >> 32, bits - 32);
+            bits = 32;
+        }
+
+        put(value, bits);
+    }
+
+    size_t finish()
+    {
+        if (_count > 0) {
+            emit((uint8_t)(_acc << (8 - _count)));
+            _count = 0;
+        }
+
+        return _overflow ? 0 : _pos;
+    }
+
+private:
+    void emit(uint8_t byte)
+    {
+        if (_pos < _size) {
+            _out[_pos++] = byte;
+        } else {
+            _overflow = true;
+        }
+    }
+
+    uint8_t *_out;
+    size_t _size;
+    size_t _pos = 0;
+    uint64_t _acc = 0;
+    int _count = 0;
+    bool _overflow = false;
+};
+
+struct BitReader
+{
+    BitReader(const uint8_t *in, size_t size): _in(in), _size(size) {}
+
+    // bits must be at most 32.
+    uint64_t get(int bits)
+    {
+        while (_count < bits) {
+            _acc = (_acc << 8) | (_pos < _size ? _in[_pos] : 0);
+            _overrun |= _pos >= _size;
+            _pos++;
+            _count += 8;
+        }
+
+        _count -= bits;
+        return (_acc >> _count) & ((1ULL << bits) - 1);
+    }
+
+    uint64_t getWide(int bits)
+    {
+        uint64_t high = 0;
+
+        if (bits > 32) {
+            high = get(bits - 32) << 32;
+            bits = 32;
+        }
+
+        return high | get(bits);
+    }
+
+    bool overrun() const { return _overrun; }
+
+private:
+    const uint8_t *_in;
+    size_t _size;
+    size_t _pos = 0;
+    uint64_t _acc = 0;
+    int _count = 0;
+    bool _overrun = false;
+};
+
+static inline int32_t loadSample(const uint8_t *p, int sampleSize)
+{
+    switch (sampleSize) {
+        case 2:
+            return (int16_t)(p[0] | (p[1] << 8));
+        case 3:
+            return (int32_t)(
+                ((uint32_t)p[0] << 8) |
+                ((uint32_t)p[1] << 16) |
+                ((uint32_t)p[2] << 24)) >> 8;
+        default:
+            return (int32_t)(
+                (uint32_t)p[0] |
+                ((uint32_t)p[1] << 8) |
+                ((uint32_t)p[2] << 16) |
+                ((uint32_t)p[3] << 24));
+    }
+}
+
+static inline void storeSample(uint8_t *p, int32_t value, int sampleSize)
+{
+    for (int i = 0; i < sampleSize; ++i) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+CastCodec::CastCodec(int frameCount, int sampleSize):
+    _frameCount(frameCount), _sampleSize(sampleSize),
+    _samples(frameCount), _residual(frameCount)
+{
+}
+
+size_t CastCodec::encode(const void *samples, uint8_t *out, size_t outSize)
+{
+    auto src = (const uint8_t *)samples;
+    auto rawSize = (size_t)_frameCount * _sampleSize;
+    auto x = _samples.data();
+    int64_t sums[MAX_ORDER + 1] = {};
+
+    if (_frameCount <= MAX_ORDER) {
+        return 0;
+    }
+
+    for (int i = 0; i < _frameCount; ++i) {
+        x[i] = loadSample(src + i * _sampleSize, _sampleSize);
+    }
+
+    // estimate the cost of every predictor in one branch-free pass; the
+    // compiler vectorizes this, which matters more than the Rice coder.
+    for (int i = MAX_ORDER; i < _frameCount; ++i) {
+        int64_t e0 = x[i];
+        int64_t e1 = e0 - x[i - 1];
+        int64_t e2 = e1 - ((int64_t)x[i - 1] - x[i - 2]);
+        int64_t e3 = e2 - ((int64_t)x[i - 1] - 2 * (int64_t)x[i - 2] +
+            x[i - 3]);
+
+        sums[0] += e0 < 0 ? -e0 : e0;
+        sums[1] += e1 < 0 ? -e1 : e1;
+        sums[2] += e2 < 0 ? -e2 : e2;
+        sums[3] += e3 < 0 ? -e3 : e3;
+    }
+
+    int order = 0;
+
+    for (int i = 1; i <= MAX_ORDER; ++i) {
+        if (sums[i] < sums[order]) {
+            order = i;
+        }
+    }
+
+    auto r = _residual.data();
+    uint64_t total = 0;
+
+    for (int i = order; i < _frameCount; ++i) {
+        int64_t prediction;
+
+        switch (order) {
+            case 0: prediction = 0; break;
+            case 1: prediction = x[i - 1]; break;
+            case 2: prediction = 2 * (int64_t)x[i - 1] - x[i - 2]; break;
+            default:
+                prediction = 3 * (int64_t)x[i - 1] - 3 * (int64_t)x[i - 2] +
+                    x[i - 3];
+                break;
+        }
+
+        r[i] = x[i] - prediction;
+        total += (uint64_t)((r[i] << 1) ^ (r[i] >> 63));
+    }
+
+    auto count = (uint64_t)(_frameCount - order);
+    auto rawBits = _sampleSize * 8 + 4;
+    int k = 0;
+
+    while (k < rawBits - 1 && (count << (k + 1)) < total) {
+        k++;
+    }
+
+    auto header = 2 + order * (size_t)_sampleSize;
+    auto limit = std::min(outSize, rawSize);
+
+    if (limit <= header) {
+        return 0;
+    }
+
+    out[0] = (uint8_t)order;
+    out[1] = (uint8_t)k;
+
+    for (int i = 0; i < order; ++i) {
+        storeSample(out + 2 + i * _sampleSize, x[i], _sampleSize);
+    }
+
+    BitWriter writer(out + header, limit - header);
+
+    for (int i = order; i < _frameCount; ++i) {
+        auto u = (uint64_t)((r[i] << 1) ^ (r[i] >> 63));
+        auto q = u >> k;
+
+        if (q < RICE_ESCAPE) {
+            writer.put(1, (int)q + 1);
+            writer.putWide(u, k);
+        } else {
+            writer.put(0, RICE_ESCAPE);
+            writer.putWide(u, rawBits);
+        }
+    }
+
+    auto size = writer.finish();
+
+    if (!size || header + size >= rawSize) {
+        return 0;
+    }
+
+    return header + size;
+}
+
+bool CastCodec::decode(const uint8_t *in, size_t size, void *samples)
+{
+    auto dst = (uint8_t *)samples;
+    auto rawBits = _sampleSize * 8 + 4;
+
+    if (size < 2) {
+        return false;
+    }
+
+    int order = in[0];
+    int k = in[1];
+    auto header = 2 + order * (size_t)_sampleSize;
+
+    if (order > MAX_ORDER || order > _frameCount || k >= rawBits ||
+        size < header) {
+
+        return false;
+    }
+
+    auto x = _samples.data();
+
+    for (int i = 0; i < order; ++i) {
+        x[i] = loadSample(in + 2 + i * _sampleSize, _sampleSize);
+    }
+
+    BitReader reader(in + header, size - header);
+
+    for (int i = order; i < _frameCount; ++i) {
+        uint64_t u;
+        int q = 0;
+
+        while (q < RICE_ESCAPE && !reader.get(1)) {
+            q++;
+        }
+
+        if (q == RICE_ESCAPE) {
+            u = reader.getWide(rawBits);
+        } else {
+            u = ((uint64_t)q << k) | reader.getWide(k);
+        }
+
+        if (reader.overrun()) {
+            return false;
+        }
+
+        auto residual = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+        int64_t prediction;
+
+        switch (order) {
+            case 0: prediction = 0; break;
+            case 1: prediction = x[i - 1]; break;
+            case 2: prediction = 2 * (int64_t)x[i - 1] - x[i - 2]; break;
+            default:
+                prediction = 3 * (int64_t)x[i - 1] - 3 * (int64_t)x[i - 2] +
+                    x[i - 3];
+                break;
+        }
+
+        x[i] = (int32_t)(prediction + residual);
+    }
+
+    for (int i = 0; i < _frameCount; ++i) {
+        storeSample(dst + i * _sampleSize, x[i], _sampleSize);
+    }
+
+    return true;
+}
+
+} // namespace Sar
@@ -0,0 +1,43 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_CASTCODEC_H
+#define _SAR_ASIO_CASTCODEC_H
+
+namespace Sar {
+
+// Lossless codec for one channel's worth of a period. Picks the best of the
+// fixed polynomial predictors of order 0-3 (as in FLAC) and Rice codes the
+// residual. Each period is coded independently so a lost packet never
+// affects its neighbours.
+struct CastCodec
+{
+    CastCodec(int frameCount, int sampleSize);
+    // Returns the encoded size, or 0 if the period doesn't get smaller and
+    // should be sent raw.
+    size_t encode(const void *samples, uint8_t *out, size_t outSize);
+    bool decode(const uint8_t *in, size_t size, void *samples);
+
+private:
+    int _frameCount;
+    int _sampleSize;
+    std::vector<int32_t> _samples;
+    std::vector<int64_t> _residual;
+};
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_CASTCODEC_H
@@ -0,0 +1,207 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "castsocket.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define closesocket ::close
+#define WSAPoll ::poll
+typedef pollfd WSAPOLLFD;
+#endif
+
+namespace Sar {
+
+CastSocket::CastSocket()
+{
+#ifdef _WIN32
+    WSADATA data;
+
+    WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+}
+
+CastSocket::~CastSocket()
+{
+    close();
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+bool CastSocket::open(const std::string& bindAddress, uint16_t port)
+{
+    sockaddr_in addr;
+    int reuse = 1;
+
+    close();
+
+    if (!CastParseAddress(bindAddress, port, &addr)) {
+        return false;
+    }
+
+    _socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (_socket == CAST_INVALID_SOCKET) {
+        LOG(ERROR) << "Couldn't create cast socket.";
+        return false;
+    }
+
+    // several slaves on one host need to share the group port.
+    setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR,
+        (const char *)&reuse, sizeof(reuse));
+
+    if (bind(_socket, (const sockaddr *)&addr, sizeof(addr))) {
+        LOG(ERROR) << "Couldn't bind cast socket to "
+            << CastFormatAddress(addr) << ".";
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void CastSocket::close()
+{
+    if (_socket != CAST_INVALID_SOCKET) {
+        closesocket(_socket);
+        _socket = CAST_INVALID_SOCKET;
+    }
+}
+
+bool CastSocket::joinGroup(
+    const std::string& group, const std::string& interfaceAddress)
+{
+    sockaddr_in groupAddr, interfaceAddr;
+    ip_mreq mreq = {};
+
+    if (!CastParseAddress(group, 0, &groupAddr) ||
+        !CastParseAddress(interfaceAddress, 0, &interfaceAddr)) {
+
+        return false;
+    }
+
+    mreq.imr_multiaddr = groupAddr.sin_addr;
+    mreq.imr_interface = interfaceAddr.sin_addr;
+
+    if (setsockopt(_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+        (const char *)&mreq, sizeof(mreq))) {
+
+        LOG(ERROR) << "Couldn't join multicast group " << group << ".";
+        return false;
+    }
+
+    return true;
+}
+
+bool CastSocket::setMulticastOptions(
+    const std::string& interfaceAddress, int ttl, bool loopback)
+{
+    sockaddr_in interfaceAddr;
+    int loop = loopback ? 1 : 0;
+
+    if (!CastParseAddress(interfaceAddress, 0, &interfaceAddr)) {
+        return false;
+    }
+
+    if (setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_IF,
+            (const char *)&interfaceAddr.sin_addr,
+            sizeof(interfaceAddr.sin_addr)) ||
+        setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_TTL,
+            (const char *)&ttl, sizeof(ttl)) ||
+        setsockopt(_socket, IPPROTO_IP, IP_MULTICAST_LOOP,
+            (const char *)&loop, sizeof(loop))) {
+
+        LOG(ERROR) << "Couldn't set multicast options.";
+        return false;
+    }
+
+    return true;
+}
+
+bool CastSocket::setDestination(const std::string& address, uint16_t port)
+{
+    return CastParseAddress(address, port, &_destination);
+}
+
+bool CastSocket::send(const void *data, size_t size)
+{
+    return sendTo(data, size, _destination);
+}
+
+bool CastSocket::sendTo(const void *data, size_t size, const sockaddr_in& to)
+{
+    return sendto(_socket, (const char *)data, (int)size, 0,
+        (const sockaddr *)&to, sizeof(to)) == (int)size;
+}
+
+int CastSocket::receive(
+    void *buffer, size_t size, sockaddr_in *from, int timeoutMs)
+{
+    WSAPOLLFD pfd = {};
+    socklen_t fromSize = sizeof(*from);
+
+    pfd.fd = _socket;
+    pfd.events = POLLIN;
+
+    auto ready = WSAPoll(&pfd, 1, timeoutMs);
+
+    if (ready <= 0) {
+        return ready;
+    }
+
+    auto result = recvfrom(_socket, (char *)buffer, (int)size, 0,
+        (sockaddr *)from, &fromSize);
+
+    return result < 0 ? -1 : (int)result;
+}
+
+bool CastParseAddress(
+    const std::string& address, uint16_t port, sockaddr_in *result)
+{
+    memset(result, 0, sizeof(*result));
+    result->sin_family = AF_INET;
+    result->sin_port = htons(port);
+
+    if (address.empty()) {
+        result->sin_addr.s_addr = htonl(INADDR_ANY);
+        return true;
+    }
+
+    if (inet_pton(AF_INET, address.c_str(), &result->sin_addr) != 1) {
+        LOG(ERROR) << "Invalid cast address " << address << ".";
+        return false;
+    }
+
+    return true;
+}
+
+std::string CastFormatAddress(const sockaddr_in& address)
+{
+    char buf[INET_ADDRSTRLEN] = {};
+    std::ostringstream os;
+
+    inet_ntop(AF_INET, (void *)&address.sin_addr, buf, sizeof(buf));
+    os << buf << ":" << ntohs(address.sin_port);
+    return os.str();
+}
+
+} // namespace Sar
@@ -0,0 +1,69 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_CASTSOCKET_H
+#define _SAR_ASIO_CASTSOCKET_H
+
+#ifdef _WIN32
+typedef SOCKET CastSocketHandle;
+#define CAST_INVALID_SOCKET INVALID_SOCKET
+#else
+#include <netinet/in.h>
+typedef int CastSocketHandle;
+#define CAST_INVALID_SOCKET (-1)
+#endif
+
+namespace Sar {
+
+// Thin UDP socket used by the cast master and slaves. The destination can be
+// a unicast slave or a multicast group, in which case every slave that has
+// joined the group receives each packet from a single send.
+struct CastSocket
+{
+    CastSocket();
+    ~CastSocket();
+    CastSocket(const CastSocket&) = delete;
+    CastSocket& operator=(const CastSocket&) = delete;
+
+    // bindAddress may be empty to bind to all interfaces.
+    bool open(const std::string& bindAddress, uint16_t port);
+    void close();
+    // Slave side: receive packets sent to group on the given interface.
+    bool joinGroup(
+        const std::string& group, const std::string& interfaceAddress = "");
+    // Master side: choose the outgoing interface and scope for multicast.
+    bool setMulticastOptions(
+        const std::string& interfaceAddress, int ttl, bool loopback);
+    bool setDestination(const std::string& address, uint16_t port);
+    bool send(const void *data, size_t size);
+    bool sendTo(const void *data, size_t size, const sockaddr_in& to);
+    // Returns the datagram size, 0 on timeout or -1 on error. A negative
+    // timeout blocks indefinitely.
+    int receive(void *buffer, size_t size, sockaddr_in *from, int timeoutMs);
+    CastSocketHandle handle() const { return _socket; }
+
+private:
+    CastSocketHandle _socket = CAST_INVALID_SOCKET;
+    sockaddr_in _destination = {};
+};
+
+bool CastParseAddress(
+    const std::string& address, uint16_t port, sockaddr_in *result);
+std::string CastFormatAddress(const sockaddr_in& address);
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_CASTSOCKET_H
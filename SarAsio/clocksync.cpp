@@ -0,0 +1,147 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "clocksync.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Sar {
+
+// Offset errors beyond this step the clock rather than slewing it.
+static const double STEP_THRESHOLD = 10000;
+// For this long after a step the offset follows the filtered measurements
+// outright and the frequency is the slope since the step, which converges
+// much faster than the PI loop from a cold start. Microseconds.
+static const double LOCK_TIME = 8000000;
+static const double OFFSET_GAIN = 0.1;
+static const double FREQUENCY_GAIN = 0.01;
+static const double MAX_FREQUENCY = 0.0005;
+
+ClockSync::ClockSync()
+{
+    reset();
+}
+
+void ClockSync::reset()
+{
+    _windowCount = 0;
+    _windowNext = 0;
+    _lastUsedTime = INT64_MIN;
+    _valid = false;
+    _lockTime = 0;
+    _lockOffset = 0;
+    _offset = 0;
+    _frequency = 0;
+    _time = 0;
+    _delay = 0;
+    _stats = ClockSyncStats();
+}
+
+bool ClockSync::update(int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+    Sample sample;
+
+    sample.time = t1 + (t4 - t1) / 2;
+    sample.delay = (t4 - t1) - (t3 - t2);
+    sample.offset = ((t2 - t1) + (t3 - t4) + _asymmetry) / 2;
+    _stats.exchanges++;
+
+    // a negative round trip means one side's clock jumped mid-exchange.
+    if (sample.delay < 0 || t4 < t1) {
+        return false;
+    }
+
+    _window[_windowNext] = sample;
+    _windowNext = (_windowNext + 1) % WINDOW_SIZE;
+    _windowCount = std::min(_windowCount + 1, WINDOW_SIZE);
+
+    auto best = &_window[0];
+
+    for (int i = 1; i < _windowCount; ++i) {
+        if (_window[i].delay < best->delay) {
+            best = &_window[i];
+        }
+    }
+
+    // like NTP's clock filter, never steer from the same exchange twice or
+    // from one older than the last used.
+    if (best->time <= _lastUsedTime) {
+        return false;
+    }
+
+    _lastUsedTime = best->time;
+    _delay = best->delay;
+    _stats.used++;
+
+    auto dt = (double)(best->time - _time);
+    auto predicted = _offset + _frequency * dt;
+    auto error = best->offset - predicted;
+
+    if (!_valid || std::fabs(error) > STEP_THRESHOLD || dt <= 0) {
+        if (_valid) {
+            _stats.steps++;
+        }
+
+        _valid = true;
+        _lockTime = best->time;
+        _lockOffset = best->offset;
+        _offset = (double)best->offset;
+        _frequency = 0;
+        _time = best->time;
+        return true;
+    }
+
+    auto sinceLock = (double)(best->time - _lockTime);
+
+    if (sinceLock < LOCK_TIME) {
+        _offset = (double)best->offset;
+        _frequency = (best->offset - _lockOffset) / sinceLock;
+    } else {
+        _offset = predicted + OFFSET_GAIN * error;
+        _frequency += FREQUENCY_GAIN * error / dt;
+    }
+
+    _frequency = std::min(std::max(_frequency, -MAX_FREQUENCY), MAX_FREQUENCY);
+    _time = best->time;
+    return true;
+}
+
+int64_t ClockSync::toMaster(int64_t localTime) const
+{
+    return localTime + (int64_t)std::llround(
+        _offset + _frequency * (double)(localTime - _time));
+}
+
+int64_t ClockSync::toLocal(int64_t masterTime) const
+{
+    // invert master = local + offset + frequency * (local - time).
+    return (int64_t)std::llround(
+        (masterTime - _offset + _frequency * _time) / (1.0 + _frequency));
+}
+
+ClockSyncStats ClockSync::stats() const
+{
+    auto stats = _stats;
+
+    stats.offset = (int64_t)std::llround(_offset);
+    stats.delay = _delay;
+    stats.frequencyPpm = _frequency * 1e6;
+    return stats;
+}
+
+} // namespace Sar
@@ -0,0 +1,84 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_CLOCKSYNC_H
+#define _SAR_ASIO_CLOCKSYNC_H
+
+namespace Sar {
+
+struct ClockSyncStats
+{
+    uint64_t exchanges = 0;
+    uint64_t used = 0;
+    uint64_t steps = 0;
+    int64_t offset = 0;
+    int64_t delay = 0;
+    double frequencyPpm = 0;
+};
+
+// Tracks the master's clock from PTP style two-way exchanges. The slave
+// sends at t1, the master receives at t2 and answers at t3, and the answer
+// arrives at t4. Each exchange gives an offset and a round trip delay;
+// queueing only ever adds delay, so the lowest delay exchange of the recent
+// window is the most trustworthy and is what steers a PI loop that
+// disciplines both the offset and the relative frequency.
+struct ClockSync
+{
+    ClockSync();
+    void reset();
+    // Master-to-slave minus slave-to-master delay, in microseconds. Two-way
+    // exchanges can't observe asymmetry, so it has to be configured; half
+    // of any unconfigured asymmetry shows up as offset error.
+    void setAsymmetry(int64_t asymmetry) { _asymmetry = asymmetry; }
+    // All times in microseconds, t1 and t4 on the local clock and t2 and t3
+    // on the master's. Returns true if the exchange steered the clock.
+    bool update(int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+    bool valid() const { return _valid; }
+    int64_t toMaster(int64_t localTime) const;
+    int64_t toLocal(int64_t masterTime) const;
+    // Master microseconds per local microsecond.
+    double rate() const { return 1.0 + _frequency; }
+    ClockSyncStats stats() const;
+
+private:
+    static const int WINDOW_SIZE = 8;
+
+    struct Sample
+    {
+        int64_t time;
+        int64_t offset;
+        int64_t delay;
+    };
+
+    Sample _window[WINDOW_SIZE];
+    int _windowCount = 0;
+    int _windowNext = 0;
+    int64_t _lastUsedTime = 0;
+    int64_t _asymmetry = 0;
+    bool _valid = false;
+    int64_t _lockTime = 0;
+    int64_t _lockOffset = 0;
+    // offset (master - local) at local time _time, and its rate of change.
+    double _offset = 0;
+    double _frequency = 0;
+    int64_t _time = 0;
+    int64_t _delay = 0;
+    ClockSyncStats _stats;
+};
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_CLOCKSYNC_H
@@ -16,6 +16,7 @@
 
 #include "stdafx.h"
 #include "config.h"
+#include "configsnapshot.h"
 #include "utility.h"
 
 #include <fstream>
@@ -156,19 +157,6 @@ picojson::object DefaultEndpointConfig::save()
     return result;
 }
 
-static std::wstring constantRegex(const std::wstring& path)
-{
-    static const std::wregex escape(L"[.^$|()\\[\\]{}*+?\\\\]");
-    std::wostringstream os;
-
-    os << "^"
-       << std::regex_replace(path, escape, L"\\\\&",
-              std::regex_constants::match_default |
-              std::regex_constants::format_sed)
-       << "$";
-    return os.str();
-}
-
 bool ApplicationConfig::load(picojson::object& obj)
 {
     auto poDescription = obj.find("description");
@@ -209,12 +197,8 @@ bool ApplicationConfig::load(picojson::object& obj)
     }
 
     try {
+        // patterns are compiled by ApplicationMatcher when they're used.
         path = UTF8ToWide(poPath->second.get<std::string>());
-
-        // TODO: UTF-8 support on Windows is very sad. This might need ICU or
-        // PCRE.
-        pattern = std::wregex(regexMatch ? path : constantRegex(path),
-            std::regex_constants::ECMAScript | std::regex_constants::icase);
     } catch (std::exception&) {
         // nom nom
     }
@@ -246,13 +230,177 @@ picojson::object ApplicationConfig::save()
     return result;
 }
 
+bool LoopbackConfig::load(picojson::object& obj)
+{
+    auto poSource = obj.find("source");
+    auto poTarget = obj.find("target");
+
+    if (poSource == obj.end() || poTarget == obj.end()) {
+        return false;
+    }
+
+    if (!poSource->second.is<std::string>() ||
+        !poTarget->second.is<std::string>()) {
+
+        return false;
+    }
+
+    source = poSource->second.get<std::string>();
+    target = poTarget->second.get<std::string>();
+    return true;
+}
+
+picojson::object LoopbackConfig::save()
+{
+    picojson::object result;
+
+    result.insert(std::make_pair("source", picojson::value(source)));
+    result.insert(std::make_pair("target", picojson::value(target)));
+    return result;
+}
+
+bool CastConfig::load(picojson::object& obj)
+{
+    auto poMode = obj.find("mode");
+    auto poEndpointId = obj.find("endpointId");
+    auto poAddress = obj.find("address");
+    auto poPort = obj.find("port");
+    auto poInterfaceAddress = obj.find("interfaceAddress");
+    auto poSession = obj.find("session");
+    auto poFecGroupSize = obj.find("fecGroupSize");
+    auto poCompression = obj.find("compression");
+    auto poPlayoutLatency = obj.find("playoutLatency");
+    auto poClockAsymmetry = obj.find("clockAsymmetry");
+    auto poWaitMode = obj.find("waitMode");
+
+    if (poMode == obj.end() || poEndpointId == obj.end() ||
+        poAddress == obj.end()) {
+
+        return false;
+    }
+
+    if (!poMode->second.is<std::string>() ||
+        !poEndpointId->second.is<std::string>() ||
+        !poAddress->second.is<std::string>()) {
+
+        return false;
+    }
+
+    auto modeStr = poMode->second.get<std::string>();
+
+    if (modeStr == "master") {
+        mode = CastMode::Master;
+    } else if (modeStr == "slave") {
+        mode = CastMode::Slave;
+    } else {
+        mode = CastMode::Off;
+    }
+
+    endpointId = poEndpointId->second.get<std::string>();
+    address = poAddress->second.get<std::string>();
+
+    if (poPort != obj.end() && poPort->second.is<double>()) {
+        port = (int)poPort->second.get<double>();
+    }
+
+    if (poInterfaceAddress != obj.end() &&
+        poInterfaceAddress->second.is<std::string>()) {
+
+        interfaceAddress = poInterfaceAddress->second.get<std::string>();
+    }
+
+    if (poSession != obj.end() && poSession->second.is<double>()) {
+        session = (uint64_t)poSession->second.get<double>();
+    }
+
+    if (poFecGroupSize != obj.end() && poFecGroupSize->second.is<double>()) {
+        fecGroupSize = (int)poFecGroupSize->second.get<double>();
+    }
+
+    if (poCompression != obj.end() && poCompression->second.is<bool>()) {
+        compression = poCompression->second.get<bool>();
+    }
+
+    if (poPlayoutLatency != obj.end() &&
+        poPlayoutLatency->second.is<double>()) {
+
+        playoutLatency = (int)poPlayoutLatency->second.get<double>();
+    }
+
+    if (poClockAsymmetry != obj.end() &&
+        poClockAsymmetry->second.is<double>()) {
+
+        clockAsymmetry = (int)poClockAsymmetry->second.get<double>();
+    }
+
+    // unknown wait modes leave the receiver blocking.
+    if (poWaitMode != obj.end() && poWaitMode->second.is<std::string>()) {
+        parseWaitMode(
+            poWaitMode->second.get<std::string>().c_str(), &waitMode);
+    }
+
+    return true;
+}
+
+picojson::object CastConfig::save()
+{
+    picojson::object result;
+
+    result.insert(std::make_pair("mode", picojson::value(
+        mode == CastMode::Master ? "master" :
+        mode == CastMode::Slave ? "slave" : "off")));
+    result.insert(std::make_pair("endpointId", picojson::value(endpointId)));
+    result.insert(std::make_pair("address", picojson::value(address)));
+    result.insert(std::make_pair("port", picojson::value(double(port))));
+
+    if (!interfaceAddress.empty()) {
+        result.insert(std::make_pair("interfaceAddress",
+            picojson::value(interfaceAddress)));
+    }
+
+    if (session) {
+        result.insert(std::make_pair("session",
+            picojson::value(double(session))));
+    }
+
+    if (fecGroupSize) {
+        result.insert(std::make_pair("fecGroupSize",
+            picojson::value(double(fecGroupSize))));
+    }
+
+    if (compression) {
+        result.insert(std::make_pair("compression",
+            picojson::value(compression)));
+    }
+
+    if (playoutLatency) {
+        result.insert(std::make_pair("playoutLatency",
+            picojson::value(double(playoutLatency))));
+    }
+
+    if (clockAsymmetry) {
+        result.insert(std::make_pair("clockAsymmetry",
+            picojson::value(double(clockAsymmetry))));
+    }
+
+    if (waitMode != WAIT_BLOCK) {
+        result.insert(std::make_pair("waitMode",
+            picojson::value(waitModeName(waitMode))));
+    }
+
+    return result;
+}
+
 void DriverConfig::load(picojson::object& obj)
 {
     auto poDriverClsid = obj.find("driverClsid");
     auto poEndpoints = obj.find("endpoints");
     auto poApplications = obj.find("applications");
+    auto poLoopbacks = obj.find("loopbacks");
+    auto poCast = obj.find("cast");
     auto poWaveRtMinimumFrames = obj.find("waveRtMinimumFrames");
     auto poEnableApplicationRouting = obj.find("enableApplicationRouting");
+    auto poLargePageBuffers = obj.find("largePageBuffers");
 
     if (poDriverClsid != obj.end() &&
         poDriverClsid->second.is<std::string>()) {
@@ -289,6 +437,28 @@ void DriverConfig::load(picojson::object& obj)
         }
     }
 
+    if (poLoopbacks != obj.end() && poLoopbacks->second.is<picojson::array>()) {
+        for (auto& item : poLoopbacks->second.get<picojson::array>()) {
+            if (!item.is<picojson::object>()) {
+                continue;
+            }
+
+            LoopbackConfig loopback;
+
+            if (loopback.load(item.get<picojson::object>())) {
+                loopbacks.emplace_back(loopback);
+            }
+        }
+    }
+
+    if (poCast != obj.end() && poCast->second.is<picojson::object>()) {
+        CastConfig castConfig;
+
+        if (castConfig.load(poCast->second.get<picojson::object>())) {
+            cast = castConfig;
+        }
+    }
+
     if (poWaveRtMinimumFrames != obj.end() &&
         poWaveRtMinimumFrames->second.is<double>()) {
 
@@ -301,6 +471,12 @@ void DriverConfig::load(picojson::object& obj)
         enableApplicationRouting =
             poEnableApplicationRouting->second.get<bool>();
     }
+
+    if (poLargePageBuffers != obj.end() &&
+        poLargePageBuffers->second.is<bool>()) {
+
+        largePageBuffers = poLargePageBuffers->second.get<bool>();
+    }
 }
 
 picojson::object DriverConfig::save()
@@ -316,6 +492,11 @@ picojson::object DriverConfig::save()
             picojson::value((double)waveRtMinimumFrames)));
     }
 
+    if (largePageBuffers) {
+        result.insert(std::make_pair("largePageBuffers",
+            picojson::value(largePageBuffers)));
+    }
+
     if (endpoints.size()) {
         picojson::array arr;
 
@@ -336,27 +517,148 @@ picojson::object DriverConfig::save()
         result.insert(std::make_pair("applications", picojson::value(arr)));
     }
 
+    if (loopbacks.size()) {
+        picojson::array arr;
+
+        for (auto& loopback : loopbacks) {
+            arr.emplace_back(loopback.save());
+        }
+
+        result.insert(std::make_pair("loopbacks", picojson::value(arr)));
+    }
+
+    if (cast.mode != CastMode::Off) {
+        result.insert(std::make_pair("cast", picojson::value(cast.save())));
+    }
+
     return result;
 }
 
-bool DriverConfig::writeFile(const std::wstring& path)
+static std::wstring snapshotPath(const std::wstring& path)
 {
-    std::ofstream fp(path);
+    return path + L".snapshot";
+}
+
+static bool getSnapshotSource(
+    const std::wstring& path, ConfigSnapshotSource *source)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+    if (!GetFileAttributesEx(
+        path.c_str(), GetFileExInfoStandard, &attributes)) {
 
-    if (fp.bad()) {
         return false;
     }
 
-    picojson::value(save()).serialize(std::ostream_iterator<char>(fp), true);
+    source->size = ((uint64_t)attributes.nFileSizeHigh << 32) |
+        attributes.nFileSizeLow;
+    source->writeTime =
+        ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) |
+        attributes.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+// Failing to write the snapshot only costs the next load a JSON parse.
+static void writeSnapshot(
+    const std::wstring& path, const ConfigSnapshotSource& source,
+    const DriverConfig& config)
+{
+    auto snapshot = EncodeConfigSnapshot(config, source);
+    auto tempPath = snapshotPath(path) + L".tmp";
+
+    {
+        std::ofstream fp(tempPath, std::ios::binary | std::ios::trunc);
+
+        if (!fp.write(snapshot.data(), snapshot.size())) {
+            return;
+        }
+    }
+
+    // other driver instances may be loading the old one, so swap the new
+    // one in whole rather than rewriting it in place. If it's mapped right
+    // now the replace fails and the stale snapshot is rejected next load.
+    if (!MoveFileEx(tempPath.c_str(), snapshotPath(path).c_str(),
+        MOVEFILE_REPLACE_EXISTING)) {
+
+        DeleteFile(tempPath.c_str());
+    }
+}
+
+static bool readSnapshot(
+    const std::wstring& path, const ConfigSnapshotSource& source,
+    DriverConfig *config)
+{
+    LARGE_INTEGER size;
+    bool result = false;
+    auto file = CreateFile(snapshotPath(path).c_str(), GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        auto mapping = CreateFileMapping(
+            file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+        if (mapping) {
+            auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+            if (view) {
+                result = DecodeConfigSnapshot(
+                    view, (size_t)size.QuadPart, source, config);
+                UnmapViewOfFile(view);
+            }
+
+            CloseHandle(mapping);
+        }
+    }
+
+    CloseHandle(file);
+    return result;
+}
+
+bool DriverConfig::writeFile(const std::wstring& path)
+{
+    ConfigSnapshotSource source;
+    picojson::value json(save());
+    DriverConfig saved;
+
+    {
+        std::ofstream fp(path);
+
+        if (fp.bad()) {
+            return false;
+        }
+
+        json.serialize(std::ostream_iterator<char>(fp), true);
+    }
+
+    // snapshot what loading the JSON would give, which isn't always
+    // exactly this config.
+    saved.load(json.get<picojson::object>());
+
+    if (getSnapshotSource(path, &source)) {
+        writeSnapshot(path, source, saved);
+    }
+
     return true;
 }
 
 DriverConfig DriverConfig::fromFile(const std::wstring& path)
 {
-    std::ifstream fp(path);
+    ConfigSnapshotSource source;
+    bool haveSource = getSnapshotSource(path, &source);
     picojson::value json;
     DriverConfig result;
 
+    if (haveSource && readSnapshot(path, source, &result)) {
+        return result;
+    }
+
+    std::ifstream fp(path);
+
     if (fp.bad()) {
         return result;
     }
@@ -365,6 +667,12 @@ DriverConfig DriverConfig::fromFile(const std::wstring& path)
 
     if (json.is<picojson::object>()) {
         result.load(json.get<picojson::object>());
+
+        // the JSON was edited by hand or saved by an older version, so
+        // snapshot it for the next instance.
+        if (haveSource) {
+            writeSnapshot(path, source, result);
+        }
     }
 
     return result;
@@ -18,6 +18,7 @@
 #define _SAR_ASIO_CONFIG_H
 
 #include "picojson.h"
+#include "spinpolicy.h"
 
 namespace Sar {
 
@@ -55,20 +56,67 @@ struct ApplicationConfig
     std::wstring description;
     std::wstring path;
     bool regexMatch = false;
-    std::wregex pattern;
     std::vector<DefaultEndpointConfig> defaults;
 
     bool load(picojson::object& obj);
     picojson::object save();
 };
 
+enum class CastMode
+{
+    Off,
+    Master,
+    Slave
+};
+
+// Streams one endpoint over UDP. A master sends a playback endpoint's audio
+// to address, which may be a multicast group; a slave plays what it
+// receives into a recording endpoint, joining address if it is a group.
+struct CastConfig
+{
+    CastMode mode = CastMode::Off;
+    std::string endpointId;
+    std::string address;
+    int port = 17000;
+    std::string interfaceAddress;
+    // 0 picks a random session on the master and follows any master on
+    // the slave.
+    uint64_t session = 0;
+    int fecGroupSize = 0;
+    bool compression = false;
+    // Slave playout latency in microseconds, 0 to just follow the buffer.
+    int playoutLatency = 0;
+    // Master-to-slave minus slave-to-master network delay in microseconds,
+    // for links that are slower one way, like Wi-Fi uplinks.
+    int clockAsymmetry = 0;
+    // How the receive thread waits for packets; see CastTransport.
+    WaitMode waitMode = WAIT_BLOCK;
+
+    bool load(picojson::object& obj);
+    picojson::object save();
+};
+
+// Copies a playback endpoint's audio straight into a recording endpoint on
+// every tick, channel for channel.
+struct LoopbackConfig
+{
+    std::string source;
+    std::string target;
+
+    bool load(picojson::object& obj);
+    picojson::object save();
+};
+
 struct DriverConfig
 {
     std::string driverClsid;
     std::vector<EndpointConfig> endpoints;
     std::vector<ApplicationConfig> applications;
+    std::vector<LoopbackConfig> loopbacks;
+    CastConfig cast;
     int waveRtMinimumFrames = 0;
     bool enableApplicationRouting = false;
+    bool largePageBuffers = false;
 
     void load(picojson::object& obj);
     picojson::object save();
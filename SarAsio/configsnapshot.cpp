@@ -0,0 +1,344 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "configsnapshot.h"
+
+#include <cstring>
+
+namespace Sar {
+
+struct ConfigSnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceSize;
+    uint64_t sourceWriteTime;
+    uint64_t payloadSize;
+    uint64_t payloadHash;
+};
+
+// FNV-1a. Only has to catch torn writes and bit rot, not tampering.
+static uint64_t hashPayload(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+struct SnapshotWriter
+{
+    std::string buffer;
+
+    void raw(const void *data, size_t size)
+    {
+        buffer.append((const char *)data, size);
+    }
+
+    void u32(uint32_t value) { raw(&value, sizeof(value)); }
+    void i32(int value) { u32((uint32_t)value); }
+
+    void str(const std::string& value)
+    {
+        u32((uint32_t)value.size());
+        raw(value.data(), value.size());
+    }
+
+    void wstr(const std::wstring& value)
+    {
+        u32((uint32_t)value.size());
+        raw(value.data(), value.size() * sizeof(wchar_t));
+    }
+};
+
+struct SnapshotReader
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+
+    bool raw(void *data, size_t size)
+    {
+        if ((size_t)(end - pos) < size) {
+            return false;
+        }
+
+        memcpy(data, pos, size);
+        pos += size;
+        return true;
+    }
+
+    bool u32(uint32_t *value) { return raw(value, sizeof(*value)); }
+
+    bool i32(int *value)
+    {
+        uint32_t bits;
+
+        if (!u32(&bits)) {
+            return false;
+        }
+
+        *value = (int)bits;
+        return true;
+    }
+
+    bool flag(bool *value)
+    {
+        uint32_t bits;
+
+        if (!u32(&bits)) {
+            return false;
+        }
+
+        *value = bits != 0;
+        return true;
+    }
+
+    bool str(std::string *value)
+    {
+        uint32_t size;
+
+        if (!u32(&size) || (size_t)(end - pos) < size) {
+            return false;
+        }
+
+        value->assign((const char *)pos, size);
+        pos += size;
+        return true;
+    }
+
+    bool wstr(std::wstring *value)
+    {
+        uint32_t size;
+
+        if (!u32(&size) || (size_t)(end - pos) / sizeof(wchar_t) < size) {
+            return false;
+        }
+
+        value->resize(size);
+        return raw(&(*value)[0], size * sizeof(wchar_t));
+    }
+
+    // bounds a count by the smallest encoding of an item so damaged
+    // counts can't make us reserve absurd amounts of memory.
+    bool count(uint32_t *value, size_t minimumItemSize)
+    {
+        return u32(value) && *value <= (size_t)(end - pos) / minimumItemSize;
+    }
+};
+
+std::string EncodeConfigSnapshot(
+    const DriverConfig& config, const ConfigSnapshotSource& source)
+{
+    SnapshotWriter writer;
+    ConfigSnapshotHeader header = {};
+
+    writer.raw(&header, sizeof(header));
+    writer.str(config.driverClsid);
+    writer.i32(config.waveRtMinimumFrames);
+    writer.u32(config.enableApplicationRouting);
+    writer.u32(config.largePageBuffers);
+    writer.u32((uint32_t)config.endpoints.size());
+
+    for (auto& endpoint : config.endpoints) {
+        writer.str(endpoint.id);
+        writer.wstr(endpoint.description);
+        writer.u32((uint32_t)endpoint.type);
+        writer.i32(endpoint.channelCount);
+        writer.u32(endpoint.attachPhysical);
+        writer.i32(endpoint.physicalChannelBase);
+    }
+
+    writer.u32((uint32_t)config.applications.size());
+
+    for (auto& application : config.applications) {
+        writer.wstr(application.description);
+        writer.wstr(application.path);
+        writer.u32(application.regexMatch);
+        writer.u32((uint32_t)application.defaults.size());
+
+        for (auto& defaultEndpoint : application.defaults) {
+            writer.u32((uint32_t)defaultEndpoint.type);
+            writer.u32((uint32_t)defaultEndpoint.role);
+            writer.str(defaultEndpoint.id);
+        }
+    }
+
+    writer.u32((uint32_t)config.loopbacks.size());
+
+    for (auto& loopback : config.loopbacks) {
+        writer.str(loopback.source);
+        writer.str(loopback.target);
+    }
+
+    writer.u32((uint32_t)config.cast.mode);
+    writer.str(config.cast.endpointId);
+    writer.str(config.cast.address);
+    writer.i32(config.cast.port);
+    writer.str(config.cast.interfaceAddress);
+    writer.raw(&config.cast.session, sizeof(config.cast.session));
+    writer.i32(config.cast.fecGroupSize);
+    writer.u32(config.cast.compression);
+    writer.i32(config.cast.playoutLatency);
+    writer.i32(config.cast.clockAsymmetry);
+    writer.u32((uint32_t)config.cast.waitMode);
+
+    auto payload = (const uint8_t *)writer.buffer.data() + sizeof(header);
+
+    header.magic = CONFIG_SNAPSHOT_MAGIC;
+    header.version = CONFIG_SNAPSHOT_VERSION;
+    header.sourceSize = source.size;
+    header.sourceWriteTime = source.writeTime;
+    header.payloadSize = writer.buffer.size() - sizeof(header);
+    header.payloadHash = hashPayload(payload, header.payloadSize);
+    memcpy(&writer.buffer[0], &header, sizeof(header));
+    return writer.buffer;
+}
+
+bool DecodeConfigSnapshot(
+    const void *data, size_t size, const ConfigSnapshotSource& source,
+    DriverConfig *config)
+{
+    ConfigSnapshotHeader header;
+    SnapshotReader reader;
+    DriverConfig result;
+    uint32_t count, value;
+
+    if (size < sizeof(header)) {
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+
+    if (header.magic != CONFIG_SNAPSHOT_MAGIC ||
+        header.version != CONFIG_SNAPSHOT_VERSION ||
+        header.sourceSize != source.size ||
+        header.sourceWriteTime != source.writeTime ||
+        header.payloadSize != size - sizeof(header)) {
+
+        return false;
+    }
+
+    reader.pos = (const uint8_t *)data + sizeof(header);
+    reader.end = reader.pos + header.payloadSize;
+
+    if (hashPayload(reader.pos, header.payloadSize) != header.payloadHash) {
+        return false;
+    }
+
+    if (!reader.str(&result.driverClsid) ||
+        !reader.i32(&result.waveRtMinimumFrames) ||
+        !reader.flag(&result.enableApplicationRouting) ||
+        !reader.flag(&result.largePageBuffers) ||
+        !reader.count(&count, 6 * sizeof(uint32_t))) {
+
+        return false;
+    }
+
+    result.endpoints.resize(count);
+
+    for (auto& endpoint : result.endpoints) {
+        if (!reader.str(&endpoint.id) ||
+            !reader.wstr(&endpoint.description) ||
+            !reader.u32(&value) ||
+            !reader.i32(&endpoint.channelCount) ||
+            !reader.flag(&endpoint.attachPhysical) ||
+            !reader.i32(&endpoint.physicalChannelBase)) {
+
+            return false;
+        }
+
+        endpoint.type = (EndpointType)value;
+    }
+
+    if (!reader.count(&count, 4 * sizeof(uint32_t))) {
+        return false;
+    }
+
+    result.applications.resize(count);
+
+    for (auto& application : result.applications) {
+        if (!reader.wstr(&application.description) ||
+            !reader.wstr(&application.path) ||
+            !reader.flag(&application.regexMatch) ||
+            !reader.count(&count, 3 * sizeof(uint32_t))) {
+
+            return false;
+        }
+
+        application.defaults.resize(count);
+
+        for (auto& defaultEndpoint : application.defaults) {
+            if (!reader.u32(&value)) {
+                return false;
+            }
+
+            defaultEndpoint.type = (EDataFlow)value;
+
+            if (!reader.u32(&value) || !reader.str(&defaultEndpoint.id)) {
+                return false;
+            }
+
+            defaultEndpoint.role = (ERole)value;
+        }
+    }
+
+    if (!reader.count(&count, 2 * sizeof(uint32_t))) {
+        return false;
+    }
+
+    result.loopbacks.resize(count);
+
+    for (auto& loopback : result.loopbacks) {
+        if (!reader.str(&loopback.source) || !reader.str(&loopback.target)) {
+            return false;
+        }
+    }
+
+    if (!reader.u32(&value) ||
+        !reader.str(&result.cast.endpointId) ||
+        !reader.str(&result.cast.address) ||
+        !reader.i32(&result.cast.port) ||
+        !reader.str(&result.cast.interfaceAddress) ||
+        !reader.raw(&result.cast.session, sizeof(result.cast.session)) ||
+        !reader.i32(&result.cast.fecGroupSize) ||
+        !reader.flag(&result.cast.compression) ||
+        !reader.i32(&result.cast.playoutLatency) ||
+        !reader.i32(&result.cast.clockAsymmetry)) {
+
+        return false;
+    }
+
+    result.cast.mode = (CastMode)value;
+
+    if (!reader.u32(&value)) {
+        return false;
+    }
+
+    result.cast.waitMode = (WaitMode)value;
+
+    if (reader.pos != reader.end) {
+        return false;
+    }
+
+    *config = std::move(result);
+    return true;
+}
+
+} // namespace Sar
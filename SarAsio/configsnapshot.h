@@ -0,0 +1,50 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_CONFIGSNAPSHOT_H
+#define _SAR_ASIO_CONFIGSNAPSHOT_H
+
+#include "config.h"
+
+namespace Sar {
+
+// Identifies the JSON a snapshot was made from, so a hand edited config
+// isn't shadowed by a stale snapshot.
+struct ConfigSnapshotSource
+{
+    uint64_t size = 0;
+    uint64_t writeTime = 0;
+};
+
+// A DriverConfig flattened into one buffer. DAWs create driver instances
+// over and over while probing, and decoding this is much cheaper than
+// parsing the JSON. The layout is a fixed header followed by a payload of
+// length prefixed fields in DriverConfig order; bump CONFIG_SNAPSHOT_VERSION
+// whenever either changes.
+static const uint32_t CONFIG_SNAPSHOT_MAGIC = 0x43524153; // 'SARC'
+static const uint32_t CONFIG_SNAPSHOT_VERSION = 6;
+
+std::string EncodeConfigSnapshot(
+    const DriverConfig& config, const ConfigSnapshotSource& source);
+// Returns false if the snapshot is damaged, from another version, or made
+// from a different source; config is only written on success.
+bool DecodeConfigSnapshot(
+    const void *data, size_t size, const ConfigSnapshotSource& source,
+    DriverConfig *config);
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_CONFIGSNAPSHOT_H
@@ -0,0 +1,93 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "fec.h"
+
+#include <algorithm>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || \
+    defined(__SSE2__)
+#define SAR_FEC_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace Sar {
+
+void FecXor(void *dst, const void *src, size_t size)
+{
+    auto d = (uint8_t *)dst;
+    auto s = (const uint8_t *)src;
+    size_t i = 0;
+
+#ifdef SAR_FEC_SSE
+    for (; i + 16 <= size; i += 16) {
+        auto a = _mm_loadu_si128((const __m128i *)(d + i));
+        auto b = _mm_loadu_si128((const __m128i *)(s + i));
+
+        _mm_storeu_si128((__m128i *)(d + i), _mm_xor_si128(a, b));
+    }
+#endif
+
+    for (; i < size; ++i) {
+        d[i] ^= s[i];
+    }
+}
+
+FecEncoder::FecEncoder(int channelCount, int groupSize, size_t payloadSize):
+    _channelCount(channelCount),
+    _groupSize(std::min(std::max(groupSize, 1), FEC_MAX_GROUP_SIZE)),
+    _payloadSize(payloadSize)
+{
+    _groupCount = (_channelCount + _groupSize - 1) / _groupSize;
+    _pending.resize(_groupCount);
+    _parity.resize(_groupCount * _payloadSize);
+
+    for (int i = 0; i < _groupCount; ++i) {
+        _pending[i] = groupChannels(i);
+    }
+}
+
+int FecEncoder::add(int channel, const void *payload)
+{
+    auto group = channel / _groupSize;
+    auto parity = &_parity[group * _payloadSize];
+
+    if (_pending[group] == groupChannels(group)) {
+        memcpy(parity, payload, _payloadSize);
+    } else {
+        FecXor(parity, payload, _payloadSize);
+    }
+
+    if (--_pending[group] > 0) {
+        return -1;
+    }
+
+    _pending[group] = groupChannels(group);
+    return group;
+}
+
+const uint8_t *FecEncoder::parity(int group) const
+{
+    return &_parity[group * _payloadSize];
+}
+
+int FecEncoder::groupChannels(int group) const
+{
+    return std::min(_groupSize, _channelCount - group * _groupSize);
+}
+
+} // namespace Sar
@@ -0,0 +1,54 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_FEC_H
+#define _SAR_ASIO_FEC_H
+
+namespace Sar {
+
+// XORs size bytes of src into dst.
+void FecXor(void *dst, const void *src, size_t size);
+
+// CastParityPacket carries the group size in a byte.
+static const int FEC_MAX_GROUP_SIZE = 255;
+
+// Builds XOR parity over groups of adjacent channels within one period, so
+// a receiver can rebuild any single lost buffer packet per group as soon as
+// the rest of the period arrives, without adding latency or a round trip.
+struct FecEncoder
+{
+    // groupSize is clamped to [1, FEC_MAX_GROUP_SIZE].
+    FecEncoder(int channelCount, int groupSize, size_t payloadSize);
+    // Folds a channel's payload into its group's parity. Returns the group
+    // index once every channel of that group has been added, -1 otherwise.
+    int add(int channel, const void *payload);
+    const uint8_t *parity(int group) const;
+    int groupCount() const { return _groupCount; }
+    int groupSize() const { return _groupSize; }
+    int groupChannels(int group) const;
+
+private:
+    int _channelCount;
+    int _groupSize;
+    int _groupCount;
+    size_t _payloadSize;
+    std::vector<int> _pending;
+    std::vector<uint8_t> _parity;
+};
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_FEC_H
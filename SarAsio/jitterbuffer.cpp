@@ -0,0 +1,452 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "fec.h"
+#include "jitterbuffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Sar {
+
+// Target depth is this many jitter deviations above the minimum depth.
+static const double JITTER_DEPTH_FACTOR = 4.0;
+// How long the target must have been too deep before it shrinks, in ms.
+static const int SHRINK_HOLD_MS = 2000;
+// Number of repeated periods before concealment fades to silence.
+static const int MAX_CONCEAL_FADE = 4;
+
+static void attenuate(uint8_t *data, size_t samples, int sampleSize, int shift)
+{
+    switch (sampleSize) {
+        case 2: {
+            auto p = (int16_t *)data;
+
+            for (size_t i = 0; i < samples; ++i) {
+                p[i] = (int16_t)(p[i] >> shift);
+            }
+
+            break;
+        }
+        case 3:
+            for (size_t i = 0; i < samples; ++i) {
+                auto p = data + i * 3;
+                int32_t value = (int32_t)(
+                    ((uint32_t)p[0] << 8) |
+                    ((uint32_t)p[1] << 16) |
+                    ((uint32_t)p[2] << 24)) >> 8;
+
+                value >>= shift;
+                p[0] = (uint8_t)value;
+                p[1] = (uint8_t)(value >> 8);
+                p[2] = (uint8_t)(value >> 16);
+            }
+
+            break;
+        case 4: {
+            auto p = (int32_t *)data;
+
+            for (size_t i = 0; i < samples; ++i) {
+                p[i] >>= shift;
+            }
+
+            break;
+        }
+    }
+}
+
+JitterBuffer::JitterBuffer(
+    int channelCount, int periodFrameSize, int sampleRate, int sampleSize,
+    int minDepth, int maxDepth):
+    _channelCount(std::min(channelCount, JITTER_BUFFER_MAX_CHANNELS)),
+    _periodFrameSize(periodFrameSize),
+    _sampleRate(sampleRate), _sampleSize(sampleSize),
+    _periodBytes((size_t)periodFrameSize * sampleSize),
+    _minDepth(std::max(minDepth, 1)),
+    _maxDepth(std::max(maxDepth, std::max(minDepth, 1))),
+    _targetDepth(_minDepth)
+{
+    // leave room for packets arriving ahead of the target depth so a burst
+    // after a stall doesn't force a resync.
+    _capacity = _maxDepth * 2 + 2;
+    _slots.resize(_capacity);
+    _data.resize(_capacity * _channelCount * _periodBytes);
+    _parity.resize(_capacity * _channelCount * _periodBytes);
+    _lastPeriod.resize(_channelCount * _periodBytes);
+    _concealCount.resize(_channelCount, MAX_CONCEAL_FADE);
+    _stats.targetDepth = _targetDepth;
+}
+
+bool JitterBuffer::push(
+    uint64_t offset, int channel,
+    const void *data, size_t size, int64_t arrivalTime)
+{
+    if (channel < 0 || channel >= _channelCount || size != _periodBytes) {
+        return false;
+    }
+
+    auto slot = acquireSlot(offset, arrivalTime);
+
+    if (!slot) {
+        return false;
+    }
+
+    if (slot->receivedMask & (1ULL << channel)) {
+        _stats.duplicate++;
+        return false;
+    }
+
+    memcpy(slotData(*slot, channel), data, _periodBytes);
+    slot->receivedMask |= 1ULL << channel;
+    _stats.received++;
+
+    if (_fecGroupSize) {
+        recover(*slot, channel / _fecGroupSize);
+    }
+
+    return true;
+}
+
+bool JitterBuffer::pushParity(
+    uint64_t offset, int firstChannel, int count,
+    const void *data, size_t size, int64_t arrivalTime)
+{
+    if (count <= 0 || firstChannel < 0 || firstChannel % count != 0 ||
+        firstChannel >= _channelCount || size != _periodBytes) {
+
+        return false;
+    }
+
+    if (_fecGroupSize != count) {
+        // the sender changed its grouping; parity we hold is meaningless.
+        for (auto& slot : _slots) {
+            slot.parityMask = 0;
+        }
+
+        _fecGroupSize = count;
+    }
+
+    auto slot = acquireSlot(offset, arrivalTime);
+
+    if (!slot) {
+        return false;
+    }
+
+    auto group = firstChannel / count;
+
+    if (slot->parityMask & (1ULL << group)) {
+        _stats.duplicate++;
+        return false;
+    }
+
+    memcpy(slotParity(*slot, group), data, _periodBytes);
+    slot->parityMask |= 1ULL << group;
+    recover(*slot, group);
+    return true;
+}
+
+bool JitterBuffer::pop(void **targetBuffers)
+{
+    if (!_playing) {
+        if (!_started || (!_scheduled && bufferedDepth() < _targetDepth)) {
+            for (int i = 0; i < _channelCount; ++i) {
+                memset(targetBuffers[i], 0, _periodBytes);
+            }
+
+            return false;
+        }
+
+        _playing = true;
+        _growTicks = 0;
+    }
+
+    auto depth = bufferedDepth();
+
+    // the target grew while playing; stretch the buffer to match by playing
+    // a concealed period without moving the playout point, rather than
+    // leaving it short and losing every packet of the next spike as well.
+    if (_growTicks > 0) {
+        _growTicks--;
+
+        if (!_scheduled && depth < _targetDepth) {
+            for (int i = 0; i < _channelCount; ++i) {
+                conceal(i, targetBuffers[i]);
+            }
+
+            _stats.concealed++;
+            return false;
+        }
+    }
+
+    auto& slot = slotFor(_playoutOffset);
+    bool present = slot.valid && slot.offset == _playoutOffset;
+    bool complete = true;
+
+    for (int i = 0; i < _channelCount; ++i) {
+        if (present && (slot.receivedMask & (1ULL << i))) {
+            auto src = slotData(slot, i);
+
+            memcpy(targetBuffers[i], src, _periodBytes);
+            memcpy(&_lastPeriod[i * _periodBytes], src, _periodBytes);
+            _concealCount[i] = 0;
+        } else {
+            conceal(i, targetBuffers[i]);
+            complete = false;
+        }
+    }
+
+    if (!complete) {
+        _stats.concealed++;
+    }
+
+    // if nothing newer has arrived either we ran dry, so hold the playout
+    // point: the buffer stretches by the concealed period instead of the
+    // packet being counted as late when it shows up.
+    if (present) {
+        slot.valid = false;
+        _playoutOffset += _periodFrameSize;
+    } else if (_highestOffset > _playoutOffset) {
+        _playoutOffset += _periodFrameSize;
+    }
+
+    updateTargetDepth();
+
+    if (!_scheduled && depth > _targetDepth + 1) {
+        if (++_quietTicks >= holdTicks()) {
+            auto& excess = slotFor(_playoutOffset);
+
+            if (excess.valid && excess.offset == _playoutOffset) {
+                excess.valid = false;
+            }
+
+            _playoutOffset += _periodFrameSize;
+            _stats.dropped++;
+            _quietTicks = 0;
+        }
+    } else {
+        _quietTicks = 0;
+    }
+
+    return complete;
+}
+
+void JitterBuffer::reset()
+{
+    for (auto& slot : _slots) {
+        slot.valid = false;
+        slot.parityMask = 0;
+    }
+
+    std::fill(_concealCount.begin(), _concealCount.end(), MAX_CONCEAL_FADE);
+    _started = false;
+    _playing = false;
+    _playoutOffset = 0;
+    _highestOffset = 0;
+    _targetDepth = _minDepth;
+    _quietTicks = 0;
+    _shrinkTicks = 0;
+    _growTicks = 0;
+    _haveTransit = false;
+    _lastTransit = 0;
+    _jitter = 0;
+    _stats = JitterBufferStats();
+    _stats.targetDepth = _targetDepth;
+}
+
+JitterBufferStats JitterBuffer::stats() const
+{
+    auto result = _stats;
+
+    result.depth = bufferedDepth();
+    result.targetDepth = _targetDepth;
+    result.jitterFrames = _jitter * _sampleRate / 1000000.0;
+    return result;
+}
+
+JitterBuffer::Slot *JitterBuffer::acquireSlot(
+    uint64_t offset, int64_t arrivalTime)
+{
+    if (!_started) {
+        _started = true;
+        _playoutOffset = offset;
+        _highestOffset = offset;
+    }
+
+    if (offset < _playoutOffset) {
+        _stats.late++;
+        _shrinkTicks = 0;
+
+        if (_targetDepth < _maxDepth) {
+            _targetDepth++;
+            _growTicks++;
+        }
+
+        return nullptr;
+    }
+
+    if (offset >= _playoutOffset + (uint64_t)_capacity * _periodFrameSize) {
+        // the sender restarted or we stalled for longer than we can buffer.
+        auto stats = _stats;
+
+        reset();
+        stats.resyncs++;
+        _stats = stats;
+        _started = true;
+        _playoutOffset = offset;
+        _highestOffset = offset;
+    }
+
+    auto& slot = slotFor(offset);
+
+    if (!slot.valid || slot.offset != offset) {
+        slot.valid = true;
+        slot.offset = offset;
+        slot.receivedMask = 0;
+        slot.parityMask = 0;
+        updateJitter(offset, arrivalTime);
+    }
+
+    _highestOffset = std::max(_highestOffset, offset);
+    return &slot;
+}
+
+JitterBuffer::Slot& JitterBuffer::slotFor(uint64_t offset)
+{
+    return _slots[(offset / _periodFrameSize) % _capacity];
+}
+
+uint8_t *JitterBuffer::slotData(const Slot& slot, int channel)
+{
+    auto index = &slot - &_slots[0];
+
+    return &_data[(index * _channelCount + channel) * _periodBytes];
+}
+
+uint8_t *JitterBuffer::slotParity(const Slot& slot, int group)
+{
+    auto index = &slot - &_slots[0];
+
+    return &_parity[(index * _channelCount + group) * _periodBytes];
+}
+
+void JitterBuffer::recover(Slot& slot, int group)
+{
+    if (!(slot.parityMask & (1ULL << group))) {
+        return;
+    }
+
+    auto first = group * _fecGroupSize;
+    auto last = std::min(first + _fecGroupSize, _channelCount);
+    int missing = -1;
+
+    for (int i = first; i < last; ++i) {
+        if (!(slot.receivedMask & (1ULL << i))) {
+            if (missing >= 0) {
+                return;
+            }
+
+            missing = i;
+        }
+    }
+
+    if (missing < 0) {
+        return;
+    }
+
+    auto target = slotData(slot, missing);
+
+    memcpy(target, slotParity(slot, group), _periodBytes);
+
+    for (int i = first; i < last; ++i) {
+        if (i != missing) {
+            FecXor(target, slotData(slot, i), _periodBytes);
+        }
+    }
+
+    slot.receivedMask |= 1ULL << missing;
+    _stats.recovered++;
+}
+
+int JitterBuffer::bufferedDepth() const
+{
+    if (!_started || _highestOffset < _playoutOffset) {
+        return 0;
+    }
+
+    return (int)((_highestOffset - _playoutOffset) / _periodFrameSize) + 1;
+}
+
+void JitterBuffer::updateJitter(uint64_t offset, int64_t arrivalTime)
+{
+    double transit = arrivalTime - offset * 1000000.0 / _sampleRate;
+
+    if (_haveTransit) {
+        double d = std::fabs(transit - _lastTransit);
+
+        _jitter += (d - _jitter) / 16.0;
+    }
+
+    _haveTransit = true;
+    _lastTransit = transit;
+}
+
+void JitterBuffer::updateTargetDepth()
+{
+    double jitterFrames = _jitter * _sampleRate / 1000000.0;
+    auto desired = _minDepth + (int)std::ceil(
+        JITTER_DEPTH_FACTOR * jitterFrames / _periodFrameSize);
+
+    desired = std::min(desired, _maxDepth);
+
+    if (desired > _targetDepth) {
+        _growTicks += desired - _targetDepth;
+        _targetDepth = desired;
+        _shrinkTicks = 0;
+    } else if (desired < _targetDepth) {
+        if (++_shrinkTicks >= holdTicks()) {
+            _targetDepth--;
+            _shrinkTicks = 0;
+        }
+    } else {
+        _shrinkTicks = 0;
+    }
+}
+
+int JitterBuffer::holdTicks() const
+{
+    return std::max(1, (int)(
+        (int64_t)SHRINK_HOLD_MS * _sampleRate / 1000 / _periodFrameSize));
+}
+
+void JitterBuffer::conceal(int channel, void *target)
+{
+    auto count = _concealCount[channel];
+
+    if (count >= MAX_CONCEAL_FADE) {
+        memset(target, 0, _periodBytes);
+        return;
+    }
+
+    // repeat the last good period, halving it each time it's reused.
+    auto last = &_lastPeriod[channel * _periodBytes];
+
+    attenuate(last, _periodFrameSize, _sampleSize, 1);
+    memcpy(target, last, _periodBytes);
+    _concealCount[channel] = count + 1;
+}
+
+} // namespace Sar
@@ -0,0 +1,124 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_JITTERBUFFER_H
+#define _SAR_ASIO_JITTERBUFFER_H
+
+namespace Sar {
+
+// Slots track received channels in a 64-bit mask.
+static const int JITTER_BUFFER_MAX_CHANNELS = 64;
+
+struct JitterBufferStats
+{
+    uint64_t received = 0;
+    uint64_t late = 0;
+    uint64_t duplicate = 0;
+    uint64_t concealed = 0;
+    uint64_t recovered = 0;
+    uint64_t dropped = 0;
+    uint64_t resyncs = 0;
+    int depth = 0;
+    int targetDepth = 0;
+    double jitterFrames = 0;
+};
+
+// Playout buffer for a cast stream. Packets are keyed on their sample offset
+// and each slot holds one period for every channel. The target depth follows
+// an RFC 3550 style interarrival jitter estimate: it grows as soon as jitter
+// or late packets show up and only shrinks after a sustained quiet period.
+struct JitterBuffer
+{
+    // channelCount is clamped to JITTER_BUFFER_MAX_CHANNELS; callers should
+    // reject wider streams up front.
+    JitterBuffer(
+        int channelCount, int periodFrameSize, int sampleRate, int sampleSize,
+        int minDepth = 1, int maxDepth = 16);
+
+    // arrivalTime is in microseconds on any monotonic local clock.
+    bool push(
+        uint64_t offset, int channel,
+        const void *data, size_t size, int64_t arrivalTime);
+    // Accepts XOR parity over channels [firstChannel, firstChannel + count)
+    // and rebuilds a single missing channel of that group when possible.
+    bool pushParity(
+        uint64_t offset, int firstChannel, int count,
+        const void *data, size_t size, int64_t arrivalTime);
+    // Fills one period per channel. Returns false if any of the output was
+    // concealed rather than received.
+    bool pop(void **targetBuffers);
+    void reset();
+    JitterBufferStats stats() const;
+    uint64_t playoutOffset() const { return _playoutOffset; }
+    bool playing() const { return _playing; }
+    // When the caller schedules playout against a synchronized clock it
+    // decides when to skip or hold, so the buffer starts as soon as it has
+    // data and leaves excess depth alone.
+    void setScheduled(bool scheduled) { _scheduled = scheduled; }
+
+private:
+    struct Slot
+    {
+        uint64_t offset = 0;
+        uint64_t receivedMask = 0;
+        uint64_t parityMask = 0;
+        bool valid = false;
+    };
+
+    Slot *acquireSlot(uint64_t offset, int64_t arrivalTime);
+    Slot& slotFor(uint64_t offset);
+    uint8_t *slotData(const Slot& slot, int channel);
+    uint8_t *slotParity(const Slot& slot, int group);
+    void recover(Slot& slot, int group);
+    int bufferedDepth() const;
+    void updateJitter(uint64_t offset, int64_t arrivalTime);
+    void updateTargetDepth();
+    int holdTicks() const;
+    void conceal(int channel, void *target);
+
+    int _channelCount;
+    int _periodFrameSize;
+    int _sampleRate;
+    int _sampleSize;
+    size_t _periodBytes;
+    int _minDepth;
+    int _maxDepth;
+    int _capacity;
+    std::vector<Slot> _slots;
+    std::vector<uint8_t> _data;
+    std::vector<uint8_t> _parity;
+    std::vector<uint8_t> _lastPeriod;
+    std::vector<int> _concealCount;
+
+    bool _started = false;
+    bool _playing = false;
+    bool _scheduled = false;
+    uint64_t _playoutOffset = 0;
+    uint64_t _highestOffset = 0;
+    int _targetDepth;
+    int _fecGroupSize = 0;
+    int _quietTicks = 0;
+    int _shrinkTicks = 0;
+    int _growTicks = 0;
+    bool _haveTransit = false;
+    double _lastTransit = 0;
+    double _jitter = 0;
+    JitterBufferStats _stats;
+};
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_JITTERBUFFER_H
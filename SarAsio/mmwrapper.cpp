@@ -16,6 +16,7 @@
 
 #include "stdafx.h"
 #include "mmwrapper.h"
+#include "appmatcher.h"
 #include "utility.h"
 #include <DbgHelp.h>
 #pragma comment(lib, "dbghelp.lib")
@@ -44,6 +45,12 @@ const PROPERTYKEY PKEY_Unknown_DevicePath =
     1
 };
 
+// Shared by every enumerator in the process.
+static ApplicationMatchCache gApplicationMatch;
+static EndpointIndex gEndpointIndex;
+static std::once_flag gEndpointNotificationsOnce;
+static std::atomic<bool> gEndpointNotificationsActive = false;
+
 static HRESULT CreateMMDevAPIObject(
     REFCLSID rclsid, REFIID riid, LPVOID *ppvObject)
 {
@@ -108,6 +115,107 @@ static HRESULT CreateMMDevAPIObject(
     return cf->CreateInstance(0, riid, ppvObject);
 }
 
+// The endpoint index outlives any one enumerator, so it gets notifications
+// through an inner enumerator of its own. Like MMDevAPI itself, that and the
+// client stay alive until the process exits.
+static void RegisterEndpointNotifications()
+{
+    IMMDeviceEnumerator *enumerator = nullptr;
+    CComPtr<IMMNotificationClient> client;
+    HRESULT hr;
+
+    hr = CreateMMDevAPIObject(
+        __uuidof(MMDeviceEnumerator), __uuidof(IMMDeviceEnumerator),
+        (LPVOID *)&enumerator);
+
+    if (!SUCCEEDED(hr)) {
+        LOG(ERROR) << "Failed to instantiate notification enumerator";
+        return;
+    }
+
+    if (!SUCCEEDED(SarEndpointNotificationClient::CreateInstance(&client)) ||
+        !SUCCEEDED(enumerator->RegisterEndpointNotificationCallback(client))) {
+
+        LOG(ERROR) << "Failed to register for endpoint notifications; "
+            << "application routing will not be cached.";
+        enumerator->Release();
+        return;
+    }
+
+    client.Detach();
+    gEndpointNotificationsActive = true;
+}
+
+// Without notifications the index can't be trusted from one call to the
+// next, so it's rebuilt every time like the search it replaced.
+static void RefreshEndpointIndex(IMMDeviceEnumerator *enumerator)
+{
+    CComPtr<IMMDeviceCollection> devices;
+    std::vector<EndpointIndexEntry> entries;
+    uint64_t generation;
+    UINT deviceCount;
+
+    if (!gEndpointNotificationsActive) {
+        gEndpointIndex.invalidate();
+    }
+
+    if (gEndpointIndex.valid(&generation)) {
+        return;
+    }
+
+    if (!SUCCEEDED(enumerator->EnumAudioEndpoints(
+        eAll, DEVICE_STATE_ACTIVE, &devices))) {
+
+        return;
+    }
+
+    if (!SUCCEEDED(devices->GetCount(&deviceCount))) {
+        return;
+    }
+
+    for (UINT i = 0; i < deviceCount; ++i) {
+        CComPtr<IMMDevice> device;
+        CComPtr<IPropertyStore> ps;
+        PROPVARIANT pvalue = {};
+        LPWSTR deviceId = nullptr;
+        EDataFlow dataFlow;
+
+        if (!SUCCEEDED(devices->Item(i, &device))) {
+            continue;
+        }
+
+        CComQIPtr<IMMEndpoint> endpoint(device);
+
+        if (!endpoint || !SUCCEEDED(endpoint->GetDataFlow(&dataFlow))) {
+            continue;
+        }
+
+        if (!SUCCEEDED(device->OpenPropertyStore(STGM_READ, &ps))) {
+            continue;
+        }
+
+        if (!SUCCEEDED(ps->GetValue(
+            PKEY_SynchronousAudioRouter_EndpointId, &pvalue))) {
+
+            continue;
+        }
+
+        if (pvalue.vt == VT_LPWSTR && SUCCEEDED(device->GetId(&deviceId))) {
+            EndpointIndexEntry entry;
+
+            entry.endpointId = TCHARToUTF8(pvalue.pwszVal);
+            entry.deviceId = deviceId;
+            entry.dataFlow = dataFlow;
+            entries.emplace_back(std::move(entry));
+            CoTaskMemFree(deviceId);
+        }
+
+        PropVariantClear(&pvalue);
+    }
+
+    gEndpointIndex.rebuild(generation, std::move(entries));
+}
+
 SarMMDeviceEnumerator::SarMMDeviceEnumerator()
 {
     LOG(INFO) << "Initializing SarMMDeviceEnumerator.";
@@ -123,6 +231,40 @@ SarMMDeviceEnumerator::SarMMDeviceEnumerator()
         LOG(ERROR) << "Failed to instantiate MMDeviceEnumerator";
     }
 
+    if (_config.enableApplicationRouting) {
+        std::wstring signature;
+
+        // the process image can't change, so the regexes only need to run
+        // again if this config has a different application list.
+        for (auto& app : _config.applications) {
+            signature += app.regexMatch ? L"r:" : L"p:";
+            signature += app.path;
+            signature += L'\n';
+        }
+
+        if (!gApplicationMatch.find(signature, &_applicationIndex)) {
+            WCHAR processNameWide[512] = {};
+
+            GetModuleFileName(nullptr, processNameWide,
+                sizeof(processNameWide)/sizeof(processNameWide[0]));
+
+            std::vector<ApplicationRule> rules(_config.applications.size());
+
+            for (size_t i = 0; i < rules.size(); ++i) {
+                rules[i].path = _config.applications[i].path;
+                rules[i].regexMatch = _config.applications[i].regexMatch;
+            }
+
+            _applicationIndex =
+                ApplicationMatcher(rules).match(std::wstring(processNameWide));
+
+            gApplicationMatch.store(signature, _applicationIndex);
+        }
+
+        std::call_once(
+            gEndpointNotificationsOnce, RegisterEndpointNotifications);
+    }
+
     LOG(INFO) << "Initialized SarMMDeviceEnumerator.";
 }
 
@@ -198,81 +340,42 @@ HRESULT STDMETHODCALLTYPE SarMMDeviceEnumerator::GetDefaultAudioEndpoint(
             dataFlow, role, ppEndpoint);
     }
 
-    CComPtr<IMMDeviceCollection> devices;
     CComPtr<IMMDevice> foundDevice;
-    UINT deviceCount;
-    WCHAR processNameWide[512] = {};
-    ApplicationConfig *appConfig = nullptr;
+    std::wstring deviceId;
 
-    GetModuleFileName(nullptr, processNameWide, sizeof(processNameWide)/sizeof(processNameWide[0]));
-
-    auto processName = std::wstring(processNameWide);
-
-    for (auto& candidateApp : _config.applications) {
-        if (std::regex_search(processName, candidateApp.pattern)) {
-            appConfig = &candidateApp;
-            break;
-        }
-    }
+    if (findDefaultDevice(dataFlow, role, &deviceId) &&
+        SUCCEEDED(_innerEnumerator->GetDevice(
+            deviceId.c_str(), &foundDevice))) {
 
-    if (!appConfig) {
-        return _innerEnumerator->GetDefaultAudioEndpoint(
-                dataFlow, role, ppEndpoint);
+        *ppEndpoint = foundDevice.Detach();
+        return S_OK;
     }
 
-    if (!SUCCEEDED(_innerEnumerator->EnumAudioEndpoints(
-        dataFlow, DEVICE_STATE_ACTIVE, &devices))) {
-
-        return E_FAIL;
-    }
+    return _innerEnumerator->GetDefaultAudioEndpoint(
+        dataFlow, role, ppEndpoint);
+}
 
-    if (!SUCCEEDED(devices->GetCount(&deviceCount))) {
-        return E_FAIL;
+bool SarMMDeviceEnumerator::findDefaultDevice(
+    EDataFlow dataFlow, ERole role, std::wstring *deviceId)
+{
+    if (_applicationIndex < 0) {
+        return false;
     }
 
-    for (UINT i = 0; i < deviceCount && !foundDevice; ++i) {
-        CComPtr<IMMDevice> device;
-        CComPtr<IPropertyStore> ps;
-        PROPVARIANT pvalue = {};
+    RefreshEndpointIndex(_innerEnumerator);
 
-        if (!SUCCEEDED(devices->Item(i, &device))) {
-            continue;
-        }
+    for (auto& defaultEndpoint :
+        _config.applications[_applicationIndex].defaults) {
 
-        if (!SUCCEEDED(device->OpenPropertyStore(STGM_READ, &ps))) {
-            continue;
-        }
-
-        if (!SUCCEEDED(ps->GetValue(
-            PKEY_SynchronousAudioRouter_EndpointId, &pvalue))) {
+        if (role == defaultEndpoint.role &&
+            dataFlow == defaultEndpoint.type &&
+            gEndpointIndex.find(defaultEndpoint.id, dataFlow, deviceId)) {
 
-            continue;
+            return true;
         }
-
-        if (pvalue.vt == VT_LPWSTR) {
-            auto candidateId = TCHARToUTF8(pvalue.pwszVal);
-
-            for (auto& defaultEndpoint : appConfig->defaults) {
-                if (role == defaultEndpoint.role &&
-                    dataFlow == defaultEndpoint.type &&
-                    candidateId == defaultEndpoint.id) {
-
-                    foundDevice = device;
-                    break;
-                }
-            }
-        }
-
-        PropVariantClear(&pvalue);
     }
 
-    if (foundDevice) {
-        *ppEndpoint = foundDevice.Detach();
-        return S_OK;
-    }
-
-    return _innerEnumerator->GetDefaultAudioEndpoint(
-        dataFlow, role, ppEndpoint);
+    return false;
 }
 
 HRESULT STDMETHODCALLTYPE SarMMDeviceEnumerator::GetDevice(
@@ -316,6 +419,44 @@ SarMMDeviceEnumerator::UnregisterEndpointNotificationCallback(
         pClient);
 }
 
+HRESULT STDMETHODCALLTYPE SarEndpointNotificationClient::OnDeviceStateChanged(
+    _In_ LPCWSTR pwstrDeviceId, _In_ DWORD dwNewState)
+{
+    gEndpointIndex.invalidate();
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SarEndpointNotificationClient::OnDeviceAdded(
+    _In_ LPCWSTR pwstrDeviceId)
+{
+    gEndpointIndex.invalidate();
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SarEndpointNotificationClient::OnDeviceRemoved(
+    _In_ LPCWSTR pwstrDeviceId)
+{
+    gEndpointIndex.invalidate();
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SarEndpointNotificationClient::OnDefaultDeviceChanged(
+    _In_ EDataFlow flow, _In_ ERole role, _In_ LPCWSTR pwstrDefaultDeviceId)
+{
+    // routed defaults come from the config, not the system defaults.
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE SarEndpointNotificationClient::OnPropertyValueChanged(
+    _In_ LPCWSTR pwstrDeviceId, _In_ const PROPERTYKEY key)
+{
+    if (IsEqualPropertyKey(key, PKEY_SynchronousAudioRouter_EndpointId)) {
+        gEndpointIndex.invalidate();
+    }
+
+    return S_OK;
+}
+
 HRESULT SarMMDeviceCollection::Initialize(
     const std::vector<CComPtr<IMMDevice>> &items)
 {
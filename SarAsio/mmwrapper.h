@@ -18,6 +18,7 @@
 #define _SAR_ASIO_MMWRAPPER_H
 
 #include "config.h"
+#include "routingcache.h"
 #include "ActivateAudioInterfaceWorker_h.h"
 
 namespace Sar {
@@ -56,10 +57,41 @@ struct ATL_NO_VTABLE SarMMDeviceEnumerator:
         _In_ IMMNotificationClient *pClient) override;
 
 private:
+    bool findDefaultDevice(
+        EDataFlow dataFlow, ERole role, std::wstring *deviceId);
+
     DriverConfig _config;
+    // index into _config.applications of the one matching this process.
+    int _applicationIndex = -1;
     CComPtr<IMMDeviceEnumerator> _innerEnumerator;
 };
 
+// Invalidates the process wide endpoint index when devices come and go or
+// a device's SAR endpoint id changes.
+struct ATL_NO_VTABLE SarEndpointNotificationClient:
+    public CComObjectRootEx<CComMultiThreadModel>,
+    public CComCoClass<SarEndpointNotificationClient>,
+    public IMMNotificationClient
+{
+    BEGIN_COM_MAP(SarEndpointNotificationClient)
+        COM_INTERFACE_ENTRY(IMMNotificationClient)
+    END_COM_MAP()
+
+    DECLARE_NO_REGISTRY()
+
+    virtual HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(
+        _In_ LPCWSTR pwstrDeviceId, _In_ DWORD dwNewState) override;
+    virtual HRESULT STDMETHODCALLTYPE OnDeviceAdded(
+        _In_ LPCWSTR pwstrDeviceId) override;
+    virtual HRESULT STDMETHODCALLTYPE OnDeviceRemoved(
+        _In_ LPCWSTR pwstrDeviceId) override;
+    virtual HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(
+        _In_ EDataFlow flow, _In_ ERole role,
+        _In_ LPCWSTR pwstrDefaultDeviceId) override;
+    virtual HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(
+        _In_ LPCWSTR pwstrDeviceId, _In_ const PROPERTYKEY key) override;
+};
+
 struct DECLSPEC_UUID("7A3A9E4A-6212-42C8-BE71-5772D95CCD8E") ATL_NO_VTABLE
     ISarMMDeviceCollectionInit: public IUnknown
 {
@@ -0,0 +1,765 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "network.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace Sar {
+
+// Largest correction we will apply on top of the measured drift, and the
+// gain used to pull the buffered latency back towards the jitter buffer's
+// target depth.
+static const double MAX_RATIO_CORRECTION = 0.001;
+static const double DEPTH_CORRECTION_GAIN = 0.000001;
+// Scheduled playout slews towards its target with this gain per frame of
+// error, and steps a period at a time once it is more than a period off.
+static const double SCHEDULE_CORRECTION_GAIN = 0.00005;
+// Microseconds between clock sync exchanges.
+static const int64_t SYNC_INTERVAL = 250000;
+// Microseconds a slave waits without hearing its master before it follows
+// the ticks of a new session.
+static const int64_t SESSION_TIMEOUT = 2000000;
+
+int64_t CastClockNow()
+{
+    return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SarCastMaster::SarCastMaster(
+    const BufferConfig& bufferConfig, int channelCount,
+    uint64_t session, int fecGroupSize):
+    _bufferConfig(bufferConfig),
+    _channelCount(channelCount),
+    _session(session)
+{
+    auto payloadSize =
+        (size_t)bufferConfig.periodFrameSize * bufferConfig.sampleSize;
+
+    if (fecGroupSize > FEC_MAX_GROUP_SIZE) {
+        LOG(WARNING) << "FEC group size " << fecGroupSize
+            << " clamped to " << FEC_MAX_GROUP_SIZE;
+    }
+
+    if (fecGroupSize > 0) {
+        _fec.reset(new FecEncoder(channelCount, fecGroupSize, payloadSize));
+    }
+
+    _packet.resize(std::max(
+        sizeof(CastBufferPacket), sizeof(CastParityPacket)) + payloadSize);
+}
+
+void SarCastMaster::setCompression(bool enable)
+{
+    if (enable) {
+        _codec.reset(new CastCodec(
+            _bufferConfig.periodFrameSize, _bufferConfig.sampleSize));
+    } else {
+        _codec.reset();
+    }
+}
+
+void SarCastMaster::tick(void **sourceBuffers, uint64_t offset)
+{
+    auto payloadSize =
+        (size_t)_bufferConfig.periodFrameSize * _bufferConfig.sampleSize;
+
+    if (!_send) {
+        return;
+    }
+
+    CastTickPacket tickPacket;
+
+    initHeader(&tickPacket.header, CastPacketType::Tick, sizeof(tickPacket));
+    tickPacket.offset = offset;
+    tickPacket.time = CastClockNow();
+    _send(&tickPacket, sizeof(tickPacket));
+
+    for (int i = 0; i < _channelCount; ++i) {
+        auto packet = (CastBufferPacket *)_packet.data();
+        size_t encodedSize = 0;
+
+        if (_codec) {
+            encodedSize = _codec->encode(
+                sourceBuffers[i], packet->data, payloadSize);
+        }
+
+        if (!encodedSize) {
+            memcpy(packet->data, sourceBuffers[i], payloadSize);
+        }
+
+        auto length = sizeof(CastBufferPacket) +
+            (encodedSize ? encodedSize : payloadSize);
+
+        initHeader(&packet->header, CastPacketType::Buffer, length);
+
+        if (encodedSize) {
+            packet->header.type |= CAST_PACKET_FLAG_COMPRESSED;
+        }
+
+        packet->offset = offset;
+        packet->channel = (uint16_t)i;
+        _send(packet, length);
+
+        if (!_fec) {
+            continue;
+        }
+
+        auto group = _fec->add(i, sourceBuffers[i]);
+
+        if (group >= 0) {
+            auto parity = (CastParityPacket *)_packet.data();
+
+            length = sizeof(CastParityPacket) + payloadSize;
+            initHeader(&parity->header, CastPacketType::Parity, length);
+            parity->offset = offset;
+            parity->channel = (uint16_t)(group * _fec->groupSize());
+            parity->groupSize = (uint8_t)_fec->groupSize();
+            memcpy(parity->data, _fec->parity(group), payloadSize);
+            _send(parity, length);
+        }
+    }
+}
+
+void SarCastMaster::requestStatus(int64_t now)
+{
+    CastStatusRequestPacket packet;
+
+    if (!_send) {
+        return;
+    }
+
+    initHeader(&packet.header, CastPacketType::StatusRequest, sizeof(packet));
+
+    {
+        std::lock_guard<std::mutex> lock(_statusLock);
+
+        _statusRequestTag = packet.header.tag;
+        _statusRequestTime = now;
+    }
+
+    _send(&packet, sizeof(packet));
+}
+
+bool SarCastMaster::handlePacket(
+    const void *packet, size_t size,
+    const std::string& from, int64_t arrivalTime)
+{
+    auto header = (const CastPacketHeader *)packet;
+
+    if (size < sizeof(CastPacketHeader) ||
+        header->length != size ||
+        header->session != _session) {
+
+        return false;
+    }
+
+    switch ((CastPacketType)header->type) {
+        case CastPacketType::StatusResponse:
+            return handleStatusResponse(
+                (const CastStatusResponsePacket *)packet, size,
+                from, arrivalTime);
+        case CastPacketType::SyncRequest:
+            return handleSyncRequest(
+                (const CastSyncRequestPacket *)packet, size, arrivalTime);
+        case CastPacketType::NewEndpoint:
+        case CastPacketType::Ack:
+            // see SarCastSlave::handlePacket; nothing sends these.
+            return false;
+        default:
+            return false;
+    }
+}
+
+bool SarCastMaster::handleStatusResponse(
+    const CastStatusResponsePacket *response, size_t size,
+    const std::string& from, int64_t arrivalTime)
+{
+    if (size < sizeof(CastStatusResponsePacket)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_statusLock);
+    auto& status = _slaves[response->slaveId];
+
+    status.slaveId = response->slaveId;
+    status.address = from;
+    status.received = response->received;
+    status.late = response->late;
+    status.concealed = response->concealed;
+    status.recovered = response->recovered;
+    status.depthFrames = response->depthFrames;
+    status.driftPpm = response->driftPpb / 1000.0;
+    status.lastSeen = arrivalTime;
+
+    if (response->requestTag == _statusRequestTag) {
+        status.roundTripTime = arrivalTime - _statusRequestTime;
+    }
+
+    return true;
+}
+
+bool SarCastMaster::handleSyncRequest(
+    const CastSyncRequestPacket *request, size_t size, int64_t arrivalTime)
+{
+    CastSyncResponsePacket response;
+
+    if (size < sizeof(CastSyncRequestPacket) || !_send) {
+        return false;
+    }
+
+    // in multicast mode every slave sees the response; they pick out their
+    // own by slaveId and tag.
+    response.header.session = _session;
+    response.header.tag = request->header.tag;
+    response.header.length = sizeof(response);
+    response.header.type = (uint8_t)CastPacketType::SyncResponse;
+    response.slaveId = request->slaveId;
+    response.originTime = request->originTime;
+    response.receiveTime = arrivalTime;
+    response.transmitTime = CastClockNow();
+    _send(&response, sizeof(response));
+    return true;
+}
+
+std::vector<CastSlaveStatus> SarCastMaster::slaveStatus()
+{
+    std::lock_guard<std::mutex> lock(_statusLock);
+    std::vector<CastSlaveStatus> result;
+
+    for (auto& entry : _slaves) {
+        result.push_back(entry.second);
+    }
+
+    return result;
+}
+
+void SarCastMaster::initHeader(
+    CastPacketHeader *header, CastPacketType type, size_t length)
+{
+    header->session = _session;
+    header->tag = _tag++;
+    header->length = (uint32_t)length;
+    header->type = (uint8_t)type;
+}
+
+SarCastSlave::SarCastSlave(
+    const BufferConfig& bufferConfig, int channelCount, uint64_t session):
+    _bufferConfig(bufferConfig),
+    _channelCount(channelCount),
+    _session(session),
+    _pinnedSession(session != 0),
+    _jitterBuffer(
+        channelCount, bufferConfig.periodFrameSize,
+        bufferConfig.sampleRate, bufferConfig.sampleSize),
+    _masterClock(bufferConfig.sampleRate),
+    _localClock(bufferConfig.sampleRate),
+    _resampler(channelCount),
+    _codec(bufferConfig.periodFrameSize, bufferConfig.sampleSize),
+    _decodeBuffer(bufferConfig.periodFrameSize * bufferConfig.sampleSize),
+    _periodBuffers(channelCount, std::vector<uint8_t>(
+        bufferConfig.periodFrameSize * bufferConfig.sampleSize)),
+    _inputBuffers(channelCount,
+        std::vector<float>(bufferConfig.periodFrameSize)),
+    _outputBuffers(channelCount,
+        std::vector<float>(bufferConfig.periodFrameSize))
+{
+    // several slaves can share one host and port, so they identify
+    // themselves to the master with a random id.
+    std::random_device rd;
+
+    _slaveId = ((uint64_t)rd() << 32) | rd();
+
+    for (int i = 0; i < channelCount; ++i) {
+        _periodPointers.push_back(_periodBuffers[i].data());
+        _inputPointers.push_back(_inputBuffers[i].data());
+        _outputPointers.push_back(_outputBuffers[i].data());
+    }
+}
+
+bool SarCastSlave::handlePacket(
+    const void *packet, size_t size, int64_t arrivalTime)
+{
+    auto header = (const CastPacketHeader *)packet;
+
+    if (size < sizeof(CastPacketHeader) || header->length != size) {
+        return false;
+    }
+
+    auto type = (CastPacketType)(header->type & CAST_PACKET_TYPE_MASK);
+
+    if (!acceptSession(header->session, type, arrivalTime)) {
+        return false;
+    }
+
+    switch (type) {
+        case CastPacketType::Buffer:
+            return handleBuffer(
+                (const CastBufferPacket *)packet, size, arrivalTime);
+        case CastPacketType::StatusRequest:
+            return handleStatusRequest(
+                (const CastStatusRequestPacket *)packet);
+        case CastPacketType::Parity: {
+            auto parity = (const CastParityPacket *)packet;
+
+            if (size < sizeof(CastParityPacket)) {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(_lock);
+
+            return _jitterBuffer.pushParity(
+                parity->offset, parity->channel, parity->groupSize,
+                parity->data, size - sizeof(CastParityPacket), arrivalTime);
+        }
+        case CastPacketType::Tick:
+            if (size < sizeof(CastTickPacket)) {
+                return false;
+            }
+
+            return handleTick((const CastTickPacket *)packet, arrivalTime);
+        case CastPacketType::SyncResponse:
+            if (size < sizeof(CastSyncResponsePacket)) {
+                return false;
+            }
+
+            return handleSyncResponse(
+                (const CastSyncResponsePacket *)packet, arrivalTime);
+        case CastPacketType::NewEndpoint:
+        case CastPacketType::Ack:
+            // slaves take the stream format from their own config; endpoint
+            // negotiation isn't part of the protocol.
+            return false;
+        default:
+            return false;
+    }
+}
+
+bool SarCastSlave::acceptSession(
+    uint64_t session, CastPacketType type, int64_t arrivalTime)
+{
+    if (session == _session) {
+        _lastSessionTime = arrivalTime;
+        return true;
+    }
+
+    // an unpinned slave follows the first master it hears ticking, and only
+    // moves to another once that one has gone quiet. Everything else from a
+    // stale or foreign session is dropped.
+    if (_pinnedSession || type != CastPacketType::Tick ||
+        (_session && arrivalTime - _lastSessionTime < SESSION_TIMEOUT)) {
+
+        return false;
+    }
+
+    LOG(INFO) << "Cast slave following session " << session;
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+
+        _jitterBuffer.reset();
+        _masterClock.reset();
+        _clockSync.reset();
+        _resampler.reset();
+    }
+
+    _session = session;
+    _lastSessionTime = arrivalTime;
+    _syncPending = false;
+    _nextSyncTime = 0;
+    return true;
+}
+
+void SarCastSlave::tick(void **targetBuffers, int64_t tickTime)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto frames = _bufferConfig.periodFrameSize;
+    auto sampleSize = _bufferConfig.sampleSize;
+
+    _localClock.update(_localFrames, tickTime / 1000000.0);
+    _localFrames += frames;
+    updateRatio(tickTime);
+
+    while (!_resampler.canPull(frames)) {
+        _jitterBuffer.pop(_periodPointers.data());
+
+        for (int i = 0; i < _channelCount; ++i) {
+            SamplesToFloat(
+                _periodPointers[i], _inputPointers[i], frames, sampleSize);
+        }
+
+        _resampler.push(_inputPointers.data(), frames);
+    }
+
+    _resampler.pull(_outputPointers.data(), frames);
+
+    for (int i = 0; i < _channelCount; ++i) {
+        FloatToSamples(
+            _outputPointers[i], targetBuffers[i], frames, sampleSize);
+    }
+}
+
+double SarCastSlave::driftRatio()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    return _masterClock.rate() / _localClock.rate();
+}
+
+void SarCastSlave::setPlayoutLatency(int64_t latency)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _playoutLatency = latency;
+}
+
+void SarCastSlave::setClockAsymmetry(int64_t asymmetry)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _clockSync.setAsymmetry(asymmetry);
+}
+
+ClockSyncStats SarCastSlave::clockStats()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    return _clockSync.stats();
+}
+
+JitterBufferStats SarCastSlave::jitterStats()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    return _jitterBuffer.stats();
+}
+
+bool SarCastSlave::handleStatusRequest(const CastStatusRequestPacket *packet)
+{
+    CastStatusResponsePacket response = {};
+
+    if (!_reply) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        auto stats = _jitterBuffer.stats();
+        auto ratio = _masterClock.rate() / _localClock.rate();
+
+        response.depthFrames = (uint32_t)(
+            stats.depth * _bufferConfig.periodFrameSize +
+            _resampler.buffered());
+        response.received = stats.received;
+        response.late = stats.late;
+        response.concealed = stats.concealed;
+        response.recovered = stats.recovered;
+        response.driftPpb = (int32_t)((ratio - 1.0) * 1e9);
+    }
+
+    response.header.session = packet->header.session;
+    response.header.tag = packet->header.tag;
+    response.header.length = sizeof(response);
+    response.header.type = (uint8_t)CastPacketType::StatusResponse;
+    response.slaveId = _slaveId;
+    response.requestTag = packet->header.tag;
+    _reply(&response, sizeof(response));
+    return true;
+}
+
+bool SarCastSlave::handleTick(const CastTickPacket *packet, int64_t arrivalTime)
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+
+        // once synced, the master's own timestamp replaces the arrival time
+        // so network jitter stays out of the master clock estimate.
+        auto time = _clockSync.valid() ?
+            _clockSync.toLocal(packet->time) : arrivalTime;
+
+        _masterClock.update(packet->offset, time / 1000000.0);
+    }
+
+    if (_reply && arrivalTime >= _nextSyncTime) {
+        _nextSyncTime = arrivalTime + SYNC_INTERVAL;
+        sendSyncRequest(packet->header.session);
+    }
+
+    return true;
+}
+
+void SarCastSlave::sendSyncRequest(uint64_t session)
+{
+    CastSyncRequestPacket request;
+
+    request.header.session = session;
+    request.header.tag = ++_syncTag;
+    request.header.length = sizeof(request);
+    request.header.type = (uint8_t)CastPacketType::SyncRequest;
+    request.slaveId = _slaveId;
+    request.originTime = CastClockNow();
+    _syncPending = true;
+    _reply(&request, sizeof(request));
+}
+
+bool SarCastSlave::handleSyncResponse(
+    const CastSyncResponsePacket *packet, int64_t arrivalTime)
+{
+    if (packet->slaveId != _slaveId ||
+        !_syncPending ||
+        packet->header.tag != _syncTag) {
+
+        return false;
+    }
+
+    _syncPending = false;
+
+    std::lock_guard<std::mutex> lock(_lock);
+    auto steps = _clockSync.stats().steps;
+    auto wasValid = _clockSync.valid();
+
+    if (!_clockSync.update(
+            packet->originTime, packet->receiveTime,
+            packet->transmitTime, arrivalTime)) {
+
+        return true;
+    }
+
+    // the master clock was tracking arrival times, or a time base that just
+    // stepped; relock it on the new one.
+    if (!wasValid || _clockSync.stats().steps != steps) {
+        _masterClock.reset();
+    }
+
+    return true;
+}
+
+void SarCastSlave::updateRatio(int64_t tickTime)
+{
+    if (!_masterClock.valid() || !_localClock.valid()) {
+        _resampler.setRatio(1.0);
+        return;
+    }
+
+    auto scheduled = _playoutLatency && _clockSync.valid();
+
+    _jitterBuffer.setScheduled(scheduled);
+
+    if (scheduled && _jitterBuffer.playing()) {
+        schedulePlayout(tickTime);
+        return;
+    }
+
+    // the clock estimates do the heavy lifting; a small proportional term on
+    // the buffered latency keeps residual error from walking the buffer off.
+    auto stats = _jitterBuffer.stats();
+    auto frames = _bufferConfig.periodFrameSize;
+    auto excess = (stats.depth - stats.targetDepth) * frames +
+        _resampler.buffered();
+    auto correction = std::min(std::max(excess * DEPTH_CORRECTION_GAIN,
+        -MAX_RATIO_CORRECTION), MAX_RATIO_CORRECTION);
+
+    _resampler.setRatio(
+        _masterClock.rate() / _localClock.rate() + correction);
+}
+
+void SarCastSlave::schedulePlayout(int64_t tickTime)
+{
+    // the frame the master started playout latency ago, against the one
+    // we're about to play.
+    auto frames = _bufferConfig.periodFrameSize;
+    auto target = _masterClock.frameAt(
+        (tickTime - _playoutLatency) / 1000000.0);
+    auto playing = _jitterBuffer.playoutOffset() - _resampler.buffered();
+    auto error = target - playing;
+
+    if (error >= frames) {
+        // behind: drop whole periods.
+        for (; error >= frames; error -= frames) {
+            _jitterBuffer.pop(_periodPointers.data());
+        }
+    } else if (error <= -frames) {
+        // ahead: hold back with silence.
+        for (int i = 0; i < _channelCount; ++i) {
+            std::fill(_inputBuffers[i].begin(), _inputBuffers[i].end(), 0.0f);
+        }
+
+        for (; error <= -frames; error += frames) {
+            _resampler.push(_inputPointers.data(), frames);
+        }
+    }
+
+    auto correction = std::min(std::max(error * SCHEDULE_CORRECTION_GAIN,
+        -MAX_RATIO_CORRECTION), MAX_RATIO_CORRECTION);
+
+    _resampler.setRatio(
+        _masterClock.rate() / _localClock.rate() + correction);
+}
+
+bool SarCastSlave::handleBuffer(
+    const CastBufferPacket *packet, size_t size, int64_t arrivalTime)
+{
+    if (size < sizeof(CastBufferPacket)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_lock);
+    auto data = packet->data;
+    auto dataSize = size - sizeof(CastBufferPacket);
+
+    if (packet->header.type & CAST_PACKET_FLAG_COMPRESSED) {
+        if (!_codec.decode(data, dataSize, _decodeBuffer.data())) {
+            return false;
+        }
+
+        data = _decodeBuffer.data();
+        dataSize = _decodeBuffer.size();
+    }
+
+    return _jitterBuffer.push(
+        packet->offset, packet->channel, data, dataSize, arrivalTime);
+}
+
+CastTransport::CastTransport()
+{
+    spinPolicyInit(
+        &_spinPolicy, WAIT_BLOCK, SPIN_MIN_WINDOW_NS, SPIN_MAX_WINDOW_NS);
+}
+
+bool CastTransport::openMaster(
+    const std::string& destination, uint16_t port,
+    const std::string& interfaceAddress, int ttl)
+{
+    sockaddr_in addr;
+
+    if (!CastParseAddress(destination, port, &addr) ||
+        !_socket.open(interfaceAddress, 0) ||
+        !_socket.setDestination(destination, port)) {
+
+        return false;
+    }
+
+    if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr)) &&
+        !_socket.setMulticastOptions(interfaceAddress, ttl, true)) {
+
+        return false;
+    }
+
+    return true;
+}
+
+bool CastTransport::openSlave(
+    const std::string& group, uint16_t port,
+    const std::string& interfaceAddress)
+{
+    // bind to the wildcard address so group traffic is delivered.
+    if (!_socket.open("", port)) {
+        return false;
+    }
+
+    if (!group.empty() && !_socket.joinGroup(group, interfaceAddress)) {
+        return false;
+    }
+
+    return true;
+}
+
+void CastTransport::attach(std::shared_ptr<SarCastMaster> master)
+{
+    _master = master;
+    _master->setSendFunction([this](const void *packet, size_t size) {
+        _socket.send(packet, size);
+    });
+}
+
+void CastTransport::attach(std::shared_ptr<SarCastSlave> slave)
+{
+    _slave = slave;
+    _slave->setReplyFunction([this](const void *packet, size_t size) {
+        _socket.sendTo(packet, size, _lastSender);
+    });
+}
+
+void CastTransport::setWaitMode(
+    WaitMode mode, uint64_t minSpinNs, uint64_t maxSpinNs)
+{
+    spinPolicyInit(&_spinPolicy, mode, minSpinNs, maxSpinNs);
+}
+
+bool CastTransport::poll(int timeoutMs)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto elapsedNs = [start]() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    };
+    auto window = spinPolicyWindow(&_spinPolicy);
+    uint64_t spunNs = 0;
+    int size = 0;
+
+    if (timeoutMs >= 0) {
+        window = std::min(window, (uint64_t)timeoutMs * 1000000);
+    }
+
+    if (window) {
+        do {
+            size = _socket.receive(
+                _receiveBuffer.data(), _receiveBuffer.size(), &_lastSender, 0);
+            spunNs = elapsedNs();
+        } while (!size && spunNs < window);
+    }
+
+    auto spinHit = size != 0;
+
+    if (!size) {
+        auto remainingMs = timeoutMs;
+
+        if (timeoutMs > 0) {
+            remainingMs = std::max(0, timeoutMs - (int)(spunNs / 1000000));
+        }
+
+        size = _socket.receive(
+            _receiveBuffer.data(), _receiveBuffer.size(), &_lastSender,
+            remainingMs);
+    }
+
+    if (size >= 0) {
+        spinPolicyUpdate(&_spinPolicy, elapsedNs(), spunNs, spinHit);
+    }
+
+    if (size <= 0) {
+        return false;
+    }
+
+    auto now = CastClockNow();
+
+    if (_slave) {
+        return _slave->handlePacket(_receiveBuffer.data(), size, now);
+    }
+
+    if (_master) {
+        return _master->handlePacket(
+            _receiveBuffer.data(), size, CastFormatAddress(_lastSender), now);
+    }
+
+    return false;
+}
+
+} // namespace Sar
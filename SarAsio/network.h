@@ -17,11 +17,38 @@
 #ifndef _SAR_ASIO_NETWORK_H
 #define _SAR_ASIO_NETWORK_H
 
-#include "config.h"
-#include "sar.h"
+#include "castcodec.h"
+#include "castsocket.h"
+#include "clocksync.h"
+#include "fec.h"
+#include "jitterbuffer.h"
+#include "resampler.h"
+#include "sarclient.h"
+#include "spinpolicy.h"
+
+#include <functional>
 
 namespace Sar {
 
+enum class CastPacketType: uint8_t
+{
+    StatusRequest,
+    StatusResponse,
+    NewEndpoint,
+    Tick,
+    Buffer,
+    Ack,
+    Parity,
+    SyncRequest,
+    SyncResponse,
+};
+
+// Or'd into CastPacketHeader::type when a buffer packet's payload is
+// CastCodec encoded. Senders fall back to raw periods that don't compress,
+// so a stream can mix both.
+static const uint8_t CAST_PACKET_FLAG_COMPRESSED = 0x80;
+static const uint8_t CAST_PACKET_TYPE_MASK = 0x7f;
+
 #pragma pack(push, 1)
 #pragma warning(disable: 4200) // don't warn on 0-length arrays
 
@@ -41,6 +68,14 @@ struct CastStatusRequestPacket
 struct CastStatusResponsePacket
 {
     CastPacketHeader header;
+    uint64_t slaveId;
+    uint32_t requestTag;
+    uint32_t depthFrames;
+    uint64_t received;
+    uint64_t late;
+    uint64_t concealed;
+    uint64_t recovered;
+    int32_t driftPpb;
 };
 
 struct CastNewEndpointPacket
@@ -53,10 +88,12 @@ struct CastNewEndpointPacket
     uint16_t bufferSampleCount;
 };
 
+// time is the master's CastClockNow() when the period at offset started.
 struct CastTickPacket
 {
     CastPacketHeader header;
     uint64_t offset;
+    int64_t time;
 };
 
 struct CastBufferPacket
@@ -72,14 +109,208 @@ struct CastAckPacket
     CastPacketHeader header;
 };
 
+// XOR of the buffer packets for channels [channel, channel + groupSize) at
+// the same offset.
+struct CastParityPacket
+{
+    CastPacketHeader header;
+    uint64_t offset;
+    uint16_t channel;
+    uint8_t groupSize;
+    uint8_t data[0];
+};
+
+// Two-way clock exchange. The slave sends originTime on its own clock, the
+// master answers with the request's tag and when it received the request and
+// sent the response on its clock.
+struct CastSyncRequestPacket
+{
+    CastPacketHeader header;
+    uint64_t slaveId;
+    int64_t originTime;
+};
+
+struct CastSyncResponsePacket
+{
+    CastPacketHeader header;
+    uint64_t slaveId;
+    int64_t originTime;
+    int64_t receiveTime;
+    int64_t transmitTime;
+};
+
 #pragma pack(pop)
 
+// steady_clock in microseconds. Arrival, tick and sync times all use it.
+int64_t CastClockNow();
+
+typedef std::function<void(const void *packet, size_t size)>
+    CastSendFunction;
+
+struct CastSlaveStatus
+{
+    uint64_t slaveId = 0;
+    std::string address;
+    uint64_t received = 0;
+    uint64_t late = 0;
+    uint64_t concealed = 0;
+    uint64_t recovered = 0;
+    int depthFrames = 0;
+    double driftPpm = 0;
+    int64_t roundTripTime = 0;
+    int64_t lastSeen = 0;
+};
+
 struct SarCastMaster: public std::enable_shared_from_this<SarCastMaster>
 {
+    // fecGroupSize is the number of channels covered by each parity packet,
+    // or 0 to send no parity.
+    SarCastMaster(
+        const BufferConfig& bufferConfig, int channelCount,
+        uint64_t session, int fecGroupSize = 0);
+    void setSendFunction(CastSendFunction send) { _send = send; }
+    void setCompression(bool enable);
+    // Packetizes one period of channel buffers starting at offset.
+    void tick(void **sourceBuffers, uint64_t offset);
+    // Asks every slave (all of them at once in multicast mode) to report.
+    // Times are in microseconds.
+    void requestStatus(int64_t now);
+    // Called from the receive thread with packets sent back by slaves.
+    bool handlePacket(
+        const void *packet, size_t size,
+        const std::string& from, int64_t arrivalTime);
+    std::vector<CastSlaveStatus> slaveStatus();
+
+private:
+    bool handleStatusResponse(
+        const CastStatusResponsePacket *response, size_t size,
+        const std::string& from, int64_t arrivalTime);
+    bool handleSyncRequest(
+        const CastSyncRequestPacket *request, size_t size,
+        int64_t arrivalTime);
+    void initHeader(
+        CastPacketHeader *header, CastPacketType type, size_t length);
+
+    BufferConfig _bufferConfig;
+    int _channelCount;
+    uint64_t _session;
+    std::atomic<uint32_t> _tag = 0;
+    std::unique_ptr<FecEncoder> _fec;
+    std::unique_ptr<CastCodec> _codec;
+    std::vector<uint8_t> _packet;
+    CastSendFunction _send;
+    std::mutex _statusLock;
+    uint32_t _statusRequestTag = 0;
+    int64_t _statusRequestTime = 0;
+    std::unordered_map<uint64_t, CastSlaveStatus> _slaves;
 };
 
 struct SarCastSlave: public std::enable_shared_from_this<SarCastSlave>
 {
+    // session pins the slave to one master; 0 follows whichever master is
+    // ticking, switching only after the current one goes quiet.
+    SarCastSlave(
+        const BufferConfig& bufferConfig, int channelCount,
+        uint64_t session = 0);
+
+    // Called from the receive thread. arrivalTime is in microseconds.
+    bool handlePacket(const void *packet, size_t size, int64_t arrivalTime);
+    // Called once per ASIO period with one target buffer per channel.
+    // tickTime is in microseconds on the same clock as arrivalTime.
+    void tick(void **targetBuffers, int64_t tickTime);
+    JitterBufferStats jitterStats();
+    // Used to answer status requests from the master.
+    void setReplyFunction(CastSendFunction reply) { _reply = reply; }
+    // Master sample clock relative to the local one, e.g. 1.0001 if the
+    // master runs 100ppm fast.
+    double driftRatio();
+    // Plays each master frame this long after the master started its
+    // period, so every slave with the same latency plays it at the same
+    // instant. Needs clock sync and should exceed the network delay plus
+    // the jitter buffer depth; 0 (the default) just follows the buffer.
+    // latency is in microseconds.
+    void setPlayoutLatency(int64_t latency);
+    // See ClockSync::setAsymmetry.
+    void setClockAsymmetry(int64_t asymmetry);
+    ClockSyncStats clockStats();
+
+private:
+    bool acceptSession(
+        uint64_t session, CastPacketType type, int64_t arrivalTime);
+    bool handleBuffer(
+        const CastBufferPacket *packet, size_t size, int64_t arrivalTime);
+    bool handleStatusRequest(const CastStatusRequestPacket *packet);
+    bool handleTick(const CastTickPacket *packet, int64_t arrivalTime);
+    bool handleSyncResponse(
+        const CastSyncResponsePacket *packet, int64_t arrivalTime);
+    void sendSyncRequest(uint64_t session);
+    void updateRatio(int64_t tickTime);
+    void schedulePlayout(int64_t tickTime);
+
+    std::mutex _lock;
+    BufferConfig _bufferConfig;
+    int _channelCount;
+    // session state is only touched on the receive thread.
+    uint64_t _session;
+    bool _pinnedSession;
+    int64_t _lastSessionTime = 0;
+    JitterBuffer _jitterBuffer;
+    DriftEstimator _masterClock;
+    DriftEstimator _localClock;
+    ClockSync _clockSync;
+    int64_t _playoutLatency = 0;
+    // sync requests are sent and answered on the receive thread.
+    uint32_t _syncTag = 0;
+    bool _syncPending = false;
+    int64_t _nextSyncTime = 0;
+    Resampler _resampler;
+    CastCodec _codec;
+    std::vector<uint8_t> _decodeBuffer;
+    uint64_t _localFrames = 0;
+    std::vector<std::vector<uint8_t>> _periodBuffers;
+    std::vector<std::vector<float>> _inputBuffers;
+    std::vector<std::vector<float>> _outputBuffers;
+    std::vector<void *> _periodPointers;
+    std::vector<float *> _inputPointers;
+    std::vector<float *> _outputPointers;
+    CastSendFunction _reply;
+    uint64_t _slaveId;
+};
+
+// Binds a cast master or slave to a UDP socket. In multicast mode the
+// master sends each packet once to the group and every slave that joined
+// it receives a copy; status replies come back unicast to the master.
+struct CastTransport
+{
+    CastTransport();
+    // Master: destination is a multicast group or a single slave.
+    bool openMaster(
+        const std::string& destination, uint16_t port,
+        const std::string& interfaceAddress = "", int ttl = 1);
+    // Slave: group may be empty to receive unicast only.
+    bool openSlave(
+        const std::string& group, uint16_t port,
+        const std::string& interfaceAddress = "");
+    void attach(std::shared_ptr<SarCastMaster> master);
+    void attach(std::shared_ptr<SarCastSlave> slave);
+    // Receives and dispatches one packet, stamping it with steady_clock in
+    // microseconds. Returns false on timeout or error.
+    bool poll(int timeoutMs);
+    // Selects how poll waits. Blocking is the default; adaptive spins for a
+    // window tracking recent packet gaps before it blocks, which catches
+    // the burst of buffer packets following each tick without a wakeup.
+    void setWaitMode(
+        WaitMode mode, uint64_t minSpinNs = SPIN_MIN_WINDOW_NS,
+        uint64_t maxSpinNs = SPIN_MAX_WINDOW_NS);
+    const SpinPolicy& spinPolicy() const { return _spinPolicy; }
+
+private:
+    CastSocket _socket;
+    SpinPolicy _spinPolicy;
+    std::shared_ptr<SarCastMaster> _master;
+    std::shared_ptr<SarCastSlave> _slave;
+    sockaddr_in _lastSender = {};
+    std::vector<uint8_t> _receiveBuffer = std::vector<uint8_t>(65536);
 };
 
 }
@@ -0,0 +1,279 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || \
+    defined(__SSE2__)
+#define SAR_RESAMPLER_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace Sar {
+
+static const double PI = 3.14159265358979323846;
+// Filter length in input frames, must be a multiple of 4 for the SSE path.
+static const int TAPS = 32;
+static const int PHASES = 256;
+// Passband edge relative to the input Nyquist frequency. The ratio never
+// strays far from 1 so there's no need to track it for anti-aliasing.
+static const double CUTOFF = 0.9;
+static const double INITIAL_BANDWIDTH = 1.0;
+
+DriftEstimator::DriftEstimator(double nominalRate, double bandwidth):
+    _nominalRate(nominalRate), _targetBandwidth(bandwidth),
+    _bandwidth(INITIAL_BANDWIDTH)
+{
+}
+
+void DriftEstimator::reset()
+{
+    _valid = false;
+    _bandwidth = INITIAL_BANDWIDTH;
+}
+
+void DriftEstimator::update(uint64_t frame, double time)
+{
+    if (!_valid) {
+        _valid = true;
+        _frame = frame;
+        _time = time;
+        _period = 1.0 / _nominalRate;
+        return;
+    }
+
+    if (frame <= _frame) {
+        return;
+    }
+
+    auto delta = (double)(frame - _frame);
+    auto predicted = _time + delta * _period;
+    auto error = time - predicted;
+
+    // a gap of more than a second means the stream restarted; relock.
+    if (std::fabs(error) > 1.0) {
+        reset();
+        update(frame, time);
+        return;
+    }
+
+    auto omega = 2 * PI * _bandwidth * delta * _period;
+
+    _time = predicted + sqrt(2.0) * omega * error;
+    _period += omega * omega * error / delta;
+    _period = std::min(std::max(_period,
+        0.99 / _nominalRate), 1.01 / _nominalRate);
+    _frame = frame;
+    _bandwidth = std::max(_targetBandwidth, _bandwidth * 0.999);
+}
+
+Resampler::Resampler(int channelCount):
+    _channelCount(channelCount),
+    _table((PHASES + 1) * TAPS),
+    _history(channelCount)
+{
+    // row p holds the taps for an output that lands p / PHASES of the way
+    // between input frames TAPS / 2 - 1 and TAPS / 2.
+    for (int p = 0; p <= PHASES; ++p) {
+        auto row = &_table[p * TAPS];
+        double sum = 0;
+
+        for (int k = 0; k < TAPS; ++k) {
+            double t = k - TAPS / 2 + 1 - (double)p / PHASES;
+            double x = PI * CUTOFF * t;
+            double sinc = t == 0 ? 1.0 : sin(x) / x;
+            double w = (t + TAPS / 2) / TAPS;
+            double window = 0.42 - 0.5 * cos(2 * PI * w) +
+                0.08 * cos(4 * PI * w);
+
+            row[k] = (float)(sinc * window);
+            sum += row[k];
+        }
+
+        for (int k = 0; k < TAPS; ++k) {
+            row[k] = (float)(row[k] / sum);
+        }
+    }
+
+    reset();
+}
+
+void Resampler::reset()
+{
+    for (auto& history : _history) {
+        history.assign(TAPS - 1, 0.0f);
+    }
+
+    _position = TAPS / 2 - 1;
+}
+
+void Resampler::push(const float *const *input, int frames)
+{
+    for (int i = 0; i < _channelCount; ++i) {
+        _history[i].insert(
+            _history[i].end(), input[i], input[i] + frames);
+    }
+}
+
+bool Resampler::canPull(int frames) const
+{
+    if (frames <= 0) {
+        return true;
+    }
+
+    auto last = (size_t)(_position + (frames - 1) * _ratio) + TAPS / 2;
+
+    return last < _history[0].size();
+}
+
+static inline float convolve(
+    const float *x, const float *c0, const float *c1, float frac)
+{
+#ifdef SAR_RESAMPLER_SSE
+    auto f = _mm_set1_ps(frac);
+    auto acc = _mm_setzero_ps();
+
+    for (int k = 0; k < TAPS; k += 4) {
+        auto a = _mm_loadu_ps(c0 + k);
+        auto b = _mm_loadu_ps(c1 + k);
+        auto c = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), f));
+
+        acc = _mm_add_ps(acc, _mm_mul_ps(c, _mm_loadu_ps(x + k)));
+    }
+
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#else
+    float acc = 0;
+
+    for (int k = 0; k < TAPS; ++k) {
+        acc += (c0[k] + (c1[k] - c0[k]) * frac) * x[k];
+    }
+
+    return acc;
+#endif
+}
+
+void Resampler::pull(float **output, int frames)
+{
+    for (int j = 0; j < frames; ++j) {
+        auto index = (size_t)_position;
+        auto phase = (_position - index) * PHASES;
+        auto p = (int)phase;
+        auto frac = (float)(phase - p);
+        auto c0 = &_table[p * TAPS];
+        auto c1 = c0 + TAPS;
+        auto start = index - (TAPS / 2 - 1);
+
+        for (int i = 0; i < _channelCount; ++i) {
+            output[i][j] = convolve(&_history[i][start], c0, c1, frac);
+        }
+
+        _position += _ratio;
+    }
+
+    // drop consumed input once enough has built up to be worth the move.
+    auto consumed = (size_t)_position - (TAPS / 2 - 1);
+
+    if (consumed >= 4096) {
+        for (auto& history : _history) {
+            history.erase(history.begin(), history.begin() + consumed);
+        }
+
+        _position -= consumed;
+    }
+}
+
+double Resampler::buffered() const
+{
+    return _history[0].size() - TAPS / 2 - _position;
+}
+
+void SamplesToFloat(const void *src, float *dst, size_t count, int sampleSize)
+{
+    auto p = (const uint8_t *)src;
+
+    switch (sampleSize) {
+        case 2:
+            for (size_t i = 0; i < count; ++i) {
+                dst[i] = ((const int16_t *)p)[i] * (1.0f / 32768.0f);
+            }
+
+            break;
+        case 3:
+            for (size_t i = 0; i < count; ++i, p += 3) {
+                auto value = (int32_t)(
+                    ((uint32_t)p[0] << 8) |
+                    ((uint32_t)p[1] << 16) |
+                    ((uint32_t)p[2] << 24)) >> 8;
+
+                dst[i] = value * (1.0f / 8388608.0f);
+            }
+
+            break;
+        case 4:
+            for (size_t i = 0; i < count; ++i) {
+                dst[i] = (float)(((const int32_t *)p)[i] *
+                    (1.0 / 2147483648.0));
+            }
+
+            break;
+    }
+}
+
+void FloatToSamples(const float *src, void *dst, size_t count, int sampleSize)
+{
+    auto p = (uint8_t *)dst;
+
+    switch (sampleSize) {
+        case 2:
+            for (size_t i = 0; i < count; ++i) {
+                auto value = std::min(std::max(src[i], -1.0f), 1.0f);
+
+                ((int16_t *)p)[i] = (int16_t)std::min(
+                    lrintf(value * 32768.0f), 32767L);
+            }
+
+            break;
+        case 3:
+            for (size_t i = 0; i < count; ++i, p += 3) {
+                auto value = std::min(std::max(src[i], -1.0f), 1.0f);
+                auto sample = std::min(lrintf(value * 8388608.0f), 8388607L);
+
+                p[0] = (uint8_t)sample;
+                p[1] = (uint8_t)(sample >> 8);
+                p[2] = (uint8_t)(sample >> 16);
+            }
+
+            break;
+        case 4:
+            for (size_t i = 0; i < count; ++i) {
+                double value = std::min(std::max(src[i], -1.0f), 1.0f);
+
+                ((int32_t *)p)[i] = (int32_t)std::min(
+                    llrint(value * 2147483648.0), 2147483647LL);
+            }
+
+            break;
+    }
+}
+
+} // namespace Sar
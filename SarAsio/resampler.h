@@ -0,0 +1,79 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_RESAMPLER_H
+#define _SAR_ASIO_RESAMPLER_H
+
+namespace Sar {
+
+// Second order delay-locked loop that filters (frame, time) observations of
+// a sample clock into a smooth estimate of its rate. Starts with a wide
+// bandwidth so it locks quickly and narrows towards the configured bandwidth.
+struct DriftEstimator
+{
+    DriftEstimator(double nominalRate, double bandwidth = 0.05);
+    void reset();
+    // time is in seconds on the local monotonic clock.
+    void update(uint64_t frame, double time);
+    bool valid() const { return _valid; }
+    // Estimated frames per local second.
+    double rate() const { return _valid ? 1.0 / _period : _nominalRate; }
+    // Fractional frame the clock is estimated to reach at time.
+    double frameAt(double time) const
+    {
+        return _frame + (time - _time) / _period;
+    }
+
+private:
+    double _nominalRate;
+    double _targetBandwidth;
+    double _bandwidth;
+    bool _valid = false;
+    uint64_t _frame = 0;
+    double _time = 0;
+    double _period = 0;
+};
+
+// Band-limited variable ratio resampler for planar float audio. Uses a
+// windowed sinc table with linear interpolation between phases, so the
+// ratio can change on every call without glitching.
+struct Resampler
+{
+    Resampler(int channelCount);
+    void reset();
+    // Input frames consumed per output frame, i.e. source rate / sink rate.
+    void setRatio(double ratio) { _ratio = ratio; }
+    double ratio() const { return _ratio; }
+    void push(const float *const *input, int frames);
+    bool canPull(int frames) const;
+    void pull(float **output, int frames);
+    // Input frames queued but not yet consumed.
+    double buffered() const;
+
+private:
+    int _channelCount;
+    double _ratio = 1.0;
+    double _position;
+    std::vector<float> _table;
+    std::vector<std::vector<float>> _history;
+};
+
+void SamplesToFloat(const void *src, float *dst, size_t count, int sampleSize);
+void FloatToSamples(const float *src, void *dst, size_t count, int sampleSize);
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_RESAMPLER_H
@@ -0,0 +1,89 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "stdafx.h"
+#include "routingcache.h"
+
+namespace Sar {
+
+bool ApplicationMatchCache::find(const std::wstring& signature, int *index)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    if (!_valid || _signature != signature) {
+        return false;
+    }
+
+    *index = _index;
+    return true;
+}
+
+void ApplicationMatchCache::store(const std::wstring& signature, int index)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _valid = true;
+    _signature = signature;
+    _index = index;
+}
+
+bool EndpointIndex::valid(uint64_t *generation)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    *generation = _generation;
+    return _valid;
+}
+
+void EndpointIndex::rebuild(
+    uint64_t generation, std::vector<EndpointIndexEntry> entries)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _entries.clear();
+
+    for (auto& entry : entries) {
+        // SAR endpoint ids are unique, but keep the first like a linear
+        // search over the devices would.
+        _entries.emplace(entry.endpointId, std::move(entry));
+    }
+
+    _valid = generation == _generation;
+}
+
+void EndpointIndex::invalidate()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    _generation++;
+    _valid = false;
+}
+
+bool EndpointIndex::find(
+    const std::string& endpointId, int dataFlow, std::wstring *deviceId)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto it = _entries.find(endpointId);
+
+    if (it == _entries.end() || it->second.dataFlow != dataFlow) {
+        return false;
+    }
+
+    *deviceId = it->second.deviceId;
+    return true;
+}
+
+} // namespace Sar
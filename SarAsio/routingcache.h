@@ -0,0 +1,71 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_ROUTINGCACHE_H
+#define _SAR_ASIO_ROUTINGCACHE_H
+
+namespace Sar {
+
+// Remembers which application config matched this process. The process
+// image never changes, so matching only has to run again when a config
+// with a different application list is loaded.
+struct ApplicationMatchCache
+{
+    // signature identifies the application list, e.g. its patterns in
+    // order. index is -1 if no application matched.
+    bool find(const std::wstring& signature, int *index);
+    void store(const std::wstring& signature, int index);
+
+private:
+    std::mutex _lock;
+    bool _valid = false;
+    std::wstring _signature;
+    int _index = -1;
+};
+
+struct EndpointIndexEntry
+{
+    std::string endpointId;
+    std::wstring deviceId;
+    int dataFlow;
+};
+
+// Maps SAR endpoint ids to the ids of the audio devices that expose them.
+// Building it means opening every device's property store, so it's kept
+// until a device notification invalidates it.
+struct EndpointIndex
+{
+    // Returns true if the index is current. Otherwise generation is set to
+    // pass to rebuild.
+    bool valid(uint64_t *generation);
+    // Installs a freshly enumerated index. If it was invalidated again
+    // while the caller enumerated, the entries are still used but the
+    // index stays invalid so the next lookup rebuilds it.
+    void rebuild(uint64_t generation, std::vector<EndpointIndexEntry> entries);
+    void invalidate();
+    bool find(
+        const std::string& endpointId, int dataFlow, std::wstring *deviceId);
+
+private:
+    std::mutex _lock;
+    uint64_t _generation = 0;
+    bool _valid = false;
+    std::unordered_map<std::string, EndpointIndexEntry> _entries;
+};
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_ROUTINGCACHE_H
@@ -29,6 +29,7 @@ SarClient::SarClient(
       _handleQueueStarted(false)
 {
     ZeroMemory(&_handleQueueCompletion, sizeof(HandleQueueCompletion));
+    initLoopbacks();
 }
 
 void SarClient::tick(long bufferIndex)
@@ -44,10 +45,25 @@ void SarClient::tick(long bufferIndex)
         return;
 
     if (_updateSampleRateOnTick.exchange(false)) {
+        std::vector<DWORD> endpoints;
         DWORD dummy;
 
-        DeviceIoControl(_device, SAR_SEND_FORMAT_CHANGE_EVENT,
-            nullptr, 0, nullptr, 0, &dummy, nullptr);
+        {
+            std::lock_guard<std::mutex> lock(_formatChangeLock);
+            endpoints.swap(_formatChangedEndpoints);
+        }
+
+        // only the filters of the endpoints that changed are notified.
+        for (size_t i = 0; i < endpoints.size();
+             i += SAR_MAX_FORMAT_CHANGE_ENDPOINTS) {
+
+            size_t count = min(endpoints.size() - i,
+                (size_t)SAR_MAX_FORMAT_CHANGE_ENDPOINTS);
+
+            DeviceIoControl(_device, SAR_SEND_FORMAT_CHANGE_EVENT,
+                &endpoints[i], (DWORD)(count * sizeof(DWORD)),
+                nullptr, 0, &dummy, nullptr);
+        }
     }
 
     // for each endpoint
@@ -60,7 +76,7 @@ void SarClient::tick(long bufferIndex)
     // read isActive, generation
     //   if conflicted, skip endpoint and fill asio frames with 0
     // else increment position register
-    for (size_t i = 0; i < _driverConfig.endpoints.size(); ++i) {
+    for (auto i : _tickOrder) {
         auto& endpoint = _driverConfig.endpoints[i];
         auto& asioBuffers = _bufferConfig.asioBuffers[bufferIndex][i];
         auto asioBufferSize = (DWORD)(
@@ -115,8 +131,8 @@ void SarClient::tick(long bufferIndex)
             mux(
                 endpointDataFirst, firstSize,
                 endpointDataSecond, secondSize,
-                asioBuffers.data(), ntargets, activeChannelCount,
-                asioBufferSize, _bufferConfig.sampleSize);
+                _muxSources[bufferIndex][i].data(), ntargets,
+                activeChannelCount, asioBufferSize, _bufferConfig.sampleSize);
         }
 
         auto lateGeneration = _registers[i].generation;
@@ -180,6 +196,67 @@ void SarClient::tick(long bufferIndex)
     }
 }
 
+void SarClient::initLoopbacks()
+{
+    auto& endpoints = _driverConfig.endpoints;
+    auto bufferSize =
+        (size_t)_bufferConfig.periodFrameSize * _bufferConfig.sampleSize;
+
+    // playback endpoints are demuxed before any recording endpoint is muxed,
+    // so a looped back period reaches its target in the same tick.
+    for (size_t i = 0; i < endpoints.size(); ++i) {
+        if (endpoints[i].type == EndpointType::Playback) {
+            _tickOrder.push_back(i);
+        }
+    }
+
+    for (size_t i = 0; i < endpoints.size(); ++i) {
+        if (endpoints[i].type == EndpointType::Recording) {
+            _tickOrder.push_back(i);
+        }
+    }
+
+    _muxSources = _bufferConfig.asioBuffers;
+
+    if (_bufferConfig.asioBuffers[0].size() != endpoints.size()) {
+        return;
+    }
+
+    for (auto& loopback : _driverConfig.loopbacks) {
+        auto source = _driverConfig.findEndpoint(loopback.source);
+        auto target = _driverConfig.findEndpoint(loopback.target);
+
+        if (!source || source->type != EndpointType::Playback ||
+            !target || target->type != EndpointType::Recording) {
+
+            LOG(WARNING) << "Ignoring loopback from " << loopback.source
+                << " to " << loopback.target << ": loopbacks must go from a "
+                << "playback endpoint to a recording endpoint.";
+            continue;
+        }
+
+        auto sourceIndex = source - endpoints.data();
+        auto targetIndex = target - endpoints.data();
+        auto channelCount = min(source->channelCount, target->channelCount);
+
+        // the target muxes from the source's period buffers, which the host
+        // may not have asked for; those are backed by our own.
+        for (int channel = 0; channel < channelCount; ++channel) {
+            for (size_t swapIndex = 0; swapIndex < 2; ++swapIndex) {
+                auto& sourceBuffer =
+                    _bufferConfig.asioBuffers[swapIndex][sourceIndex][channel];
+
+                if (!sourceBuffer) {
+                    _loopbackBuffers.emplace_back(bufferSize);
+                    sourceBuffer = _loopbackBuffers.back().data();
+                }
+
+                _muxSources[swapIndex][targetIndex][channel] = sourceBuffer;
+            }
+        }
+    }
+}
+
 bool SarClient::start()
 {
     if (!openControlDevice()) {
@@ -375,6 +452,27 @@ bool SarClient::setBufferLayout()
     return true;
 }
 
+void SarClient::updateSampleRateOnTick(const std::string& endpointId)
+{
+    std::lock_guard<std::mutex> lock(_formatChangeLock);
+
+    for (size_t i = 0; i < _driverConfig.endpoints.size(); ++i) {
+        if (_driverConfig.endpoints[i].id != endpointId) {
+            continue;
+        }
+
+        if (std::find(_formatChangedEndpoints.begin(),
+            _formatChangedEndpoints.end(), (DWORD)i) ==
+            _formatChangedEndpoints.end()) {
+
+            _formatChangedEndpoints.push_back((DWORD)i);
+        }
+
+        _updateSampleRateOnTick = true;
+        break;
+    }
+}
+
 bool SarClient::createEndpoints()
 {
     int i = 0;
@@ -606,7 +704,10 @@ HRESULT STDMETHODCALLTYPE SarClient::NotificationClient::OnDeviceStateChanged(
                 break;
             }
 
-            client->updateSampleRateOnTick();
+            if (pvalue.vt == VT_LPWSTR) {
+                client->updateSampleRateOnTick(TCHARToUTF8(pvalue.pwszVal));
+            }
+
             PropVariantClear(&pvalue);
         } while(false);
 
@@ -39,10 +39,7 @@ struct SarClient: public std::enable_shared_from_this<SarClient>
     void tick(long bufferIndex);
     bool start();
     void stop();
-    void updateSampleRateOnTick()
-    {
-        _updateSampleRateOnTick = true;
-    }
+    void updateSampleRateOnTick(const std::string& endpointId);
 
 private:
     struct NotificationHandle
@@ -103,6 +100,7 @@ private:
     bool setBufferLayout();
     bool createEndpoints();
     bool enableRegistryFilter();
+    void initLoopbacks();
     void updateNotificationHandles();
     void processNotificationHandleUpdates(int updateCount);
 
@@ -119,6 +117,9 @@ private:
 
     DriverConfig _driverConfig;
     BufferConfig _bufferConfig;
+    std::vector<size_t> _tickOrder;
+    std::array<std::vector<std::vector<void *>>, 2> _muxSources;
+    std::vector<std::vector<uint8_t>> _loopbackBuffers;
     std::vector<NotificationHandle> _notificationHandles;
     HANDLE _device;
     HANDLE _completionPort;
@@ -131,6 +132,8 @@ private:
     CComObject<NotificationClient> *_mmNotificationClient = nullptr;
     bool _mmNotificationClientRegistered = false;
     std::atomic<bool> _updateSampleRateOnTick = false;
+    std::mutex _formatChangeLock;
+    std::vector<DWORD> _formatChangedEndpoints;
     std::mutex _registersLock;
 };
 
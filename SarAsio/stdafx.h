@@ -18,6 +18,8 @@
 
 #include "targetver.h"
 
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 #include <CommCtrl.h>
 #include <prsht.h>
@@ -36,6 +38,7 @@
 #include <atlcom.h>
 #include <atlstr.h>
 
+#include <algorithm>
 #include <atomic>
 #include <codecvt>
 #include <cstddef>
@@ -49,6 +52,7 @@
 #include <unordered_map>
 #include <array>
 #include <mutex>
+#include <thread>
 
 #include "resource.h"
 
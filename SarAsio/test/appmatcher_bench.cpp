@@ -0,0 +1,164 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Times ApplicationMatcher against one compiled regex per rule, which is
+// how application rules were matched before, with 1000 rules: startup cost
+// and per-lookup cost for literal hits, regex hits and misses. Fails if
+// the two ever disagree about which rule matches first.
+
+#include "stdafx.h"
+#include "appmatcher.h"
+
+#include <chrono>
+#include <cstdio>
+
+using namespace Sar;
+
+static const int RULE_COUNT = 1000;
+// one rule in this many is a regex; the rest are literal paths.
+static const int REGEX_EVERY = 10;
+static const int BASELINE_LOOKUPS = 50;
+static const int MATCHER_LOOKUPS = 20000;
+static const int STARTUPS = 5;
+
+// The old per-rule matcher: literal paths escaped into anchored regexes.
+struct RegexListMatcher
+{
+    explicit RegexListMatcher(const std::vector<ApplicationRule>& rules)
+    {
+        static const std::wregex escape(L"[.^$|()\\[\\]{}*+?\\\\]");
+
+        for (auto& rule : rules) {
+            auto pattern = rule.regexMatch ? rule.path :
+                L"^" + std::regex_replace(rule.path, escape, L"\\\\&",
+                    std::regex_constants::match_default |
+                    std::regex_constants::format_sed) + L"$";
+
+            _regexes.emplace_back(pattern,
+                std::regex_constants::ECMAScript |
+                std::regex_constants::icase);
+        }
+    }
+
+    int match(const std::wstring& path) const
+    {
+        for (size_t i = 0; i < _regexes.size(); ++i) {
+            if (std::regex_search(path, _regexes[i])) {
+                return (int)i;
+            }
+        }
+
+        return -1;
+    }
+
+private:
+    std::vector<std::wregex> _regexes;
+};
+
+struct Lookup
+{
+    const char *name;
+    std::wstring path;
+};
+
+static std::vector<ApplicationRule> makeRules()
+{
+    std::vector<ApplicationRule> rules;
+
+    for (int i = 0; i < RULE_COUNT; ++i) {
+        ApplicationRule rule;
+        auto n = std::to_wstring(i);
+
+        if (i % REGEX_EVERY == REGEX_EVERY - 1) {
+            rule.path = L"\\\\Vendor" + n + L"\\\\[^\\\\]+\\.exe$";
+            rule.regexMatch = true;
+        } else {
+            rule.path = L"C:\\Program Files\\App" + n + L"\\App" + n + L".exe";
+        }
+
+        rules.push_back(rule);
+    }
+
+    // a literal and an earlier regex that both match; the regex wins.
+    rules[5].path = L"\\\\Shared\\\\player\\.exe$";
+    rules[5].regexMatch = true;
+    rules[500].path = L"C:\\Tools\\Shared\\player.exe";
+    return rules;
+}
+
+template<typename F>
+static double timeNs(int iterations, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main()
+{
+    auto rules = makeRules();
+    std::unique_ptr<RegexListMatcher> baseline;
+    std::unique_ptr<ApplicationMatcher> matcher;
+    int failures = 0;
+
+    auto baselineStartNs = timeNs(STARTUPS, [&]() {
+        baseline.reset(new RegexListMatcher(rules));
+    });
+    auto matcherStartNs = timeNs(STARTUPS, [&]() {
+        matcher.reset(new ApplicationMatcher(rules));
+    });
+
+    printf("%d rules, startup: regex list %.2fms, matcher %.2fms\n",
+        RULE_COUNT, baselineStartNs / 1e6, matcherStartNs / 1e6);
+
+    Lookup lookups[] = {
+        { "first literal", L"C:\\Program Files\\App0\\App0.exe" },
+        { "last literal", L"c:\\program files\\app998\\APP998.EXE" },
+        { "last regex", L"D:\\Vendor999\\run.exe" },
+        { "priority", L"C:\\Tools\\Shared\\player.exe" },
+        { "miss", L"C:\\Windows\\System32\\svchost.exe" },
+    };
+
+    printf("%-14s %6s %14s %12s\n",
+        "lookup", "rule", "regex list ns", "matcher ns");
+
+    for (auto& lookup : lookups) {
+        int expected = baseline->match(lookup.path);
+        int result = matcher->match(lookup.path);
+        auto baselineNs = timeNs(BASELINE_LOOKUPS, [&]() {
+            baseline->match(lookup.path);
+        });
+        auto matcherNs = timeNs(MATCHER_LOOKUPS, [&]() {
+            matcher->match(lookup.path);
+        });
+
+        printf("%-14s %6d %14.0f %12.0f\n",
+            lookup.name, result, baselineNs, matcherNs);
+
+        if (result != expected) {
+            printf("  FAIL: matcher picked rule %d, the regex list %d\n",
+                result, expected);
+            failures++;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Runs ClockSync's two-way exchanges over simulated links with different
+// delays and queueing jitter each way, against a master clock with a fixed
+// offset and frequency error. Fails if configuring the asymmetry doesn't
+// remove the offset error it otherwise causes.
+
+#include "stdafx.h"
+#include "clocksync.h"
+#include "netsim.h"
+
+#include <cmath>
+#include <cstdio>
+
+using namespace Sar;
+
+// all times in microseconds.
+static const int64_t SYNC_INTERVAL = 250000;
+static const int64_t DURATION = 600000000;
+// error is only measured once the loop has had time to settle.
+static const int64_t SETTLE_TIME = 120000000;
+static const int64_t TURNAROUND = 20;
+static const int64_t MASTER_OFFSET = 12345678;
+static const double MASTER_PPM = 80;
+
+struct SyncPacket
+{
+    int64_t t1;
+    int64_t t2;
+    int64_t t3;
+};
+
+struct Result
+{
+    double meanError = 0;
+    double maxError = 0;
+};
+
+static int64_t masterTime(int64_t localTime)
+{
+    return localTime + MASTER_OFFSET +
+        (int64_t)std::llround(localTime * MASTER_PPM * 1e-6);
+}
+
+static Result run(
+    const NetSimulatorConfig& toMaster, const NetSimulatorConfig& toSlave,
+    int64_t asymmetry)
+{
+    NetSimulator<SyncPacket> uplink(toMaster, 1);
+    NetSimulator<SyncPacket> downlink(toSlave, 2);
+    ClockSync sync;
+    double totalError = 0;
+    uint64_t measured = 0;
+    Result result;
+
+    sync.setAsymmetry(asymmetry);
+
+    for (int64_t now = 0; now < DURATION; now += SYNC_INTERVAL) {
+        uplink.send(now, { now, 0, 0 });
+
+        // deliver well inside the interval; the largest simulated delay
+        // plus its jitter stays far below it.
+        uplink.deliver(now + SYNC_INTERVAL / 2,
+            [&](const SyncPacket& packet, int64_t arrival) {
+                auto reply = packet;
+
+                reply.t2 = masterTime(arrival);
+                reply.t3 = masterTime(arrival + TURNAROUND);
+                downlink.send(arrival + TURNAROUND, reply);
+            });
+        downlink.deliver(now + SYNC_INTERVAL - 1,
+            [&](const SyncPacket& packet, int64_t arrival) {
+                sync.update(packet.t1, packet.t2, packet.t3, arrival);
+            });
+
+        auto check = now + SYNC_INTERVAL - 1;
+
+        if (check < SETTLE_TIME || !sync.valid()) {
+            continue;
+        }
+
+        auto error = (double)std::llabs(
+            sync.toMaster(check) - masterTime(check));
+
+        totalError += error;
+        result.maxError = std::max(result.maxError, error);
+        measured++;
+    }
+
+    if (measured) {
+        result.meanError = totalError / measured;
+    }
+
+    return result;
+}
+
+int main()
+{
+    struct Scenario
+    {
+        const char *name;
+        // delay and jitter only; exchanges are never lost here.
+        NetSimulatorConfig toMaster;
+        NetSimulatorConfig toSlave;
+    };
+
+    // the uplink case is a Wi-Fi slave with a slow, congested uplink.
+    Scenario scenarios[] = {
+        { "symmetric", { 1000, 200 }, { 1000, 200 } },
+        { "uplink+800", { 1800, 400 }, { 1000, 200 } },
+        { "downlink+600", { 500, 100 }, { 1100, 300 } },
+    };
+    int failures = 0;
+
+    printf("%-13s %10s %10s %10s\n",
+        "network", "asymmetry", "mean err", "max err");
+
+    for (auto& scenario : scenarios) {
+        auto asymmetry = (int64_t)(
+            scenario.toSlave.delay - scenario.toMaster.delay);
+        auto unconfigured = run(scenario.toMaster, scenario.toSlave, 0);
+        auto configured = run(
+            scenario.toMaster, scenario.toSlave, asymmetry);
+
+        printf("%-13s %10d %8.1fus %8.1fus\n", scenario.name, 0,
+            unconfigured.meanError, unconfigured.maxError);
+
+        if (asymmetry) {
+            printf("%-13s %10lld %8.1fus %8.1fus\n", scenario.name,
+                (long long)asymmetry, configured.meanError,
+                configured.maxError);
+        }
+
+        // the minimum delay filter should pick exchanges with little
+        // queueing, so what's left is a fraction of the jitter.
+        if (configured.meanError > 100) {
+            printf("  FAIL: %.1fus mean offset error with the asymmetry "
+                "configured\n", configured.meanError);
+            failures++;
+        }
+
+        // unconfigured, half the asymmetry shows up as offset error.
+        if (asymmetry && configured.meanError * 2 > unconfigured.meanError) {
+            printf("  FAIL: configuring %lldus of asymmetry only took the "
+                "error from %.1fus to %.1fus\n", (long long)asymmetry,
+                unconfigured.meanError, configured.meanError);
+            failures++;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
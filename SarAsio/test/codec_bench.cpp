@@ -0,0 +1,148 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Measures CastCodec's compression ratio and speed on tones, noise and a
+// full scale square wave at each sample size, and checks every period
+// decodes back to exactly what went in.
+
+#include "stdafx.h"
+#include "castcodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+using namespace Sar;
+
+static const int PERIOD_FRAMES = 256;
+static const int PERIODS = 2000;
+static const double SAMPLE_RATE = 48000;
+static const double PI = 3.14159265358979323846;
+
+enum class Signal
+{
+    Tones,
+    Noise,
+    Square,
+};
+
+static const char *signalName(Signal signal)
+{
+    switch (signal) {
+        case Signal::Tones:
+            return "tones";
+        case Signal::Noise:
+            return "noise";
+        default:
+            return "square";
+    }
+}
+
+static int32_t sampleAt(
+    Signal signal, uint64_t frame, int sampleSize, std::mt19937& rng)
+{
+    std::normal_distribution<double> normal(0, 1);
+    double scale = std::ldexp(1.0, sampleSize * 8 - 1) - 1;
+    double value;
+
+    switch (signal) {
+        case Signal::Tones:
+            value = 0.5 * sin(2 * PI * 440 * frame / SAMPLE_RATE) +
+                0.3 * sin(2 * PI * 1375 * frame / SAMPLE_RATE) +
+                1e-4 * normal(rng);
+            break;
+        case Signal::Noise:
+            value = 0.3 * normal(rng);
+            break;
+        default:
+            // hits both extremes of the sample range.
+            return frame % 64 < 32 ? (int32_t)scale : -(int32_t)scale - 1;
+    }
+
+    return (int32_t)std::lrint(std::max(-1.0, std::min(1.0, value)) * scale);
+}
+
+static bool run(int sampleSize, Signal signal)
+{
+    CastCodec codec(PERIOD_FRAMES, sampleSize);
+    std::mt19937 rng(3);
+    std::vector<uint8_t> input(PERIOD_FRAMES * sampleSize);
+    std::vector<uint8_t> encoded(input.size());
+    std::vector<uint8_t> decoded(input.size());
+    size_t rawBytes = 0, encodedBytes = 0;
+    double encodeNs = 0, decodeNs = 0;
+    uint64_t frame = 0;
+
+    for (int period = 0; period < PERIODS; ++period) {
+        for (int i = 0; i < PERIOD_FRAMES; ++i, ++frame) {
+            auto sample = sampleAt(signal, frame, sampleSize, rng);
+
+            for (int byte = 0; byte < sampleSize; ++byte) {
+                input[i * sampleSize + byte] = (uint8_t)(sample >> (8 * byte));
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto size = codec.encode(input.data(), encoded.data(), encoded.size());
+
+        encodeNs += std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+        rawBytes += input.size();
+        encodedBytes += size ? size : input.size();
+
+        if (!size) {
+            continue;
+        }
+
+        start = std::chrono::steady_clock::now();
+
+        bool ok = codec.decode(encoded.data(), size, decoded.data());
+
+        decodeNs += std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+
+        if (!ok || memcmp(input.data(), decoded.data(), input.size())) {
+            printf("FAIL: %d byte %s period %d didn't round trip\n",
+                sampleSize, signalName(signal), period);
+            return false;
+        }
+    }
+
+    printf("%5d %-7s %6.3f %8.2f %8.2f\n",
+        sampleSize, signalName(signal), (double)encodedBytes / rawBytes,
+        encodeNs / (PERIODS * PERIOD_FRAMES),
+        decodeNs / (PERIODS * PERIOD_FRAMES));
+    return true;
+}
+
+int main()
+{
+    bool ok = true;
+
+    printf("%5s %-7s %6s %8s %8s\n",
+        "bytes", "signal", "ratio", "enc ns", "dec ns");
+
+    for (int sampleSize : { 2, 3, 4 }) {
+        for (auto signal : { Signal::Tones, Signal::Noise, Signal::Square }) {
+            ok &= run(sampleSize, signal);
+        }
+    }
+
+    return ok ? 0 : 1;
+}
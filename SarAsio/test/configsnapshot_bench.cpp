@@ -0,0 +1,324 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Checks that every DriverConfig field survives a snapshot round trip and
+// that damaged, truncated or stale snapshots are rejected, then times
+// decoding a large config's snapshot against parsing the same config as
+// JSON. The JSON side only parses, without DriverConfig::load's field
+// conversions, so it understates what the snapshot saves.
+
+#include "stdafx.h"
+#include "configsnapshot.h"
+
+#include <chrono>
+#include <cstdio>
+
+using namespace Sar;
+
+static const int ENDPOINT_COUNT = 64;
+static const int APPLICATION_COUNT = 1000;
+static const int LOOPBACK_COUNT = 8;
+static const int LOADS = 50;
+
+static DriverConfig makeConfig(int endpoints, int applications)
+{
+    DriverConfig config;
+
+    config.driverClsid = "{8ED83C2E-6F8E-4A3A-8B4C-5D6E7F809112}";
+    config.waveRtMinimumFrames = 96;
+    config.enableApplicationRouting = true;
+    config.largePageBuffers = true;
+
+    for (int i = 0; i < endpoints; ++i) {
+        EndpointConfig endpoint;
+
+        endpoint.id = "endpoint_" + std::to_string(i);
+        endpoint.description = L"Endpoint \u00e9 " + std::to_wstring(i);
+        endpoint.type = i % 2 ?
+            EndpointType::Recording : EndpointType::Playback;
+        endpoint.channelCount = 2 + i % 7;
+        endpoint.attachPhysical = i % 3 == 0;
+        endpoint.physicalChannelBase = i;
+        config.endpoints.push_back(endpoint);
+    }
+
+    for (int i = 0; i < applications; ++i) {
+        ApplicationConfig application;
+        DefaultEndpointConfig defaultEndpoint;
+
+        application.description = L"Application " + std::to_wstring(i);
+        application.path = L"C:\\Program Files\\App" + std::to_wstring(i) +
+            L"\\app.exe";
+        application.regexMatch = i % 10 == 0;
+        defaultEndpoint.type = eCapture;
+        defaultEndpoint.role = eCommunications;
+        defaultEndpoint.id = "endpoint_" + std::to_string(i % endpoints);
+        application.defaults.push_back(defaultEndpoint);
+        defaultEndpoint.type = eRender;
+        defaultEndpoint.role = eConsole;
+        application.defaults.push_back(defaultEndpoint);
+        config.applications.push_back(application);
+    }
+
+    for (int i = 0; i < LOOPBACK_COUNT && i + 1 < endpoints; i += 2) {
+        LoopbackConfig loopback;
+
+        loopback.source = config.endpoints[i].id;
+        loopback.target = config.endpoints[i + 1].id;
+        config.loopbacks.push_back(loopback);
+    }
+
+    config.cast.mode = CastMode::Slave;
+    config.cast.endpointId = "endpoint_1";
+    config.cast.address = "239.255.7.7";
+    config.cast.port = 17001;
+    config.cast.interfaceAddress = "192.168.1.20";
+    config.cast.session = 0x123456789abcdefULL;
+    config.cast.fecGroupSize = 4;
+    config.cast.compression = true;
+    config.cast.playoutLatency = 12000;
+    config.cast.clockAsymmetry = -800;
+    config.cast.waitMode = WAIT_ADAPTIVE;
+    return config;
+}
+
+static bool sameConfig(const DriverConfig& a, const DriverConfig& b)
+{
+    if (a.driverClsid != b.driverClsid ||
+        a.waveRtMinimumFrames != b.waveRtMinimumFrames ||
+        a.enableApplicationRouting != b.enableApplicationRouting ||
+        a.largePageBuffers != b.largePageBuffers ||
+        a.endpoints.size() != b.endpoints.size() ||
+        a.applications.size() != b.applications.size() ||
+        a.loopbacks.size() != b.loopbacks.size()) {
+
+        return false;
+    }
+
+    for (size_t i = 0; i < a.endpoints.size(); ++i) {
+        auto& x = a.endpoints[i];
+        auto& y = b.endpoints[i];
+
+        if (x.id != y.id || x.description != y.description ||
+            x.type != y.type || x.channelCount != y.channelCount ||
+            x.attachPhysical != y.attachPhysical ||
+            x.physicalChannelBase != y.physicalChannelBase) {
+
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < a.applications.size(); ++i) {
+        auto& x = a.applications[i];
+        auto& y = b.applications[i];
+
+        if (x.description != y.description || x.path != y.path ||
+            x.regexMatch != y.regexMatch ||
+            x.defaults.size() != y.defaults.size()) {
+
+            return false;
+        }
+
+        for (size_t j = 0; j < x.defaults.size(); ++j) {
+            if (x.defaults[j].type != y.defaults[j].type ||
+                x.defaults[j].role != y.defaults[j].role ||
+                x.defaults[j].id != y.defaults[j].id) {
+
+                return false;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < a.loopbacks.size(); ++i) {
+        if (a.loopbacks[i].source != b.loopbacks[i].source ||
+            a.loopbacks[i].target != b.loopbacks[i].target) {
+
+            return false;
+        }
+    }
+
+    auto& x = a.cast;
+    auto& y = b.cast;
+
+    return x.mode == y.mode && x.endpointId == y.endpointId &&
+        x.address == y.address && x.port == y.port &&
+        x.interfaceAddress == y.interfaceAddress &&
+        x.session == y.session && x.fecGroupSize == y.fecGroupSize &&
+        x.compression == y.compression &&
+        x.playoutLatency == y.playoutLatency &&
+        x.clockAsymmetry == y.clockAsymmetry &&
+        x.waitMode == y.waitMode;
+}
+
+// The same shape DriverConfig::save writes, for timing the JSON parse.
+static std::string makeJson(const DriverConfig& config)
+{
+    picojson::object root;
+    picojson::array endpoints, applications;
+
+    for (auto& endpoint : config.endpoints) {
+        picojson::object obj;
+        auto type = endpoint.type == EndpointType::Playback ?
+            "playback" : "recording";
+
+        obj.insert(std::make_pair("id", picojson::value(endpoint.id)));
+        obj.insert(std::make_pair("description",
+            picojson::value(endpoint.id + " description")));
+        obj.insert(std::make_pair("type", picojson::value(type)));
+        obj.insert(std::make_pair("channelCount",
+            picojson::value(double(endpoint.channelCount))));
+        endpoints.emplace_back(obj);
+    }
+
+    for (auto& application : config.applications) {
+        picojson::object obj;
+        picojson::array defaults;
+        std::string path(application.path.begin(), application.path.end());
+
+        for (auto& defaultEndpoint : application.defaults) {
+            picojson::object entry;
+
+            entry.insert(std::make_pair("id",
+                picojson::value(defaultEndpoint.id)));
+            entry.insert(std::make_pair("role",
+                picojson::value("communications")));
+            entry.insert(std::make_pair("type", picojson::value("capture")));
+            defaults.emplace_back(entry);
+        }
+
+        obj.insert(std::make_pair("description",
+            picojson::value(path + " description")));
+        obj.insert(std::make_pair("path", picojson::value(path)));
+        obj.insert(std::make_pair("regexMatch",
+            picojson::value(application.regexMatch)));
+        obj.insert(std::make_pair("defaults", picojson::value(defaults)));
+        applications.emplace_back(obj);
+    }
+
+    root.insert(std::make_pair("driverClsid",
+        picojson::value(config.driverClsid)));
+    root.insert(std::make_pair("endpoints", picojson::value(endpoints)));
+    root.insert(std::make_pair("applications",
+        picojson::value(applications)));
+    return picojson::value(root).serialize(true);
+}
+
+template<typename F>
+static double timeNs(int iterations, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static int check(const char *what, bool ok)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+    }
+
+    return ok ? 0 : 1;
+}
+
+static int checkRoundTrip()
+{
+    ConfigSnapshotSource source;
+    auto config = makeConfig(6, 5);
+    DriverConfig decoded;
+    int failures = 0;
+
+    source.size = 1234;
+    source.writeTime = 131000000000000000ULL;
+
+    auto snapshot = EncodeConfigSnapshot(config, source);
+
+    failures += check("a snapshot decodes",
+        DecodeConfigSnapshot(
+            snapshot.data(), snapshot.size(), source, &decoded));
+    failures += check("every field round trips", sameConfig(config, decoded));
+
+    auto empty = EncodeConfigSnapshot(DriverConfig(), source);
+
+    failures += check("an empty config round trips",
+        DecodeConfigSnapshot(empty.data(), empty.size(), source, &decoded) &&
+        sameConfig(DriverConfig(), decoded));
+
+    auto stale = source;
+
+    stale.writeTime++;
+    failures += check("a snapshot of an older JSON file is rejected",
+        !DecodeConfigSnapshot(
+            snapshot.data(), snapshot.size(), stale, &decoded));
+
+    // every truncation and every flipped payload byte must be caught by
+    // the size check or the hash, and leave the output alone.
+    int accepted = 0;
+    auto damaged = snapshot;
+
+    decoded.driverClsid = "untouched";
+
+    for (size_t size = 0; size < snapshot.size(); ++size) {
+        accepted += DecodeConfigSnapshot(
+            snapshot.data(), size, source, &decoded);
+    }
+
+    for (size_t i = 0; i < damaged.size(); ++i) {
+        damaged[i] ^= 0x40;
+        accepted += DecodeConfigSnapshot(
+            damaged.data(), damaged.size(), source, &decoded);
+        damaged[i] ^= 0x40;
+    }
+
+    failures += check("damaged snapshots are rejected", !accepted);
+    failures += check("rejected snapshots don't write the config",
+        decoded.driverClsid == "untouched");
+    return failures;
+}
+
+int main()
+{
+    int failures = checkRoundTrip();
+    ConfigSnapshotSource source;
+    auto config = makeConfig(ENDPOINT_COUNT, APPLICATION_COUNT);
+    auto json = makeJson(config);
+    auto snapshot = EncodeConfigSnapshot(config, source);
+    DriverConfig decoded;
+    bool ok = true;
+
+    auto jsonNs = timeNs(LOADS, [&]() {
+        picojson::value value;
+        auto error = picojson::parse(value, json);
+
+        ok &= error.empty();
+    });
+    auto snapshotNs = timeNs(LOADS, [&]() {
+        ok &= DecodeConfigSnapshot(
+            snapshot.data(), snapshot.size(), source, &decoded);
+    });
+
+    printf("%d endpoints, %d applications: json %zu bytes parsed in "
+        "%.2fms, snapshot %zu bytes decoded in %.2fms\n",
+        ENDPOINT_COUNT, APPLICATION_COUNT, json.size(), jsonNs / 1e6,
+        snapshot.size(), snapshotNs / 1e6);
+    failures += check("the large config loads both ways",
+        ok && sameConfig(config, decoded));
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Feeds the drift estimators ticks from a master clock ±200 ppm off the
+// local one and checks the ratio they settle on, then runs a sine through
+// the resampler at that ratio and checks its SNR.
+
+#include "stdafx.h"
+#include "resampler.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+using namespace Sar;
+
+static const double SAMPLE_RATE = 48000;
+static const int PERIOD_FRAMES = 128;
+static const int SECONDS = 60;
+static const double MAX_DRIFT_ERROR_PPM = 2.0;
+static const double MIN_SNR_DB = 60.0;
+static const double TONE_HZ = 1000;
+// Input frames the resampler lags its output by.
+static const double RESAMPLER_DELAY = 16;
+static const double PI = 3.14159265358979323846;
+
+static bool checkDrift(double ppm)
+{
+    DriftEstimator master(SAMPLE_RATE), local(SAMPLE_RATE);
+    std::mt19937 rng(2);
+    std::normal_distribution<double> jitter(0, 0.0005);
+    double masterRate = SAMPLE_RATE * (1 + ppm * 1e-6);
+    uint64_t masterFrame = 0, localFrame = 0;
+
+    // Master ticks arrive over the network with 2ms delay plus jitter,
+    // local ones straight from the sound card with a tenth of it.
+    for (int i = 0; i < SECONDS * SAMPLE_RATE / PERIOD_FRAMES; ++i) {
+        master.update(masterFrame,
+            masterFrame / masterRate + 0.002 + std::fabs(jitter(rng)));
+        local.update(localFrame,
+            localFrame / SAMPLE_RATE + std::fabs(jitter(rng)) * 0.1);
+        masterFrame += PERIOD_FRAMES;
+        localFrame += PERIOD_FRAMES;
+    }
+
+    double estimate = (master.rate() / local.rate() - 1) * 1e6;
+    bool ok = std::fabs(estimate - ppm) <= MAX_DRIFT_ERROR_PPM;
+
+    printf("drift %+.0f ppm: estimated %+.2f ppm %s\n",
+        ppm, estimate, ok ? "ok" : "FAIL");
+    return ok;
+}
+
+static bool checkResampler(double ppm)
+{
+    double ratio = 1 + ppm * 1e-6;
+    Resampler resampler(1);
+    std::vector<float> input(PERIOD_FRAMES), output(PERIOD_FRAMES);
+    float *inputPointer = input.data();
+    float *outputPointer = output.data();
+    uint64_t inputFrame = 0, outputFrame = 0;
+    double error = 0, signal = 0;
+
+    resampler.setRatio(ratio);
+
+    for (int i = 0; i < 4000; ++i) {
+        while (!resampler.canPull(PERIOD_FRAMES)) {
+            for (int j = 0; j < PERIOD_FRAMES; ++j, ++inputFrame) {
+                input[j] = (float)(0.5 *
+                    sin(2 * PI * TONE_HZ * inputFrame / SAMPLE_RATE));
+            }
+
+            resampler.push(&inputPointer, PERIOD_FRAMES);
+        }
+
+        resampler.pull(&outputPointer, PERIOD_FRAMES);
+
+        for (int j = 0; j < PERIOD_FRAMES; ++j, ++outputFrame) {
+            double position = outputFrame * ratio - RESAMPLER_DELAY;
+            double expected =
+                0.5 * sin(2 * PI * TONE_HZ * position / SAMPLE_RATE);
+
+            // Skip the filter warming up.
+            if (outputFrame > 1000) {
+                error += (output[j] - expected) * (output[j] - expected);
+                signal += expected * expected;
+            }
+        }
+    }
+
+    double snr = 10 * log10(signal / error);
+    bool ok = snr >= MIN_SNR_DB;
+
+    printf("resampler %+.0f ppm: SNR %.1f dB, %.1f frames buffered %s\n",
+        ppm, snr, resampler.buffered(), ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+
+    for (double ppm : { -200.0, 200.0 }) {
+        ok &= checkDrift(ppm);
+        ok &= checkResampler(ppm);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Measures what FEC parity buys over a lossy network: the glitch rate and
+// bandwidth overhead for each group size, plus the encoder's cost per
+// packet. Fails if parity doesn't cut glitches under random loss.
+
+#include "stdafx.h"
+#include "fec.h"
+#include "jitterbuffer.h"
+#include "netsim.h"
+
+#include <chrono>
+#include <cstdio>
+
+using namespace Sar;
+
+static const int CHANNEL_COUNT = 8;
+static const int PERIOD_FRAMES = 128;
+static const int SAMPLE_RATE = 48000;
+static const int PAYLOAD_SIZE = PERIOD_FRAMES * 4;
+static const int PERIODS = 30000;
+static const int WARMUP_PERIODS = 500;
+
+struct SimPacket
+{
+    bool parity;
+    uint64_t offset;
+    // parity packets cover [channel, channel + count).
+    int channel;
+    int count;
+    std::vector<uint8_t> data;
+};
+
+struct Result
+{
+    int glitches = 0;
+    uint64_t sent = 0;
+    uint64_t lost = 0;
+    // includes channels rebuilt before their own packet arrived late.
+    uint64_t recovered = 0;
+    double encodeNs = 0;
+};
+
+static Result run(int groupSize, const NetSimulatorConfig& config)
+{
+    JitterBuffer buffer(CHANNEL_COUNT, PERIOD_FRAMES, SAMPLE_RATE, 4);
+    FecEncoder encoder(CHANNEL_COUNT, groupSize, PAYLOAD_SIZE);
+    NetSimulator<SimPacket> network(config, 5);
+    std::vector<int32_t> output(CHANNEL_COUNT * PERIOD_FRAMES);
+    std::vector<uint8_t> payload(PAYLOAD_SIZE);
+    void *targets[CHANNEL_COUNT];
+    double period = PERIOD_FRAMES * 1e6 / SAMPLE_RATE;
+    uint64_t encoded = 0;
+    Result result;
+
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        targets[i] = &output[i * PERIOD_FRAMES];
+    }
+
+    for (int i = 0; i < PERIODS; ++i) {
+        auto now = (int64_t)(i * period);
+        auto offset = (uint64_t)i * PERIOD_FRAMES;
+
+        for (int channel = 0; channel < CHANNEL_COUNT; ++channel) {
+            auto samples = (int32_t *)payload.data();
+
+            for (int frame = 0; frame < PERIOD_FRAMES; ++frame) {
+                samples[frame] = (int32_t)((offset + frame) * 16 + channel);
+            }
+
+            network.send(now, { false, offset, channel, 1, payload });
+
+            if (!groupSize) {
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            auto group = encoder.add(channel, payload.data());
+
+            result.encodeNs += std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count();
+            encoded++;
+
+            if (group >= 0) {
+                auto parity = encoder.parity(group);
+
+                network.send(now, {
+                    true, offset, group * encoder.groupSize(),
+                    encoder.groupChannels(group),
+                    std::vector<uint8_t>(parity, parity + PAYLOAD_SIZE) });
+            }
+        }
+
+        network.deliver(now + (int64_t)(period / 2),
+            [&](const SimPacket& packet, int64_t arrival) {
+                if (packet.parity) {
+                    buffer.pushParity(packet.offset, packet.channel,
+                        packet.count, packet.data.data(), packet.data.size(),
+                        arrival);
+                } else {
+                    buffer.push(packet.offset, packet.channel,
+                        packet.data.data(), packet.data.size(), arrival);
+                }
+            });
+
+        auto playing = buffer.playing();
+        auto complete = buffer.pop(targets);
+
+        if (i >= WARMUP_PERIODS && playing && !complete) {
+            result.glitches++;
+        }
+    }
+
+    result.sent = network.sent();
+    result.lost = network.lost();
+    result.recovered = buffer.stats().recovered;
+
+    if (encoded) {
+        result.encodeNs /= encoded;
+    }
+
+    return result;
+}
+
+int main()
+{
+    struct Scenario
+    {
+        const char *name;
+        NetSimulatorConfig network;
+    };
+
+    // times in microseconds; a period is about 2667us.
+    Scenario scenarios[] = {
+        { "1% loss", { 1000, 300, 0.01, 0, 1 } },
+        { "5% loss", { 1000, 300, 0.05, 0, 1 } },
+        { "bursty", { 1000, 300, 0.005, 0.005, 4 } },
+    };
+    int failures = 0;
+
+    printf("%-8s %5s %9s %6s %8s %9s %8s\n",
+        "network", "group", "overhead", "glitch", "glitch%", "recovered",
+        "ns/pkt");
+
+    for (auto& scenario : scenarios) {
+        int baseline = 0;
+
+        for (int groupSize : { 0, 8, 4, 2 }) {
+            auto result = run(groupSize, scenario.network);
+            auto periods = PERIODS - WARMUP_PERIODS;
+            auto dataPackets = (double)PERIODS * CHANNEL_COUNT;
+
+            printf("%-8s %5d %8.1f%% %6d %7.3f%% %9llu %8.1f\n",
+                scenario.name, groupSize,
+                100.0 * (result.sent - dataPackets) / dataPackets,
+                result.glitches, 100.0 * result.glitches / periods,
+                (unsigned long long)result.recovered, result.encodeNs);
+
+            if (!groupSize) {
+                baseline = result.glitches;
+            } else if (scenario.network.burstRate == 0 &&
+                result.glitches * 2 > baseline) {
+
+                // random single losses are what parity is for, so it should
+                // at least halve the glitches there. Bursts can take out a
+                // whole group, so they're only reported.
+                printf("  FAIL: group size %d only brought %d glitches "
+                    "down to %d\n", groupSize, baseline, result.glitches);
+                failures++;
+            }
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Runs a cast stream through the jitter buffer over a simulated network and
+// checks that it conceals no more than the network lost, plays what it
+// received in order, and sizes its depth to the jitter it sees.
+
+#include "stdafx.h"
+#include "jitterbuffer.h"
+#include "netsim.h"
+
+#include <cstdio>
+
+using namespace Sar;
+
+static const int CHANNEL_COUNT = 2;
+static const int PERIOD_FRAMES = 128;
+static const int SAMPLE_RATE = 48000;
+static const int PERIODS = 30000;
+// periods played before the statistics count.
+static const int WARMUP_PERIODS = 500;
+
+struct SimPacket
+{
+    uint64_t offset;
+    int channel;
+};
+
+struct Scenario
+{
+    const char *name;
+    NetSimulatorConfig network;
+};
+
+struct Result
+{
+    JitterBufferStats stats;
+    uint64_t lost = 0;
+    int glitches = 0;
+    int mismatches = 0;
+    int maxTargetDepth = 0;
+};
+
+static int32_t sampleAt(uint64_t offset, int channel, int frame)
+{
+    return (int32_t)((offset + frame) * 4 + channel);
+}
+
+static Result run(const Scenario& scenario)
+{
+    JitterBuffer buffer(CHANNEL_COUNT, PERIOD_FRAMES, SAMPLE_RATE, 4);
+    NetSimulator<SimPacket> network(scenario.network, 1);
+    std::vector<int32_t> output(CHANNEL_COUNT * PERIOD_FRAMES);
+    int32_t payload[PERIOD_FRAMES];
+    void *targets[CHANNEL_COUNT];
+    double period = PERIOD_FRAMES * 1e6 / SAMPLE_RATE;
+    Result result;
+
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        targets[i] = &output[i * PERIOD_FRAMES];
+    }
+
+    for (int i = 0; i < PERIODS; ++i) {
+        auto now = (int64_t)(i * period);
+        auto offset = (uint64_t)i * PERIOD_FRAMES;
+
+        for (int channel = 0; channel < CHANNEL_COUNT; ++channel) {
+            if (!network.send(now, { offset, channel }) &&
+                i >= WARMUP_PERIODS) {
+
+                result.lost++;
+            }
+        }
+
+        // the slave's period runs half a period behind the master's.
+        network.deliver(now + (int64_t)(period / 2),
+            [&](const SimPacket& packet, int64_t arrival) {
+                for (int frame = 0; frame < PERIOD_FRAMES; ++frame) {
+                    payload[frame] =
+                        sampleAt(packet.offset, packet.channel, frame);
+                }
+
+                buffer.push(packet.offset, packet.channel,
+                    payload, sizeof(payload), arrival);
+            });
+
+        auto playing = buffer.playing();
+        auto playoutOffset = buffer.playoutOffset();
+        auto complete = buffer.pop(targets);
+
+        if (i < WARMUP_PERIODS) {
+            continue;
+        }
+
+        if (!complete && playing) {
+            result.glitches++;
+        }
+
+        if (complete) {
+            for (int channel = 0; channel < CHANNEL_COUNT; ++channel) {
+                for (int frame = 0; frame < PERIOD_FRAMES; ++frame) {
+                    if (output[channel * PERIOD_FRAMES + frame] !=
+                        sampleAt(playoutOffset, channel, frame)) {
+
+                        result.mismatches++;
+                    }
+                }
+            }
+        }
+
+        result.maxTargetDepth =
+            std::max(result.maxTargetDepth, buffer.stats().targetDepth);
+    }
+
+    result.stats = buffer.stats();
+    return result;
+}
+
+int main()
+{
+    // times in microseconds; a period is about 2667us.
+    Scenario scenarios[] = {
+        { "wired", { 200, 50, 0, 0, 1 } },
+        { "jittery", { 1000, 1500, 0, 0, 1 } },
+        { "lossy", { 1000, 300, 0.01, 0, 1 } },
+        { "wifi", { 2000, 2000, 0.005, 0.002, 4 } },
+    };
+    int failures = 0;
+    int wiredTarget = 0;
+
+    printf("%-8s %6s %6s %6s %8s %6s %6s %8s\n",
+        "network", "lost", "late", "glitch", "glitch%", "depth", "target",
+        "jitter");
+
+    for (auto& scenario : scenarios) {
+        auto result = run(scenario);
+        auto periods = PERIODS - WARMUP_PERIODS;
+
+        printf("%-8s %6llu %6llu %6d %7.3f%% %6d %6d %8.1f\n",
+            scenario.name, (unsigned long long)result.lost,
+            (unsigned long long)result.stats.late, result.glitches,
+            100.0 * result.glitches / periods, result.stats.depth,
+            result.maxTargetDepth, result.stats.jitterFrames);
+
+        if (result.mismatches) {
+            printf("  FAIL: %d samples played out of order\n",
+                result.mismatches);
+            failures++;
+        }
+
+        // every glitch should be explained by a lost packet, apart from the
+        // few periods it takes the depth to grow after a jitter spike.
+        if ((uint64_t)result.glitches > result.lost + periods / 1000) {
+            printf("  FAIL: %d glitches for %llu lost packets\n",
+                result.glitches, (unsigned long long)result.lost);
+            failures++;
+        }
+
+        if (!strcmp(scenario.name, "wired")) {
+            wiredTarget = result.maxTargetDepth;
+        } else if (!strcmp(scenario.name, "jittery") &&
+            result.maxTargetDepth <= wiredTarget) {
+
+            printf("  FAIL: target depth didn't grow with jitter\n");
+            failures++;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
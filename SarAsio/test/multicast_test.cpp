@@ -0,0 +1,215 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Casts over real multicast sockets on the loopback interface: one master,
+// two slaves, each transport polled from its own thread the way the wrapper
+// does it. Fails unless both slaves answer status requests and actually
+// receive and play what the master sends.
+
+#include "stdafx.h"
+#include "network.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace Sar;
+
+static const int CHANNEL_COUNT = 2;
+static const int PERIOD_FRAMES = 128;
+static const int SAMPLE_RATE = 48000;
+static const int PERIODS = 1000;
+static const int STATUS_INTERVAL = 200;
+static const int SLAVE_COUNT = 2;
+static const int FEC_GROUP_SIZE = 2;
+static const char *GROUP_ADDRESS = "239.255.7.7";
+static const uint16_t GROUP_PORT = 17000;
+static const char *INTERFACE_ADDRESS = "127.0.0.1";
+
+struct Slave
+{
+    std::shared_ptr<SarCastSlave> cast;
+    CastTransport transport;
+    std::thread thread;
+    uint64_t ticks = 0;
+    uint64_t silentTicks = 0;
+};
+
+int main()
+{
+    BufferConfig bufferConfig = {};
+    auto period = std::chrono::microseconds(
+        PERIOD_FRAMES * 1000000LL / SAMPLE_RATE);
+    std::atomic<bool> stop(false);
+    Slave slaves[SLAVE_COUNT];
+    CastTransport masterTransport;
+    int failures = 0;
+
+    bufferConfig.periodFrameSize = PERIOD_FRAMES;
+    bufferConfig.sampleRate = SAMPLE_RATE;
+    bufferConfig.sampleSize = 4;
+
+    auto master = std::make_shared<SarCastMaster>(
+        bufferConfig, CHANNEL_COUNT, 42, FEC_GROUP_SIZE);
+
+    if (!masterTransport.openMaster(
+        GROUP_ADDRESS, GROUP_PORT, INTERFACE_ADDRESS)) {
+
+        printf("FAIL: couldn't open the master on %s\n", INTERFACE_ADDRESS);
+        return 1;
+    }
+
+    masterTransport.attach(master);
+
+    for (auto& slave : slaves) {
+        slave.cast = std::make_shared<SarCastSlave>(
+            bufferConfig, CHANNEL_COUNT, 42);
+
+        if (!slave.transport.openSlave(
+            GROUP_ADDRESS, GROUP_PORT, INTERFACE_ADDRESS)) {
+
+            printf("FAIL: couldn't open a slave on %s\n", INTERFACE_ADDRESS);
+            return 1;
+        }
+
+        slave.transport.attach(slave.cast);
+    }
+
+    // slaves tick on their own clock, like a second machine's audio device.
+    for (auto& slave : slaves) {
+        slave.thread = std::thread([&slave, &stop, period]() {
+            std::vector<int32_t> output(CHANNEL_COUNT * PERIOD_FRAMES);
+            void *targets[CHANNEL_COUNT];
+            auto next = std::chrono::steady_clock::now() + period;
+
+            for (int i = 0; i < CHANNEL_COUNT; ++i) {
+                targets[i] = &output[i * PERIOD_FRAMES];
+            }
+
+            while (!stop) {
+                slave.transport.poll(1);
+
+                if (std::chrono::steady_clock::now() < next) {
+                    continue;
+                }
+
+                next += period;
+                memset(output.data(), 0, output.size() * sizeof(int32_t));
+                slave.cast->tick(targets, CastClockNow());
+                slave.ticks++;
+
+                bool silent = true;
+
+                for (auto sample : output) {
+                    if (sample) {
+                        silent = false;
+                        break;
+                    }
+                }
+
+                slave.silentTicks += silent;
+            }
+        });
+    }
+
+    std::thread masterThread([&]() {
+        while (!stop) {
+            masterTransport.poll(1);
+        }
+    });
+
+    std::vector<int32_t> input(CHANNEL_COUNT * PERIOD_FRAMES);
+    void *sources[CHANNEL_COUNT];
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        sources[i] = &input[i * PERIOD_FRAMES];
+    }
+
+    for (int i = 0; i < PERIODS; ++i) {
+        auto offset = (uint64_t)i * PERIOD_FRAMES;
+
+        for (int channel = 0; channel < CHANNEL_COUNT; ++channel) {
+            for (int frame = 0; frame < PERIOD_FRAMES; ++frame) {
+                input[channel * PERIOD_FRAMES + frame] =
+                    (int32_t)((offset + frame) * 16 + channel + 1);
+            }
+        }
+
+        master->tick(sources, offset);
+
+        if (i % STATUS_INTERVAL == STATUS_INTERVAL - 1) {
+            master->requestStatus(CastClockNow());
+        }
+
+        std::this_thread::sleep_until(start + period * (i + 1));
+    }
+
+    // let the last status replies land.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stop = true;
+    masterThread.join();
+
+    for (auto& slave : slaves) {
+        slave.thread.join();
+    }
+
+    auto status = master->slaveStatus();
+
+    printf("%-16s %8s %6s %9s %9s %5s %9s %7s\n",
+        "slave", "received", "late", "concealed", "recovered", "depth",
+        "drift", "rtt");
+
+    for (auto& entry : status) {
+        printf("%-16s %8llu %6llu %9llu %9llu %5d %8.1fp %5lldus\n",
+            entry.address.c_str(), (unsigned long long)entry.received,
+            (unsigned long long)entry.late,
+            (unsigned long long)entry.concealed,
+            (unsigned long long)entry.recovered, entry.depthFrames,
+            entry.driftPpm, (long long)entry.roundTripTime);
+
+        // loopback doesn't drop, so nearly every period should arrive by the
+        // last request; the slack covers periods still in flight.
+        if (entry.received < (PERIODS - STATUS_INTERVAL) * CHANNEL_COUNT) {
+            printf("  FAIL: %s only received %llu packets\n",
+                entry.address.c_str(), (unsigned long long)entry.received);
+            failures++;
+        }
+    }
+
+    if (status.size() != SLAVE_COUNT) {
+        printf("FAIL: %d of %d slaves answered status requests\n",
+            (int)status.size(), SLAVE_COUNT);
+        failures++;
+    }
+
+    for (auto& slave : slaves) {
+        auto playing = slave.ticks - slave.silentTicks;
+
+        printf("slave ticks %llu, %llu with audio\n",
+            (unsigned long long)slave.ticks, (unsigned long long)playing);
+
+        // the first ticks are silent while the playout latency fills.
+        if (playing * 2 < slave.ticks) {
+            printf("  FAIL: a slave played audio for only %llu of %llu "
+                "ticks\n", (unsigned long long)playing,
+                (unsigned long long)slave.ticks);
+            failures++;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,125 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_ASIO_TEST_NETSIM_H
+#define _SAR_ASIO_TEST_NETSIM_H
+
+#include <queue>
+#include <random>
+
+namespace Sar {
+
+struct NetSimulatorConfig
+{
+    // microseconds
+    double delay = 1000;
+    // mean of the exponentially distributed queueing delay on top of delay,
+    // in microseconds.
+    double jitter = 0;
+    // chance of a packet being lost outside of a burst.
+    double loss = 0;
+    // chance per packet of a loss burst starting, and its mean length in
+    // packets (Gilbert-Elliott style).
+    double burstRate = 0;
+    double burstLength = 1;
+};
+
+// Local stand-in for a lossy, jittery network. Packets come back in arrival
+// order, which is not necessarily the order they were sent in.
+template<typename T>
+struct NetSimulator
+{
+    NetSimulator(const NetSimulatorConfig& config, uint32_t seed):
+        _config(config), _rng(seed) {}
+
+    // Returns false if the packet was lost.
+    bool send(int64_t now, const T& packet)
+    {
+        _sent++;
+
+        if (_burstRemaining > 0) {
+            _burstRemaining--;
+            _lost++;
+            return false;
+        }
+
+        if (_config.burstRate > 0 && _uniform(_rng) < _config.burstRate) {
+            std::geometric_distribution<int> length(1.0 / _config.burstLength);
+
+            _burstRemaining = length(_rng);
+            _lost++;
+            return false;
+        }
+
+        if (_uniform(_rng) < _config.loss) {
+            _lost++;
+            return false;
+        }
+
+        auto arrival = now + _config.delay;
+
+        if (_config.jitter > 0) {
+            arrival += std::exponential_distribution<double>(
+                1.0 / _config.jitter)(_rng);
+        }
+
+        _queue.push({ (int64_t)arrival, _sequence++, packet });
+        return true;
+    }
+
+    // Hands every packet that has arrived by now to receive(packet, time).
+    template<typename F>
+    void deliver(int64_t now, F receive)
+    {
+        while (!_queue.empty() && _queue.top().arrival <= now) {
+            auto entry = _queue.top();
+
+            _queue.pop();
+            receive(entry.packet, entry.arrival);
+        }
+    }
+
+    uint64_t sent() const { return _sent; }
+    uint64_t lost() const { return _lost; }
+
+private:
+    struct Entry
+    {
+        int64_t arrival;
+        uint64_t sequence;
+        T packet;
+
+        bool operator<(const Entry& other) const
+        {
+            // std::priority_queue is a max heap.
+            return arrival != other.arrival ?
+                arrival > other.arrival : sequence > other.sequence;
+        }
+    };
+
+    NetSimulatorConfig _config;
+    std::mt19937 _rng;
+    std::uniform_real_distribution<double> _uniform;
+    std::priority_queue<Entry> _queue;
+    uint64_t _sequence = 0;
+    uint64_t _sent = 0;
+    uint64_t _lost = 0;
+    int _burstRemaining = 0;
+};
+
+} // namespace Sar
+
+#endif // _SAR_ASIO_TEST_NETSIM_H
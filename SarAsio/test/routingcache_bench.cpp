@@ -0,0 +1,182 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Times EndpointIndex lookups against the linear search over every device
+// that they replaced, plus index rebuilds and ApplicationMatchCache hits.
+// The search here only compares strings; the real one also opened each
+// device's property store, so it understates what the index saves. Also
+// checks lookups, invalidation and cache signatures behave.
+
+#include "stdafx.h"
+#include "routingcache.h"
+
+#include <chrono>
+#include <cstdio>
+
+using namespace Sar;
+
+static const int LOOKUPS = 200000;
+static const int REBUILDS = 200;
+
+static std::vector<EndpointIndexEntry> makeEntries(int count)
+{
+    std::vector<EndpointIndexEntry> entries;
+
+    for (int i = 0; i < count; ++i) {
+        EndpointIndexEntry entry;
+
+        entry.endpointId = "sar_endpoint_" + std::to_string(i);
+        entry.deviceId = L"{0.0." + std::to_wstring(i % 2) +
+            L".00000000}.{" + std::to_wstring(i) + L"}";
+        entry.dataFlow = i % 2;
+        entries.push_back(entry);
+    }
+
+    return entries;
+}
+
+template<typename F>
+static double timeNs(int iterations, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; ++i) {
+        f(i);
+    }
+
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static int check(const char *what, bool ok)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+    }
+
+    return ok ? 0 : 1;
+}
+
+static int checkBehavior()
+{
+    EndpointIndex index;
+    ApplicationMatchCache cache;
+    std::wstring deviceId;
+    uint64_t generation;
+    int matched = -2;
+    int failures = 0;
+
+    failures += check("a new index is invalid", !index.valid(&generation));
+    index.rebuild(generation, makeEntries(4));
+    failures += check("a rebuilt index is valid", index.valid(&generation));
+    failures += check("an indexed endpoint is found",
+        index.find("sar_endpoint_3", 1, &deviceId) &&
+        deviceId == L"{0.0.1.00000000}.{3}");
+    failures += check("the wrong data flow isn't found",
+        !index.find("sar_endpoint_3", 0, &deviceId));
+    failures += check("an unknown endpoint isn't found",
+        !index.find("sar_endpoint_9", 0, &deviceId));
+
+    // a device event arriving mid-enumeration.
+    index.invalidate();
+    index.valid(&generation);
+    index.invalidate();
+    index.rebuild(generation, makeEntries(2));
+    failures += check("a rebuild that raced an invalidation stays invalid",
+        !index.valid(&generation));
+    failures += check("a raced rebuild still answers lookups",
+        index.find("sar_endpoint_0", 0, &deviceId));
+
+    failures += check("an empty cache misses", !cache.find(L"a|b", &matched));
+    cache.store(L"a|b", 1);
+    failures += check("the stored signature hits",
+        cache.find(L"a|b", &matched) && matched == 1);
+    failures += check("a changed application list misses",
+        !cache.find(L"a|b|c", &matched));
+    cache.store(L"a|b|c", -1);
+    failures += check("no match is cached too",
+        cache.find(L"a|b|c", &matched) && matched == -1);
+
+    return failures;
+}
+
+int main()
+{
+    int failures = checkBehavior();
+
+    printf("%9s %12s %12s %12s\n",
+        "endpoints", "search ns", "index ns", "rebuild ns");
+
+    for (int count : { 8, 64, 512 }) {
+        auto entries = makeEntries(count);
+        std::vector<std::string> ids;
+        EndpointIndex index;
+        std::wstring deviceId;
+        uint64_t generation;
+        uint64_t found = 0;
+
+        for (auto& entry : entries) {
+            ids.push_back(entry.endpointId);
+        }
+
+        auto searchNs = timeNs(LOOKUPS, [&](int i) {
+            auto& id = ids[i % count];
+
+            for (auto& entry : entries) {
+                if (entry.endpointId == id && entry.dataFlow == i % 2) {
+                    deviceId = entry.deviceId;
+                    found++;
+                    break;
+                }
+            }
+        });
+        auto rebuildNs = timeNs(REBUILDS, [&](int) {
+            index.valid(&generation);
+            index.rebuild(generation, entries);
+        });
+        auto indexNs = timeNs(LOOKUPS, [&](int i) {
+            found += index.find(ids[i % count], i % 2, &deviceId);
+        });
+
+        printf("%9d %12.1f %12.1f %12.1f\n",
+            count, searchNs, indexNs, rebuildNs);
+
+        if (found != 2 * (uint64_t)LOOKUPS) {
+            printf("  FAIL: %llu of %d lookups found their endpoint\n",
+                (unsigned long long)found, 2 * LOOKUPS);
+            failures++;
+        }
+    }
+
+    ApplicationMatchCache cache;
+    std::wstring signature;
+    int matched = 0;
+
+    for (int i = 0; i < 50; ++i) {
+        signature += L"C:\\Program Files\\App" + std::to_wstring(i) +
+            L"\\app.exe|";
+    }
+
+    cache.store(signature, 7);
+
+    auto cacheNs = timeNs(LOOKUPS, [&](int) {
+        cache.find(signature, &matched);
+    });
+
+    printf("application match cache hit, 50 applications: %.1fns\n",
+        cacheNs);
+    return failures ? 1 : 0;
+}
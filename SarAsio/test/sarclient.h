@@ -0,0 +1,35 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Stands in for SarAsio's sarclient.h, which needs the driver's ioctl
+// interface. The cast code only uses BufferConfig from it.
+#pragma once
+
+#include <array>
+#include <vector>
+
+namespace Sar {
+
+struct BufferConfig
+{
+    int periodFrameSize;
+    int sampleRate;
+    int sampleSize;
+
+    std::array<std::vector<std::vector<void *>>, 2> asioBuffers;
+};
+
+} // namespace Sar
@@ -0,0 +1,66 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Stands in for SarAsio's precompiled header so the portable cast code can
+// be built and exercised off Windows.
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+#include <iostream>
+#include <locale>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// glog stand-in: each LOG(severity) << ... statement writes one line.
+struct TestLogLine
+{
+    ~TestLogLine() { std::cerr << std::endl; }
+
+    template <typename T>
+    TestLogLine& operator<<(const T& value)
+    {
+        std::cerr << value;
+        return *this;
+    }
+};
+
+#define LOG(severity) TestLogLine()
+
+// mmdeviceapi.h enums the config refers to.
+enum EDataFlow
+{
+    eRender,
+    eCapture,
+    eAll,
+};
+
+enum ERole
+{
+    eConsole,
+    eMultimedia,
+    eCommunications,
+};
@@ -73,6 +73,60 @@ std::wstring ConfigurationPath(const std::wstring& name)
     return std::wstring(path);
 }
 
+static bool enableLockMemoryPrivilege()
+{
+    HANDLE token;
+    TOKEN_PRIVILEGES privileges = {};
+    bool result;
+
+    if (!OpenProcessToken(GetCurrentProcess(),
+        TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+
+        return false;
+    }
+
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    // AdjustTokenPrivileges succeeds without assigning anything if the
+    // account lacks the privilege, so the last error has to be checked too.
+    result = LookupPrivilegeValue(
+            nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+        GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    return result;
+}
+
+void *AllocateBufferArena(size_t size, bool largePages)
+{
+    if (largePages) {
+        auto largePageSize = GetLargePageMinimum();
+
+        if (largePageSize && enableLockMemoryPrivilege()) {
+            auto arena = VirtualAlloc(nullptr,
+                (size + largePageSize - 1) & ~(largePageSize - 1),
+                MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+            if (arena) {
+                return arena;
+            }
+        }
+
+        LOG(WARNING) << "Large pages unavailable for ASIO buffers, falling "
+            << "back to regular pages.";
+    }
+
+    return VirtualAlloc(
+        nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void FreeBufferArena(void *arena)
+{
+    if (arena) {
+        VirtualFree(arena, 0, MEM_RELEASE);
+    }
+}
+
 static std::wstring getProductName(const std::wstring& wpath)
 {
     auto verLength = GetFileVersionInfoSize(wpath.c_str(), nullptr);
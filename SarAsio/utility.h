@@ -29,6 +29,11 @@ std::wstring LoggingPath();
 std::wstring UTF8ToWide(const std::string& str);
 std::string TCHARToLocal(const TCHAR *ptr);
 
+// Zeroed, page aligned memory for ASIO buffers, backed by large pages when
+// asked for and the process is allowed to lock memory.
+void *AllocateBufferArena(size_t size, bool largePages);
+void FreeBufferArena(void *arena);
+
 struct RunningApplication
 {
     std::wstring name;
@@ -22,12 +22,17 @@
 #include "wrapper.h"
 #include "utility.h"
 
+#include <random>
+
 using namespace Sar;
 
-SarAsioWrapper *gActiveWrapper;
+SarAsioWrapper *gActiveWrappers[SarAsioWrapper::kMaxActiveWrappers];
 
 static const char kNoInterfaceSelected[] = "No Interface Selected";
 
+// how often a cast master asks its slaves for status, in microseconds.
+static const int64_t CAST_STATUS_INTERVAL = 10000000;
+
 SarAsioWrapper::SarAsioWrapper()
 {
     LOG(INFO) << "SarAsioWrapper::SarAsioWrapper";
@@ -80,10 +85,12 @@ AsioStatus SarAsioWrapper::start()
         return AsioStatus::OK;
     }
 
+    startCast();
     _sar = std::make_shared<SarClient>(_config, _bufferConfig);
 
     if (!_sar->start()) {
         LOG(INFO) << "Failed to start SAR";
+        stopCast();
         return AsioStatus::HardwareMalfunction;
     }
 
@@ -101,7 +108,12 @@ AsioStatus SarAsioWrapper::stop()
     if(_sar)
         _sar->stop();
 
-    return _innerDriver->stop();
+    // the inner driver keeps ticking until it's stopped, and ticks use the
+    // cast and its buffers.
+    auto status = _innerDriver->stop();
+
+    stopCast();
+    return status;
 }
 
 AsioStatus SarAsioWrapper::getChannels(long *inputCount, long *outputCount)
@@ -360,7 +372,15 @@ AsioStatus SarAsioWrapper::createBuffers(
         return AsioStatus::OK;
     }
 
-    _callbacks.tick = &SarAsioWrapper::onTickStub;
+    // hosts must disposeBuffers first; creating over live buffers would
+    // leak the arena and the tick stub slot they hold.
+    if (_virtualBufferArena || _activeSlot >= 0) {
+        LOG(ERROR) << "createBuffers called without disposing the previous "
+            << "buffers";
+        return AsioStatus::InvalidMode;
+    }
+
+    _callbacks.tick = nullptr;
     _callbacks.tickWithTime = nullptr;
     _callbacks.asioMessage = callbacks->asioMessage;
     _callbacks.sampleRateDidChange = callbacks->sampleRateDidChange;
@@ -406,13 +426,103 @@ AsioStatus SarAsioWrapper::createBuffers(
         }
     }
 
+    // Channels of endpoints attached to physical channels use the inner
+    // driver's buffers directly, so the tick muxes and demuxes straight to
+    // the hardware. Physical channels the host didn't ask for are created on
+    // the endpoint's behalf; a physical output can only have one writer.
+    struct AttachedChannel
+    {
+        size_t endpointIndex;
+        int channelIndex;
+        size_t physicalIndex;
+    };
+
+    std::vector<AttachedChannel> attachedChannels;
+
+    for (size_t i = 0; i < _config.endpoints.size(); ++i) {
+        auto& endpoint = _config.endpoints[i];
+        auto isInput = endpoint.type == EndpointType::Recording ?
+            AsioBool::True : AsioBool::False;
+        auto count = isInput == AsioBool::True ?
+            physicalInputCount : physicalOutputCount;
+
+        if (!endpoint.attachPhysical) {
+            continue;
+        }
+
+        for (int channelIndex = 0; channelIndex < endpoint.channelCount;
+             ++channelIndex) {
+
+            long index = endpoint.physicalChannelBase + channelIndex;
+
+            if (index < 0 || index >= count) {
+                LOG(WARNING) << "Endpoint " << endpoint.id << " channel "
+                    << channelIndex << " has no physical channel to attach to.";
+                continue;
+            }
+
+            auto physical = std::find_if(
+                physicalChannelBuffers.begin(), physicalChannelBuffers.end(),
+                [&](const AsioBufferInfo& info) {
+                    return info.isInput == isInput && info.index == index;
+                });
+
+            if (physical != physicalChannelBuffers.end() &&
+                isInput == AsioBool::False) {
+
+                LOG(WARNING) << "Endpoint " << endpoint.id << " channel "
+                    << channelIndex << " can't attach to physical output "
+                    << index << ", it is already in use.";
+                continue;
+            }
+
+            if (physical == physicalChannelBuffers.end()) {
+                AsioBufferInfo info = {};
+
+                info.isInput = isInput;
+                info.index = index;
+                physicalChannelBuffers.emplace_back(info);
+                physical = physicalChannelBuffers.end() - 1;
+            }
+
+            attachedChannels.push_back({ i, channelIndex,
+                (size_t)(physical - physicalChannelBuffers.begin()) });
+        }
+    }
+
+    // Every virtual channel's double buffer comes from one arena. Each half
+    // is laid out endpoint-major, and each buffer starts on a cache line.
+    size_t virtualBufferStride =
+        ((size_t)bufferFrameSize * getSampleSize(_sampleType) + 63) & ~63;
+
+    if (virtualChannelIndices.size()) {
+        _virtualBufferArena = AllocateBufferArena(
+            2 * virtualChannelIndices.size() * virtualBufferStride,
+            _config.largePageBuffers);
+
+        if (!_virtualBufferArena) {
+            LOG(ERROR) << "Couldn't allocate virtual channel buffers.";
+            return AsioStatus::NoMemory;
+        }
+    }
+
+    if (!acquireTickStubs()) {
+        LOG(ERROR) << "Client attempted to create more than "
+            << kMaxActiveWrappers << " active instances of SarAsioWrapper.";
+        FreeBufferArena(_virtualBufferArena);
+        _virtualBufferArena = nullptr;
+        return AsioStatus::HardwareMalfunction;
+    }
+
     _userTick = callbacks->tick;
+    _userTickWithTime = nullptr;
+    _callbacks.tick = kTickStubs[_activeSlot].tick;
 
     if (callbacks->asioMessage(AsioMessage::SupportsTimeInfo,
         0, nullptr, nullptr)) {
 
         _userTickWithTime = callbacks->tickWithTime;
-        _callbacks.tickWithTime = &SarAsioWrapper::onTickWithTimeStub;
+        _callbacks.tickWithTime = kTickStubs[_activeSlot].tickWithTime;
     }
 
     LOG(INFO) << "Creating inner driver buffers."
@@ -437,10 +547,14 @@ AsioStatus SarAsioWrapper::createBuffers(
     if (status != AsioStatus::OK) {
         LOG(ERROR) << "Couldn't create inner driver buffers: "
             << (int)status;
+        _callbacks = {};
+        releaseTickStubs();
+        FreeBufferArena(_virtualBufferArena);
+        _virtualBufferArena = nullptr;
         return status;
     }
 
-    for (size_t i = 0; i < physicalChannelBuffers.size(); ++i) {
+    for (size_t i = 0; i < physicalChannelIndices.size(); ++i) {
         infos[physicalChannelIndices[i]] = physicalChannelBuffers[i];
     }
 
@@ -458,17 +572,46 @@ AsioStatus SarAsioWrapper::createBuffers(
         }
     }
 
+    for (auto& attached : attachedChannels) {
+        auto& physical = physicalChannelBuffers[attached.physicalIndex];
+
+        for (size_t swapIndex = 0; swapIndex < 2; swapIndex++) {
+            _bufferConfig.asioBuffers[swapIndex][attached.endpointIndex]
+                [attached.channelIndex] = physical.asioBuffers[swapIndex];
+        }
+    }
+
+    std::vector<std::pair<VirtualChannel *, int>> arenaOrder;
+
     for (auto i : virtualChannelIndices) {
         auto count = infos[i].isInput == AsioBool::True ?
             physicalInputCount : physicalOutputCount;
         auto& channels = infos[i].isInput == AsioBool::True ?
             _virtualInputs : _virtualOutputs;
-        auto& channel = channels[infos[i].index - count];
 
-        channel.asioBuffers[0] =
-            infos[i].asioBuffers[0] = calloc(bufferFrameSize, getSampleSize(_sampleType));
-        channel.asioBuffers[1] =
-            infos[i].asioBuffers[1] = calloc(bufferFrameSize, getSampleSize(_sampleType));
+        arenaOrder.emplace_back(&channels[infos[i].index - count], i);
+    }
+
+    std::sort(arenaOrder.begin(), arenaOrder.end(),
+        [](const std::pair<VirtualChannel *, int>& lhs,
+           const std::pair<VirtualChannel *, int>& rhs) {
+
+        if (lhs.first->endpointIndex != rhs.first->endpointIndex) {
+            return lhs.first->endpointIndex < rhs.first->endpointIndex;
+        }
+
+        return lhs.first->channelIndex < rhs.first->channelIndex;
+    });
+
+    for (size_t slot = 0; slot < arenaOrder.size(); ++slot) {
+        auto& channel = *arenaOrder[slot].first;
+        auto i = arenaOrder[slot].second;
+        auto arena = (uint8_t *)_virtualBufferArena;
+
+        channel.asioBuffers[0] = infos[i].asioBuffers[0] =
+            arena + slot * virtualBufferStride;
+        channel.asioBuffers[1] = infos[i].asioBuffers[1] =
+            arena + (arenaOrder.size() + slot) * virtualBufferStride;
         _bufferConfig
             .asioBuffers[0][channel.endpointIndex][channel.channelIndex] =
                 channel.asioBuffers[0];
@@ -477,18 +620,6 @@ AsioStatus SarAsioWrapper::createBuffers(
                 channel.asioBuffers[1];
     }
 
-    InterlockedCompareExchangePointer((PVOID *)&gActiveWrapper, this, nullptr);
-
-    // We need a thiscall thunk to support multiple active instances, and
-    // there doesn't seem to be any reasonable use case for that, so for now
-    // just use a global reference to our wrapper.
-    if (gActiveWrapper != this) {
-        LOG(ERROR) << "Client attempted to create multiple active instances of "
-            << "SarAsioWrapper. This is currently unsupported.";
-        disposeBuffers();
-        return AsioStatus::HardwareMalfunction;
-    }
-
     return AsioStatus::OK;
 }
 
@@ -510,18 +641,16 @@ AsioStatus SarAsioWrapper::disposeBuffers()
     stop();
 
     for (auto& swapBuffers : _bufferConfig.asioBuffers) {
-        for (auto& endpointBuffers : swapBuffers) {
-            for (auto buffer : endpointBuffers) {
-                free(buffer);
-            }
-        }
         swapBuffers.clear();
     }
 
+    FreeBufferArena(_virtualBufferArena);
+    _virtualBufferArena = nullptr;
+
     _callbacks = {};
     _userTick = nullptr;
     _userTickWithTime = nullptr;
-    InterlockedExchangePointer((PVOID *)&gActiveWrapper, nullptr);
+    releaseTickStubs();
     return _innerDriver->disposeBuffers();
 }
 
@@ -592,6 +721,12 @@ void SarAsioWrapper::initVirtualChannels()
     int endpointIndex = 0;
 
     for (auto& endpoint : _config.endpoints) {
+        // attached endpoints are routed to the hardware, not the host.
+        if (endpoint.attachPhysical) {
+            endpointIndex++;
+            continue;
+        }
+
         for (int i = 0; i < endpoint.channelCount; ++i) {
             VirtualChannel chan;
             std::ostringstream os;
@@ -612,15 +747,227 @@ void SarAsioWrapper::initVirtualChannels()
     }
 }
 
-void SarAsioWrapper::onTick(long bufferIndex, AsioBool directProcess)
+bool SarAsioWrapper::acquireTickStubs()
 {
+    if (_activeSlot >= 0) {
+        return true;
+    }
+
+    for (int i = 0; i < kMaxActiveWrappers; ++i) {
+        if (!InterlockedCompareExchangePointer(
+            (PVOID *)&gActiveWrappers[i], this, nullptr)) {
+
+            _activeSlot = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void SarAsioWrapper::releaseTickStubs()
+{
+    if (_activeSlot < 0) {
+        return;
+    }
+
+    InterlockedExchangePointer((PVOID *)&gActiveWrappers[_activeSlot], nullptr);
+    _activeSlot = -1;
+}
+
+void SarAsioWrapper::startCast()
+{
+    auto& cast = _config.cast;
+
+    // a start() without a stop() in between must not orphan the last
+    // receive thread.
+    stopCast();
+
+    if (cast.mode == CastMode::Off) {
+        return;
+    }
+
+    auto endpoint = std::find_if(
+        _config.endpoints.begin(), _config.endpoints.end(),
+        [&](const EndpointConfig& candidate) {
+            return candidate.id == cast.endpointId;
+        });
+
+    if (endpoint == _config.endpoints.end()) {
+        LOG(WARNING) << "Cast endpoint " << cast.endpointId << " not found";
+        return;
+    }
+
+    auto wantType = cast.mode == CastMode::Master ?
+        EndpointType::Playback : EndpointType::Recording;
+
+    if (endpoint->type != wantType) {
+        LOG(WARNING) << "Cast endpoint " << cast.endpointId
+            << (cast.mode == CastMode::Master ?
+                " must be a playback endpoint" :
+                " must be a recording endpoint");
+        return;
+    }
+
+    if (endpoint->channelCount > JITTER_BUFFER_MAX_CHANNELS) {
+        LOG(ERROR) << "Cast endpoint " << cast.endpointId << " has "
+            << endpoint->channelCount << " channels; casts carry at most "
+            << JITTER_BUFFER_MAX_CHANNELS;
+        return;
+    }
+
+    if (_bufferConfig.asioBuffers[0].size() != _config.endpoints.size()) {
+        LOG(WARNING) << "Cast needs buffers for every endpoint";
+        return;
+    }
+
+    auto endpointIndex = endpoint - _config.endpoints.begin();
+    auto channelCount = endpoint->channelCount;
+    auto periodBytes =
+        _bufferConfig.periodFrameSize * _bufferConfig.sampleSize;
+
+    // channels the host didn't open are backed by our own buffers, which go
+    // into _bufferConfig too so SarClient muxes and demuxes them like any
+    // other channel; the cast always carries the whole endpoint.
+    _castEndpointIndex = endpointIndex;
+
+    for (size_t swapIndex = 0; swapIndex < 2; swapIndex++) {
+        auto& channels = _bufferConfig.asioBuffers[swapIndex][endpointIndex];
+
+        for (int i = 0; i < channelCount; ++i) {
+            if (!channels[i]) {
+                _castScratch.emplace_back(periodBytes);
+                _castScratchSlots.emplace_back(swapIndex, i);
+                channels[i] = _castScratch.back().data();
+            }
+        }
+
+        _castChannels[swapIndex] = channels;
+    }
+
+    auto transport = std::make_unique<CastTransport>();
+
+    transport->setWaitMode(cast.waitMode);
+
+    if (cast.mode == CastMode::Master) {
+        auto session = cast.session;
+
+        if (!session) {
+            std::random_device rd;
+
+            session = ((uint64_t)rd() << 32) | rd();
+        }
+
+        if (!transport->openMaster(
+            cast.address, (uint16_t)cast.port, cast.interfaceAddress)) {
+
+            LOG(ERROR) << "Couldn't open cast master to " << cast.address;
+            return;
+        }
+
+        _castMaster = std::make_shared<SarCastMaster>(
+            _bufferConfig, channelCount, session, cast.fecGroupSize);
+        _castMaster->setCompression(cast.compression);
+        transport->attach(_castMaster);
+        _castOffset = 0;
+        LOG(INFO) << "Casting " << cast.endpointId << " to " << cast.address
+            << ":" << cast.port << " session " << session;
+    } else {
+        if (!transport->openSlave(
+            cast.address, (uint16_t)cast.port, cast.interfaceAddress)) {
+
+            LOG(ERROR) << "Couldn't open cast slave on " << cast.address;
+            return;
+        }
+
+        _castSlave = std::make_shared<SarCastSlave>(
+            _bufferConfig, channelCount, cast.session);
+        _castSlave->setPlayoutLatency(cast.playoutLatency);
+        _castSlave->setClockAsymmetry(cast.clockAsymmetry);
+        transport->attach(_castSlave);
+        LOG(INFO) << "Receiving cast into " << cast.endpointId << " from "
+            << cast.address << ":" << cast.port;
+    }
+
+    _castTransport = std::move(transport);
+    _castStop = false;
+    _castThread = std::thread([this]() {
+        auto nextStatus = CastClockNow() + CAST_STATUS_INTERVAL;
+
+        while (!_castStop) {
+            _castTransport->poll(100);
+
+            if (!_castMaster || CastClockNow() < nextStatus) {
+                continue;
+            }
+
+            // replies to the previous request have had a full interval to
+            // arrive, so report them before asking again.
+            for (auto& status : _castMaster->slaveStatus()) {
+                LOG(INFO) << "Cast slave " << status.slaveId << " ("
+                    << status.address << "): received " << status.received
+                    << " late " << status.late
+                    << " concealed " << status.concealed
+                    << " recovered " << status.recovered
+                    << " depth " << status.depthFrames
+                    << " drift " << status.driftPpm << "ppm"
+                    << " rtt " << status.roundTripTime << "us";
+            }
+
+            nextStatus = CastClockNow() + CAST_STATUS_INTERVAL;
+            _castMaster->requestStatus(CastClockNow());
+        }
+    });
+}
+
+void SarAsioWrapper::stopCast()
+{
+    if (_castThread.joinable()) {
+        _castStop = true;
+        _castThread.join();
+    }
+
+    _castMaster.reset();
+    _castSlave.reset();
+    _castTransport.reset();
+    _castChannels[0].clear();
+    _castChannels[1].clear();
+
+    for (auto& slot : _castScratchSlots) {
+        _bufferConfig.asioBuffers[slot.first][_castEndpointIndex]
+            [slot.second] = nullptr;
+    }
+
+    _castScratchSlots.clear();
+    _castScratch.clear();
+}
+
+// The slave fills its recording endpoint before SAR copies it out, and the
+// master sends its playback endpoint once SAR has copied it in.
+void SarAsioWrapper::tickSar(long bufferIndex)
+{
+    if (_castSlave) {
+        _castSlave->tick(_castChannels[bufferIndex].data(), CastClockNow());
+    }
+
     _sar->tick(bufferIndex);
+
+    if (_castMaster) {
+        _castMaster->tick(_castChannels[bufferIndex].data(), _castOffset);
+        _castOffset += _bufferConfig.periodFrameSize;
+    }
+}
+
+void SarAsioWrapper::onTick(long bufferIndex, AsioBool directProcess)
+{
+    tickSar(bufferIndex);
     _userTick(bufferIndex, directProcess);
 }
 
+template<int Slot>
 void SarAsioWrapper::onTickStub(long bufferIndex, AsioBool directProcess)
 {
-    auto wrapper = gActiveWrapper;
+    auto wrapper = gActiveWrappers[Slot];
 
     if (wrapper) {
         wrapper->onTick(bufferIndex, directProcess);
@@ -630,14 +977,15 @@ void SarAsioWrapper::onTickStub(long bufferIndex, AsioBool directProcess)
 AsioTime *SarAsioWrapper::onTickWithTime(
     AsioTime *time, long bufferIndex, AsioBool directProcess)
 {
-    _sar->tick(bufferIndex);
+    tickSar(bufferIndex);
     return _userTickWithTime(time, bufferIndex, directProcess);
 }
 
+template<int Slot>
 AsioTime *SarAsioWrapper::onTickWithTimeStub(
     AsioTime *time, long bufferIndex, AsioBool directProcess)
 {
-    auto wrapper = gActiveWrapper;
+    auto wrapper = gActiveWrappers[Slot];
 
     if (wrapper) {
         return wrapper->onTickWithTime(time, bufferIndex, directProcess);
@@ -646,6 +994,14 @@ AsioTime *SarAsioWrapper::onTickWithTimeStub(
     return time;
 }
 
+const SarAsioWrapper::TickStubs
+    SarAsioWrapper::kTickStubs[SarAsioWrapper::kMaxActiveWrappers] = {
+    { &SarAsioWrapper::onTickStub<0>, &SarAsioWrapper::onTickWithTimeStub<0> },
+    { &SarAsioWrapper::onTickStub<1>, &SarAsioWrapper::onTickWithTimeStub<1> },
+    { &SarAsioWrapper::onTickStub<2>, &SarAsioWrapper::onTickWithTimeStub<2> },
+    { &SarAsioWrapper::onTickStub<3>, &SarAsioWrapper::onTickWithTimeStub<3> },
+};
+
 AsioSampleType SarAsioWrapper::getSampleType()
 {
     AsioSampleType physicalSampleType = Int32LSB;
@@ -87,12 +87,30 @@ private:
         void *asioBuffers[2];
     };
 
+    // ASIO callbacks carry no context pointer, so each active instance
+    // borrows one of a fixed set of static stubs bound to a slot.
+    struct TickStubs
+    {
+        AsioTickCallback *tick;
+        AsioTickWithTimeCallback *tickWithTime;
+    };
+
+    static const int kMaxActiveWrappers = 4;
+    static const TickStubs kTickStubs[kMaxActiveWrappers];
+
     bool initInnerDriver();
     void initVirtualChannels();
+    void startCast();
+    void stopCast();
+    void tickSar(long bufferIndex);
+    bool acquireTickStubs();
+    void releaseTickStubs();
     void onTick(long bufferIndex, AsioBool directProcess);
     AsioTime *onTickWithTime(
         AsioTime *time, long bufferIndex, AsioBool directProcess);
+    template<int Slot>
     static void onTickStub(long bufferIndex, AsioBool directProcess);
+    template<int Slot>
     static AsioTime *onTickWithTimeStub(
         AsioTime *time, long bufferIndex, AsioBool directProcess);
     AsioSampleType getSampleType();
@@ -103,12 +121,26 @@ private:
     BufferConfig _bufferConfig;
     std::shared_ptr<SarClient> _sar;
     std::shared_ptr<SarCastMaster> _castMaster;
+    std::shared_ptr<SarCastSlave> _castSlave;
+    std::unique_ptr<CastTransport> _castTransport;
+    std::thread _castThread;
+    std::atomic<bool> _castStop = false;
+    std::array<std::vector<void *>, 2> _castChannels;
+    // Stands in for cast endpoint channels the host didn't create buffers
+    // for; _castScratchSlots lists the (swap, channel) slots of
+    // _bufferConfig they fill, to be cleared again on stop.
+    std::vector<std::vector<uint8_t>> _castScratch;
+    std::vector<std::pair<size_t, int>> _castScratchSlots;
+    size_t _castEndpointIndex = 0;
+    uint64_t _castOffset = 0;
     CComPtr<IASIO> _innerDriver;
     std::vector<VirtualChannel> _virtualInputs;
     std::vector<VirtualChannel> _virtualOutputs;
+    void *_virtualBufferArena = nullptr;
     AsioTickCallback *_userTick;
     AsioTickWithTimeCallback *_userTickWithTime;
     AsioCallbacks _callbacks = {};
+    int _activeSlot = -1;
     AsioBool _isFakeChannelStarted[2] = {};
     std::vector<void *> _fakeBuffers;
     AsioSampleType _sampleType;
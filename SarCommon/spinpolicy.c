@@ -0,0 +1,93 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "spinpolicy.h"
+
+#include <string.h>
+
+static const char *const kWaitModeNames[] = { "spin", "block", "adaptive" };
+
+void spinPolicyInit(
+    SpinPolicy *policy, WaitMode mode,
+    uint64_t minWindowNs, uint64_t maxWindowNs)
+{
+    memset(policy, 0, sizeof(*policy));
+    policy->mode = mode;
+    policy->minWindowNs = minWindowNs;
+    policy->maxWindowNs = maxWindowNs < minWindowNs ? minWindowNs : maxWindowNs;
+    policy->windowNs = policy->maxWindowNs;
+}
+
+uint64_t spinPolicyWindow(const SpinPolicy *policy)
+{
+    switch (policy->mode) {
+    case WAIT_SPIN:
+        return UINT64_MAX;
+    case WAIT_BLOCK:
+        return 0;
+    default:
+        return policy->windowNs;
+    }
+}
+
+void spinPolicyUpdate(
+    SpinPolicy *policy, uint64_t waitedNs, uint64_t spunNs, bool spinHit)
+{
+    uint64_t target = waitedNs * 2;
+
+    policy->waits++;
+    policy->spinNs += spunNs;
+    policy->waitNs += waitedNs;
+
+    if (spinHit) {
+        policy->spinHits++;
+    }
+
+    if (policy->mode != WAIT_ADAPTIVE) {
+        return;
+    }
+
+    // grow at once so the next similar wait is caught, shrink gradually so
+    // one early packet doesn't undo it.
+    if (target > policy->maxWindowNs) {
+        policy->windowNs /= 2;
+    } else if (target > policy->windowNs) {
+        policy->windowNs = target;
+    } else {
+        policy->windowNs -= (policy->windowNs - target) / 8;
+    }
+
+    if (policy->windowNs < policy->minWindowNs) {
+        policy->windowNs = policy->minWindowNs;
+    }
+}
+
+bool parseWaitMode(const char *name, WaitMode *mode)
+{
+    for (int i = 0; i <= WAIT_ADAPTIVE; ++i) {
+        if (!strcmp(name, kWaitModeNames[i])) {
+            *mode = (WaitMode)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *waitModeName(WaitMode mode)
+{
+    return mode <= WAIT_ADAPTIVE ? kWaitModeNames[mode] : "unknown";
+}
@@ -0,0 +1,71 @@
+// SynchronousAudioRouter
+// Copyright (C) 2017 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_COMMON_SPINPOLICY_H
+#define _SAR_COMMON_SPINPOLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPIN_MIN_WINDOW_NS 1000
+#define SPIN_MAX_WINDOW_NS 100000
+
+typedef enum WaitMode
+{
+    WAIT_SPIN,
+    WAIT_BLOCK,
+    WAIT_ADAPTIVE,
+} WaitMode;
+
+// Decides how long a receiver should poll without blocking before falling
+// back to a blocking wait. In adaptive mode the window follows twice the
+// recent wait time, so back-to-back traffic is caught while spinning and
+// only long gaps pay for a wakeup. Waits longer than half the maximum
+// window aren't worth spinning for and shrink the window instead.
+typedef struct SpinPolicy
+{
+    WaitMode mode;
+    uint64_t windowNs;
+    uint64_t minWindowNs;
+    uint64_t maxWindowNs;
+    uint64_t waits;
+    uint64_t spinHits;
+    uint64_t spinNs;
+    uint64_t waitNs;
+} SpinPolicy;
+
+void spinPolicyInit(
+    SpinPolicy *policy, WaitMode mode,
+    uint64_t minWindowNs, uint64_t maxWindowNs);
+// Returns how long to spin before blocking: 0 blocks straight away and
+// UINT64_MAX never blocks.
+uint64_t spinPolicyWindow(const SpinPolicy *policy);
+// Reports a finished wait. waitedNs covers the whole wait, spunNs the part
+// spent spinning, and spinHit whether data turned up before blocking.
+void spinPolicyUpdate(
+    SpinPolicy *policy, uint64_t waitedNs, uint64_t spunNs, bool spinHit);
+bool parseWaitMode(const char *name, WaitMode *mode);
+const char *waitModeName(WaitMode mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SAR_COMMON_SPINPOLICY_H
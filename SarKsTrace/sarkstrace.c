@@ -0,0 +1,496 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Decodes a dump of the driver's KS ioctl trace (see kstrace.h) into one
+// line per event, oldest first. Builds anywhere with a C compiler, so the
+// dump can be looked at away from the machine it came from.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+typedef uint8_t UCHAR;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONG64;
+#endif
+
+#include "../SynchronousAudioRouter/kstrace.h"
+
+#define FILE_DEVICE_KS 0x2F
+#define KS_IOCTL(function, access) \
+    ((FILE_DEVICE_KS << 16) | ((access) << 14) | ((function) << 2) | 3)
+#define IOCTL_KS_PROPERTY KS_IOCTL(0, 0)
+
+#define KSPROPERTY_TYPE_GET 0x1
+#define KSPROPERTY_TYPE_SET 0x2
+#define KSPROPERTY_TYPE_BASICSUPPORT 0x200
+#define KSPROPERTY_TYPE_TOPOLOGY 0x10000000
+
+// Same layout as the GUID and KSPROPERTY at the start of the input.
+typedef struct TraceGuid
+{
+    uint32_t data1;
+    uint16_t data2;
+    uint16_t data3;
+    uint8_t data4[8];
+} TraceGuid;
+
+typedef struct TraceProperty
+{
+    TraceGuid set;
+    uint32_t id;
+    uint32_t flags;
+} TraceProperty;
+
+typedef struct TraceEvent
+{
+    const SarKsTraceEvent *event;
+    ULONG cpu;
+} TraceEvent;
+
+// Property names, indexed by id.
+typedef struct PropertySet
+{
+    const char *name;
+    TraceGuid guid;
+    const char *const *properties;
+    size_t propertyCount;
+} PropertySet;
+
+static const char *const gPinProperties[] = {
+    "KSPROPERTY_PIN_CINSTANCES",
+    "KSPROPERTY_PIN_CTYPES",
+    "KSPROPERTY_PIN_DATAFLOW",
+    "KSPROPERTY_PIN_DATARANGES",
+    "KSPROPERTY_PIN_DATAINTERSECTION",
+    "KSPROPERTY_PIN_INTERFACES",
+    "KSPROPERTY_PIN_MEDIUMS",
+    "KSPROPERTY_PIN_COMMUNICATION",
+    "KSPROPERTY_PIN_GLOBALCINSTANCES",
+    "KSPROPERTY_PIN_NECESSARYINSTANCES",
+    "KSPROPERTY_PIN_PHYSICALCONNECTION",
+    "KSPROPERTY_PIN_CATEGORY",
+    "KSPROPERTY_PIN_NAME",
+    "KSPROPERTY_PIN_CONSTRAINEDDATARANGES",
+    "KSPROPERTY_PIN_PROPOSEDATAFORMAT",
+    "KSPROPERTY_PIN_PROPOSEDATAFORMAT2",
+};
+
+// KSPROPERTY_AUDIO ids start at 1.
+static const char *const gAudioProperties[] = {
+    NULL,
+    "KSPROPERTY_AUDIO_LATENCY",
+    "KSPROPERTY_AUDIO_COPY_PROTECTION",
+    "KSPROPERTY_AUDIO_CHANNEL_CONFIG",
+    "KSPROPERTY_AUDIO_VOLUMELEVEL",
+    "KSPROPERTY_AUDIO_POSITION",
+    "KSPROPERTY_AUDIO_DYNAMIC_RANGE",
+    "KSPROPERTY_AUDIO_QUALITY",
+    "KSPROPERTY_AUDIO_SAMPLING_RATE",
+    "KSPROPERTY_AUDIO_DYNAMIC_SAMPLING_RATE",
+    "KSPROPERTY_AUDIO_MIX_LEVEL_TABLE",
+    "KSPROPERTY_AUDIO_MIX_LEVEL_CAPS",
+    "KSPROPERTY_AUDIO_MUX_SOURCE",
+    "KSPROPERTY_AUDIO_MUTE",
+    "KSPROPERTY_AUDIO_BASS",
+    "KSPROPERTY_AUDIO_MID",
+    "KSPROPERTY_AUDIO_TREBLE",
+    "KSPROPERTY_AUDIO_BASS_BOOST",
+    "KSPROPERTY_AUDIO_EQ_LEVEL",
+    "KSPROPERTY_AUDIO_NUM_EQ_BANDS",
+    "KSPROPERTY_AUDIO_EQ_BANDS",
+    "KSPROPERTY_AUDIO_AGC",
+    "KSPROPERTY_AUDIO_DELAY",
+    "KSPROPERTY_AUDIO_LOUDNESS",
+    "KSPROPERTY_AUDIO_WIDE_MODE",
+    "KSPROPERTY_AUDIO_WIDENESS",
+    "KSPROPERTY_AUDIO_REVERB_LEVEL",
+    "KSPROPERTY_AUDIO_CHORUS_LEVEL",
+    "KSPROPERTY_AUDIO_DEV_SPECIFIC",
+    "KSPROPERTY_AUDIO_DEMUX_DEST",
+    "KSPROPERTY_AUDIO_STEREO_ENHANCE",
+    "KSPROPERTY_AUDIO_MANUFACTURE_GUID",
+    "KSPROPERTY_AUDIO_PRODUCT_GUID",
+    "KSPROPERTY_AUDIO_CPU_RESOURCES",
+    "KSPROPERTY_AUDIO_STEREO_SPEAKER_GEOMETRY",
+    "KSPROPERTY_AUDIO_SURROUND_ENCODE",
+    "KSPROPERTY_AUDIO_3D_INTERFACE",
+    "KSPROPERTY_AUDIO_PEAKMETER",
+    "KSPROPERTY_AUDIO_ALGORITHM_INSTANCE",
+    "KSPROPERTY_AUDIO_FILTER_STATE",
+    "KSPROPERTY_AUDIO_PREFERRED_STATUS",
+    "KSPROPERTY_AUDIO_PEQ_MAX_BANDS",
+    "KSPROPERTY_AUDIO_PEQ_NUM_BANDS",
+    "KSPROPERTY_AUDIO_PEQ_BAND_CENTER_FREQ",
+    "KSPROPERTY_AUDIO_PEQ_BAND_Q_FACTOR",
+    "KSPROPERTY_AUDIO_PEQ_BAND_LEVEL",
+    "KSPROPERTY_AUDIO_CHORUS_MODULATION_RATE",
+    "KSPROPERTY_AUDIO_CHORUS_MODULATION_DEPTH",
+    "KSPROPERTY_AUDIO_REVERB_TIME",
+    "KSPROPERTY_AUDIO_REVERB_DELAY_FEEDBACK",
+    "KSPROPERTY_AUDIO_POSITIONEX",
+    "KSPROPERTY_AUDIO_MIC_ARRAY_GEOMETRY",
+};
+
+static const char *const gRtAudioProperties[] = {
+    "KSPROPERTY_RTAUDIO_GETPOSITIONFUNCTION",
+    "KSPROPERTY_RTAUDIO_BUFFER",
+    "KSPROPERTY_RTAUDIO_HWLATENCY",
+    "KSPROPERTY_RTAUDIO_POSITIONREGISTER",
+    "KSPROPERTY_RTAUDIO_CLOCKREGISTER",
+    "KSPROPERTY_RTAUDIO_BUFFER_WITH_NOTIFICATION",
+    "KSPROPERTY_RTAUDIO_REGISTER_NOTIFICATION_EVENT",
+    "KSPROPERTY_RTAUDIO_UNREGISTER_NOTIFICATION_EVENT",
+    "KSPROPERTY_RTAUDIO_QUERY_NOTIFICATION_SUPPORT",
+    "KSPROPERTY_RTAUDIO_PACKETCOUNT",
+    "KSPROPERTY_RTAUDIO_PRESENTATION_POSITION",
+    "KSPROPERTY_RTAUDIO_GETREADPACKET",
+    "KSPROPERTY_RTAUDIO_SETWRITEPACKET",
+    "KSPROPERTY_RTAUDIO_PACKETVREGISTER",
+};
+
+static const char *const gConnectionProperties[] = {
+    "KSPROPERTY_CONNECTION_STATE",
+    "KSPROPERTY_CONNECTION_PRIORITY",
+    "KSPROPERTY_CONNECTION_DATAFORMAT",
+    "KSPROPERTY_CONNECTION_ALLOCATORFRAMING",
+    "KSPROPERTY_CONNECTION_PROPOSEDATAFORMAT",
+    "KSPROPERTY_CONNECTION_ACQUIREORDERING",
+    "KSPROPERTY_CONNECTION_ALLOCATORFRAMING_EX",
+    "KSPROPERTY_CONNECTION_STARTAT",
+};
+
+#define PROPERTIES(x) x, sizeof(x) / sizeof(x[0])
+
+// The sets an audio filter like ours gets asked about. Anything else is
+// printed as a GUID.
+static const PropertySet gPropertySets[] = {
+    { "KSPROPSETID_Pin", { 0x8C134960, 0x51AD, 0x11CF,
+        { 0x87, 0x8A, 0x94, 0xF8, 0x01, 0xC1, 0x00, 0x00 } },
+        PROPERTIES(gPinProperties) },
+    { "KSPROPSETID_Audio", { 0x45FFAAA0, 0x6E1B, 0x11D0,
+        { 0xBC, 0xF2, 0x44, 0x45, 0x53, 0x54, 0x00, 0x00 } },
+        PROPERTIES(gAudioProperties) },
+    { "KSPROPSETID_RtAudio", { 0xA855A48C, 0x2F78, 0x4729,
+        { 0x90, 0x51, 0x19, 0x68, 0x74, 0x6B, 0x9E, 0xEF } },
+        PROPERTIES(gRtAudioProperties) },
+    { "KSPROPSETID_Connection", { 0x1D58C920, 0xAC9B, 0x11CF,
+        { 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00 } },
+        PROPERTIES(gConnectionProperties) },
+    { "KSPROPSETID_General", { 0x1464EDA5, 0x6A8F, 0x11D1,
+        { 0x9A, 0xA7, 0x00, 0xA0, 0xC9, 0x22, 0x31, 0x96 } }, NULL, 0 },
+    { "KSPROPSETID_Stream", { 0x65AABA60, 0x98AE, 0x11CF,
+        { 0xA1, 0x0D, 0x00, 0x20, 0xAF, 0xD1, 0x56, 0xE4 } }, NULL, 0 },
+    { "KSPROPSETID_Topology", { 0x720D4AC0, 0x7533, 0x11D0,
+        { 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00 } }, NULL, 0 },
+    { "KSPROPSETID_TopologyNode", { 0x45FFAAA1, 0x6E1B, 0x11D0,
+        { 0xBC, 0xF2, 0x44, 0x45, 0x53, 0x54, 0x00, 0x00 } }, NULL, 0 },
+    { "KSPROPSETID_Clock", { 0xDF12A4C0, 0xAC17, 0x11CF,
+        { 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00 } }, NULL, 0 },
+    { "KSPROPSETID_Jack", { 0x4509F757, 0x2D46, 0x4637,
+        { 0x8E, 0x62, 0xCE, 0x7D, 0xB9, 0x44, 0xF5, 0x7B } }, NULL, 0 },
+    { "KSPROPSETID_Wave", { 0x924E54B0, 0x630F, 0x11CF,
+        { 0xAD, 0xA7, 0x08, 0x00, 0x3E, 0x30, 0x49, 0x4A } }, NULL, 0 },
+    { "KSPROPSETID_AudioEngine", { 0x3A2F82DC, 0x886F, 0x4BAA,
+        { 0x9E, 0xB4, 0x08, 0x2B, 0x90, 0x25, 0xC5, 0x36 } }, NULL, 0 },
+};
+
+static const struct {
+    ULONG code;
+    const char *name;
+} gIoctls[] = {
+    { IOCTL_KS_PROPERTY, "IOCTL_KS_PROPERTY" },
+    { KS_IOCTL(1, 0), "IOCTL_KS_ENABLE_EVENT" },
+    { KS_IOCTL(2, 0), "IOCTL_KS_DISABLE_EVENT" },
+    { KS_IOCTL(3, 0), "IOCTL_KS_METHOD" },
+    { KS_IOCTL(4, 2), "IOCTL_KS_WRITE_STREAM" },
+    { KS_IOCTL(5, 1), "IOCTL_KS_READ_STREAM" },
+    { KS_IOCTL(6, 0), "IOCTL_KS_RESET_STATE" },
+};
+
+static const PropertySet *findPropertySet(const TraceGuid *guid)
+{
+    for (size_t i = 0; i < sizeof(gPropertySets) / sizeof(gPropertySets[0]);
+        ++i) {
+
+        if (!memcmp(&gPropertySets[i].guid, guid, sizeof(*guid))) {
+            return &gPropertySets[i];
+        }
+    }
+
+    return NULL;
+}
+
+static const char *ioctlName(ULONG code)
+{
+    for (size_t i = 0; i < sizeof(gIoctls) / sizeof(gIoctls[0]); ++i) {
+        if (gIoctls[i].code == code) {
+            return gIoctls[i].name;
+        }
+    }
+
+    return NULL;
+}
+
+static void printFlags(uint32_t flags)
+{
+    static const struct {
+        uint32_t flag;
+        const char *name;
+    } names[] = {
+        { KSPROPERTY_TYPE_GET, "GET" },
+        { KSPROPERTY_TYPE_SET, "SET" },
+        { KSPROPERTY_TYPE_BASICSUPPORT, "BASICSUPPORT" },
+        { KSPROPERTY_TYPE_TOPOLOGY, "TOPOLOGY" },
+    };
+    const char *sep = "";
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (flags & names[i].flag) {
+            printf("%s%s", sep, names[i].name);
+            flags &= ~names[i].flag;
+            sep = "|";
+        }
+    }
+
+    if (flags || !*sep) {
+        printf("%s0x%x", sep, flags);
+    }
+}
+
+static void printProperty(const SarKsTraceEvent *event)
+{
+    TraceProperty property;
+    const PropertySet *set;
+
+    if (event->readStatus) {
+        printf(" (input unreadable: 0x%x)", (uint32_t)event->readStatus);
+        return;
+    }
+
+    if (event->inputLength < sizeof(property)) {
+        printf(" (input too small)");
+        return;
+    }
+
+    memcpy(&property, event->data, sizeof(property));
+    set = findPropertySet(&property.set);
+
+    if (set) {
+        printf(" %s", set->name);
+    } else {
+        printf(" {%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x}",
+            property.set.data1, property.set.data2, property.set.data3,
+            property.set.data4[0], property.set.data4[1],
+            property.set.data4[2], property.set.data4[3],
+            property.set.data4[4], property.set.data4[5],
+            property.set.data4[6], property.set.data4[7]);
+    }
+
+    if (set && property.id < set->propertyCount &&
+        set->properties[property.id]) {
+
+        printf(" %s ", set->properties[property.id]);
+    } else {
+        printf(" %u ", property.id);
+    }
+
+    printFlags(property.flags);
+}
+
+static void printData(const SarKsTraceEvent *event)
+{
+    size_t size = event->inputLength;
+
+    if (size > SAR_KS_TRACE_DATA_SIZE) {
+        size = SAR_KS_TRACE_DATA_SIZE;
+    }
+
+    for (size_t i = 0; i < size; i += 16) {
+        printf("    %04zx:", i);
+
+        for (size_t j = i; j < size && j < i + 16; ++j) {
+            printf(" %02X", event->data[j]);
+        }
+
+        printf("\n");
+    }
+}
+
+static int compareEvents(const void *a, const void *b)
+{
+    const TraceEvent *x = a, *y = b;
+
+    if (x->event->timestamp != y->event->timestamp) {
+        return x->event->timestamp < y->event->timestamp ? -1 : 1;
+    }
+
+    if (x->cpu != y->cpu) {
+        return x->cpu < y->cpu ? -1 : 1;
+    }
+
+    return x->event->sequence < y->event->sequence ? -1 :
+        x->event->sequence > y->event->sequence;
+}
+
+static void *readFile(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    void *data = NULL;
+    long length;
+
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) || (length = ftell(file)) < 0 ||
+        fseek(file, 0, SEEK_SET)) {
+
+        perror(path);
+        goto out;
+    }
+
+    data = malloc(length ? length : 1);
+
+    if (!data || fread(data, 1, length, file) != (size_t)length) {
+        fprintf(stderr, "Couldn't read %s\n", path);
+        free(data);
+        data = NULL;
+        goto out;
+    }
+
+    *size = length;
+
+out:
+    fclose(file);
+    return data;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-x] kstrace.bin\n", name);
+    fprintf(stderr, "  -x  dump the captured start of each input buffer\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = NULL;
+    bool dumpData = false;
+    const SarKsTraceHeader *header;
+    const SarKsTraceRing *rings;
+    TraceEvent *events;
+    size_t size, count = 0;
+    uint8_t *data;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-x")) {
+            dumpData = true;
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!(data = readFile(path, &size))) {
+        return 1;
+    }
+
+    header = (const SarKsTraceHeader *)data;
+
+    if (size < sizeof(*header) || header->magic != SAR_KS_TRACE_MAGIC) {
+        fprintf(stderr, "%s isn't a SAR KS trace\n", path);
+        return 1;
+    }
+
+    if (header->version != SAR_KS_TRACE_VERSION ||
+        header->ringSize != SAR_KS_TRACE_RING_SIZE) {
+
+        fprintf(stderr, "%s is from a different driver version\n", path);
+        return 1;
+    }
+
+    if ((size - sizeof(*header)) / sizeof(SarKsTraceRing) <
+        header->ringCount) {
+
+        fprintf(stderr, "%s is truncated\n", path);
+        return 1;
+    }
+
+    rings = (const SarKsTraceRing *)(header + 1);
+    events = calloc((size_t)header->ringCount * SAR_KS_TRACE_RING_SIZE,
+        sizeof(TraceEvent));
+
+    for (ULONG cpu = 0; cpu < header->ringCount; ++cpu) {
+        for (ULONG i = 0; i < SAR_KS_TRACE_RING_SIZE; ++i) {
+            const SarKsTraceEvent *event = &rings[cpu].events[i];
+
+            if (event->sequence) {
+                events[count].event = event;
+                events[count].cpu = cpu;
+                count++;
+            }
+        }
+    }
+
+    qsort(events, count, sizeof(TraceEvent), compareEvents);
+
+    for (size_t i = 0; i < count; ++i) {
+        const SarKsTraceEvent *event = events[i].event;
+        const char *name = ioctlName(event->ioControlCode);
+        double us = (double)(event->timestamp - events[0].event->timestamp) *
+            1000000.0 / (double)header->frequency;
+
+        printf("%14.1f cpu %-3u pid %-6u ", us, events[i].cpu,
+            event->processId);
+
+        if (name) {
+            printf("%s", name);
+        } else {
+            printf("0x%x", event->ioControlCode);
+        }
+
+        if (event->ioControlCode == IOCTL_KS_PROPERTY) {
+            printProperty(event);
+        }
+
+        printf(" in %u out %u\n", event->inputLength, event->outputLength);
+
+        if (dumpData && event->ioControlCode == IOCTL_KS_PROPERTY &&
+            !event->readStatus) {
+
+            printData(event);
+        }
+    }
+
+    free(events);
+    free(data);
+    return 0;
+}
@@ -395,6 +395,32 @@ out:
     SarReleaseControlContext(controlContext);
 }
 
+// Whether a live or pending endpoint of this client already uses index.
+// Must be called with the control context mutex held.
+static BOOLEAN SarEndpointIndexInUse(
+    SarControlContext *controlContext, DWORD index)
+{
+    PLIST_ENTRY lists[] = {
+        &controlContext->endpointList,
+        &controlContext->pendingEndpointList
+    };
+
+    for (PLIST_ENTRY list : lists) {
+        for (PLIST_ENTRY entry = list->Flink; entry != list;
+            entry = entry->Flink) {
+
+            SarEndpoint *endpoint =
+                CONTAINING_RECORD(entry, SarEndpoint, listEntry);
+
+            if (endpoint->index == index) {
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
 NTSTATUS SarCreateEndpoint(
     PDEVICE_OBJECT device,
     PIRP irp,
@@ -427,11 +453,32 @@ NTSTATUS SarCreateEndpoint(
         return status;
     }
 
+    // checked again when the endpoint is queued; this just saves building
+    // filter factories for a request that can't succeed.
+    ExAcquireFastMutex(&controlContext->mutex);
+    BOOLEAN indexInUse = SarEndpointIndexInUse(controlContext, request->index);
+    ExReleaseFastMutex(&controlContext->mutex);
+
+    if (indexInUse) {
+        SAR_ERROR("Endpoint index %u is already in use", request->index);
+        return STATUS_OBJECT_NAME_COLLISION;
+    }
+
     status = STATUS_INSUFFICIENT_RESOURCES;
-    endpoint = (SarEndpoint *)
-        ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(SarEndpoint), SAR_TAG);
+
+    // set aside the process contexts now so opening the endpoint's pin
+    // doesn't have to allocate them. SarDeleteEndpoint gives them back.
+    if (!SarReserveObjects(
+        &gSarProcessContextPool, SAR_PROCESS_CONTEXTS_PER_ENDPOINT)) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    endpoint = (SarEndpoint *)SarAllocateObject(&gSarEndpointPool);
 
     if (!endpoint) {
+        SarUnreserveObjects(
+            &gSarProcessContextPool, SAR_PROCESS_CONTEXTS_PER_ENDPOINT);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
@@ -531,13 +578,20 @@ NTSTATUS SarCreateEndpoint(
         goto err_out;
     }
 
+    ExAcquireFastMutex(&controlContext->mutex);
+
+    if (SarEndpointIndexInUse(controlContext, request->index)) {
+        ExReleaseFastMutex(&controlContext->mutex);
+        SAR_ERROR("Endpoint index %u is already in use", request->index);
+        status = STATUS_OBJECT_NAME_COLLISION;
+        goto err_out;
+    }
+
     // Only call IoMarkIrpPending when there is no error and we WILL return STATUS_PENDING
     // but before any chance for the IRP to be completed (in SarProcessPendingEndpoints)
     // So before queuing the endpoint to the pendingEndpointList list
     IoMarkIrpPending(irp);
 
-    ExAcquireFastMutex(&controlContext->mutex);
-
     BOOLEAN runWorkItem = IsListEmpty(&controlContext->pendingEndpointList);
 
     InsertTailList(&controlContext->pendingEndpointList, &endpoint->listEntry);
@@ -607,7 +661,9 @@ VOID SarDeleteEndpoint(SarEndpoint *endpoint)
         SarStringFree(&endpoint->topologyFilterRefId);
     }
 
-    ExFreePoolWithTag(endpoint, SAR_TAG);
+    SarFreeObject(&gSarEndpointPool, endpoint);
+    SarUnreserveObjects(
+        &gSarProcessContextPool, SAR_PROCESS_CONTEXTS_PER_ENDPOINT);
 }
 
 VOID SarOrphanEndpoint(SarEndpoint *endpoint)
@@ -623,6 +679,23 @@ VOID SarOrphanEndpoint(SarEndpoint *endpoint)
     }
 }
 
+// Caller must hold the KS device mutex, which guards the filter factory's
+// child filter list.
+static VOID SarGenerateFormatChangeEvents(SarEndpoint *endpoint)
+{
+    for (PKSFILTER filter =
+            KsFilterFactoryGetFirstChildFilter(endpoint->filterFactory);
+         filter;
+         filter = KsFilterGetNextSiblingFilter(filter)) {
+
+        KsFilterGenerateEvents(filter,
+            &KSEVENTSETID_PinCapsChange,
+            KSEVENT_PINCAPS_FORMATCHANGE,
+            0, nullptr,
+            nullptr, nullptr);
+    }
+}
+
 NTSTATUS SarSendFormatChangeEvent(PDEVICE_OBJECT deviceObject, SarDriverExtension *extension)
 {
     PVOID restartKey = nullptr;
@@ -650,18 +723,7 @@ NTSTATUS SarSendFormatChangeEvent(PDEVICE_OBJECT deviceObject, SarDriverExtensio
                 CONTAINING_RECORD(entry, SarEndpoint, listEntry);
 
             entry = entry->Flink;
-
-            for (PKSFILTER filter =
-                    KsFilterFactoryGetFirstChildFilter(endpoint->filterFactory);
-                 filter;
-                 filter = KsFilterGetNextSiblingFilter(filter)) {
-
-                KsFilterGenerateEvents(filter,
-                    &KSEVENTSETID_PinCapsChange,
-                    KSEVENT_PINCAPS_FORMATCHANGE,
-                    0, nullptr,
-                    nullptr, nullptr);
-            }
+            SarGenerateFormatChangeEvents(endpoint);
         }
 
         ExReleaseFastMutexUnsafe(&controlContext->mutex);
@@ -674,3 +736,72 @@ NTSTATUS SarSendFormatChangeEvent(PDEVICE_OBJECT deviceObject, SarDriverExtensio
 
     return STATUS_SUCCESS;
 }
+
+NTSTATUS SarSendEndpointFormatChangeEvents(
+    PDEVICE_OBJECT deviceObject,
+    SarControlContext *controlContext,
+    PIRP irp)
+{
+    PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(irp);
+    PKSDEVICE ksDevice = KsGetDeviceForDeviceObject(deviceObject);
+    ULONG inputLength = irpStack->Parameters.DeviceIoControl.InputBufferLength;
+    DWORD indices[SAR_MAX_FORMAT_CHANGE_ENDPOINTS];
+    SarEndpoint *endpoints[SAR_MAX_FORMAT_CHANGE_ENDPOINTS];
+    ULONG indexCount = inputLength / sizeof(DWORD);
+    ULONG endpointCount = 0;
+    NTSTATUS status;
+
+    if (inputLength % sizeof(DWORD) || inputLength > sizeof(indices)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    status = SarReadUserBuffer(indices, irp, inputLength);
+
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    // only this client's endpoint list is walked, and its mutex is dropped
+    // before taking the device so this never nests inside the filter create
+    // lock order.
+    ExAcquireFastMutex(&controlContext->mutex);
+
+    PLIST_ENTRY entry = controlContext->endpointList.Flink;
+
+    while (entry != &controlContext->endpointList &&
+        endpointCount < SAR_MAX_FORMAT_CHANGE_ENDPOINTS) {
+
+        SarEndpoint *endpoint =
+            CONTAINING_RECORD(entry, SarEndpoint, listEntry);
+
+        entry = entry->Flink;
+
+        for (ULONG i = 0; i < indexCount; ++i) {
+            if (endpoint->index == indices[i]) {
+                SarRetainEndpoint(endpoint);
+                endpoints[endpointCount++] = endpoint;
+                break;
+            }
+        }
+    }
+
+    ExReleaseFastMutex(&controlContext->mutex);
+
+    if (endpointCount) {
+        KsAcquireDevice(ksDevice);
+
+        for (ULONG i = 0; i < endpointCount; ++i) {
+            SarGenerateFormatChangeEvents(endpoints[i]);
+        }
+
+        KsReleaseDevice(ksDevice);
+    }
+
+    // releasing can delete an orphaned endpoint, which takes the device
+    // itself.
+    for (ULONG i = 0; i < endpointCount; ++i) {
+        SarReleaseEndpoint(endpoints[i]);
+    }
+
+    return STATUS_SUCCESS;
+}
@@ -17,7 +17,7 @@
 #include <initguid.h>
 #include "sar.h"
 
-static void SarDeleteRegistryRedirect(PVOID ptr);
+static void SarDeleteRegistryRedirect(SarRedirectEntry *entry);
 
 DRIVER_UNLOAD SarUnload;
 EX_CALLBACK_FUNCTION SarRegistryCallback;
@@ -67,10 +67,18 @@ SarControlContext *SarCreateControlContext(PFILE_OBJECT fileObject)
     InitializeListHead(&controlContext->endpointList);
     InitializeListHead(&controlContext->pendingEndpointList);
     SarInitializeHandleQueue(&controlContext->handleQueue);
+
+    // the client keeps one handle queue wait outstanding.
+    if (!SarReserveObjects(&gSarHandleQueueIrpPool, 1)) {
+        ExFreePoolWithTag(controlContext, SAR_TAG);
+        return nullptr;
+    }
+
     controlContext->workItem = IoAllocateWorkItem(
         controlContext->fileObject->DeviceObject);
 
     if (!controlContext->workItem) {
+        SarUnreserveObjects(&gSarHandleQueueIrpPool, 1);
         ExFreePoolWithTag(controlContext, SAR_TAG);
         return nullptr;
     }
@@ -102,6 +110,9 @@ VOID SarDeleteControlContext(SarControlContext *controlContext)
         SarReleaseEndpoint(endpoint);
     }
 
+    SarDeleteHandleQueue(&controlContext->handleQueue);
+    SarUnreserveObjects(&gSarHandleQueueIrpPool, 1);
+
     if (controlContext->workItem) {
         IoFreeWorkItem(controlContext->workItem);
         controlContext->workItem = nullptr;
@@ -180,300 +191,10 @@ BOOLEAN SarOrphanControlContext(SarDriverExtension *extension, PIRP irp)
     return TRUE;
 }
 
-template<class Key, class T>
-static const char* getKsElementName(Key key, T mapping) {
-    for (size_t i = 0; mapping[i].name != NULL; i++) {
-        if (mapping[i].key == key)
-            return mapping[i].name;
-    }
-    return nullptr;
-}
-
-#ifdef SAR_DEBUG_KS_PROPERTIES
-static void SarToHexString(const char* input, int size, char* output) {
-    static const char* const hexMapping[] = {
-        "00", "01", "02", "03", "04", "05", "06", "07", "08", "09", "0A", "0B", "0C", "0D", "0E", "0F", "10", "11",
-        "12", "13", "14", "15", "16", "17", "18", "19", "1A", "1B", "1C", "1D", "1E", "1F", "20", "21", "22", "23",
-        "24", "25", "26", "27", "28", "29", "2A", "2B", "2C", "2D", "2E", "2F", "30", "31", "32", "33", "34", "35",
-        "36", "37", "38", "39", "3A", "3B", "3C", "3D", "3E", "3F", "40", "41", "42", "43", "44", "45", "46", "47",
-        "48", "49", "4A", "4B", "4C", "4D", "4E", "4F", "50", "51", "52", "53", "54", "55", "56", "57", "58", "59",
-        "5A", "5B", "5C", "5D", "5E", "5F", "60", "61", "62", "63", "64", "65", "66", "67", "68", "69", "6A", "6B",
-        "6C", "6D", "6E", "6F", "70", "71", "72", "73", "74", "75", "76", "77", "78", "79", "7A", "7B", "7C", "7D",
-        "7E", "7F", "80", "81", "82", "83", "84", "85", "86", "87", "88", "89", "8A", "8B", "8C", "8D", "8E", "8F",
-        "90", "91", "92", "93", "94", "95", "96", "97", "98", "99", "9A", "9B", "9C", "9D", "9E", "9F", "A0", "A1",
-        "A2", "A3", "A4", "A5", "A6", "A7", "A8", "A9", "AA", "AB", "AC", "AD", "AE", "AF", "B0", "B1", "B2", "B3",
-        "B4", "B5", "B6", "B7", "B8", "B9", "BA", "BB", "BC", "BD", "BE", "BF", "C0", "C1", "C2", "C3", "C4", "C5",
-        "C6", "C7", "C8", "C9", "CA", "CB", "CC", "CD", "CE", "CF", "D0", "D1", "D2", "D3", "D4", "D5", "D6", "D7",
-        "D8", "D9", "DA", "DB", "DC", "DD", "DE", "DF", "E0", "E1", "E2", "E3", "E4", "E5", "E6", "E7", "E8", "E9",
-        "EA", "EB", "EC", "ED", "EE", "EF", "F0", "F1", "F2", "F3", "F4", "F5", "F6", "F7", "F8", "F9", "FA", "FB",
-        "FC", "FD", "FE", "FF" };
-
-    for (int i = 0; i < size; i += 16) {
-        int maxCharNum = size - i;
-        if (maxCharNum > 16)
-            maxCharNum = 16;
-
-        *(output++) = hexMapping[(i >> 8) & 0xFF][0];
-        *(output++) = hexMapping[(i >> 8) & 0xFF][1];
-        *(output++) = hexMapping[(i) & 0xFF][0];
-        *(output++) = hexMapping[(i) & 0xFF][1];
-        *(output++) = ':';
-        *(output++) = ' ';
-
-        for (int row = 0; row < maxCharNum; row++) {
-                *(output++) = hexMapping[(unsigned char)input[i + row]][0];
-                *(output++) = hexMapping[(unsigned char)input[i + row]][1];
-                *(output++) = ' ';
-        }
-        *(output++) = '\n';
-    }
-    *(output++) = 0;
-}
-#endif
-
-static void SarLogKsIrp(PIRP irp) {
-    UNREFERENCED_PARAMETER(irp);
-
-#ifdef SAR_DEBUG_KS_PROPERTIES
-    PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(irp);
-    ULONG ioControlCode = irpStack->Parameters.DeviceIoControl.IoControlCode;
-    if (ioControlCode == IOCTL_KS_PROPERTY)
-    {
-
-        struct SetMapping {
-            const GUID key;
-            const char* name;
-        };
-#pragma region Mappings
-
-#define NAMED_GUID(x) {x, #x}
-        static const SetMapping knownSets[] = {
-            NAMED_GUID(KSPROPSETID_AC3),
-            NAMED_GUID(KSPROPSETID_Audio),
-            NAMED_GUID(KSPROPSETID_AudioBufferDuration),
-            NAMED_GUID(KSPROPSETID_AudioDecoderOut),
-            NAMED_GUID(KSPROPSETID_AudioEngine),
-            NAMED_GUID(KSPROPSETID_AudioSignalProcessing),
-            NAMED_GUID(KSPROPSETID_Bibliographic),
-            NAMED_GUID(KSPROPSETID_BtAudio),
-            NAMED_GUID(KSPROPSETID_Clock),
-            NAMED_GUID(KSPROPSETID_Connection),
-            NAMED_GUID(KSPROPSETID_CopyProt),
-            NAMED_GUID(KSPROPSETID_Cyclic),
-            NAMED_GUID(KSPROPSETID_DirectSound3DBuffer),
-            NAMED_GUID(KSPROPSETID_DirectSound3DListener),
-            NAMED_GUID(KSPROPSETID_DrmAudioStream),
-            NAMED_GUID(KSPROPSETID_DvdSubPic),
-            NAMED_GUID(KSPROPSETID_General),
-            NAMED_GUID(KSPROPSETID_GM),
-            NAMED_GUID(KSPROPSETID_Hrtf3d),
-            NAMED_GUID(KSPROPSETID_Itd3d),
-            NAMED_GUID(KSPROPSETID_Jack),
-            NAMED_GUID(KSPROPSETID_MediaSeeking),
-            NAMED_GUID(KSPROPSETID_MemoryTransport),
-            NAMED_GUID(KSPROPSETID_Mpeg2Vid),
-            NAMED_GUID(KSPROPSETID_MPEG4_MediaType_Attributes),
-            NAMED_GUID(KSPROPSETID_OverlayUpdate),
-            NAMED_GUID(KSPROPSETID_Pin),
-            NAMED_GUID(KSPROPSETID_PinMDLCacheClearProp),
-            NAMED_GUID(KSPROPSETID_Quality),
-            NAMED_GUID(KSPROPSETID_RtAudio),
-            NAMED_GUID(KSPROPSETID_SoundDetector),
-            NAMED_GUID(KSPROPSETID_Stream),
-            NAMED_GUID(KSPROPSETID_StreamAllocator),
-            NAMED_GUID(KSPROPSETID_StreamInterface),
-            NAMED_GUID(KSPROPSETID_Topology),
-            NAMED_GUID(KSPROPSETID_TopologyNode),
-            NAMED_GUID(KSPROPSETID_TSRateChange),
-            NAMED_GUID(KSPROPSETID_VBICAP_PROPERTIES),
-            NAMED_GUID(KSPROPSETID_VBICodecFiltering),
-            NAMED_GUID(KSPROPSETID_VPConfig),
-            NAMED_GUID(KSPROPSETID_VPVBIConfig),
-            NAMED_GUID(KSPROPSETID_VramCapture),
-            NAMED_GUID(KSPROPSETID_Wave),
-            NAMED_GUID(PROPSETID_ALLOCATOR_CONTROL),
-            NAMED_GUID(PROPSETID_EXT_DEVICE),
-            NAMED_GUID(PROPSETID_EXT_TRANSPORT),
-            NAMED_GUID(PROPSETID_TIMECODE_READER),
-            NAMED_GUID(PROPSETID_TUNER),
-            NAMED_GUID(PROPSETID_VIDCAP_CAMERACONTROL),
-            NAMED_GUID(PROPSETID_VIDCAP_CROSSBAR),
-            NAMED_GUID(PROPSETID_VIDCAP_DROPPEDFRAMES),
-            NAMED_GUID(PROPSETID_VIDCAP_SELECTOR),
-            NAMED_GUID(PROPSETID_VIDCAP_TVAUDIO),
-            NAMED_GUID(PROPSETID_VIDCAP_VIDEOCOMPRESSION),
-            NAMED_GUID(PROPSETID_VIDCAP_VIDEOCONTROL),
-            NAMED_GUID(PROPSETID_VIDCAP_VIDEODECODER),
-            NAMED_GUID(PROPSETID_VIDCAP_VIDEOENCODER),
-            NAMED_GUID(PROPSETID_VIDCAP_VIDEOPROCAMP),
-            {{0}, NULL}
-        };
-#undef NAMED_GUID
-
-        struct PropertyNameMapping {
-            ULONG key;
-            const char* name;
-        };
-
-#define NAMED_PROPERTY(x) {x, #x}
-        static const PropertyNameMapping pinPropertiesMapping[] = {
-            NAMED_PROPERTY(KSPROPERTY_PIN_CINSTANCES),
-            NAMED_PROPERTY(KSPROPERTY_PIN_CTYPES),
-            NAMED_PROPERTY(KSPROPERTY_PIN_DATAFLOW),
-            NAMED_PROPERTY(KSPROPERTY_PIN_DATARANGES),
-            NAMED_PROPERTY(KSPROPERTY_PIN_DATAINTERSECTION),
-            NAMED_PROPERTY(KSPROPERTY_PIN_INTERFACES),
-            NAMED_PROPERTY(KSPROPERTY_PIN_MEDIUMS),
-            NAMED_PROPERTY(KSPROPERTY_PIN_COMMUNICATION),
-            NAMED_PROPERTY(KSPROPERTY_PIN_GLOBALCINSTANCES),
-            NAMED_PROPERTY(KSPROPERTY_PIN_NECESSARYINSTANCES),
-            NAMED_PROPERTY(KSPROPERTY_PIN_PHYSICALCONNECTION),
-            NAMED_PROPERTY(KSPROPERTY_PIN_CATEGORY),
-            NAMED_PROPERTY(KSPROPERTY_PIN_NAME),
-            NAMED_PROPERTY(KSPROPERTY_PIN_CONSTRAINEDDATARANGES),
-            NAMED_PROPERTY(KSPROPERTY_PIN_PROPOSEDATAFORMAT),
-            NAMED_PROPERTY(KSPROPERTY_PIN_PROPOSEDATAFORMAT2),
-            {0, NULL}
-        };
-
-#define NAMED_PROPERTY(x) {x, #x}
-        static const PropertyNameMapping audioPropertiesMapping[] = {
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_LATENCY),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_COPY_PROTECTION),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_CHANNEL_CONFIG),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_VOLUMELEVEL),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_POSITION),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_DYNAMIC_RANGE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_QUALITY),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_SAMPLING_RATE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_DYNAMIC_SAMPLING_RATE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_MIX_LEVEL_TABLE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_MIX_LEVEL_CAPS),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_MUX_SOURCE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_MUTE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_BASS),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_MID),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_TREBLE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_BASS_BOOST),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_EQ_LEVEL),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_NUM_EQ_BANDS),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_EQ_BANDS),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_AGC),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_DELAY),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_LOUDNESS),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_WIDE_MODE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_WIDENESS),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_REVERB_LEVEL),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_CHORUS_LEVEL),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_DEV_SPECIFIC),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_DEMUX_DEST),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_STEREO_ENHANCE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_MANUFACTURE_GUID),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_PRODUCT_GUID),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_CPU_RESOURCES),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_STEREO_SPEAKER_GEOMETRY),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_SURROUND_ENCODE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_3D_INTERFACE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_PEAKMETER),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_ALGORITHM_INSTANCE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_FILTER_STATE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_PREFERRED_STATUS),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_PEQ_MAX_BANDS),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_PEQ_NUM_BANDS),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_PEQ_BAND_CENTER_FREQ),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_PEQ_BAND_Q_FACTOR),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_PEQ_BAND_LEVEL),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_CHORUS_MODULATION_RATE),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_CHORUS_MODULATION_DEPTH),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_REVERB_TIME),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_REVERB_DELAY_FEEDBACK),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_POSITIONEX),
-            NAMED_PROPERTY(KSPROPERTY_AUDIO_MIC_ARRAY_GEOMETRY),
-            {0, NULL}
-        };
-
-        static const PropertyNameMapping rtaudioPropertiesMapping[] = {
-            NAMED_PROPERTY(KSPROPERTY_RTAUDIO_GETPOSITIONFUNCTION),
-            NAMED_PROPERTY(KSPROPERTY_RTAUDIO_BUFFER),
-            NAMED_PROPERTY(KSPROPERTY_RTAUDIO_HWLATENCY),
-            NAMED_PROPERTY(KSPROPERTY_RTAUDIO_POSITIONREGISTER),
-            NAMED_PROPERTY(KSPROPERTY_RTAUDIO_CLOCKREGISTER),
-            NAMED_PROPERTY(KSPROPERTY_RTAUDIO_BUFFER_WITH_NOTIFICATION),
-            NAMED_PROPERTY(KSPROPERTY_RTAUDIO_REGISTER_NOTIFICATION_EVENT),
-            NAMED_PROPERTY(KSPROPERTY_RTAUDIO_UNREGISTER_NOTIFICATION_EVENT),
-            NAMED_PROPERTY(KSPROPERTY_RTAUDIO_QUERY_NOTIFICATION_SUPPORT),
-            {9, "KSPROPERTY_RTAUDIO_PACKETCOUNT"},
-            {10, "KSPROPERTY_RTAUDIO_PRESENTATION_POSITION"},
-            {11, "KSPROPERTY_RTAUDIO_GETREADPACKET"},
-            {12, "KSPROPERTY_RTAUDIO_SETWRITEPACKET"},
-            {13, "KSPROPERTY_RTAUDIO_PACKETVREGISTER"},
-            {0, NULL}
-        };
-
-        static const PropertyNameMapping connectionPropertiesMapping[] = {
-            NAMED_PROPERTY(KSPROPERTY_CONNECTION_PRIORITY),
-            NAMED_PROPERTY(KSPROPERTY_CONNECTION_DATAFORMAT),
-            NAMED_PROPERTY(KSPROPERTY_CONNECTION_ALLOCATORFRAMING),
-            NAMED_PROPERTY(KSPROPERTY_CONNECTION_PROPOSEDATAFORMAT),
-            NAMED_PROPERTY(KSPROPERTY_CONNECTION_ACQUIREORDERING),
-            NAMED_PROPERTY(KSPROPERTY_CONNECTION_ALLOCATORFRAMING_EX),
-            NAMED_PROPERTY(KSPROPERTY_CONNECTION_STARTAT),
-            {0, NULL}
-        };
-
-
-#pragma endregion
-
-        KSPROPERTY property;
-        char inputBuffer[1024];
-        char inputBufferString[4096];
-        NTSTATUS result = SarReadUserBuffer(
-            &property, irp, sizeof(property));
-        int size = irpStack->Parameters.DeviceIoControl.InputBufferLength;
-        if (size > 1024)
-            size = 1024;
-
-        SarReadUserBuffer(
-            inputBuffer, irp, size);
-
-        if (result == 0) {
-            const char* setName = getKsElementName(property.Set, knownSets);
-            const char* propertyNameStr = nullptr;
-            char propertyName[256];
-            if (property.Set == KSPROPSETID_Pin)
-                propertyNameStr = getKsElementName(property.Id, pinPropertiesMapping);
-            else if (property.Set == KSPROPSETID_Audio)
-                propertyNameStr = getKsElementName(property.Id, audioPropertiesMapping);
-            else if (property.Set == KSPROPSETID_RtAudio)
-                propertyNameStr = getKsElementName(property.Id, rtaudioPropertiesMapping);
-            else if (property.Set == KSPROPSETID_Connection)
-                propertyNameStr = getKsElementName(property.Id, connectionPropertiesMapping);
-
-            if(propertyNameStr)
-                strncpy(propertyName, propertyNameStr, sizeof(propertyName));
-            else
-                _snprintf(propertyName, sizeof(propertyName), "%d", property.Id);
-
-            SAR_TRACE("IRQ KS_PROPERTY: Set: %s, Property: %s, Flags: 0x%x, inputSize: %d, outputSize: %d",
-                setName, propertyName, property.Flags, irpStack->Parameters.DeviceIoControl.InputBufferLength, irpStack->Parameters.DeviceIoControl.OutputBufferLength);
-        }
-        else {
-            SAR_TRACE("IRQ KS_PROPERTY: unknown (size too small: %d), error: 0x%x, inputSize: %d, outputSize: %d", irpStack->Parameters.DeviceIoControl.InputBufferLength, result, irpStack->Parameters.DeviceIoControl.InputBufferLength, irpStack->Parameters.DeviceIoControl.OutputBufferLength);
-        }
-
-        if (size < 1024) {
-            SarToHexString(inputBuffer, size, inputBufferString);
-            SAR_TRACE("Data: %s", inputBufferString);
-        }
-
-    }
-    else
-    {
-        SAR_TRACE("IRQ 0x%x", ioControlCode);
-    }
-#endif
-}
+const ULONG gSarControlFileTag = SAR_TAG;
 
+// Only used at create time; after that the file object is tagged and
+// SarIsControlFileObject is all the other dispatch routines need.
 BOOL SarIsControlIrp(PIRP irp) {
     UNICODE_STRING referencePath;
     PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(irp);
@@ -516,6 +237,11 @@ NTSTATUS SarIrpCreate(PDEVICE_OBJECT deviceObject, PIRP irp)
         goto out;
     }
 
+    // the file object holds its own reference so the dispatch routines can
+    // use FsContext2 without a lookup until IRP_MJ_CLOSE, which can't arrive
+    // while any other IRP for the file object is in flight.
+    SarRetainControlContext(controlContext);
+    irpStack->FileObject->FsContext = (PVOID)&gSarControlFileTag;
     irpStack->FileObject->FsContext2 = controlContext;
 
 out:
@@ -536,15 +262,17 @@ NTSTATUS SarIrpClose(PDEVICE_OBJECT deviceObject, PIRP irp)
         (SarDriverExtension *)IoGetDriverObjectExtension(
             deviceObject->DriverObject, DriverEntry);
 
-    UNREFERENCED_PARAMETER(irpStack);
-
-    if (!SarIsControlIrp(irp)) {
+    if (!SarIsControlFileObject(irpStack->FileObject)) {
         SAR_DEBUG("close KS %wZ", &irpStack->FileObject->FileName);
         return extension->ksDispatchClose(deviceObject, irp);
     }
 
     SAR_DEBUG("IRP_MJ_CLOSE: %wZ", &irpStack->FileObject->FileName);
     SarOrphanControlContext(extension, irp);
+    SarReleaseControlContext(
+        (SarControlContext *)irpStack->FileObject->FsContext2);
+    irpStack->FileObject->FsContext = nullptr;
+    irpStack->FileObject->FsContext2 = nullptr;
 
     status = STATUS_SUCCESS;
     irp->IoStatus.Status = status;
@@ -560,9 +288,7 @@ NTSTATUS SarIrpCleanup(PDEVICE_OBJECT deviceObject, PIRP irp)
         (SarDriverExtension *)IoGetDriverObjectExtension(
             deviceObject->DriverObject, DriverEntry);
 
-    UNREFERENCED_PARAMETER(irpStack);
-
-    if (!SarIsControlIrp(irp)) {
+    if (!SarIsControlFileObject(irpStack->FileObject)) {
         SAR_DEBUG("cleanup KS %wZ", &irpStack->FileObject->FileName);
         return extension->ksDispatchCleanup(deviceObject, irp);
     }
@@ -585,18 +311,17 @@ NTSTATUS SarIrpDeviceControl(PDEVICE_OBJECT deviceObject, PIRP irp)
         (SarDriverExtension *)IoGetDriverObjectExtension(
             deviceObject->DriverObject, DriverEntry);
 
-    if (!SarIsControlIrp(irp)) {
-        SarLogKsIrp(irp);
+    irpStack = IoGetCurrentIrpStackLocation(irp);
+
+    if (!SarIsControlFileObject(irpStack->FileObject)) {
+        SarTraceKsIrp(irp);
         return extension->ksDispatchDeviceControl(deviceObject, irp);
     }
 
-    irpStack = IoGetCurrentIrpStackLocation(irp);
     ioControlCode = irpStack->Parameters.DeviceIoControl.IoControlCode;
 
-    ExAcquireFastMutex(&extension->mutex);
-    SarControlContext * controlContext = (SarControlContext *)SarGetTableEntry(
-        &extension->controlContextTable, irpStack->FileObject);
-    ExReleaseFastMutex(&extension->mutex);
+    SarControlContext *controlContext =
+        (SarControlContext *)irpStack->FileObject->FsContext2;
 
     switch (ioControlCode) {
         case SAR_SET_BUFFER_LAYOUT: {
@@ -677,7 +402,13 @@ NTSTATUS SarIrpDeviceControl(PDEVICE_OBJECT deviceObject, PIRP irp)
             break;
         }
         case SAR_SEND_FORMAT_CHANGE_EVENT:
-            ntStatus = SarSendFormatChangeEvent(deviceObject, extension);
+            if (irpStack->Parameters.DeviceIoControl.InputBufferLength) {
+                ntStatus = SarSendEndpointFormatChangeEvents(
+                    deviceObject, controlContext, irp);
+            } else {
+                ntStatus = SarSendFormatChangeEvent(deviceObject, extension);
+            }
+
             break;
         default:
             SAR_ERROR("Unknown ioctl %lu", ioControlCode);
@@ -697,7 +428,6 @@ NTSTATUS SarIrpDeviceControl(PDEVICE_OBJECT deviceObject, PIRP irp)
 VOID SarUnload(PDRIVER_OBJECT driverObject)
 {
     SAR_INFO("SAR is unloading");
-    KIRQL irql;
     SarDriverExtension *extension =
         (SarDriverExtension *)IoGetDriverObjectExtension(
             driverObject, DriverEntry);
@@ -710,33 +440,62 @@ VOID SarUnload(PDRIVER_OBJECT driverObject)
         CmUnRegisterCallback(extension->filterCookie);
     }
 
-    irql = ExAcquireSpinLockExclusive(&extension->registryRedirectLock);
-    SarClearStringTable(
+    KeEnterCriticalRegion();
+    ExAcquireResourceExclusiveLite(&extension->registryRedirectLock, TRUE);
+    SarClearRedirectTable(
         &extension->registryRedirectTableWow64, SarDeleteRegistryRedirect);
-    SarClearStringTable(
+    SarClearRedirectTable(
         &extension->registryRedirectTable, SarDeleteRegistryRedirect);
-    ExReleaseSpinLockExclusive(&extension->registryRedirectLock, irql);
+    ExReleaseResourceLite(&extension->registryRedirectLock);
+    KeLeaveCriticalRegion();
+    ExDeleteResourceLite(&extension->registryRedirectLock);
 
     if (extension->filterUser) {
         // Allocated by SeQueryInformationToken
         ExFreePool(extension->filterUser);
     }
+
+    SarDeleteObjectPool(&gSarHandleQueueIrpPool);
+    SarDeleteObjectPool(&gSarProcessContextPool);
+    SarDeleteObjectPool(&gSarEndpointPool);
+    SarDeleteKsTrace();
 }
 
 BOOL SarFilterMatchesCurrentProcess(SarDriverExtension *extension)
 {
+    PEPROCESS process = PsGetCurrentProcess();
+    LONGLONG createTime = PsGetProcessCreateTimeQuadPart(process);
     PTOKEN_USER tokenUser = nullptr;
-    NTSTATUS status = SarCopyProcessUser(PsGetCurrentProcess(), &tokenUser);
+    BOOLEAN isMatch;
+    BOOLEAN found;
+    KIRQL irql;
+
+    // A process's primary token doesn't change once it's running, so the
+    // answer only has to be worked out once per process.
+    irql = ExAcquireSpinLockShared(&extension->processMatchLock);
+    found = SarLookupProcessMatch(
+        &extension->processMatchCache, process, createTime, &isMatch);
+    ExReleaseSpinLockShared(&extension->processMatchLock, irql);
+
+    if (found) {
+        return isMatch;
+    }
+
+    NTSTATUS status = SarCopyProcessUser(process, &tokenUser);
 
     if (!NT_SUCCESS(status)) {
         return FALSE;
     }
 
-    BOOL isMatch = RtlEqualSid(
+    isMatch = RtlEqualSid(
         extension->filterUser->User.Sid,
         tokenUser->User.Sid);
 
     ExFreePool(tokenUser);
+    irql = ExAcquireSpinLockExclusive(&extension->processMatchLock);
+    SarStoreProcessMatch(
+        &extension->processMatchCache, process, createTime, isMatch);
+    ExReleaseSpinLockExclusive(&extension->processMatchLock, irql);
     return isMatch;
 }
 
@@ -745,11 +504,9 @@ BOOL SarFilterMatchesPath(
     PCUNICODE_STRING path,
     PUNICODE_STRING redirectPath)
 {
-    PRTL_AVL_TABLE table = &extension->registryRedirectTable;
-    PVOID entry = nullptr;
-    KIRQL irql;
-    UNICODE_STRING nonpagedPath;
-    NTSTATUS status = STATUS_SUCCESS;
+    SarRedirectTable *table = &extension->registryRedirectTable;
+    SarRedirectEntry *entry = nullptr;
+    ULONG hash;
 
     if (!path) {
         return FALSE;
@@ -761,24 +518,22 @@ BOOL SarFilterMatchesPath(
     }
 #endif
 
-    // TODO: we get a path that's in paged memory from the configuration manager
-    // so we can't access it with IRQL raised to dispatch level by the spinlock.
-    // Probably better to just use an ERESOURCE or something here instead.
-    status = SarStringDuplicate(&nonpagedPath, path);
-
-    if (!NT_SUCCESS(status)) {
+    // Nearly every query is for a key we don't redirect, and most of those
+    // are ruled out by their length alone.
+    if (!SarRedirectTableMayContain(table, path, &hash)) {
         return FALSE;
     }
 
-    irql = ExAcquireSpinLockShared(&extension->registryRedirectLock);
-    entry = SarGetStringTableEntry(table, &nonpagedPath);
+    KeEnterCriticalRegion();
+    ExAcquireResourceSharedLite(&extension->registryRedirectLock, TRUE);
+    entry = SarLookupRedirectEntry(table, path, hash);
 
     if (entry) {
-        *redirectPath = *(PCUNICODE_STRING)entry;
+        *redirectPath = *(PCUNICODE_STRING)entry->value;
     }
 
-    ExReleaseSpinLockShared(&extension->registryRedirectLock, irql);
-    SarStringFree(&nonpagedPath);
+    ExReleaseResourceLite(&extension->registryRedirectLock);
+    KeLeaveCriticalRegion();
     return entry != nullptr;
 }
 
@@ -962,27 +717,56 @@ NTSTATUS SarRegistryCallback(PVOID context, PVOID argument1, PVOID argument2)
     return STATUS_SUCCESS;
 }
 
-static void SarDeleteRegistryRedirect(PVOID ptr)
+static void SarDeleteRegistryRedirect(SarRedirectEntry *entry)
 {
-    PUNICODE_STRING str = (PUNICODE_STRING)ptr;
+    PUNICODE_STRING str = (PUNICODE_STRING)entry->value;
+
+    if (str) {
+        if (str->Buffer) {
+            SarStringFree(str);
+        }
+
+        ExFreePoolWithTag(str, SAR_TAG);
+    }
 
-    if (str->Buffer) {
-        SarStringFree(str);
+    if (entry->key.Buffer) {
+        SarStringFree(&entry->key);
     }
 
-    ExFreePoolWithTag(str, SAR_TAG);
+    ExFreePoolWithTag(entry, SAR_TAG);
+}
+
+static WCHAR SarUpcaseChar(WCHAR c)
+{
+    return RtlUpcaseUnicodeChar(c);
 }
 
 static NTSTATUS SarAddRegistryRedirect(
-    PRTL_AVL_TABLE table, NTSTRSAFE_PCWSTR src, NTSTRSAFE_PCWSTR dst)
+    SarRedirectTable *table, NTSTRSAFE_PCWSTR src, NTSTRSAFE_PCWSTR dst)
 {
     NTSTATUS status = STATUS_SUCCESS;
     UNICODE_STRING srcLocal = {}, dstLocal = {};
     PUNICODE_STRING dstHeap = nullptr;
+    SarRedirectEntry *entry = nullptr;
 
     RtlUnicodeStringInit(&srcLocal, src);
     RtlUnicodeStringInit(&dstLocal, dst);
 
+    entry = (SarRedirectEntry *)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, sizeof(SarRedirectEntry), SAR_TAG);
+
+    if (!entry) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto err;
+    }
+
+    RtlZeroMemory(entry, sizeof(SarRedirectEntry));
+    status = SarStringDuplicate(&entry->key, &srcLocal);
+
+    if (!NT_SUCCESS(status)) {
+        goto err;
+    }
+
     dstHeap = (PUNICODE_STRING)ExAllocatePool2(
         POOL_FLAG_NON_PAGED, sizeof(UNICODE_STRING), SAR_TAG);
 
@@ -992,32 +776,42 @@ static NTSTATUS SarAddRegistryRedirect(
     }
 
     RtlZeroMemory(dstHeap, sizeof(UNICODE_STRING));
+    entry->value = dstHeap;
     status = SarStringDuplicate(dstHeap, &dstLocal);
 
     if (!NT_SUCCESS(status)) {
         goto err;
     }
 
-    status = SarInsertStringTableEntry(table, &srcLocal, dstHeap);
-
-    if (!NT_SUCCESS(status)) {
+    if (!SarInsertRedirectEntry(table, entry)) {
+        status = STATUS_OBJECT_NAME_EXISTS;
         goto err;
     }
 
     return STATUS_SUCCESS;
 
 err:
-    if (dstHeap) {
-        if (dstHeap->Buffer) {
-            SarStringFree(dstHeap);
-        }
-
-        ExFreePoolWithTag(dstHeap, SAR_TAG);
+    if (entry) {
+        SarDeleteRegistryRedirect(entry);
     }
 
     return status;
 }
 
+static VOID SarLogRegistryRedirects(SarRedirectTable *table, PCSTR kind)
+{
+    UNREFERENCED_PARAMETER(kind);
+
+    for (ULONG i = 0; i < SAR_REDIRECT_BUCKET_COUNT; ++i) {
+        for (SarRedirectEntry *entry = table->buckets[i]; entry;
+             entry = entry->next) {
+
+            SAR_DEBUG("%sRegistry mapping: %wZ -> %wZ",
+                kind, &entry->key, (PUNICODE_STRING)entry->value);
+        }
+    }
+}
+
 #define REDIRECT_INPROC_WOW64(src, dst) \
     do { \
         status = SarAddRegistryRedirect(wow64, \
@@ -1045,9 +839,8 @@ err:
 static NTSTATUS SarAddAllRegistryRedirects(SarDriverExtension *extension)
 {
     NTSTATUS status = STATUS_SUCCESS;
-    PVOID p;
-    PRTL_AVL_TABLE wow64 = &extension->registryRedirectTableWow64;
-    PRTL_AVL_TABLE table = &extension->registryRedirectTable;
+    SarRedirectTable *wow64 = &extension->registryRedirectTableWow64;
+    SarRedirectTable *table = &extension->registryRedirectTable;
 
     // MMDeviceEnumerator
     REDIRECT(
@@ -1059,25 +852,8 @@ static NTSTATUS SarAddAllRegistryRedirects(SarDriverExtension *extension)
         L"{739191CC-CCBE-45D8-8D24-828D8E989E8E}"
     );
 
-    for (p = RtlEnumerateGenericTableAvl(table, TRUE); p;
-         p = RtlEnumerateGenericTableAvl(table, FALSE)) {
-
-        SarStringTableEntry *entry = (SarStringTableEntry *)p;
-        UNREFERENCED_PARAMETER(entry);
-
-        SAR_DEBUG("Registry mapping: %wZ -> %wZ", &entry->key, entry->value);
-    }
-
-    for (p = RtlEnumerateGenericTableAvl(wow64, TRUE); p;
-         p = RtlEnumerateGenericTableAvl(wow64, FALSE)) {
-
-        SarStringTableEntry *entry = (SarStringTableEntry *)p;
-        UNREFERENCED_PARAMETER(entry);
-
-        SAR_DEBUG("WOW64 Registry mapping: %wZ -> %wZ",
-            &entry->key, entry->value);
-    }
-
+    SarLogRegistryRedirects(table, "");
+    SarLogRegistryRedirects(wow64, "WOW64 ");
     return STATUS_SUCCESS;
 }
 
@@ -1106,11 +882,25 @@ extern "C" NTSTATUS DriverEntry(
         return status;
     }
 
+    status = SarInitializeKsTrace();
+
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
     RtlZeroMemory(extension, sizeof(SarDriverExtension));
     ExInitializeFastMutex(&extension->mutex);
+    SarInitializeObjectPool(&gSarEndpointPool, sizeof(SarEndpoint), 4);
+    SarInitializeObjectPool(
+        &gSarProcessContextPool, sizeof(SarEndpointProcessContext), 16);
+    SarInitializeObjectPool(
+        &gSarHandleQueueIrpPool, sizeof(SarHandleQueueIrp), 4);
     SarInitializeTable(&extension->controlContextTable);
-    SarInitializeStringTable(&extension->registryRedirectTableWow64);
-    SarInitializeStringTable(&extension->registryRedirectTable);
+    ExInitializeResourceLite(&extension->registryRedirectLock);
+    SarInitializeRedirectTable(
+        &extension->registryRedirectTableWow64, SarUpcaseChar);
+    SarInitializeRedirectTable(
+        &extension->registryRedirectTable, SarUpcaseChar);
     status = SarAddAllRegistryRedirects(extension);
 
     if (!NT_SUCCESS(status)) {
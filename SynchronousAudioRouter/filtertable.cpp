@@ -0,0 +1,218 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sar.h"
+
+static WCHAR SarFoldChar(SarRedirectTable *table, WCHAR c)
+{
+    if (c < 0x80) {
+        return c >= L'a' && c <= L'z' ? (WCHAR)(c - (L'a' - L'A')) : c;
+    }
+
+    return table->upcase(c);
+}
+
+// FNV-1a over the upcased characters.
+static ULONG SarHashRedirectKey(SarRedirectTable *table, PCUNICODE_STRING key)
+{
+    ULONG hash = 2166136261u;
+    USHORT length = key->Length / sizeof(WCHAR);
+
+    for (USHORT i = 0; i < length; ++i) {
+        hash = (hash ^ SarFoldChar(table, key->Buffer[i])) * 16777619u;
+    }
+
+    return hash;
+}
+
+static ULONG SarRedirectBucket(ULONG hash)
+{
+    return hash % SAR_REDIRECT_BUCKET_COUNT;
+}
+
+// Two bloom bits per key, taken from hash bits the bucket index doesn't use.
+static ULONG SarRedirectBloomBit(ULONG hash, int which)
+{
+    return (hash >> (which ? 21 : 8)) % SAR_REDIRECT_BLOOM_BITS;
+}
+
+static BOOLEAN SarTestBit(const ULONG *bits, ULONG bit)
+{
+    return (bits[bit / 32] & (1u << (bit % 32))) != 0;
+}
+
+static VOID SarSetBit(ULONG *bits, ULONG bit)
+{
+    bits[bit / 32] |= 1u << (bit % 32);
+}
+
+VOID SarInitializeRedirectTable(
+    SarRedirectTable *table, SarUpcaseRoutine upcase)
+{
+    RtlZeroMemory(table, sizeof(SarRedirectTable));
+    table->upcase = upcase;
+}
+
+BOOLEAN SarRedirectTableMayContain(
+    SarRedirectTable *table, PCUNICODE_STRING key, ULONG *hash)
+{
+    USHORT length = key->Length / sizeof(WCHAR);
+
+    // upcasing never changes the length, so this needs nothing but the
+    // string header.
+    if (length < SAR_REDIRECT_FILTERED_LENGTH ?
+        !SarTestBit(table->lengthFilter, length) : !table->hasLongKeys) {
+
+        return FALSE;
+    }
+
+    *hash = SarHashRedirectKey(table, key);
+    return SarTestBit(table->bloomFilter, SarRedirectBloomBit(*hash, 0)) &&
+        SarTestBit(table->bloomFilter, SarRedirectBloomBit(*hash, 1));
+}
+
+static BOOLEAN SarRedirectKeysEqual(
+    SarRedirectTable *table, PCUNICODE_STRING lhs, PCUNICODE_STRING rhs)
+{
+    USHORT length = lhs->Length / sizeof(WCHAR);
+
+    if (lhs->Length != rhs->Length) {
+        return FALSE;
+    }
+
+    for (USHORT i = 0; i < length; ++i) {
+        if (lhs->Buffer[i] != rhs->Buffer[i] &&
+            SarFoldChar(table, lhs->Buffer[i]) !=
+            SarFoldChar(table, rhs->Buffer[i])) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+SarRedirectEntry *SarLookupRedirectEntry(
+    SarRedirectTable *table, PCUNICODE_STRING key, ULONG hash)
+{
+    SarRedirectEntry *entry = table->buckets[SarRedirectBucket(hash)];
+
+    for (; entry; entry = entry->next) {
+        if (entry->hash == hash &&
+            SarRedirectKeysEqual(table, &entry->key, key)) {
+
+            return entry;
+        }
+    }
+
+    return nullptr;
+}
+
+BOOLEAN SarInsertRedirectEntry(
+    SarRedirectTable *table, SarRedirectEntry *entry)
+{
+    USHORT length = entry->key.Length / sizeof(WCHAR);
+    ULONG hash = SarHashRedirectKey(table, &entry->key);
+    SarRedirectEntry **bucket = &table->buckets[SarRedirectBucket(hash)];
+
+    if (SarLookupRedirectEntry(table, &entry->key, hash)) {
+        return FALSE;
+    }
+
+    if (length < SAR_REDIRECT_FILTERED_LENGTH) {
+        SarSetBit(table->lengthFilter, length);
+    } else {
+        table->hasLongKeys = TRUE;
+    }
+
+    SarSetBit(table->bloomFilter, SarRedirectBloomBit(hash, 0));
+    SarSetBit(table->bloomFilter, SarRedirectBloomBit(hash, 1));
+    entry->hash = hash;
+    entry->next = *bucket;
+    *bucket = entry;
+    return TRUE;
+}
+
+VOID SarClearRedirectTable(
+    SarRedirectTable *table, VOID (*freeCb)(SarRedirectEntry *))
+{
+    for (ULONG i = 0; i < SAR_REDIRECT_BUCKET_COUNT; ++i) {
+        SarRedirectEntry *entry = table->buckets[i];
+
+        table->buckets[i] = nullptr;
+
+        while (entry) {
+            SarRedirectEntry *next = entry->next;
+
+            freeCb(entry);
+            entry = next;
+        }
+    }
+}
+
+static ULONG SarProcessMatchSet(PVOID process)
+{
+    // Fibonacci hashing; EPROCESS addresses share their low bits.
+    return (ULONG)(((ULONG64)(ULONG_PTR)process * 0x9E3779B97F4A7C15ull) >>
+        58) % SAR_PROCESS_MATCH_SETS;
+}
+
+BOOLEAN SarLookupProcessMatch(
+    SarProcessMatchCache *cache, PVOID process, LONGLONG createTime,
+    BOOLEAN *match)
+{
+    SarProcessMatch *set = cache->entries[SarProcessMatchSet(process)];
+
+    for (ULONG i = 0; i < SAR_PROCESS_MATCH_WAYS; ++i) {
+        if (set[i].valid && set[i].process == process &&
+            set[i].createTime == createTime) {
+
+            *match = set[i].match;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+VOID SarStoreProcessMatch(
+    SarProcessMatchCache *cache, PVOID process, LONGLONG createTime,
+    BOOLEAN match)
+{
+    ULONG index = SarProcessMatchSet(process);
+    SarProcessMatch *set = cache->entries[index];
+    SarProcessMatch *entry = nullptr;
+
+    // take a free way, or the one a dead process with the same address had,
+    // otherwise round robin.
+    for (ULONG i = 0; i < SAR_PROCESS_MATCH_WAYS; ++i) {
+        if (!set[i].valid || set[i].process == process) {
+            entry = &set[i];
+            break;
+        }
+    }
+
+    if (!entry) {
+        entry = &set[cache->nextVictim[index]];
+        cache->nextVictim[index] =
+            (cache->nextVictim[index] + 1) % SAR_PROCESS_MATCH_WAYS;
+    }
+
+    entry->process = process;
+    entry->createTime = createTime;
+    entry->match = match;
+    entry->valid = TRUE;
+}
@@ -0,0 +1,96 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_FILTERTABLE_H
+#define _SAR_FILTERTABLE_H
+
+// Lookup structures for the registry filter. The callback sees every
+// default value query on the system, so these are built to turn away the
+// vast majority that have nothing to do with us before taking a lock or
+// allocating. They only use plain NT types so they can be built and
+// measured in user mode; callers allocate entries and do the locking.
+
+#define SAR_REDIRECT_BUCKET_COUNT 64
+// Key lengths, in characters, that the length filter can rule out.
+#define SAR_REDIRECT_FILTERED_LENGTH 512
+#define SAR_REDIRECT_BLOOM_BITS 1024
+#define SAR_PROCESS_MATCH_SETS 64
+#define SAR_PROCESS_MATCH_WAYS 4
+
+typedef WCHAR (*SarUpcaseRoutine)(WCHAR c);
+
+typedef struct SarRedirectEntry
+{
+    struct SarRedirectEntry *next;
+    ULONG hash;
+    UNICODE_STRING key;
+    PVOID value;
+} SarRedirectEntry;
+
+// Maps registry paths to values, case insensitively. The length and bloom
+// filters only ever gain bits, so they can be checked without the lock.
+typedef struct SarRedirectTable
+{
+    SarUpcaseRoutine upcase;
+    ULONG lengthFilter[SAR_REDIRECT_FILTERED_LENGTH / 32];
+    BOOLEAN hasLongKeys;
+    ULONG bloomFilter[SAR_REDIRECT_BLOOM_BITS / 32];
+    SarRedirectEntry *buckets[SAR_REDIRECT_BUCKET_COUNT];
+} SarRedirectTable;
+
+typedef struct SarProcessMatch
+{
+    PVOID process;
+    LONGLONG createTime;
+    BOOLEAN valid;
+    BOOLEAN match;
+} SarProcessMatch;
+
+// Remembers whether processes run as the filter user. PEPROCESS addresses
+// get reused, so entries are keyed on the process creation time as well.
+// Set associative so a few processes querying in turn don't keep evicting
+// each other.
+typedef struct SarProcessMatchCache
+{
+    SarProcessMatch entries[SAR_PROCESS_MATCH_SETS][SAR_PROCESS_MATCH_WAYS];
+    UCHAR nextVictim[SAR_PROCESS_MATCH_SETS];
+} SarProcessMatchCache;
+
+// upcase must agree with the case folding used to compare keys;
+// characters below 0x80 are folded inline without calling it.
+VOID SarInitializeRedirectTable(
+    SarRedirectTable *table, SarUpcaseRoutine upcase);
+// Returns FALSE if key is definitely not in the table. Otherwise hash is
+// set for SarLookupRedirectEntry.
+BOOLEAN SarRedirectTableMayContain(
+    SarRedirectTable *table, PCUNICODE_STRING key, ULONG *hash);
+SarRedirectEntry *SarLookupRedirectEntry(
+    SarRedirectTable *table, PCUNICODE_STRING key, ULONG hash);
+// entry->key must stay valid while the entry is in the table. Returns
+// FALSE without inserting if the key is already present.
+BOOLEAN SarInsertRedirectEntry(
+    SarRedirectTable *table, SarRedirectEntry *entry);
+VOID SarClearRedirectTable(
+    SarRedirectTable *table, VOID (*freeCb)(SarRedirectEntry *));
+
+BOOLEAN SarLookupProcessMatch(
+    SarProcessMatchCache *cache, PVOID process, LONGLONG createTime,
+    BOOLEAN *match);
+VOID SarStoreProcessMatch(
+    SarProcessMatchCache *cache, PVOID process, LONGLONG createTime,
+    BOOLEAN match);
+
+#endif // _SAR_FILTERTABLE_H
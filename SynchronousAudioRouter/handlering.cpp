@@ -0,0 +1,81 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sar.h"
+
+VOID SarInitializeHandleRing(SarHandleRing *ring)
+{
+    ring->tail = 0;
+    ring->head = 0;
+
+    for (LONG64 i = 0; i < SAR_HANDLE_RING_SIZE; ++i) {
+        ring->slots[i].sequence = i;
+    }
+}
+
+BOOLEAN SarPushHandleRing(SarHandleRing *ring, const SarHandleRingEntry *entry)
+{
+    LONG64 position = ReadNoFence64(&ring->tail);
+
+    for (;;) {
+        SarHandleRingSlot *slot =
+            &ring->slots[position & (SAR_HANDLE_RING_SIZE - 1)];
+        LONG64 difference = ReadAcquire64(&slot->sequence) - position;
+
+        if (difference == 0) {
+            LONG64 previous = InterlockedCompareExchange64(
+                &ring->tail, position + 1, position);
+
+            if (previous == position) {
+                slot->entry = *entry;
+                WriteRelease64(&slot->sequence, position + 1);
+                return TRUE;
+            }
+
+            position = previous;
+        } else if (difference < 0) {
+            // the consumer hasn't freed the slot from the previous lap yet.
+            return FALSE;
+        } else {
+            // another producer claimed this position first.
+            position = ReadNoFence64(&ring->tail);
+        }
+    }
+}
+
+BOOLEAN SarPopHandleRing(SarHandleRing *ring, SarHandleRingEntry *entry)
+{
+    LONG64 position = ring->head;
+    SarHandleRingSlot *slot =
+        &ring->slots[position & (SAR_HANDLE_RING_SIZE - 1)];
+
+    if (ReadAcquire64(&slot->sequence) != position + 1) {
+        return FALSE;
+    }
+
+    *entry = slot->entry;
+    WriteRelease64(&slot->sequence, position + SAR_HANDLE_RING_SIZE);
+    ring->head = position + 1;
+    return TRUE;
+}
+
+BOOLEAN SarHandleRingHasEntry(SarHandleRing *ring)
+{
+    SarHandleRingSlot *slot =
+        &ring->slots[ring->head & (SAR_HANDLE_RING_SIZE - 1)];
+
+    return ReadAcquire64(&slot->sequence) == ring->head + 1;
+}
@@ -0,0 +1,59 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_HANDLERING_H
+#define _SAR_HANDLERING_H
+
+// Bounded queue of notification handles waiting to be sent to the ASIO
+// client. Any number of threads can push without taking a lock; pops must
+// be serialized by the caller. Every slot carries a sequence number that
+// says whose turn it is: position for a free slot waiting for the producer
+// that claims it, position + 1 once that producer has filled it in. Only
+// plain NT types are used so it can be stress tested in user mode.
+
+// Must be a power of two.
+#define SAR_HANDLE_RING_SIZE 256
+
+typedef struct SarHandleRingEntry
+{
+    HANDLE kernelProcessHandle;
+    HANDLE userHandle;
+    ULONG64 associatedData;
+} SarHandleRingEntry;
+
+typedef struct SarHandleRingSlot
+{
+    volatile LONG64 sequence;
+    SarHandleRingEntry entry;
+} SarHandleRingSlot;
+
+typedef struct SarHandleRing
+{
+    DECLSPEC_CACHEALIGN volatile LONG64 tail;
+    DECLSPEC_CACHEALIGN LONG64 head;
+    DECLSPEC_CACHEALIGN SarHandleRingSlot slots[SAR_HANDLE_RING_SIZE];
+} SarHandleRing;
+
+VOID SarInitializeHandleRing(SarHandleRing *ring);
+// Returns FALSE if the ring is full.
+BOOLEAN SarPushHandleRing(SarHandleRing *ring, const SarHandleRingEntry *entry);
+// Returns FALSE if the next entry isn't there yet. Entries pushed
+// afterwards stay queued until whoever is still writing it finishes.
+BOOLEAN SarPopHandleRing(SarHandleRing *ring, SarHandleRingEntry *entry);
+// Whether SarPopHandleRing would succeed. Serialized like pops.
+BOOLEAN SarHandleRingHasEntry(SarHandleRing *ring);
+
+#endif // _SAR_HANDLERING_H
@@ -0,0 +1,109 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sar.h"
+
+#ifdef SAR_DEBUG_KS_PROPERTIES
+
+C_ASSERT(sizeof(SarKsTraceEvent) == 128);
+C_ASSERT(sizeof(SarKsTraceHeader) == 64);
+C_ASSERT(FIELD_OFFSET(SarKsTraceRing, events) == 64);
+
+SarKsTraceHeader *gSarKsTrace;
+SIZE_T gSarKsTraceSize;
+
+static SarKsTraceRing *SarGetKsTraceRing(ULONG index)
+{
+    return (SarKsTraceRing *)(gSarKsTrace + 1) + index;
+}
+
+NTSTATUS SarInitializeKsTrace()
+{
+    ULONG ringCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    LARGE_INTEGER frequency;
+    SIZE_T size =
+        sizeof(SarKsTraceHeader) + ringCount * sizeof(SarKsTraceRing);
+
+    // ExAllocatePool2 zeroes the rings, so every slot starts out empty.
+    gSarKsTrace = (SarKsTraceHeader *)ExAllocatePool2(
+        POOL_FLAG_NON_PAGED, size, SAR_TAG);
+
+    if (!gSarKsTrace) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    KeQueryPerformanceCounter(&frequency);
+    gSarKsTrace->magic = SAR_KS_TRACE_MAGIC;
+    gSarKsTrace->version = SAR_KS_TRACE_VERSION;
+    gSarKsTrace->ringCount = ringCount;
+    gSarKsTrace->ringSize = SAR_KS_TRACE_RING_SIZE;
+    gSarKsTrace->frequency = frequency.QuadPart;
+    gSarKsTraceSize = size;
+    return STATUS_SUCCESS;
+}
+
+VOID SarDeleteKsTrace()
+{
+    if (gSarKsTrace) {
+        ExFreePoolWithTag(gSarKsTrace, SAR_TAG);
+        gSarKsTrace = nullptr;
+        gSarKsTraceSize = 0;
+    }
+}
+
+VOID SarTraceKsIrp(PIRP irp)
+{
+    PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(irp);
+    SarKsTraceEvent event = {};
+    SarKsTraceRing *ring;
+    SarKsTraceEvent *slot;
+    ULONG64 position;
+    KIRQL oldIrql;
+
+    if (!gSarKsTrace) {
+        return;
+    }
+
+    event.ioControlCode = irpStack->Parameters.DeviceIoControl.IoControlCode;
+    event.inputLength = irpStack->Parameters.DeviceIoControl.InputBufferLength;
+    event.outputLength =
+        irpStack->Parameters.DeviceIoControl.OutputBufferLength;
+    event.processId = HandleToULong(PsGetCurrentProcessId());
+
+    // the input is user memory, so it has to be copied before raising IRQL.
+    if (event.ioControlCode == IOCTL_KS_PROPERTY) {
+        event.readStatus = SarReadUserBuffer(event.data, irp,
+            min(event.inputLength, (ULONG)SAR_KS_TRACE_DATA_SIZE));
+    }
+
+    // at DISPATCH_LEVEL nothing else can run on this processor, so it's the
+    // only writer to its ring.
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+    ring = SarGetKsTraceRing(KeGetCurrentProcessorNumberEx(nullptr));
+    position = ring->head++;
+    slot = &ring->events[position & (SAR_KS_TRACE_RING_SIZE - 1)];
+    event.timestamp = KeQueryPerformanceCounter(nullptr).QuadPart;
+
+    // a dump taken mid-write just sees an empty slot.
+    slot->sequence = 0;
+    KeMemoryBarrier();
+    RtlCopyMemory(slot, &event, sizeof(event));
+    KeMemoryBarrier();
+    slot->sequence = (ULONG)position + 1;
+    KeLowerIrql(oldIrql);
+}
+
+#endif // SAR_DEBUG_KS_PROPERTIES
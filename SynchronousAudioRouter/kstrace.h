@@ -0,0 +1,90 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_KSTRACE_H
+#define _SAR_KSTRACE_H
+
+// Binary trace of the KS ioctls forwarded to ks.sys, built only with
+// SAR_DEBUG_KS_PROPERTIES. Each processor writes fixed-size events into its
+// own ring, so recording is a short copy with no lock and no formatting.
+// The whole trace is one allocation laid out as below, pointed to by
+// gSarKsTrace; dump it from the debugger with
+//
+//   .writemem kstrace.bin poi(SynchronousAudioRouter!gSarKsTrace)
+//       L?poi(SynchronousAudioRouter!gSarKsTraceSize)
+//
+// and decode it with SarKsTrace. Only plain NT types are used so the
+// decoder can share this header.
+
+#define SAR_KS_TRACE_MAGIC 'TKAS'
+#define SAR_KS_TRACE_VERSION 1
+// Events per processor. Must be a power of two.
+#define SAR_KS_TRACE_RING_SIZE 512
+#define SAR_KS_TRACE_DATA_SIZE 96
+
+typedef struct SarKsTraceEvent
+{
+    LONGLONG timestamp;
+    // 0 for a slot that's empty or being written, otherwise the low bits of
+    // the ring position plus one.
+    ULONG sequence;
+    ULONG ioControlCode;
+    ULONG inputLength;
+    ULONG outputLength;
+    ULONG processId;
+    // Result of copying the start of the input buffer into data.
+    LONG readStatus;
+    // The start of the input buffer, e.g. the KSPROPERTY and whatever
+    // follows it, up to inputLength bytes.
+    UCHAR data[SAR_KS_TRACE_DATA_SIZE];
+} SarKsTraceEvent;
+
+typedef struct SarKsTraceRing
+{
+    ULONG64 head;
+    UCHAR padding[56];
+    SarKsTraceEvent events[SAR_KS_TRACE_RING_SIZE];
+} SarKsTraceRing;
+
+// Followed by ringCount rings, indexed by processor number.
+typedef struct SarKsTraceHeader
+{
+    ULONG magic;
+    ULONG version;
+    ULONG ringCount;
+    ULONG ringSize;
+    LONGLONG frequency;
+    UCHAR padding[40];
+} SarKsTraceHeader;
+
+#if defined(KERNEL)
+
+#ifdef SAR_DEBUG_KS_PROPERTIES
+extern SarKsTraceHeader *gSarKsTrace;
+extern SIZE_T gSarKsTraceSize;
+
+NTSTATUS SarInitializeKsTrace();
+VOID SarDeleteKsTrace();
+VOID SarTraceKsIrp(PIRP irp);
+#else
+#define SarInitializeKsTrace() STATUS_SUCCESS
+#define SarDeleteKsTrace()
+#define SarTraceKsIrp(irp)
+#endif
+
+#endif // KERNEL
+
+#endif // _SAR_KSTRACE_H
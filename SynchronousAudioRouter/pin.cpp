@@ -173,20 +173,46 @@ NTSTATUS SarKsPinCreate(PKSPIN pin, PIRP irp)
     return status;
 }
 
-NTSTATUS SarGetOrCreateEndpointProcessContext(
+static ULONG SarProcessContextSlot(PEPROCESS process)
+{
+    // Fibonacci hashing; EPROCESS addresses share their low bits.
+    return (ULONG)(((ULONG64)(ULONG_PTR)process * 0x9E3779B97F4A7C15ull) >>
+        60) % SAR_PROCESS_CONTEXT_SLOTS;
+}
+
+// Returns FALSE if the process might still have a context that's only on
+// activeProcessList.
+static BOOLEAN SarFindEndpointProcessContext(
     SarEndpoint *endpoint,
     PEPROCESS process,
     SarEndpointProcessContext **outContext)
 {
-    NTSTATUS status;
-    SarEndpointProcessContext *newContext = nullptr;
-    SIZE_T viewSize = SAR_BUFFER_CELL_SIZE;
-    LARGE_INTEGER registerFileOffset = {};
+    ULONG slot = SarProcessContextSlot(process);
 
-    ExAcquireFastMutex(&endpoint->mutex);
+    for (ULONG i = 0; i < SAR_PROCESS_CONTEXT_SLOTS; ++i) {
+        SarEndpointProcessContext *context =
+            (SarEndpointProcessContext *)ReadPointerAcquire(
+                (PVOID *)&endpoint->processContextSlots[slot]);
 
+        // slots fill in probe order, so a free one ends the search.
+        if (!context || context->process == process) {
+            *outContext = context;
+            return TRUE;
+        }
+
+        slot = (slot + 1) % SAR_PROCESS_CONTEXT_SLOTS;
+    }
+
+    *outContext = nullptr;
+    return FALSE;
+}
+
+// Must be called with the endpoint mutex held.
+static SarEndpointProcessContext *SarFindEndpointProcessContextLocked(
+    SarEndpoint *endpoint,
+    PEPROCESS process)
+{
     PLIST_ENTRY entry = endpoint->activeProcessList.Flink;
-    SarEndpointProcessContext *foundContext = nullptr;
 
     while (entry != &endpoint->activeProcessList) {
         SarEndpointProcessContext *existingContext =
@@ -194,12 +220,50 @@ NTSTATUS SarGetOrCreateEndpointProcessContext(
         entry = entry->Flink;
 
         if (existingContext->process == process) {
-            foundContext = existingContext;
-            break;
+            return existingContext;
         }
     }
 
-    ExReleaseFastMutex(&endpoint->mutex);
+    return nullptr;
+}
+
+// Must be called with the endpoint mutex held.
+static VOID SarInsertEndpointProcessContext(
+    SarEndpoint *endpoint,
+    SarEndpointProcessContext *context)
+{
+    ULONG slot = SarProcessContextSlot(context->process);
+
+    InsertHeadList(&endpoint->activeProcessList, &context->listEntry);
+
+    for (ULONG i = 0; i < SAR_PROCESS_CONTEXT_SLOTS; ++i) {
+        if (!endpoint->processContextSlots[slot]) {
+            // publish the context only once it's fully initialized.
+            WritePointerRelease(
+                (PVOID *)&endpoint->processContextSlots[slot], context);
+            return;
+        }
+
+        slot = (slot + 1) % SAR_PROCESS_CONTEXT_SLOTS;
+    }
+}
+
+NTSTATUS SarGetOrCreateEndpointProcessContext(
+    SarEndpoint *endpoint,
+    PEPROCESS process,
+    SarEndpointProcessContext **outContext)
+{
+    NTSTATUS status;
+    SarEndpointProcessContext *newContext = nullptr;
+    SarEndpointProcessContext *foundContext = nullptr;
+    SIZE_T viewSize = SAR_BUFFER_CELL_SIZE;
+    LARGE_INTEGER registerFileOffset = {};
+
+    if (!SarFindEndpointProcessContext(endpoint, process, &foundContext)) {
+        ExAcquireFastMutex(&endpoint->mutex);
+        foundContext = SarFindEndpointProcessContextLocked(endpoint, process);
+        ExReleaseFastMutex(&endpoint->mutex);
+    }
 
     if (foundContext) {
         if (outContext) {
@@ -209,8 +273,8 @@ NTSTATUS SarGetOrCreateEndpointProcessContext(
         return STATUS_SUCCESS;
     }
 
-    newContext = (SarEndpointProcessContext *)ExAllocatePool2(
-        POOL_FLAG_NON_PAGED, sizeof(SarEndpointProcessContext), SAR_TAG);
+    newContext = (SarEndpointProcessContext *)SarAllocateObject(
+        &gSarProcessContextPool);
 
     if (!newContext) {
         SAR_ERROR("Can't allocate new process context");
@@ -238,10 +302,21 @@ NTSTATUS SarGetOrCreateEndpointProcessContext(
         goto err_out;
     }
 
+    // another thread of the same process may have gotten here first.
     ExAcquireFastMutex(&endpoint->mutex);
-    InsertHeadList(&endpoint->activeProcessList, &newContext->listEntry);
+    foundContext = SarFindEndpointProcessContextLocked(endpoint, process);
+
+    if (!foundContext) {
+        SarInsertEndpointProcessContext(endpoint, newContext);
+    }
+
     ExReleaseFastMutex(&endpoint->mutex);
 
+    if (foundContext) {
+        SarDeleteEndpointProcessContext(newContext);
+        newContext = foundContext;
+    }
+
     if (outContext) {
         *outContext = newContext;
     }
@@ -254,7 +329,7 @@ err_out:
             ZwClose(newContext->processHandle);
         }
 
-        ExFreePoolWithTag(newContext, SAR_TAG);
+        SarFreeObject(&gSarProcessContextPool, newContext);
     }
 
     return status;
@@ -291,6 +366,11 @@ NTSTATUS SarKsPinClose(PKSPIN pin, PIRP irp)
         AppendTailList(&toRemoveList, entry);
     }
 
+    // nothing else can be using the pin by the time it closes, so there
+    // are no lookups left to race with.
+    RtlZeroMemory(endpoint->processContextSlots,
+        sizeof(endpoint->processContextSlots));
+
     ExReleaseFastMutex(&endpoint->mutex);
 
     PLIST_ENTRY entry = toRemoveList.Flink;
@@ -327,7 +407,7 @@ NTSTATUS SarDeleteEndpointProcessContext(SarEndpointProcessContext *context)
 
     ZwUnmapViewOfSection(context->processHandle, context->registerFileUVA);
     ZwClose(context->processHandle);
-    ExFreePoolWithTag(context, SAR_TAG);
+    SarFreeObject(&gSarProcessContextPool, context);
 
     return STATUS_SUCCESS;
 }
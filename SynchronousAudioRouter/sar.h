@@ -63,6 +63,11 @@ DEFINE_GUID(GUID_DEVINTERFACE_SYNCHRONOUSAUDIOROUTER,
 #define SAR_SEND_FORMAT_CHANGE_EVENT CTL_CODE( \
     FILE_DEVICE_UNKNOWN, 5, METHOD_NEITHER, FILE_READ_DATA | FILE_WRITE_DATA)
 
+// SAR_SEND_FORMAT_CHANGE_EVENT takes an array of up to this many DWORD
+// endpoint indices belonging to the caller. An empty input notifies every
+// endpoint of every client.
+#define SAR_MAX_FORMAT_CHANGE_ENDPOINTS 64
+
 // SarNdis ioctls
 #define SARNDIS_IOCTL_CODE(i) CTL_CODE( \
     FILE_DEVICE_PHYSICAL_NETCARD, i, METHOD_NEITHER, \
@@ -163,21 +168,32 @@ typedef struct SarNdisEnumerateResponse
     DbgPrintEx(DPFLTR_DEFAULT_ID, DPFLTR_TRACE_LEVEL, __FUNCTION__ " (SAR) " fmt "\n", __VA_ARGS__)
 #endif
 
+#include "handlering.h"
+#include "slab.h"
+
+// A slab shared by the whole driver. Objects are freed from cancel
+// routines and under other spin locks, so it's guarded by one too.
+typedef struct SarObjectPool
+{
+    KSPIN_LOCK lock;
+    SarSlab slab;
+} SarObjectPool;
+
+// Most handles a waiting IRP gets at once; the ASIO client waits with room
+// for this many.
+#define SAR_HANDLE_QUEUE_BATCH 32
+
+// Handles are posted to the ring without a lock. The lock covers the
+// pending IRPs and serializes taking handles off the ring.
 typedef struct SarHandleQueue
 {
     KSPIN_LOCK lock;
-    LIST_ENTRY pendingItems;
     LIST_ENTRY pendingIrps;
+    // Read without the lock by posters to see if anyone is waiting.
+    volatile LONG pendingIrpCount;
+    SarHandleRing ring;
 } SarHandleQueue;
 
-typedef struct SarHandleQueueItem
-{
-    LIST_ENTRY listEntry;
-    HANDLE kernelProcessHandle;
-    HANDLE userHandle;
-    ULONG64 associatedData;
-} SarHandleQueueItem;
-
 typedef struct SarHandleQueueIrp
 {
     LIST_ENTRY listEntry;
@@ -191,11 +207,8 @@ typedef struct SarTableEntry
     PVOID value;
 } SarTableEntry;
 
-typedef struct SarStringTableEntry
-{
-    UNICODE_STRING key;
-    PVOID value;
-} SarStringTableEntry;
+#include "filtertable.h"
+#include "kstrace.h"
 
 typedef struct SarDriverExtension
 {
@@ -210,15 +223,16 @@ typedef struct SarDriverExtension
     // This shouldn't really be needed as long as CmUnRegisterCallback can't
     // complete while one of our callback routines is still running, but there
     // is no explicit documentation of that, so we protect the registry redirect
-    // tables with a reader writer spinlock "just in case." Note that
-    // RTL_AVL_TABLE is used here instead of RTL_GENERIC_TABLE to avoid
-    // splaying which would be unsafe with a read-only lock. All related
-    // structures must be in nonpaged memory.
-    EX_SPIN_LOCK registryRedirectLock;
-    RTL_AVL_TABLE registryRedirectTableWow64;
-    RTL_AVL_TABLE registryRedirectTable;
+    // tables with a reader writer lock "just in case." It's a resource rather
+    // than a spinlock so lookups can compare against the paged key paths the
+    // configuration manager hands us without copying them.
+    ERESOURCE registryRedirectLock;
+    SarRedirectTable registryRedirectTableWow64;
+    SarRedirectTable registryRedirectTable;
     LARGE_INTEGER filterCookie;
     PTOKEN_USER filterUser;
+    EX_SPIN_LOCK processMatchLock;
+    SarProcessMatchCache processMatchCache;
 } SarDriverExtension;
 
 typedef struct SarControlContext
@@ -249,6 +263,11 @@ typedef struct SarControlContext
     SarBufferMapEntryCount(bufferSize) / sizeof(DWORD) + \
     (((SarBufferMapEntryCount(bufferSize) % sizeof(DWORD)) != 0) ? 1 : 0)))
 
+#define SAR_PROCESS_CONTEXT_SLOTS 16
+// Process contexts set aside for each endpoint. Usually only audiodg opens
+// a pin, but leave room for one more.
+#define SAR_PROCESS_CONTEXTS_PER_ENDPOINT 2
+
 typedef struct SarEndpointProcessContext
 {
     LIST_ENTRY listEntry;
@@ -285,6 +304,10 @@ typedef struct SarEndpoint
     SIZE_T activeViewSize;
     ULONG activeBufferSize;
     LIST_ENTRY activeProcessList;
+    // Open addressed by process so lookups don't need the mutex. Slots are
+    // only ever filled, under the mutex, until the pin closes and clears
+    // them; contexts that didn't fit are only on activeProcessList.
+    SarEndpointProcessContext *processContextSlots[SAR_PROCESS_CONTEXT_SLOTS];
 } SarEndpoint;
 
 typedef struct SarNdisDriverState
@@ -321,6 +344,10 @@ VOID SarDeleteEndpoint(SarEndpoint *endpoint);
 NTSTATUS SarSendFormatChangeEvent(
     PDEVICE_OBJECT deviceObject,
     SarDriverExtension *extension);
+NTSTATUS SarSendEndpointFormatChangeEvents(
+    PDEVICE_OBJECT deviceObject,
+    SarControlContext *controlContext,
+    PIRP irp);
 
 FORCEINLINE VOID SarRetainEndpoint(SarEndpoint *endpoint)
 {
@@ -475,9 +502,21 @@ NTSTATUS SarReadUserBuffer(PVOID src, PIRP irp, ULONG size);
 NTSTATUS SarWriteUserBuffer(PVOID src, PIRP irp, ULONG size);
 SarDriverExtension *SarGetDriverExtension(PDRIVER_OBJECT driverObject);
 SarDriverExtension *SarGetDriverExtensionFromIrp(PIRP irp);
+// Lock free; control file objects keep their context alive until
+// IRP_MJ_CLOSE.
 SarControlContext *SarGetControlContextFromFileObject(
     SarDriverExtension *extension, PFILE_OBJECT fileObject);
 
+// Control file objects have FsContext pointing here. KS file objects point
+// it at their object header, so this tells them apart without comparing
+// file names on every IRP.
+extern const ULONG gSarControlFileTag;
+
+FORCEINLINE BOOLEAN SarIsControlFileObject(PFILE_OBJECT fileObject)
+{
+    return fileObject && fileObject->FsContext == &gSarControlFileTag;
+}
+
 // Gets the endpoint associated with an IRP for a KS pin or filter. If retain
 // is TRUE, both the endpoint and its control context are retained and must be
 // released using SarReleaseEndpointAndContext.
@@ -490,6 +529,8 @@ NTSTATUS SarWriteEndpointRegisters(
 NTSTATUS SarStringDuplicate(PUNICODE_STRING str, PCUNICODE_STRING src);
 
 void SarInitializeHandleQueue(SarHandleQueue *queue);
+// Closes the process handles of anything still queued.
+void SarDeleteHandleQueue(SarHandleQueue *queue);
 NTSTATUS SarTransferQueuedHandle(
     PIRP irp, HANDLE kernelTargetProcessHandle, ULONG responseIndex,
     HANDLE kernelProcessHandle, HANDLE userHandle, ULONG64 associatedData);
@@ -504,16 +545,20 @@ BOOLEAN SarRemoveTableEntry(PRTL_GENERIC_TABLE table, PVOID key);
 PVOID SarGetTableEntry(PRTL_GENERIC_TABLE table, PVOID key);
 VOID SarInitializeTable(PRTL_GENERIC_TABLE table);
 
-NTSTATUS SarInsertStringTableEntry(
-    PRTL_AVL_TABLE table, PUNICODE_STRING key, PVOID value);
-BOOLEAN SarRemoveStringTableEntry(
-    PRTL_AVL_TABLE table, PUNICODE_STRING key);
-PVOID SarGetStringTableEntry(PRTL_AVL_TABLE table, PCUNICODE_STRING key);
-VOID SarInitializeStringTable(PRTL_AVL_TABLE table);
-VOID SarClearStringTable(PRTL_AVL_TABLE table, VOID (*freeCb)(PVOID));
-
 NTSTATUS SarCopyProcessUser(PEPROCESS process, PTOKEN_USER *outTokenUser);
 
+extern SarObjectPool gSarEndpointPool;
+extern SarObjectPool gSarProcessContextPool;
+extern SarObjectPool gSarHandleQueueIrpPool;
+
+VOID SarInitializeObjectPool(
+    SarObjectPool *pool, SIZE_T objectSize, ULONG chunkObjects);
+VOID SarDeleteObjectPool(SarObjectPool *pool);
+BOOLEAN SarReserveObjects(SarObjectPool *pool, ULONG count);
+VOID SarUnreserveObjects(SarObjectPool *pool, ULONG count);
+PVOID SarAllocateObject(SarObjectPool *pool);
+VOID SarFreeObject(SarObjectPool *pool, PVOID object);
+
 #endif // KERNEL
 
 #pragma warning(pop)
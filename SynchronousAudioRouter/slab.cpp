@@ -0,0 +1,116 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sar.h"
+
+// Keeps objects, and the chunk header in front of them, as aligned as a
+// pool allocation would be.
+#define SAR_SLAB_ALIGNMENT 16
+
+VOID SarInitializeSlab(
+    SarSlab *slab, SIZE_T objectSize, ULONG chunkObjects,
+    SarSlabAllocateRoutine allocate, SarSlabFreeRoutine free)
+{
+    RtlZeroMemory(slab, sizeof(SarSlab));
+    slab->objectSize = ROUND_UP(
+        max(objectSize, sizeof(SarSlabObject)), SAR_SLAB_ALIGNMENT);
+    slab->chunkObjects = max(chunkObjects, 1);
+    slab->allocate = allocate;
+    slab->free = free;
+}
+
+VOID SarDeleteSlab(SarSlab *slab)
+{
+    while (slab->chunks) {
+        SarSlabChunk *chunk = slab->chunks;
+
+        slab->chunks = chunk->next;
+        slab->free(chunk);
+    }
+
+    slab->freeObjects = nullptr;
+    slab->capacity = 0;
+    slab->reserved = 0;
+}
+
+static BOOLEAN SarGrowSlab(SarSlab *slab, ULONG count)
+{
+    SIZE_T headerSize = ROUND_UP(sizeof(SarSlabChunk), SAR_SLAB_ALIGNMENT);
+    PUCHAR chunk;
+
+    count = max(count, slab->chunkObjects);
+    chunk = (PUCHAR)slab->allocate(headerSize + slab->objectSize * count);
+
+    if (!chunk) {
+        return FALSE;
+    }
+
+    ((SarSlabChunk *)chunk)->next = slab->chunks;
+    slab->chunks = (SarSlabChunk *)chunk;
+
+    // push in reverse so the first allocations come from the start.
+    for (ULONG i = count; i > 0; --i) {
+        SarSlabObject *object = (SarSlabObject *)(
+            chunk + headerSize + slab->objectSize * (i - 1));
+
+        object->next = slab->freeObjects;
+        slab->freeObjects = object;
+    }
+
+    slab->capacity += count;
+    return TRUE;
+}
+
+BOOLEAN SarReserveSlab(SarSlab *slab, ULONG count)
+{
+    ULONG reserved = slab->reserved + count;
+
+    if (reserved > slab->capacity &&
+        !SarGrowSlab(slab, reserved - slab->capacity)) {
+
+        return FALSE;
+    }
+
+    slab->reserved = reserved;
+    return TRUE;
+}
+
+VOID SarUnreserveSlab(SarSlab *slab, ULONG count)
+{
+    slab->reserved -= min(count, slab->reserved);
+}
+
+PVOID SarAllocateSlab(SarSlab *slab)
+{
+    SarSlabObject *object;
+
+    if (!slab->freeObjects && !SarGrowSlab(slab, slab->chunkObjects)) {
+        return nullptr;
+    }
+
+    object = slab->freeObjects;
+    slab->freeObjects = object->next;
+    RtlZeroMemory(object, slab->objectSize);
+    return object;
+}
+
+VOID SarFreeSlab(SarSlab *slab, PVOID object)
+{
+    SarSlabObject *freeObject = (SarSlabObject *)object;
+
+    freeObject->next = slab->freeObjects;
+    slab->freeObjects = freeObject;
+}
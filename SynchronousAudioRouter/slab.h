@@ -0,0 +1,66 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SAR_SLAB_H
+#define _SAR_SLAB_H
+
+// Pools of fixed-size objects carved out of larger chunks. Memory is only
+// given back when the slab is deleted, so once a slab has grown to what a
+// configuration needs, streams can start and stop without allocating.
+// Callers do the locking. Only plain NT types are used so it can be built
+// and measured in user mode.
+
+typedef PVOID (*SarSlabAllocateRoutine)(SIZE_T size);
+typedef VOID (*SarSlabFreeRoutine)(PVOID buffer);
+
+typedef struct SarSlabChunk
+{
+    struct SarSlabChunk *next;
+} SarSlabChunk;
+
+typedef struct SarSlabObject
+{
+    struct SarSlabObject *next;
+} SarSlabObject;
+
+typedef struct SarSlab
+{
+    SIZE_T objectSize;
+    ULONG chunkObjects;
+    SarSlabAllocateRoutine allocate;
+    SarSlabFreeRoutine free;
+    SarSlabChunk *chunks;
+    SarSlabObject *freeObjects;
+    ULONG capacity;
+    ULONG reserved;
+} SarSlab;
+
+// chunkObjects is how many objects to add at a time when the slab runs out.
+VOID SarInitializeSlab(
+    SarSlab *slab, SIZE_T objectSize, ULONG chunkObjects,
+    SarSlabAllocateRoutine allocate, SarSlabFreeRoutine free);
+// Every object must have been freed.
+VOID SarDeleteSlab(SarSlab *slab);
+// Grows the slab so it holds at least count more objects than were
+// reserved before. Returns FALSE, reserving nothing, if it couldn't grow.
+BOOLEAN SarReserveSlab(SarSlab *slab, ULONG count);
+VOID SarUnreserveSlab(SarSlab *slab, ULONG count);
+// Returns a zeroed object, or nullptr if the slab was empty and couldn't
+// grow.
+PVOID SarAllocateSlab(SarSlab *slab);
+VOID SarFreeSlab(SarSlab *slab, PVOID object);
+
+#endif // _SAR_SLAB_H
@@ -0,0 +1,269 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Times the registry filter's redirect lookups on a mix of queries like the
+// callback sees: 40% other CLSIDs with the same path shape as the
+// redirected ones, 50% unrelated keys and 10% hits in mixed case. The
+// baseline copies and upcases each key and searches an ordered tree, like
+// the AVL table the filter used to use, minus the kernel's locking and
+// pool costs. Also times the process match cache with processes taking
+// turns, and checks both give the right answers.
+
+#include "sar.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cwctype>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#define CLSID_ROOT L"\\REGISTRY\\MACHINE\\SOFTWARE\\Classes\\CLSID\\"
+
+static const int QUERY_COUNT = 10000;
+static const int PASSES = 20;
+static const int PROCESS_COUNT = 40;
+static const int PROCESS_LOOKUPS = 1000000;
+
+static const wchar_t *kRedirected[] = {
+    L"{BCDE0395-E52F-467C-8E3D-C4579291692E}",
+    L"{E2F7A62A-862B-40AE-BBC2-5C0CA9A5B7E1}",
+};
+
+struct Query
+{
+    std::wstring path;
+    bool hit;
+};
+
+static WCHAR upcase(WCHAR c)
+{
+    return (WCHAR)towupper(c);
+}
+
+static UNICODE_STRING unicodeString(const std::wstring& str)
+{
+    UNICODE_STRING result;
+
+    result.Buffer = (WCHAR *)str.data();
+    result.Length = (USHORT)(str.size() * sizeof(WCHAR));
+    result.MaximumLength = result.Length;
+    return result;
+}
+
+static std::wstring upcased(std::wstring str)
+{
+    for (auto& c : str) {
+        c = upcase(c);
+    }
+
+    return str;
+}
+
+static std::wstring randomGuid(std::mt19937& rng)
+{
+    wchar_t buf[40];
+    std::uniform_int_distribution<uint32_t> word;
+
+    swprintf(buf, 40, L"{%08X-%04X-%04X-%04X-%04X%08X}",
+        word(rng), word(rng) & 0xffff, word(rng) & 0xffff,
+        word(rng) & 0xffff, word(rng) & 0xffff, word(rng));
+    return buf;
+}
+
+static std::vector<Query> makeQueries()
+{
+    static const wchar_t *kUnrelated[] = {
+        L"\\REGISTRY\\MACHINE\\SOFTWARE\\Microsoft\\Windows\\CurrentVersion",
+        L"\\REGISTRY\\USER\\S-1-5-21-1004336348-1177238915-682003330-1001"
+            L"\\Software\\Microsoft\\Internet Explorer\\Main",
+        L"\\REGISTRY\\MACHINE\\SYSTEM\\CurrentControlSet\\Services\\Tcpip",
+        L"\\REGISTRY\\MACHINE\\SOFTWARE\\Classes\\.txt",
+        L"\\REGISTRY\\MACHINE\\SOFTWARE\\Policies\\Microsoft\\Windows",
+    };
+    std::mt19937 rng(7);
+    std::vector<Query> queries;
+
+    for (int i = 0; i < QUERY_COUNT; ++i) {
+        auto kind = i % 10;
+
+        if (kind < 4) {
+            queries.push_back({
+                CLSID_ROOT + randomGuid(rng) + L"\\InprocServer32", false });
+        } else if (kind < 9) {
+            queries.push_back({
+                kUnrelated[rng() % 5] + std::wstring(L"\\") +
+                std::to_wstring(rng() % 100000), false });
+        } else {
+            std::wstring path = CLSID_ROOT;
+
+            path += kRedirected[rng() % 2];
+            path += L"\\InprocServer32";
+
+            // registry paths arrive in whatever case the caller used.
+            for (auto& c : path) {
+                if (rng() % 2) {
+                    c = (wchar_t)towlower(c);
+                }
+            }
+
+            queries.push_back({ path, true });
+        }
+    }
+
+    return queries;
+}
+
+template<typename F>
+static double timeNs(int iterations, F f)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; ++i) {
+        f(i);
+    }
+
+    return std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static int benchRedirects()
+{
+    auto queries = makeQueries();
+    std::vector<std::wstring> keys;
+    std::vector<SarRedirectEntry> entries(2);
+    std::map<std::wstring, PVOID> tree;
+    SarRedirectTable table;
+    int failures = 0;
+    uint64_t treeHits = 0, tableHits = 0, rejected = 0, misses = 0;
+
+    SarInitializeRedirectTable(&table, upcase);
+
+    for (auto guid : kRedirected) {
+        keys.push_back(CLSID_ROOT + std::wstring(guid) + L"\\InprocServer32");
+    }
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        entries[i].key = unicodeString(keys[i]);
+        entries[i].value = &entries[i];
+        SarInsertRedirectEntry(&table, &entries[i]);
+        tree.emplace(upcased(keys[i]), &entries[i]);
+    }
+
+    auto treeNs = timeNs(QUERY_COUNT * PASSES, [&](int i) {
+        auto& query = queries[i % QUERY_COUNT];
+
+        treeHits += tree.find(upcased(query.path)) != tree.end();
+    });
+    auto tableNs = timeNs(QUERY_COUNT * PASSES, [&](int i) {
+        auto& query = queries[i % QUERY_COUNT];
+        auto key = unicodeString(query.path);
+        ULONG hash;
+
+        if (!SarRedirectTableMayContain(&table, &key, &hash)) {
+            rejected += !query.hit;
+            return;
+        }
+
+        tableHits += SarLookupRedirectEntry(&table, &key, hash) != nullptr;
+    });
+
+    for (auto& query : queries) {
+        misses += !query.hit;
+    }
+
+    misses *= PASSES;
+    printf("copy + ordered tree lookup:  %8.1f ns/query\n", treeNs);
+    printf("prefilter + hash lookup:     %8.1f ns/query\n", tableNs);
+    printf("misses rejected before lock: %llu/%llu\n",
+        (unsigned long long)rejected, (unsigned long long)misses);
+
+    auto expectedHits = (uint64_t)(QUERY_COUNT * PASSES) - misses;
+
+    if (treeHits != expectedHits || tableHits != expectedHits) {
+        printf("  FAIL: expected %llu hits, tree found %llu, table %llu\n",
+            (unsigned long long)expectedHits, (unsigned long long)treeHits,
+            (unsigned long long)tableHits);
+        failures++;
+    }
+
+    auto duplicate = entries[0];
+
+    if (SarInsertRedirectEntry(&table, &duplicate)) {
+        printf("  FAIL: a duplicate key was inserted\n");
+        failures++;
+    }
+
+    return failures;
+}
+
+static int benchProcessMatches()
+{
+    static SarProcessMatchCache cache;
+    std::mt19937_64 rng(11);
+    std::vector<PVOID> processes;
+    uint64_t hits = 0, wrong = 0;
+    int failures = 0;
+
+    // EPROCESS addresses are allocation aligned in a narrow range.
+    for (int i = 0; i < PROCESS_COUNT; ++i) {
+        processes.push_back((PVOID)(uintptr_t)(
+            0xffff9a0000000000ull + (rng() % 0x100000) * 0x80));
+    }
+
+    auto lookupNs = timeNs(PROCESS_LOOKUPS, [&](int) {
+        auto process = processes[rng() % PROCESS_COUNT];
+        auto createTime = (LONGLONG)(uintptr_t)process / 3;
+        BOOLEAN expected = ((uintptr_t)process >> 7) % 2;
+        BOOLEAN match;
+
+        if (SarLookupProcessMatch(&cache, process, createTime, &match)) {
+            hits++;
+            wrong += match != expected;
+        } else {
+            SarStoreProcessMatch(&cache, process, createTime, expected);
+        }
+    });
+
+    printf("process cache lookup:        %8.1f ns, %.1f%% hit rate with "
+        "%d processes taking turns\n", lookupNs,
+        100.0 * hits / PROCESS_LOOKUPS, PROCESS_COUNT);
+
+    if (wrong) {
+        printf("  FAIL: %llu cached lookups returned the wrong match\n",
+            (unsigned long long)wrong);
+        failures++;
+    }
+
+    BOOLEAN match;
+
+    // a new process at a dead one's address must not inherit its answer.
+    if (SarLookupProcessMatch(&cache, processes[0], 1, &match)) {
+        printf("  FAIL: a reused process address hit the cache\n");
+        failures++;
+    }
+
+    return failures;
+}
+
+int main()
+{
+    int failures = benchRedirects();
+
+    failures += benchProcessMatches();
+    return failures ? 1 : 0;
+}
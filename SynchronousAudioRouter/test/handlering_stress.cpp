@@ -0,0 +1,105 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Pushes from many threads at once while a single consumer pops, and checks
+// every entry comes out exactly once and in order per producer.
+//
+// Usage: handlering_stress [producers] [entries per producer]
+
+#include "sar.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+static SarHandleRing ring;
+
+static ULONG64 entryData(int producer, long index)
+{
+    return ((ULONG64)producer << 40) | (ULONG64)index;
+}
+
+int main(int argc, char **argv)
+{
+    int producers = argc > 1 ? atoi(argv[1]) : 8;
+    long perProducer = argc > 2 ? atol(argv[2]) : 1000000;
+    std::vector<std::thread> threads;
+    std::vector<long> next(producers, 0);
+    long total = 0, errors = 0;
+    SarHandleRingEntry entry;
+    auto start = std::chrono::steady_clock::now();
+
+    SarInitializeHandleRing(&ring);
+
+    for (int producer = 0; producer < producers; ++producer) {
+        threads.emplace_back([=]() {
+            for (long i = 0; i < perProducer; ++i) {
+                SarHandleRingEntry entry = {
+                    (HANDLE)(uintptr_t)(producer + 1), (HANDLE)(uintptr_t)i,
+                    entryData(producer, i)
+                };
+
+                while (!SarPushHandleRing(&ring, &entry)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    while (total < producers * perProducer) {
+        if (!SarPopHandleRing(&ring, &entry)) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        int producer = (int)(uintptr_t)entry.kernelProcessHandle - 1;
+        long index = (long)(uintptr_t)entry.userHandle;
+
+        total++;
+
+        if (producer < 0 || producer >= producers ||
+            index != next[producer] ||
+            entry.associatedData != entryData(producer, index)) {
+
+            if (errors++ < 5) {
+                printf("bad entry from producer %d: %ld\n", producer, index);
+            }
+
+            continue;
+        }
+
+        next[producer]++;
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    if (SarHandleRingHasEntry(&ring) || SarPopHandleRing(&ring, &entry)) {
+        printf("ring not empty after every entry was popped\n");
+        errors++;
+    }
+
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    printf("%d producers x %ld: %ld entries, %ld errors, %.1f ns/entry\n",
+        producers, perProducer, total, errors, seconds * 1e9 / total);
+    return errors ? 1 : 0;
+}
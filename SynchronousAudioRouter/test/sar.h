@@ -0,0 +1,103 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// User mode stand-in for the driver's sar.h, with just the NT types and
+// helpers handlering.cpp, filtertable.cpp and slab.cpp need, so they can be
+// stress tested and benchmarked as ordinary programs.
+
+#ifndef _SAR_TEST_SAR_H
+#define _SAR_TEST_SAR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+typedef void *HANDLE;
+typedef void VOID;
+typedef void *PVOID;
+typedef unsigned char BOOLEAN;
+typedef unsigned char UCHAR;
+typedef unsigned char *PUCHAR;
+typedef uint16_t USHORT;
+typedef uint32_t ULONG;
+typedef uint64_t ULONG64;
+typedef int64_t LONG64;
+typedef int64_t LONGLONG;
+typedef uintptr_t ULONG_PTR;
+typedef size_t SIZE_T;
+typedef wchar_t WCHAR;
+
+typedef struct _UNICODE_STRING
+{
+    USHORT Length;
+    USHORT MaximumLength;
+    WCHAR *Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING *PCUNICODE_STRING;
+
+#define TRUE 1
+#define FALSE 0
+#define DECLSPEC_CACHEALIGN alignas(64)
+#define RtlZeroMemory(p, size) memset((p), 0, (size))
+#define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
+
+// the WDK's min and max are macros; functions keep them from breaking the
+// standard headers included after this one.
+template<typename T, typename U>
+static inline typename std::common_type<T, U>::type max(T a, U b)
+{
+    typedef typename std::common_type<T, U>::type R;
+
+    return (R)a > (R)b ? (R)a : (R)b;
+}
+
+template<typename T, typename U>
+static inline typename std::common_type<T, U>::type min(T a, U b)
+{
+    typedef typename std::common_type<T, U>::type R;
+
+    return (R)a < (R)b ? (R)a : (R)b;
+}
+
+static inline LONG64 ReadNoFence64(volatile LONG64 const *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline LONG64 ReadAcquire64(volatile LONG64 const *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void WriteRelease64(volatile LONG64 *p, LONG64 value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline LONG64 InterlockedCompareExchange64(
+    volatile LONG64 *p, LONG64 exchange, LONG64 comparand)
+{
+    __atomic_compare_exchange_n(p, &comparand, exchange, false,
+        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return comparand;
+}
+
+#include "filtertable.h"
+#include "handlering.h"
+#include "slab.h"
+
+#endif // _SAR_TEST_SAR_H
@@ -0,0 +1,227 @@
+// SynchronousAudioRouter
+// Copyright (C) 2015 Mackenzie Straight
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with SynchronousAudioRouter.  If not, see <http://www.gnu.org/licenses/>.
+
+// Checks the slab hands out distinct, 16-byte aligned, zeroed objects and
+// never grows while allocations stay within what was reserved, then times
+// alloc+free churn against calloc under the same lock the driver wraps
+// each slab in.
+
+#include "sar.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <vector>
+
+static const ULONG RESERVED = 256;
+static const int CHURN_OPERATIONS = 1000000;
+
+static int gAllocations;
+static int gFrees;
+static bool gFailAllocations;
+
+static PVOID allocateChunk(SIZE_T size)
+{
+    if (gFailAllocations) {
+        return nullptr;
+    }
+
+    gAllocations++;
+    return malloc(size);
+}
+
+static VOID freeChunk(PVOID buffer)
+{
+    gFrees++;
+    free(buffer);
+}
+
+static int check(const char *what, bool ok)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+    }
+
+    return ok ? 0 : 1;
+}
+
+static bool isZeroed(PVOID object, SIZE_T size)
+{
+    auto bytes = (const UCHAR *)object;
+
+    return std::all_of(bytes, bytes + size, [](UCHAR b) { return !b; });
+}
+
+static int checkObjects(SIZE_T objectSize)
+{
+    SarSlab slab;
+    std::vector<PVOID> objects;
+    std::mt19937 rng(5);
+    bool aligned = true, zeroed = true;
+    int failures = 0;
+
+    gAllocations = gFrees = 0;
+    SarInitializeSlab(&slab, objectSize, 16, allocateChunk, freeChunk);
+    failures += check("reserving grows an empty slab",
+        SarReserveSlab(&slab, RESERVED) && gAllocations == 1);
+
+    auto grown = gAllocations;
+
+    for (ULONG i = 0; i < RESERVED; ++i) {
+        auto object = SarAllocateSlab(&slab);
+
+        aligned &= (uintptr_t)object % 16 == 0;
+        zeroed &= isZeroed(object, objectSize);
+        memset(object, 0xab, objectSize);
+        objects.push_back(object);
+    }
+
+    failures += check("objects are 16-byte aligned", aligned);
+    failures += check("new objects are zeroed", zeroed);
+
+    // distinct and far enough apart that none overlap.
+    auto sorted = objects;
+    bool distinct = true;
+
+    std::sort(sorted.begin(), sorted.end());
+
+    for (size_t i = 1; i < sorted.size(); ++i) {
+        distinct &= (PUCHAR)sorted[i] - (PUCHAR)sorted[i - 1] >=
+            (ptrdiff_t)objectSize;
+    }
+
+    failures += check("objects are distinct and don't overlap", distinct);
+
+    // random churn that never has more than the reservation live.
+    zeroed = true;
+
+    for (int i = 0; i < 100000; ++i) {
+        auto index = rng() % objects.size();
+
+        SarFreeSlab(&slab, objects[index]);
+        objects[index] = SarAllocateSlab(&slab);
+        zeroed &= isZeroed(objects[index], objectSize);
+        memset(objects[index], 0xab, objectSize);
+    }
+
+    failures += check("reused objects are zeroed", zeroed);
+    failures += check("churn within the reservation never grows the slab",
+        gAllocations == grown);
+
+    for (auto object : objects) {
+        SarFreeSlab(&slab, object);
+    }
+
+    SarUnreserveSlab(&slab, RESERVED);
+    failures += check("reserving what was given back doesn't grow",
+        SarReserveSlab(&slab, RESERVED) && gAllocations == grown);
+
+    gFailAllocations = true;
+    failures += check("a reservation that can't grow fails",
+        !SarReserveSlab(&slab, 1) && slab.reserved == RESERVED);
+    SarUnreserveSlab(&slab, RESERVED);
+
+    for (ULONG i = 0; i < RESERVED; ++i) {
+        SarAllocateSlab(&slab);
+    }
+
+    failures += check("an exhausted slab that can't grow returns nullptr",
+        !SarAllocateSlab(&slab));
+    gFailAllocations = false;
+
+    // the objects above are abandoned; deleting frees their chunks anyway.
+    SarDeleteSlab(&slab);
+    failures += check("deleting frees every chunk", gFrees == gAllocations);
+    return failures;
+}
+
+template<typename Alloc, typename Free>
+static double churnNs(Alloc alloc, Free release)
+{
+    std::mutex lock;
+    std::vector<PVOID> live(RESERVED / 2);
+    std::mt19937 rng(9);
+
+    for (auto& object : live) {
+        std::lock_guard<std::mutex> guard(lock);
+
+        object = alloc();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < CHURN_OPERATIONS; ++i) {
+        auto& object = live[rng() % live.size()];
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            release(object);
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        object = alloc();
+    }
+
+    auto ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+
+    for (auto object : live) {
+        release(object);
+    }
+
+    return ns / CHURN_OPERATIONS;
+}
+
+static int bench(SIZE_T objectSize)
+{
+    SarSlab slab;
+
+    gAllocations = 0;
+    SarInitializeSlab(&slab, objectSize, 16, allocateChunk, freeChunk);
+    SarReserveSlab(&slab, RESERVED);
+
+    auto grown = gAllocations;
+    auto slabNs = churnNs(
+        [&]() { return SarAllocateSlab(&slab); },
+        [&](PVOID object) { SarFreeSlab(&slab, object); });
+    auto callocNs = churnNs(
+        [&]() { return calloc(1, objectSize); },
+        [](PVOID object) { free(object); });
+
+    printf("%6zu byte objects: slab %6.1f ns, calloc %6.1f ns per "
+        "alloc+free\n", objectSize, slabNs, callocNs);
+    SarDeleteSlab(&slab);
+    return check("benchmark churn never grows the slab",
+        gAllocations == grown);
+}
+
+int main()
+{
+    int failures = 0;
+
+    // a queued IRP, a process context and an endpoint.
+    for (SIZE_T size : { 40, 200, 6000 }) {
+        failures += checkObjects(size);
+        failures += bench(size);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -20,9 +20,6 @@ DRIVER_CANCEL SarCancelHandleQueueIrp;
 RTL_GENERIC_COMPARE_ROUTINE SarCompareTableEntry;
 RTL_GENERIC_ALLOCATE_ROUTINE SarAllocateTableEntry;
 RTL_GENERIC_FREE_ROUTINE SarFreeTableEntry;
-RTL_AVL_COMPARE_ROUTINE SarCompareStringTableEntry;
-RTL_AVL_ALLOCATE_ROUTINE SarAllocateStringTableEntry;
-RTL_AVL_FREE_ROUTINE SarFreeStringTableEntry;
 
 SarDriverExtension *SarGetDriverExtension(PDRIVER_OBJECT driverObject)
 {
@@ -40,14 +37,13 @@ SarDriverExtension *SarGetDriverExtensionFromIrp(PIRP irp)
 SarControlContext *SarGetControlContextFromFileObject(
     SarDriverExtension *extension, PFILE_OBJECT fileObject)
 {
-    SarControlContext *controlContext;
+    UNREFERENCED_PARAMETER(extension);
 
-    ExAcquireFastMutex(&extension->mutex);
-    controlContext = (SarControlContext *)SarGetTableEntry(
-        &extension->controlContextTable, fileObject);
-    ExReleaseFastMutex(&extension->mutex);
+    if (!SarIsControlFileObject(fileObject)) {
+        return nullptr;
+    }
 
-    return controlContext;
+    return (SarControlContext *)fileObject->FsContext2;
 }
 
 // TODO: gotta go fast
@@ -237,7 +233,17 @@ void SarInitializeHandleQueue(SarHandleQueue *queue)
 {
     KeInitializeSpinLock(&queue->lock);
     InitializeListHead(&queue->pendingIrps);
-    InitializeListHead(&queue->pendingItems);
+    queue->pendingIrpCount = 0;
+    SarInitializeHandleRing(&queue->ring);
+}
+
+void SarDeleteHandleQueue(SarHandleQueue *queue)
+{
+    SarHandleRingEntry entry;
+
+    while (SarPopHandleRing(&queue->ring, &entry)) {
+        ZwClose(entry.kernelProcessHandle);
+    }
 }
 
 NTSTATUS SarTransferQueuedHandle(
@@ -270,6 +276,57 @@ NTSTATUS SarTransferQueuedHandle(
     return status;
 }
 
+// Takes as many queued handles as the IRP has room for, up to
+// SAR_HANDLE_QUEUE_BATCH. Must be called with the queue lock held.
+static ULONG SarTakeQueuedHandles(
+    SarHandleQueue *queue, PIRP irp, SarHandleRingEntry *entries)
+{
+    PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(irp);
+    ULONG maxItems = min(SAR_HANDLE_QUEUE_BATCH,
+        (ULONG)(irpStack->Parameters.DeviceIoControl.OutputBufferLength /
+            sizeof(SarHandleQueueResponse)));
+    ULONG count = 0;
+
+    while (count < maxItems &&
+        SarPopHandleRing(&queue->ring, &entries[count])) {
+
+        count++;
+    }
+
+    return count;
+}
+
+// Duplicates a batch of taken handles into the waiting process in one go.
+// An entry whose handle can't be duplicated is still reported, with a NULL
+// handle, so one bad entry doesn't throw away the handles already
+// duplicated into the waiter. The posting processes' handles are closed
+// either way.
+static NTSTATUS SarTransferQueuedHandles(
+    PIRP irp, HANDLE kernelTargetProcessHandle,
+    SarHandleRingEntry *entries, ULONG count)
+{
+    NTSTATUS status;
+
+    irp->IoStatus.Information = 0;
+
+    for (ULONG i = 0; i < count; ++i) {
+        status = SarTransferQueuedHandle(
+            irp, kernelTargetProcessHandle, i,
+            entries[i].kernelProcessHandle, entries[i].userHandle,
+            entries[i].associatedData);
+
+        if (!NT_SUCCESS(status)) {
+            SAR_WARNING("Couldn't duplicate queued handle %p: %08X",
+                entries[i].userHandle, status);
+        }
+
+        irp->IoStatus.Information += sizeof(SarHandleQueueResponse);
+        ZwClose(entries[i].kernelProcessHandle);
+    }
+
+    return STATUS_SUCCESS;
+}
+
 void SarCancelAllHandleQueueIrps(SarHandleQueue *handleQueue)
 {
     KIRQL irql;
@@ -285,6 +342,7 @@ void SarCancelAllHandleQueueIrps(SarHandleQueue *handleQueue)
         RemoveEntryList(&handleQueue->pendingIrps);
         InitializeListHead(&handleQueue->pendingIrps);
         AppendTailList(&pendingIrqsToCancel, entry);
+        handleQueue->pendingIrpCount = 0;
     }
 
     KeReleaseSpinLock(&handleQueue->lock, irql);
@@ -297,7 +355,7 @@ void SarCancelAllHandleQueueIrps(SarHandleQueue *handleQueue)
         RemoveEntryList(&pendingIrp->listEntry);
 
         ZwClose(pendingIrp->kernelProcessHandle);
-        ExFreePoolWithTag(pendingIrp, SAR_TAG);
+        SarFreeObject(&gSarHandleQueueIrpPool, pendingIrp);
 
         SAR_INFO("Cancelling IRP %p", irp);
 
@@ -337,6 +395,7 @@ void SarCancelHandleQueueIrp(PDEVICE_OBJECT deviceObject, PIRP irp)
 
         if (pendingIrp->irp == irp) {
             RemoveEntryList(&pendingIrp->listEntry);
+            controlContext->handleQueue.pendingIrpCount--;
             toCancel = pendingIrp;
             break;
         }
@@ -346,74 +405,84 @@ void SarCancelHandleQueueIrp(PDEVICE_OBJECT deviceObject, PIRP irp)
 
     if (toCancel) {
         ZwClose(toCancel->kernelProcessHandle);
-        ExFreePoolWithTag(toCancel, SAR_TAG);
+        SarFreeObject(&gSarHandleQueueIrpPool, toCancel);
         irp->IoStatus.Information = 0;
         irp->IoStatus.Status = STATUS_CANCELLED;
         IoCompleteRequest(irp, IO_NO_INCREMENT);
     }
 }
 
-NTSTATUS SarPostHandleQueue(
-    SarHandleQueue *queue, HANDLE userHandle, ULONG64 associatedData)
+// Hands whatever is queued to the first waiting IRP, if there's both.
+static VOID SarCompletePendingHandleQueueIrp(SarHandleQueue *queue)
 {
-    NTSTATUS status = STATUS_SUCCESS;
-    HANDLE kernelProcessHandle = nullptr;
+    SarHandleRingEntry entries[SAR_HANDLE_QUEUE_BATCH];
     SarHandleQueueIrp *queuedIrp = nullptr;
+    ULONG count = 0;
+    NTSTATUS status;
     KIRQL irql;
 
-    status = ObOpenObjectByPointerWithTag(
-        PsGetCurrentProcess(), OBJ_KERNEL_HANDLE,
-        nullptr, GENERIC_ALL, nullptr,
-        KernelMode, SAR_TAG, &kernelProcessHandle);
-
-    if (!NT_SUCCESS(status)) {
-        return status;
-    }
-
     KeAcquireSpinLock(&queue->lock, &irql);
 
-    if (!IsListEmpty(&queue->pendingIrps)) {
-        PLIST_ENTRY entry = queue->pendingIrps.Flink;
+    if (!IsListEmpty(&queue->pendingIrps) &&
+        SarHandleRingHasEntry(&queue->ring)) {
 
-        queuedIrp =
-            CONTAINING_RECORD(entry, SarHandleQueueIrp, listEntry);
-        RemoveEntryList(entry);
+        queuedIrp = CONTAINING_RECORD(
+            RemoveHeadList(&queue->pendingIrps), SarHandleQueueIrp, listEntry);
+        queue->pendingIrpCount--;
+        count = SarTakeQueuedHandles(queue, queuedIrp->irp, entries);
     }
 
+    KeReleaseSpinLock(&queue->lock, irql);
+
     if (!queuedIrp) {
-        SarHandleQueueItem *item = (SarHandleQueueItem *)ExAllocatePool2(
-            POOL_FLAG_NON_PAGED, sizeof(SarHandleQueueItem), SAR_TAG);
+        return;
+    }
 
-        if (!item) {
-            KeReleaseSpinLock(&queue->lock, irql);
-            ZwClose(kernelProcessHandle);
-            return STATUS_INSUFFICIENT_RESOURCES;
-        }
+    status = SarTransferQueuedHandles(
+        queuedIrp->irp, queuedIrp->kernelProcessHandle, entries, count);
+
+    SAR_DEBUG("complete handle queue");
 
-        item->associatedData = associatedData;
-        item->userHandle = userHandle;
-        item->kernelProcessHandle = kernelProcessHandle;
-        InsertTailList(&queue->pendingItems, &item->listEntry);
+    queuedIrp->irp->IoStatus.Status = status;
+    IoSetCancelRoutine(queuedIrp->irp, nullptr);
+    IoCompleteRequest(queuedIrp->irp, IO_NO_INCREMENT);
+    ZwClose(queuedIrp->kernelProcessHandle);
+    SarFreeObject(&gSarHandleQueueIrpPool, queuedIrp);
+}
+
+NTSTATUS SarPostHandleQueue(
+    SarHandleQueue *queue, HANDLE userHandle, ULONG64 associatedData)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    SarHandleRingEntry entry = {};
+
+    status = ObOpenObjectByPointerWithTag(
+        PsGetCurrentProcess(), OBJ_KERNEL_HANDLE,
+        nullptr, GENERIC_ALL, nullptr,
+        KernelMode, SAR_TAG, &entry.kernelProcessHandle);
+
+    if (!NT_SUCCESS(status)) {
+        return status;
     }
 
-    KeReleaseSpinLock(&queue->lock, irql);
+    entry.userHandle = userHandle;
+    entry.associatedData = associatedData;
 
-    if (queuedIrp) {
-        status = SarTransferQueuedHandle(
-            queuedIrp->irp, queuedIrp->kernelProcessHandle,
-            0, kernelProcessHandle, userHandle, associatedData);
+    if (!SarPushHandleRing(&queue->ring, &entry)) {
+        SAR_ERROR("Handle queue is full");
+        ZwClose(entry.kernelProcessHandle);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
-        SAR_DEBUG("complete handle queue");
+    // pairs with the barrier in SarWaitHandleQueue: either a waiter sees
+    // this handle after queueing its IRP, or we see the IRP here.
+    KeMemoryBarrier();
 
-        queuedIrp->irp->IoStatus.Status = status;
-        queuedIrp->irp->IoStatus.Information = sizeof(SarHandleQueueResponse);
-        IoSetCancelRoutine(queuedIrp->irp, nullptr);
-        IoCompleteRequest(queuedIrp->irp, IO_NO_INCREMENT);
-        ZwClose(kernelProcessHandle);
-        ExFreePoolWithTag(queuedIrp, SAR_TAG);
+    if (queue->pendingIrpCount) {
+        SarCompletePendingHandleQueueIrp(queue);
     }
 
-    return status;
+    return STATUS_SUCCESS;
 }
 
 NTSTATUS SarWaitHandleQueue(SarHandleQueue *queue, PIRP irp)
@@ -423,11 +492,10 @@ NTSTATUS SarWaitHandleQueue(SarHandleQueue *queue, PIRP irp)
     PIO_STACK_LOCATION irpStack = IoGetCurrentIrpStackLocation(irp);
     DWORD maxItems = irpStack->Parameters.DeviceIoControl.OutputBufferLength /
         sizeof(SarHandleQueueResponse);
-    DWORD nextItem = 0;
-    LIST_ENTRY toComplete;
+    SarHandleRingEntry entries[SAR_HANDLE_QUEUE_BATCH];
+    ULONG count;
     KIRQL irql;
 
-    InitializeListHead(&toComplete);
     irp->IoStatus.Information = 0;
 
     if (maxItems == 0) {
@@ -447,18 +515,11 @@ NTSTATUS SarWaitHandleQueue(SarHandleQueue *queue, PIRP irp)
     }
 
     KeAcquireSpinLock(&queue->lock, &irql);
+    count = SarTakeQueuedHandles(queue, irp, entries);
 
-    while (!IsListEmpty(&queue->pendingItems) && nextItem < maxItems) {
-        PLIST_ENTRY entry = RemoveHeadList(&queue->pendingItems);
-
-        InsertTailList(&toComplete, entry);
-        nextItem++;
-    }
-
-    if (IsListEmpty(&toComplete)) {
+    if (count == 0) {
         SarHandleQueueIrp *queuedIrp = (SarHandleQueueIrp *)
-            ExAllocatePool2(
-                POOL_FLAG_NON_PAGED, sizeof(SarHandleQueueIrp), SAR_TAG);
+            SarAllocateObject(&gSarHandleQueueIrpPool);
 
         if (!queuedIrp) {
             KeReleaseSpinLock(&queue->lock, irql);
@@ -466,41 +527,100 @@ NTSTATUS SarWaitHandleQueue(SarHandleQueue *queue, PIRP irp)
             return STATUS_INSUFFICIENT_RESOURCES;
         }
 
-        IoMarkIrpPending(irp);
-        IoSetCancelRoutine(irp, SarCancelHandleQueueIrp);
         queuedIrp->irp = irp;
         queuedIrp->kernelProcessHandle = kernelProcessHandle;
         InsertTailList(&queue->pendingIrps, &queuedIrp->listEntry);
-        status = STATUS_PENDING;
+        queue->pendingIrpCount++;
+        KeMemoryBarrier();
+
+        // a handle posted before the IRP was visible wouldn't have been
+        // handed to it, so look again.
+        count = SarTakeQueuedHandles(queue, irp, entries);
+
+        if (count == 0) {
+            IoMarkIrpPending(irp);
+            IoSetCancelRoutine(irp, SarCancelHandleQueueIrp);
+            KeReleaseSpinLock(&queue->lock, irql);
+            return STATUS_PENDING;
+        }
+
+        RemoveEntryList(&queuedIrp->listEntry);
+        queue->pendingIrpCount--;
+        SarFreeObject(&gSarHandleQueueIrpPool, queuedIrp);
     }
 
     KeReleaseSpinLock(&queue->lock, irql);
+    status = SarTransferQueuedHandles(
+        irp, kernelProcessHandle, entries, count);
+    ZwClose(kernelProcessHandle);
+    return status;
+}
 
-    if (!IsListEmpty(&toComplete)) {
-        nextItem = 0;
+SarObjectPool gSarEndpointPool;
+SarObjectPool gSarProcessContextPool;
+SarObjectPool gSarHandleQueueIrpPool;
 
-        while (!IsListEmpty(&toComplete)) {
-            PLIST_ENTRY entry = RemoveHeadList(&toComplete);
-            SarHandleQueueItem *queueItem =
-                CONTAINING_RECORD(entry, SarHandleQueueItem, listEntry);
+static PVOID SarAllocateSlabChunk(SIZE_T size)
+{
+    return ExAllocatePool2(POOL_FLAG_NON_PAGED, size, SAR_TAG);
+}
 
-            status = SarTransferQueuedHandle(
-                irp, kernelProcessHandle, nextItem++,
-                queueItem->kernelProcessHandle, queueItem->userHandle,
-                queueItem->associatedData);
-            ZwClose(queueItem->kernelProcessHandle);
-            ExFreePoolWithTag(queueItem, SAR_TAG);
-            irp->IoStatus.Information += sizeof(SarHandleQueueResponse);
+static VOID SarFreeSlabChunk(PVOID buffer)
+{
+    ExFreePoolWithTag(buffer, SAR_TAG);
+}
 
-            if (!NT_SUCCESS(status)) {
-                break;
-            }
-        }
+VOID SarInitializeObjectPool(
+    SarObjectPool *pool, SIZE_T objectSize, ULONG chunkObjects)
+{
+    KeInitializeSpinLock(&pool->lock);
+    SarInitializeSlab(&pool->slab, objectSize, chunkObjects,
+        SarAllocateSlabChunk, SarFreeSlabChunk);
+}
 
-        ZwClose(kernelProcessHandle);
-    }
+VOID SarDeleteObjectPool(SarObjectPool *pool)
+{
+    SarDeleteSlab(&pool->slab);
+}
 
-    return status;
+BOOLEAN SarReserveObjects(SarObjectPool *pool, ULONG count)
+{
+    BOOLEAN result;
+    KIRQL irql;
+
+    KeAcquireSpinLock(&pool->lock, &irql);
+    result = SarReserveSlab(&pool->slab, count);
+    KeReleaseSpinLock(&pool->lock, irql);
+    return result;
+}
+
+VOID SarUnreserveObjects(SarObjectPool *pool, ULONG count)
+{
+    KIRQL irql;
+
+    KeAcquireSpinLock(&pool->lock, &irql);
+    SarUnreserveSlab(&pool->slab, count);
+    KeReleaseSpinLock(&pool->lock, irql);
+}
+
+PVOID SarAllocateObject(SarObjectPool *pool)
+{
+    PVOID object;
+    KIRQL irql;
+
+    KeAcquireSpinLock(&pool->lock, &irql);
+    object = SarAllocateSlab(&pool->slab);
+    KeReleaseSpinLock(&pool->lock, irql);
+    return object;
+}
+
+VOID SarFreeObject(SarObjectPool *pool, PVOID object)
+{
+    KIRQL irql;
+
+    KeAcquireSpinLock(&pool->lock, &irql);
+    SarFreeSlab(&pool->slab, object);
+    KeReleaseSpinLock(&pool->lock, irql);
 }
 
 RTL_GENERIC_COMPARE_RESULTS NTAPI SarCompareTableEntry(
@@ -571,119 +691,6 @@ PVOID SarGetTableEntry(PRTL_GENERIC_TABLE table, PVOID key)
     return nullptr;
 }
 
-RTL_GENERIC_COMPARE_RESULTS NTAPI SarCompareStringTableEntry(
-    PRTL_AVL_TABLE table, PVOID lhs, PVOID rhs)
-{
-    UNREFERENCED_PARAMETER(table);
-    SarStringTableEntry *le = (SarStringTableEntry *)lhs;
-    SarStringTableEntry *re = (SarStringTableEntry *)rhs;
-    LONG result = RtlCompareUnicodeString(&le->key, &re->key, TRUE);
-
-    return result < 0 ? GenericLessThan :
-        result > 0 ? GenericGreaterThan : GenericEqual;
-}
-
-NTSTATUS SarInsertStringTableEntry(
-    PRTL_AVL_TABLE table, PUNICODE_STRING key, PVOID value)
-{
-    NTSTATUS status = STATUS_SUCCESS;
-    SarStringTableEntry entry = { {}, value };
-    BOOLEAN isNew = FALSE;
-    PVOID result = nullptr;
-
-    status = SarStringDuplicate(&entry.key, key);
-
-    if (!NT_SUCCESS(status)) {
-        goto err;
-    }
-
-    result = RtlInsertElementGenericTableAvl(
-        table, &entry, sizeof(entry), &isNew);
-
-    if (!result) {
-        status = STATUS_INSUFFICIENT_RESOURCES;
-        goto err;
-    }
-
-    if (!isNew) {
-        status = STATUS_OBJECT_NAME_EXISTS;
-        goto err;
-    }
-
-    return STATUS_SUCCESS;
-
-err:
-    if (entry.key.Buffer) {
-        SarStringFree(&entry.key);
-    }
-
-    return status;
-}
-
-BOOLEAN SarRemoveStringTableEntry(
-    PRTL_AVL_TABLE table, PUNICODE_STRING key)
-{
-    SarStringTableEntry entry = { *key, nullptr };
-
-    return RtlDeleteElementGenericTableAvl(table, &entry);
-}
-
-PVOID NTAPI SarAllocateStringTableEntry(PRTL_AVL_TABLE table, CLONG byteSize)
-{
-    UNREFERENCED_PARAMETER(table);
-    return ExAllocatePool2(POOL_FLAG_NON_PAGED, byteSize, SAR_TAG);
-}
-
-VOID NTAPI SarFreeStringTableEntry(PRTL_AVL_TABLE table, PVOID buffer)
-{
-    UNREFERENCED_PARAMETER(table);
-    SarStringTableEntry *entry = (SarStringTableEntry *)(
-        (PCHAR)buffer + sizeof(RTL_BALANCED_LINKS));
-
-    if (entry->key.Buffer) {
-        SarStringFree(&entry->key);
-    }
-
-    ExFreePoolWithTag(buffer, SAR_TAG);
-}
-
-PVOID SarGetStringTableEntry(PRTL_AVL_TABLE table, PCUNICODE_STRING key)
-{
-    SarStringTableEntry entry = { *key, nullptr };
-    SarStringTableEntry *result =
-        (SarStringTableEntry *)RtlLookupElementGenericTableAvl(table, &entry);
-
-    if (result) {
-        return result->value;
-    }
-
-    return nullptr;
-}
-
-VOID SarInitializeStringTable(PRTL_AVL_TABLE table)
-{
-    RtlInitializeGenericTableAvl(table,
-        SarCompareStringTableEntry,
-        SarAllocateStringTableEntry,
-        SarFreeStringTableEntry,
-        nullptr);
-}
-
-VOID SarClearStringTable(PRTL_AVL_TABLE table, VOID (*freeCb)(PVOID))
-{
-    PVOID entry;
-
-    while ((entry = RtlGetElementGenericTableAvl(table, 0)) != NULL) {
-        SarStringTableEntry *stEntry = (SarStringTableEntry *)entry;
-        PVOID value = stEntry->value;
-
-        RtlDeleteElementGenericTableAvl(table, entry);
-        freeCb(value);
-    }
-
-    NT_ASSERT(RtlIsGenericTableEmptyAvl(table));
-}
-
 NTSTATUS SarCopyProcessUser(PEPROCESS process, PTOKEN_USER *outTokenUser)
 {
     NT_ASSERT(process);
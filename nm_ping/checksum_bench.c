@@ -0,0 +1,156 @@
+#include "ping.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Times frame construction against the checksum loop buildFrame used to
+// have, which byte swapped and summed one 16-bit word at a time, and
+// checks that buildFrame and updateFrame agree with it.
+
+#define ITERATIONS 200000
+
+static const size_t kPayloadSizes[] = { 64, 256, 1024, MAX_PAYLOAD_SIZE };
+
+static uint64_t refSum(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        uint16_t hword;
+
+        memcpy(&hword, p + i, sizeof(hword));
+        sum += ntohs(hword);
+    }
+
+    if (len & 1) {
+        sum += p[len - 1] << 8;
+    }
+
+    return sum;
+}
+
+static uint16_t refFinish(uint64_t sum)
+{
+    while (sum > 0xFFFF) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return htons((uint16_t)~sum);
+}
+
+// Recomputes both checksums of a built frame the old way, with the
+// checksum fields themselves counted as 0.
+static void refChecksums(
+    const uint8_t *frame, size_t len, uint16_t *ipSum, uint16_t *udpSum)
+{
+    PacketHeader pkt;
+    struct { struct in_addr src, dst; uint8_t pad, proto; uint16_t len; }
+        __attribute__((packed)) pseudo;
+    uint64_t sum;
+
+    memcpy(&pkt, frame, sizeof(pkt));
+    pkt.ip.ip_sum = 0;
+    pkt.udp.uh_sum = 0;
+    *ipSum = refFinish(refSum(&pkt.ip, sizeof(pkt.ip)));
+
+    pseudo.src = pkt.ip.ip_src;
+    pseudo.dst = pkt.ip.ip_dst;
+    pseudo.pad = 0;
+    pseudo.proto = IPPROTO_UDP;
+    pseudo.len = pkt.udp.uh_ulen;
+    sum = refSum(&pseudo, sizeof(pseudo)) +
+        refSum(&pkt.udp, sizeof(pkt.udp)) +
+        refSum(frame + sizeof(pkt), len);
+    *udpSum = refFinish(sum);
+
+    if (!*udpSum) {
+        *udpSum = 0xFFFF;
+    }
+}
+
+static bool checkFrame(const uint8_t *frame, size_t len, const char *what)
+{
+    PacketHeader pkt;
+    uint16_t ipSum, udpSum;
+
+    memcpy(&pkt, frame, sizeof(pkt));
+    refChecksums(frame, len, &ipSum, &udpSum);
+
+    if (pkt.ip.ip_sum != ipSum || pkt.udp.uh_sum != udpSum) {
+        fprintf(stderr, "%s: %zu byte frame has checksums %04x/%04x, "
+            "expected %04x/%04x\n", what, len, ntohs(pkt.ip.ip_sum),
+            ntohs(pkt.udp.uh_sum), ntohs(ipSum), ntohs(udpSum));
+        return false;
+    }
+
+    return true;
+}
+
+int main(void)
+{
+    static uint8_t frame[MAX_FRAME_SIZE], payload[MAX_PAYLOAD_SIZE];
+    PingEndpoint src = { { 2, 0, 0, 0, 0, 1 }, { 0 }, 10001 };
+    PingEndpoint dst = { { 2, 0, 0, 0, 0, 2 }, { 0 }, PINGSRV_PORT };
+    volatile uint16_t sink = 0;
+    bool ok = true;
+
+    src.addr.s_addr = inet_addr("10.0.0.1");
+    dst.addr.s_addr = inet_addr("10.0.0.2");
+    srand(1);
+
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        payload[i] = (uint8_t)rand();
+    }
+
+    printf("%5s %12s %12s %12s\n",
+        "bytes", "old loop", "buildFrame", "updateFrame");
+
+    for (size_t i = 0; i < sizeof(kPayloadSizes) / sizeof(*kPayloadSizes);
+        ++i) {
+
+        size_t len = kPayloadSizes[i];
+        size_t frameLen = buildFrame(frame, &src, &dst, payload, len);
+        uint64_t start, oldNs, buildNs, updateNs;
+        uint16_t ipSum, udpSum;
+
+        ok &= checkFrame(frame, len, "buildFrame");
+
+        start = perfTime();
+
+        for (int j = 0; j < ITERATIONS; ++j) {
+            frame[sizeof(PacketHeader)] = (uint8_t)j;
+            refChecksums(frame, len, &ipSum, &udpSum);
+            sink += udpSum;
+        }
+
+        oldNs = perfTime() - start;
+        start = perfTime();
+
+        for (int j = 0; j < ITERATIONS; ++j) {
+            payload[0] = (uint8_t)j;
+            buildFrame(frame, &src, &dst, payload, len);
+        }
+
+        buildNs = perfTime() - start;
+        ok &= checkFrame(frame, len, "buildFrame");
+        start = perfTime();
+
+        // only the leading index changes between pings.
+        for (uint64_t j = 0; j < ITERATIONS; ++j) {
+            memcpy(payload, &j, sizeof(j));
+            updateFrame(frame, frameLen, &src, &dst, payload, len);
+        }
+
+        updateNs = perfTime() - start;
+        ok &= checkFrame(frame, len, "updateFrame");
+
+        printf("%5zu %10.1fns %10.1fns %10.1fns\n", len,
+            (double)oldNs / ITERATIONS, (double)buildNs / ITERATIONS,
+            (double)updateNs / ITERATIONS);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+#include "histogram.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HALF_COUNT (SUB_COUNT >> 1)
+#define MAX_VALUE ((UINT64_C(1) << HISTOGRAM_MAX_BITS) - 1)
+
+static int highestBit(uint64_t value)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+
+    _BitScanReverse64(&index, value);
+    return (int)index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+
+    if (_BitScanReverse(&index, (unsigned long)(value >> 32))) {
+        return (int)index + 32;
+    }
+
+    _BitScanReverse(&index, (unsigned long)value);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+static size_t bucketIndex(uint64_t value)
+{
+    int shift;
+
+    if (value < SUB_COUNT) {
+        return (size_t)value;
+    }
+
+    // value >> shift lands in [HALF_COUNT, SUB_COUNT).
+    shift = highestBit(value) - (HISTOGRAM_SUB_BITS - 1);
+    return SUB_COUNT + (size_t)(shift - 1) * HALF_COUNT +
+        (size_t)((value >> shift) - HALF_COUNT);
+}
+
+static uint64_t bucketHighestValue(size_t index)
+{
+    int shift;
+    uint64_t sub;
+
+    if (index < SUB_COUNT) {
+        return index;
+    }
+
+    shift = (int)((index - SUB_COUNT) / HALF_COUNT) + 1;
+    sub = (index - SUB_COUNT) % HALF_COUNT + HALF_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+void histogramInit(LatencyHistogram *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT64_MAX;
+}
+
+void histogramRecord(LatencyHistogram *histogram, uint64_t valueNs)
+{
+    if (valueNs > MAX_VALUE) {
+        valueNs = MAX_VALUE;
+    }
+
+    histogram->counts[bucketIndex(valueNs)]++;
+    histogram->total++;
+    histogram->sum += valueNs;
+
+    if (valueNs < histogram->min) {
+        histogram->min = valueNs;
+    }
+
+    if (valueNs > histogram->max) {
+        histogram->max = valueNs;
+    }
+}
+
+uint64_t histogramPercentile(const LatencyHistogram *histogram, double percentile)
+{
+    uint64_t target, seen = 0;
+
+    if (!histogram->total) {
+        return 0;
+    }
+
+    target = (uint64_t)(percentile / 100.0 * histogram->total + 0.5);
+
+    if (target < 1) {
+        target = 1;
+    }
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->counts[i];
+
+        if (seen >= target) {
+            uint64_t value = bucketHighestValue(i);
+
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+void histogramPrint(const LatencyHistogram *histogram, FILE *out)
+{
+    static const double kPercentiles[] = { 50.0, 99.0, 99.9, 99.99 };
+
+    if (!histogram->total) {
+        fprintf(out, "No samples recorded.\n");
+        return;
+    }
+
+    fprintf(out, "Samples: %" PRIu64 "\n", histogram->total);
+    fprintf(out, "  min     %10.3fus\n", histogram->min / 1000.0);
+    fprintf(out, "  avg     %10.3fus\n",
+        (double)histogram->sum / histogram->total / 1000.0);
+
+    for (size_t i = 0; i < sizeof(kPercentiles) / sizeof(kPercentiles[0]); ++i) {
+        fprintf(out, "  p%-6g %10.3fus\n", kPercentiles[i],
+            histogramPercentile(histogram, kPercentiles[i]) / 1000.0);
+    }
+
+    fprintf(out, "  max     %10.3fus\n", histogram->max / 1000.0);
+}
+
+bool writeLatencyCsv(
+    const char *path, const LatencySample *samples, size_t count,
+    const char *const *stageNames, int stageCount)
+{
+    FILE *fp = fopen(path, "w");
+
+    if (!fp) {
+        return false;
+    }
+
+    fprintf(fp, "index,time_ns,latency_ns");
+
+    for (int stage = 0; stage < stageCount; ++stage) {
+        fprintf(fp, ",%s_ns", stageNames[stage]);
+    }
+
+    fprintf(fp, "\n");
+
+    for (size_t i = 0; i < count; ++i) {
+        fprintf(fp, "%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+            samples[i].index, samples[i].timeNs, samples[i].latencyNs);
+
+        for (int stage = 0; stage < stageCount; ++stage) {
+            fprintf(fp, ",%" PRId64, samples[i].stageNs[stage]);
+        }
+
+        fprintf(fp, "\n");
+    }
+
+    return fclose(fp) == 0;
+}
@@ -0,0 +1,58 @@
+#ifndef NM_PING_HISTOGRAM_H
+#define NM_PING_HISTOGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Log-linear latency histogram in the style of HdrHistogram: values below
+// 2^HISTOGRAM_SUB_BITS nanoseconds are exact, larger ones land in buckets
+// no wider than 1/2^(HISTOGRAM_SUB_BITS - 1) of their value (0.8%). Values
+// above 2^HISTOGRAM_MAX_BITS ns (about 18 minutes) are clamped.
+#define HISTOGRAM_SUB_BITS 8
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS ((1 << HISTOGRAM_SUB_BITS) + \
+    (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * \
+    (1 << (HISTOGRAM_SUB_BITS - 1)))
+
+typedef struct LatencyHistogram
+{
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+} LatencyHistogram;
+
+#define LATENCY_MAX_STAGES 8
+
+typedef struct LatencySample
+{
+    uint64_t index;
+    uint64_t timeNs;
+    uint64_t latencyNs;
+    // optional breakdown of latencyNs; may be negative across clocks.
+    int64_t stageNs[LATENCY_MAX_STAGES];
+} LatencySample;
+
+void histogramInit(LatencyHistogram *histogram);
+void histogramRecord(LatencyHistogram *histogram, uint64_t valueNs);
+// Returns the highest value equivalent to the given percentile (0-100).
+uint64_t histogramPercentile(const LatencyHistogram *histogram, double percentile);
+void histogramPrint(const LatencyHistogram *histogram, FILE *out);
+// Writes samples as "index,time_ns,latency_ns" rows for offline plotting,
+// followed by a column for each named stage.
+bool writeLatencyCsv(
+    const char *path, const LatencySample *samples, size_t count,
+    const char *const *stageNames, int stageCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NM_PING_HISTOGRAM_H
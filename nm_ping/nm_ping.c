@@ -1,499 +1,482 @@
-#include <assert.h>
-#define NETMAP_WITH_LIBS
-#include <net/netmap_user.h>
-#include <stdbool.h>
-#include <stddef.h>
-#include <stdint.h>
+#include "histogram.h"
+#include "ping.h"
+#include "spinpolicy.h"
+
+#include <arpa/inet.h>
 #include <inttypes.h>
 #include <stdio.h>
-#include <ifaddrs.h>
-#include <net/ethernet.h>
-#include <net/if_arp.h>
-#include <net/if_dl.h>
-#include <netinet/in.h>
-#include <netinet/ip.h>
-#include <netinet/udp.h>
-#include <arpa/inet.h>
-#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
 
-#define BUSY_WAIT
-#define MAC_FORMAT "%02X:%02X:%02X:%02X:%02X:%02X"
-#define MAC_VALUES(v) (v)[0], (v)[1], (v)[2], (v)[3], (v)[4], (v)[5]
-#define IP4_FORMAT "%d.%d.%d.%d"
-#define IP4_VALUES(v) (v)[0], (v)[1], (v)[2], (v)[3]
 #define ITERATIONS 100000
-
-#define PINGSRV_PORT 10000
-
-#ifdef DEBUG_LOG
-#define dprintf printf
-#else
-#define dprintf(...)
+#define WARMUP_ITERATIONS 1000
+
+static void clientLoop(const PingTransport *transport, void *state);
+static void serverLoop(const PingTransport *transport, void *state);
+static const char *gProgName = "nm_ping";
+static PingOptions gOptions;
+static SpinPolicy gSpinPolicy;
+
+// Where a round trip's time went, measured with socket timestamps. The
+// network stage also includes the server's turnaround.
+enum {
+    STAGE_USER_TO_KERNEL,
+    STAGE_KERNEL_TO_WIRE,
+    STAGE_NETWORK,
+    STAGE_WAKEUP,
+    STAGE_NIC_TO_NIC,
+    STAGE_COUNT,
+};
+
+static const char *const kStageNames[STAGE_COUNT] = {
+    "user_to_kernel",
+    "kernel_to_wire",
+    "network",
+    "wakeup",
+    "nic_to_nic",
+};
+
+static const PingTransport *gTransports[] = {
+#ifdef WITH_NETMAP
+    &gNetmapTransport,
 #endif
+    &gUdpTransport,
+#ifdef __linux__
+    &gBusyPollUdpTransport,
+    &gPacketTransport,
+#endif
+#ifdef WITH_URING
+    &gUringTransport,
+#endif
+};
 
-static void clientLoop();
-static void serverLoop();
-static uint8_t gSrcMac[ETHER_ADDR_LEN];
-static struct in_addr gSrcAddr;
-static uint8_t gDstMac[ETHER_ADDR_LEN];
-static struct in_addr gDstAddr;
-static struct nm_desc *gNetMap;
-static int gIterationsLeft = ITERATIONS;
+#define TRANSPORT_COUNT (sizeof(gTransports) / sizeof(gTransports[0]))
 
-typedef struct Packet
+static void usage()
 {
-    struct ether_header eth;
-    struct ip ip;
-    struct udphdr udp;
-    uint64_t index;
-} __attribute__((packed)) Packet;
-
-static bool getMacAddress(const char *ifname, uint8_t *mac) {
-    struct ifaddrs *addrs;
-    bool found = false;
-
-    if (getifaddrs(&addrs) < 0) {
-        return false;
-    }
-
-    for (struct ifaddrs *cur = addrs; cur; cur = cur->ifa_next) {
-        struct sockaddr_dl *linkaddr = (struct sockaddr_dl *)cur->ifa_addr;
-
-        if (strcmp(cur->ifa_name, ifname)) {
-            continue;
-        }
-
-        if (!linkaddr || linkaddr->sdl_family != AF_LINK) {
-            continue;
-        }
-
-        memcpy(mac, LLADDR(linkaddr), ETHER_ADDR_LEN);
-        found = true;
-        break;
+    fprintf(stderr,
+        "Usage:\n"
+        "  %s [options] -s           # Starts server\n"
+        "  %s [options] <dest-ip>    # Starts client\n\n"
+        "Options:\n"
+        "  -t <transport>  Transport to use (default %s)\n"
+        "  -i <iface>      Local interface\n"
+        "  -m <dest-mac>   Server MAC address (raw frame transports)\n"
+        "  -p <port>       UDP port (default %d)\n"
+        "  -n <count>      Measured iterations (default %d)\n"
+        "  -w <count>      Unmeasured warm-up iterations (default %d)\n"
+        "  -l <bytes>      Payload size, %d to %d (default %d)\n"
+        "  -o <file>       Write per-sample latencies to a CSV file\n"
+        "  -W <mode>       Wait with spin, block or adaptive (default)\n"
+        "  -S <usec>       Longest adaptive spin window (default %d)\n"
+        "  -T <sw|hw>      Break latency down with socket timestamps\n\n"
+        "Transports:\n",
+        gProgName, gProgName, gTransports[0]->name, PINGSRV_PORT, ITERATIONS,
+        WARMUP_ITERATIONS, (int)sizeof(uint64_t), MAX_PAYLOAD_SIZE,
+        (int)sizeof(uint64_t), SPIN_MAX_WINDOW_NS / 1000);
+
+    for (size_t i = 0; i < TRANSPORT_COUNT; ++i) {
+        fprintf(stderr, "  %-14s  %s\n",
+            gTransports[i]->name, gTransports[i]->description);
     }
 
-    freeifaddrs(addrs);
-    return found;
+    exit(1);
 }
 
-static bool getIPv4Address(const char *ifname, struct in_addr *addr) {
-    struct ifaddrs *addrs;
-    bool found = false;
-
-    if (getifaddrs(&addrs) < 0) {
-        return false;
-    }
-
-    for (struct ifaddrs *cur = addrs; cur; cur = cur->ifa_next) {
-        struct sockaddr_in *inaddr = (struct sockaddr_in *)cur->ifa_addr;
-
-        if (strcmp(cur->ifa_name, ifname)) {
-            continue;
-        }
-
-        if (!inaddr || inaddr->sin_family != AF_INET) {
-            continue;
+static const PingTransport *findTransport(const char *name)
+{
+    for (size_t i = 0; i < TRANSPORT_COUNT; ++i) {
+        if (!strcmp(gTransports[i]->name, name)) {
+            return gTransports[i];
         }
-
-        *addr = inaddr->sin_addr;
-        found = true;
-        break;
     }
 
-    freeifaddrs(addrs);
-    return found;
+    return NULL;
 }
 
-static uint64_t xsum(const void *buf, size_t len)
+int main(int argc, char **argv)
 {
-    const uint16_t *hwords = (const uint16_t *)buf;
-    uint64_t sum = 0;
+    const PingTransport *transport;
+    void *state;
+    WaitMode waitMode = WAIT_ADAPTIVE;
+    uint64_t maxSpinNs = SPIN_MAX_WINDOW_NS;
+    int opt;
 
-    for (int i = 0; i < len >> 1; ++i) {
-        sum += ntohs(hwords[i]);
-    }
+    if (argc > 0 && argv[0]) {
+        const char *slash = strrchr(argv[0], '/');
 
-    if (len & 1) {
-        sum += ((uint8_t *)buf)[len - 1] << 8;
+        gProgName = slash ? slash + 1 : argv[0];
     }
 
-    return sum;
-}
-
-static uint16_t finsum(uint64_t sum)
-{
-    while (sum > 0xFFFF) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
+    gOptions.transport = gTransports[0]->name;
+    gOptions.port = PINGSRV_PORT;
+    gOptions.iterations = ITERATIONS;
+    gOptions.warmup = WARMUP_ITERATIONS;
+    gOptions.payloadSize = sizeof(uint64_t);
+
+    while ((opt = getopt(argc, argv, "t:i:m:p:n:w:l:o:W:S:T:s")) != -1) {
+        switch (opt) {
+        case 't':
+            gOptions.transport = optarg;
+            break;
+        case 'i':
+            gOptions.ifname = optarg;
+            break;
+        case 'm': {
+            uint32_t macBytes[ETHER_ADDR_LEN];
+
+            if (sscanf(optarg, MAC_FORMAT, macBytes, macBytes + 1,
+                macBytes + 2, macBytes + 3, macBytes + 4,
+                macBytes + 5) != ETHER_ADDR_LEN) {
+
+                fprintf(stderr, "Invalid server MAC address.\n");
+                return 1;
+            }
 
-    return htons(~(uint16_t)sum);
-}
+            for (int i = 0; i < ETHER_ADDR_LEN; ++i) {
+                gOptions.dstMac[i] = (uint8_t)macBytes[i];
+            }
 
-static uint16_t ipsum(struct ip *ip)
-{
-    return finsum(xsum(ip, offsetof(struct ip, ip_sum)) +
-        xsum((uint8_t*)ip + offsetof(struct ip, ip_src),
-            (ip->ip_hl << 2) - offsetof(struct ip, ip_src)));
-}
+            gOptions.haveDstMac = true;
+            break;
+        }
+        case 'p':
+            gOptions.port = (uint16_t)atoi(optarg);
+            break;
+        case 'n':
+            gOptions.iterations = atoi(optarg);
+            break;
+        case 'w':
+            gOptions.warmup = atoi(optarg);
+            break;
+        case 'l':
+            gOptions.payloadSize = atoi(optarg);
+            break;
+        case 'o':
+            gOptions.csvPath = optarg;
+            break;
+        case 'W':
+            if (!parseWaitMode(optarg, &waitMode)) {
+                usage();
+            }
 
-static uint16_t udpsum(struct ip *ip, struct udphdr *udp, void *data)
-{
-    struct ippseudo ips;
-
-    ips.ippseudo_src = ip->ip_src;
-    ips.ippseudo_dst = ip->ip_dst;
-    ips.ippseudo_pad = 0;
-    ips.ippseudo_p = ip->ip_p;
-    ips.ippseudo_len = udp->uh_ulen;
-
-    return finsum(
-        xsum(&ips, sizeof(ips)) +
-        xsum(udp, offsetof(struct udphdr, uh_sum)) +
-        xsum(data, ntohs(udp->uh_ulen) - sizeof(struct udphdr)));
-}
+            break;
+        case 'S':
+            maxSpinNs = (uint64_t)atoi(optarg) * 1000;
+            break;
+        case 'T':
+            if (!strcmp(optarg, "sw")) {
+                gOptions.timestamping = TIMESTAMP_SOFTWARE;
+            } else if (!strcmp(optarg, "hw")) {
+                gOptions.timestamping = TIMESTAMP_HARDWARE;
+            } else {
+                usage();
+            }
 
-static void usage()
-{
-    fprintf(stderr,
-        "Usage:\n"
-        "  %s <iface>                      # Starts server\n"
-        "  %s <iface> <dest-mac> <dest-ip> # Starts client\n\n",
-        getprogname(), getprogname());
-    exit(1);
-}
+            break;
+        case 's':
+            gOptions.server = true;
+            break;
+        default:
+            usage();
+        }
+    }
 
-int main(int argc, const char **argv)
-{
-    char ifname[256];
+    if (gOptions.server == (optind < argc) || gOptions.iterations <= 0 ||
+        gOptions.warmup < 0 || gOptions.payloadSize < (int)sizeof(uint64_t) ||
+        gOptions.payloadSize > MAX_PAYLOAD_SIZE) {
 
-    if (argc < 2) {
         usage();
     }
 
-    if (!getMacAddress(argv[1], gSrcMac)) {
-        fprintf(stderr, "Unable to get local MAC address\n");
-        return 1;
-    }
+    if (!gOptions.server &&
+        inet_pton(AF_INET, argv[optind], &gOptions.dstAddr) != 1) {
 
-    if (!getIPv4Address(argv[1], &gSrcAddr)) {
-        fprintf(stderr, "Unable to get local IP address\n");
+        fprintf(stderr, "Unable to parse destination IP address\n");
         return 1;
     }
 
-    if (argc > 2) {
-        uint32_t serverAddrBytes[ETHER_ADDR_LEN];
-
-        if (argc < 4) {
-            usage();
-        }
-
-        if (sscanf(argv[2], MAC_FORMAT, serverAddrBytes, serverAddrBytes + 1,
-            serverAddrBytes + 2, serverAddrBytes + 3, serverAddrBytes + 4,
-            serverAddrBytes + 5) != ETHER_ADDR_LEN) {
-
-            fprintf(stderr, "Invalid server MAC address.\n");
-            return 1;
-        }
+    transport = findTransport(gOptions.transport);
 
-        for (int i = 0; i < ETHER_ADDR_LEN; ++i) {
-            gDstMac[i] = (uint8_t)serverAddrBytes[i];
-        }
+    if (!transport) {
+        fprintf(stderr, "Unknown transport %s.\n", gOptions.transport);
+        usage();
+    }
 
-        if (inet_pton(AF_INET, argv[3], &gDstAddr) != 1) {
-            fprintf(stderr, "Unable to parse destination IP address\n");
-            return 1;
-        }
+    if (gOptions.timestamping != TIMESTAMP_NONE && !transport->timestamps) {
+        fprintf(stderr, "The %s transport doesn't support timestamping.\n",
+            transport->name);
+        return 1;
     }
 
-    snprintf(ifname, sizeof(ifname), "netmap:%s", argv[1]);
-    printf("Opening %s (" MAC_FORMAT ")\n", argv[1], MAC_VALUES(gSrcMac));
-    gNetMap = nm_open(ifname, 0, 0, 0);
+    spinPolicyInit(&gSpinPolicy, waitMode, SPIN_MIN_WINDOW_NS, maxSpinNs);
+    state = transport->open(&gOptions);
 
-    if (!gNetMap) {
-        printf("Can't access netmap.\n");
+    if (!state) {
         return 1;
     }
 
-    if (argc > 2) {
-        printf("Pinging " MAC_FORMAT ", ip " IP4_FORMAT ".\n",
-            MAC_VALUES(gDstMac), IP4_VALUES((uint8_t *)&gDstAddr.s_addr));
-        clientLoop();
+    if (gOptions.server) {
+        printf("Serving on port %d using %s.\n", gOptions.port, transport->name);
+        serverLoop(transport, state);
     } else {
-        serverLoop();
+        printf("Pinging " IP4_FORMAT " port %d using %s.\n",
+            IP4_VALUES((uint8_t *)&gOptions.dstAddr.s_addr), gOptions.port,
+            transport->name);
+        clientLoop(transport, state);
     }
 
-    nm_close(gNetMap);
-
+    transport->close(state);
     return 0;
 }
 
-#ifdef DEBUG_LOG
-static void printArp(struct arphdr *arp)
+// Spins on non-blocking receives for the policy's window, then blocks.
+static int waitReceive(
+    const PingTransport *transport, void *state, void *payload, size_t len)
 {
-    uint8_t *sha = (uint8_t *)ar_sha(arp);
-    uint8_t *spa = (uint8_t *)ar_spa(arp);
-    uint8_t *tha = (uint8_t *)ar_tha(arp);
-    uint8_t *tpa = (uint8_t *)ar_tpa(arp);
-
-    printf("ARP(%d): sha=" MAC_FORMAT " spa=" IP4_FORMAT
-        " tha=" MAC_FORMAT " tpa=" IP4_FORMAT "\n",
-        ntohs(arp->ar_op), MAC_VALUES(sha), IP4_VALUES(spa),
-        MAC_VALUES(tha), IP4_VALUES(tpa));
-}
-#endif
-
-static void onArpReceived(struct nm_pkthdr *hdr, uint8_t *buf)
-{
-    struct arphdr *arp = (struct arphdr *)(buf + sizeof(struct ether_header));
-
-    if (hdr->len < sizeof(struct ether_header) + sizeof(struct arphdr) ||
-        ntohs(arp->ar_hrd) != ARPHRD_ETHER ||
-        ntohs(arp->ar_pro) != ETHERTYPE_IP ||
-        arp->ar_hln != ETHER_ADDR_LEN ||
-        arp->ar_pln != sizeof(struct in_addr) ||
-        hdr->len < sizeof(struct ether_header) +
-            sizeof(struct arphdr) +
-            arp->ar_hln * 2 +
-            arp->ar_pln * 2) {
-
-        return;
+    uint64_t start = perfTime(), now = start;
+    uint64_t window = spinPolicyWindow(&gSpinPolicy);
+    int result = 0;
+    bool spinHit;
+
+    if (window) {
+        do {
+            result = transport->receive(state, payload, len, 0);
+            now = perfTime();
+        } while (!result && now - start < window);
     }
 
-    uint8_t *sha = (uint8_t *)ar_sha(arp);
-    uint8_t *spa = (uint8_t *)ar_spa(arp);
-    uint8_t *tpa = (uint8_t *)ar_tpa(arp);
-
-#if DEBUG_LOG
-    printArp(arp);
-#endif
+    spinHit = result != 0;
 
-    if (memcmp(tpa, &gSrcAddr, sizeof(struct in_addr)) ||
-        ntohs(arp->ar_op) != ARPOP_REQUEST) {
-        return;
+    while (!result) {
+        result = transport->receive(state, payload, len, -1);
     }
 
-    struct {
-        struct ether_header eth;
-        struct arphdr arp;
-        uint8_t sha[ETHER_ADDR_LEN];
-        struct in_addr spa;
-        uint8_t tha[ETHER_ADDR_LEN];
-        struct in_addr tpa;
-    } __attribute__((packed)) reply;
-
-    memcpy(reply.eth.ether_dhost, sha, ETHER_ADDR_LEN);
-    memcpy(reply.eth.ether_shost, gSrcMac, ETHER_ADDR_LEN);
-    reply.eth.ether_type = htons(ETHERTYPE_ARP);
-    reply.arp.ar_hrd = htons(ARPHRD_ETHER);
-    reply.arp.ar_pro = htons(ETHERTYPE_IP);
-    reply.arp.ar_hln = ETHER_ADDR_LEN;
-    reply.arp.ar_pln = sizeof(struct in_addr);
-    reply.arp.ar_op = htons(ARPOP_REPLY);
-    memcpy(reply.sha, gSrcMac, ETHER_ADDR_LEN);
-    memcpy(&reply.spa, &gSrcAddr, sizeof(struct in_addr));
-    memcpy(reply.tha, sha, ETHER_ADDR_LEN);
-    memcpy(&reply.tpa, spa, sizeof(struct in_addr));
-
-#if DEBUG_LOG
-    printf("--> ");
-    printArp(&reply.arp);
-#endif
-
-    if (!nm_inject(gNetMap, &reply, sizeof(reply))) {
-        fprintf(stderr, "Failed to send ARP reply\n");
-    }
+    spinPolicyUpdate(&gSpinPolicy, perfTime() - start, now - start, spinHit);
+    return result;
 }
 
-static uint64_t perfTime()
+static uint64_t cpuTime()
 {
-    struct timespec tp;
+    struct rusage usage;
 
-    clock_gettime(CLOCK_MONOTONIC, &tp);
-    return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+        1000000000 + (uint64_t)(usage.ru_utime.tv_usec +
+        usage.ru_stime.tv_usec) * 1000;
 }
 
-static bool isPingPacket(struct nm_pkthdr *hdr, Packet *pkt)
+static void splitLatency(const PingTimestamps *stamps, int64_t *stageNs)
 {
-    uint16_t etype = ntohs(pkt->eth.ether_type);
-
-    if (hdr->len < sizeof(Packet) ||
-        etype != ETHERTYPE_IP ||
-        pkt->ip.ip_p != IPPROTO_UDP) {
-
-        return false;
-    }
-
-    if (memcmp(pkt->eth.ether_dhost, gSrcMac, ETHER_ADDR_LEN)) {
-        return false;
-    }
-
-    if (pkt->ip.ip_dst.s_addr != gSrcAddr.s_addr) {
-        return false;
-    }
+    stageNs[STAGE_USER_TO_KERNEL] = (int64_t)(stamps->txSched - stamps->userSend);
+    stageNs[STAGE_KERNEL_TO_WIRE] = (int64_t)(stamps->txSoftware - stamps->txSched);
+    stageNs[STAGE_NETWORK] = (int64_t)(stamps->rxSoftware - stamps->txSoftware);
+    stageNs[STAGE_WAKEUP] = (int64_t)(stamps->userRecv - stamps->rxSoftware);
+    stageNs[STAGE_NIC_TO_NIC] = stamps->txHardware && stamps->rxHardware ?
+        (int64_t)(stamps->rxHardware - stamps->txHardware) : 0;
+}
 
-    if (ntohs(pkt->udp.uh_dport) != PINGSRV_PORT) {
-        return false;
+static void printBreakdown(
+    const LatencyHistogram *stages, int stageCount, uint64_t missing)
+{
+    printf("Breakdown (p50 / p99 / p99.9), %" PRIu64
+        " replies without timestamps:\n", missing);
+
+    for (int i = 0; i < stageCount; ++i) {
+        printf("  %-15s %10.3f %10.3f %10.3fus\n", kStageNames[i],
+            histogramPercentile(&stages[i], 50.0) / 1000.0,
+            histogramPercentile(&stages[i], 99.0) / 1000.0,
+            histogramPercentile(&stages[i], 99.9) / 1000.0);
     }
-
-    return true;
 }
 
-static void clientLoop()
+static void clientLoop(const PingTransport *transport, void *state)
 {
     uint64_t index = 0;
-    bool waiting = false;
-    struct pollfd pfd;
-    uint8_t *buf;
-    struct nm_pkthdr hdr;
+    int total = gOptions.warmup + gOptions.iterations;
+    size_t sampleCount = 0;
+    uint8_t payload[MAX_PAYLOAD_SIZE] = {};
+    uint8_t reply[MAX_FRAME_SIZE];
+    LatencyHistogram *histogram = malloc(sizeof(LatencyHistogram));
+    LatencyHistogram *stages = NULL;
+    LatencySample *samples = NULL;
+    int stageCount = 0;
+    uint64_t missingStamps = 0;
     struct timespec tp;
 
-    pfd.fd = NETMAP_FD(gNetMap);
-    pfd.events = POLLIN;
+    histogramInit(histogram);
+
+    if (gOptions.timestamping != TIMESTAMP_NONE) {
+        stageCount = gOptions.timestamping == TIMESTAMP_HARDWARE ?
+            STAGE_COUNT : STAGE_NIC_TO_NIC;
+        stages = malloc(stageCount * sizeof(LatencyHistogram));
+
+        for (int i = 0; i < stageCount; ++i) {
+            histogramInit(&stages[i]);
+        }
+    }
+
+    // samples are buffered so file I/O stays out of the timed loop.
+    if (gOptions.csvPath) {
+        samples = calloc(gOptions.iterations, sizeof(LatencySample));
+    }
 
     clock_getres(CLOCK_MONOTONIC, &tp);
     printf("CLOCK_MONOTONIC resolution: %ld sec, %ld nsec\n",
         tp.tv_sec, tp.tv_nsec);
-
-    // Give the link a bit of time to come back up after initializing netmap.
-    sleep(2);
+    printf("Payload %d bytes, %d warm-up iterations, %d measured.\n",
+        gOptions.payloadSize, gOptions.warmup, gOptions.iterations);
 
     uint64_t loopStart = perfTime(), loopEnd;
+    uint64_t cpuStart = cpuTime(), cpuEnd;
     uint64_t iterStart, iterEnd;
     uint64_t worstLatency = 0;
 
-    while (gIterationsLeft) {
-        if (!waiting) {
-            Packet pkt = {};
-
-            waiting = true;
-            iterStart = perfTime();
-            memcpy(pkt.eth.ether_dhost, gDstMac, sizeof(gDstMac));
-            memcpy(pkt.eth.ether_shost, gSrcMac, sizeof(gSrcMac));
-            pkt.eth.ether_type = htons(ETHERTYPE_IP);
-            pkt.ip.ip_v = IPVERSION;
-            pkt.ip.ip_hl = sizeof(pkt.ip) >> 2;
-            pkt.ip.ip_tos = IPTOS_LOWDELAY;
-            pkt.ip.ip_len = htons(sizeof(pkt) - sizeof(struct ether_header));
-            pkt.ip.ip_id = 0;
-            pkt.ip.ip_off = htons(IP_DF);
-            pkt.ip.ip_ttl = IPDEFTTL;
-            pkt.ip.ip_p = IPPROTO_UDP;
-            pkt.ip.ip_src = gSrcAddr;
-            pkt.ip.ip_dst = gDstAddr;
-            pkt.ip.ip_sum = ipsum(&pkt.ip);
-            pkt.udp.uh_sport = htons(PINGSRV_PORT);
-            pkt.udp.uh_dport = htons(PINGSRV_PORT);
-            pkt.udp.uh_ulen = htons(
-                sizeof(pkt) - sizeof(struct ip) - sizeof(struct ether_header));
-            pkt.index = ++index;
-            pkt.udp.uh_sum = udpsum(&pkt.ip, &pkt.udp, &pkt.index);
-
-            if (!nm_inject(gNetMap, &pkt, sizeof(Packet))) {
-                fprintf(stderr, "Failed to write packet to TX ring.\n");
-                return;
-            }
+    for (int i = 0; i < total; ++i) {
+        uint64_t replyIndex;
+        int64_t stageNs[STAGE_COUNT];
+        bool haveStamps = false;
+        int result;
+
+        // only the measured iterations count towards the wait statistics.
+        if (i == gOptions.warmup) {
+            gSpinPolicy.waits = gSpinPolicy.spinHits = 0;
+            gSpinPolicy.spinNs = gSpinPolicy.waitNs = 0;
+            loopStart = perfTime();
+            cpuStart = cpuTime();
+        }
 
-            dprintf("--> %016" PRIx64 "\n", index);
+        iterStart = perfTime();
+        ++index;
+        memcpy(payload, &index, sizeof(index));
+
+        if (!transport->send(state, payload, gOptions.payloadSize)) {
+            goto out;
         }
 
-        while ((buf = nm_nextpkt(gNetMap, &hdr))) {
-            struct ether_header *eth = (struct ether_header *)buf;
-            Packet *pkt = (Packet *)buf;
-            uint16_t etype = ntohs(eth->ether_type);
+        dprintf("--> %016" PRIx64 "\n", index);
 
-            if (etype == ETHERTYPE_ARP) {
-                onArpReceived(&hdr, buf);
-                continue;
-            }
+        do {
+            result = waitReceive(transport, state, reply, sizeof(reply));
 
-            if (!isPingPacket(&hdr, pkt)) {
-                continue;
+            if (result < 0) {
+                perror("receive");
+                goto out;
             }
 
-            if (memcmp(pkt->eth.ether_shost, gDstMac, ETHER_ADDR_LEN)) {
-                continue;
+            if (result >= (int)sizeof(replyIndex)) {
+                memcpy(&replyIndex, reply, sizeof(replyIndex));
             }
 
-            if (pkt->ip.ip_src.s_addr != gDstAddr.s_addr) {
-                continue;
-            }
+            // short or stale replies from an earlier run are just skipped.
+        } while (result < (int)sizeof(replyIndex) || replyIndex < index);
+
+        if (replyIndex != index) {
+            fprintf(stderr, "Index mismatch in ping response.\n");
+            goto out;
+        }
+
+        iterEnd = perfTime();
+
+        // fetch timestamps even while warming up so the socket error queue
+        // doesn't fill with stale ones.
+        if (stages) {
+            PingTimestamps stamps;
 
-            if (pkt->index != index) {
-                fprintf(stderr, "Index mismatch in ping response.\n");
-                return;
+            haveStamps = transport->timestamps(state, &stamps);
+
+            if (haveStamps) {
+                splitLatency(&stamps, stageNs);
             }
+        }
 
-            waiting = false;
-            gIterationsLeft--;
-            iterEnd = perfTime();
+        if (i < gOptions.warmup) {
+            continue;
+        }
 
-            if (iterEnd - iterStart > worstLatency) {
-                worstLatency = iterEnd - iterStart;
-                printf("worst case %08" PRIx64 " %" PRIu64 "us\n",
-                    index, worstLatency / 1000);
+        histogramRecord(histogram, iterEnd - iterStart);
+
+        if (samples) {
+            samples[sampleCount].index = index;
+            samples[sampleCount].timeNs = iterStart - loopStart;
+            samples[sampleCount].latencyNs = iterEnd - iterStart;
+        }
+
+        if (stages && !haveStamps) {
+            missingStamps++;
+        } else if (stages) {
+            for (int stage = 0; stage < stageCount; ++stage) {
+                histogramRecord(&stages[stage],
+                    stageNs[stage] > 0 ? (uint64_t)stageNs[stage] : 0);
+
+                if (samples) {
+                    samples[sampleCount].stageNs[stage] = stageNs[stage];
+                }
             }
         }
 
-        if (waiting) {
-#ifdef BUSY_WAIT
-            ioctl(NETMAP_FD(gNetMap), NIOCTXSYNC);
-            ioctl(NETMAP_FD(gNetMap), NIOCRXSYNC);
-#else
-            poll(&pfd, 1, -1);
-#endif
+        if (samples) {
+            sampleCount++;
+        }
+
+        if (iterEnd - iterStart > worstLatency) {
+            worstLatency = iterEnd - iterStart;
+            printf("worst case %08" PRIx64 " %" PRIu64 "us\n",
+                index, worstLatency / 1000);
         }
     }
 
     loopEnd = perfTime();
+    cpuEnd = cpuTime();
     printf("Average latency: %" PRIu64 "\n",
-        (loopEnd - loopStart) / 1000 / ITERATIONS);
+        (loopEnd - loopStart) / 1000 / gOptions.iterations);
     printf("Worst case latency: %" PRIu64 "us\n", worstLatency / 1000);
-}
+    histogramPrint(histogram, stdout);
 
-static void serverLoop()
-{
-    struct pollfd pfd;
-    uint8_t *buf;
-    struct nm_pkthdr hdr;
+    if (stages) {
+        printBreakdown(stages, stageCount, missingStamps);
+    }
 
-    pfd.fd = NETMAP_FD(gNetMap);
-    pfd.events = POLLIN;
+    printf("CPU: %.1f%% of a core, %s wait: %.1f%% caught spinning, "
+        "%.1f%% of wait time spent spinning, window %.1fus\n",
+        100.0 * (cpuEnd - cpuStart) / (loopEnd - loopStart),
+        waitModeName(gSpinPolicy.mode),
+        gSpinPolicy.waits ? 100.0 * gSpinPolicy.spinHits / gSpinPolicy.waits : 0,
+        gSpinPolicy.waitNs ? 100.0 * gSpinPolicy.spinNs / gSpinPolicy.waitNs : 0,
+        gSpinPolicy.windowNs / 1000.0);
 
-    while (true) {
-        while ((buf = nm_nextpkt(gNetMap, &hdr))) {
-            struct ether_header *eth = (struct ether_header *)buf;
-            Packet *pkt = (Packet *)buf;
-            uint16_t etype = ntohs(eth->ether_type);
-
-            if (etype == ETHERTYPE_ARP) {
-                onArpReceived(&hdr, buf);
-                continue;
-            }
+out:
+    if (samples) {
+        if (!writeLatencyCsv(gOptions.csvPath, samples, sampleCount,
+            kStageNames, stageCount)) {
 
-            if (!isPingPacket(&hdr, pkt)) {
-                continue;
-            }
+            perror(gOptions.csvPath);
+        }
+
+        free(samples);
+    }
 
-            Packet reply = *pkt;
+    free(stages);
+    free(histogram);
+}
 
-            memcpy(reply.eth.ether_shost, gSrcMac, ETHER_ADDR_LEN);
-            memcpy(reply.eth.ether_dhost, pkt->eth.ether_shost, ETHER_ADDR_LEN);
-            reply.ip.ip_src = gSrcAddr;
-            reply.ip.ip_dst = pkt->ip.ip_src;
-            reply.ip.ip_sum = ipsum(&reply.ip);
-            reply.udp.uh_sum = udpsum(&reply.ip, &reply.udp, &reply.index);
+static void serverLoop(const PingTransport *transport, void *state)
+{
+    uint8_t payload[MAX_FRAME_SIZE];
 
-            if (!nm_inject(gNetMap, &reply, sizeof(Packet))) {
-                fprintf(stderr, "Failed to write packet to TX ring.\n");
-            }
+    while (true) {
+        int result = waitReceive(transport, state, payload, sizeof(payload));
+
+        if (result < 0) {
+            perror("receive");
+            return;
         }
 
-#ifdef BUSY_WAIT
-        ioctl(NETMAP_FD(gNetMap), NIOCTXSYNC);
-        ioctl(NETMAP_FD(gNetMap), NIOCRXSYNC);
-#else
-        poll(&pfd, 1, -1);
-#endif
+        if (result > 0) {
+            transport->send(state, payload, result);
+        }
     }
 }
-
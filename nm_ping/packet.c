@@ -0,0 +1,370 @@
+#include "ping.h"
+
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#ifdef __linux__
+#include <netpacket/packet.h>
+#else
+#include <net/if_dl.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+typedef struct PseudoHeader
+{
+    struct in_addr src;
+    struct in_addr dst;
+    uint8_t pad;
+    uint8_t proto;
+    uint16_t len;
+} __attribute__((packed)) PseudoHeader;
+
+uint64_t perfTime(void)
+{
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+// Kernel socket timestamps are taken against CLOCK_REALTIME.
+uint64_t realTime(void)
+{
+    struct timespec tp;
+
+    clock_gettime(CLOCK_REALTIME, &tp);
+    return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+bool getMacAddress(const char *ifname, uint8_t *mac) {
+    struct ifaddrs *addrs;
+    bool found = false;
+
+    if (getifaddrs(&addrs) < 0) {
+        return false;
+    }
+
+    for (struct ifaddrs *cur = addrs; cur; cur = cur->ifa_next) {
+        if (strcmp(cur->ifa_name, ifname) || !cur->ifa_addr) {
+            continue;
+        }
+
+#ifdef __linux__
+        struct sockaddr_ll *linkaddr = (struct sockaddr_ll *)cur->ifa_addr;
+
+        if (linkaddr->sll_family != AF_PACKET) {
+            continue;
+        }
+
+        memcpy(mac, linkaddr->sll_addr, ETHER_ADDR_LEN);
+#else
+        struct sockaddr_dl *linkaddr = (struct sockaddr_dl *)cur->ifa_addr;
+
+        if (linkaddr->sdl_family != AF_LINK) {
+            continue;
+        }
+
+        memcpy(mac, LLADDR(linkaddr), ETHER_ADDR_LEN);
+#endif
+        found = true;
+        break;
+    }
+
+    freeifaddrs(addrs);
+    return found;
+}
+
+bool getIPv4Address(const char *ifname, struct in_addr *addr) {
+    struct ifaddrs *addrs;
+    bool found = false;
+
+    if (getifaddrs(&addrs) < 0) {
+        return false;
+    }
+
+    for (struct ifaddrs *cur = addrs; cur; cur = cur->ifa_next) {
+        struct sockaddr_in *inaddr = (struct sockaddr_in *)cur->ifa_addr;
+
+        if (strcmp(cur->ifa_name, ifname)) {
+            continue;
+        }
+
+        if (!inaddr || inaddr->sin_family != AF_INET) {
+            continue;
+        }
+
+        *addr = inaddr->sin_addr;
+        found = true;
+        break;
+    }
+
+    freeifaddrs(addrs);
+    return found;
+}
+
+bool getLocalEndpoint(const PingOptions *options, PingEndpoint *local)
+{
+    if (!options->ifname) {
+        fprintf(stderr, "The %s transport needs an interface (-i).\n",
+            options->transport);
+        return false;
+    }
+
+    if (!getMacAddress(options->ifname, local->mac)) {
+        fprintf(stderr, "Unable to get local MAC address\n");
+        return false;
+    }
+
+    if (!getIPv4Address(options->ifname, &local->addr)) {
+        fprintf(stderr, "Unable to get local IP address\n");
+        return false;
+    }
+
+    local->port = options->port;
+    return true;
+}
+
+// One's complement sum of buf, unfolded. The sum is independent of byte
+// order (RFC 1071), so it adds native 32-bit words and the result is only
+// byte swapped back, for free, by storing it in native order.
+static uint64_t xsum(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint64_t sum = 0;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    uint64_t lanes[4];
+#endif
+
+#ifdef __AVX2__
+    __m256i wide = _mm256_setzero_si256();
+
+    // widening each 32-bit word to 64 bits leaves plenty of headroom for
+    // carries, which are folded back in by finsum.
+    for (; len >= 32; p += 32, len -= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+
+        wide = _mm256_add_epi64(wide,
+            _mm256_unpacklo_epi32(v, _mm256_setzero_si256()));
+        wide = _mm256_add_epi64(wide,
+            _mm256_unpackhi_epi32(v, _mm256_setzero_si256()));
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, wide);
+    sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+
+    for (; len >= 16; p += 16, len -= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, _mm_setzero_si128()));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, _mm_setzero_si128()));
+    }
+
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sum += lanes[0] + lanes[1];
+#endif
+
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+
+        memcpy(&word, p, sizeof(word));
+        sum += (word & 0xFFFFFFFF) + (word >> 32);
+    }
+
+    for (; len >= 2; p += 2, len -= 2) {
+        uint16_t hword;
+
+        memcpy(&hword, p, sizeof(hword));
+        sum += hword;
+    }
+
+    if (len) {
+        uint16_t hword = 0;
+
+        // pad the odd byte out to a 16-bit word in memory order.
+        memcpy(&hword, p, 1);
+        sum += hword;
+    }
+
+    return sum;
+}
+
+static uint16_t fold(uint64_t sum)
+{
+    while (sum > 0xFFFF) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return (uint16_t)sum;
+}
+
+static uint16_t finsum(uint64_t sum)
+{
+    return (uint16_t)~fold(sum);
+}
+
+// RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m'), with m and m' the sums of the
+// old and new contents of whatever changed.
+static uint16_t updateSum(uint16_t check, uint64_t oldSum, uint64_t newSum)
+{
+    uint64_t sum = (uint16_t)~check;
+
+    return finsum(sum + (uint16_t)~fold(oldSum) + newSum);
+}
+
+static uint16_t ipsum(struct ip *ip)
+{
+    return finsum(xsum(ip, offsetof(struct ip, ip_sum)) +
+        xsum((uint8_t*)ip + offsetof(struct ip, ip_src),
+            (ip->ip_hl << 2) - offsetof(struct ip, ip_src)));
+}
+
+// A computed UDP checksum of 0 is sent as all ones; 0 means no checksum.
+static uint16_t udpcheck(uint16_t check)
+{
+    return check ? check : 0xFFFF;
+}
+
+static uint16_t udpsum(struct ip *ip, struct udphdr *udp, const void *data)
+{
+    PseudoHeader ips;
+
+    ips.src = ip->ip_src;
+    ips.dst = ip->ip_dst;
+    ips.pad = 0;
+    ips.proto = ip->ip_p;
+    ips.len = udp->uh_ulen;
+
+    return udpcheck(finsum(
+        xsum(&ips, sizeof(ips)) +
+        xsum(udp, offsetof(struct udphdr, uh_sum)) +
+        xsum(data, ntohs(udp->uh_ulen) - sizeof(struct udphdr))));
+}
+
+size_t buildFrame(
+    uint8_t *frame, const PingEndpoint *src, const PingEndpoint *dst,
+    const void *payload, size_t len)
+{
+    PacketHeader *pkt = (PacketHeader *)frame;
+    size_t frameLen = sizeof(PacketHeader) + len;
+    struct ip ip;
+    struct udphdr udp;
+
+    if (frameLen > MAX_FRAME_SIZE) {
+        return 0;
+    }
+
+    // PacketHeader is packed, so the headers are built and summed in
+    // aligned locals and copied into the frame afterwards.
+    memset(&ip, 0, sizeof(ip));
+    memset(&udp, 0, sizeof(udp));
+    ip.ip_v = IPVERSION;
+    ip.ip_hl = sizeof(ip) >> 2;
+    ip.ip_tos = IPTOS_LOWDELAY;
+    ip.ip_len = htons(frameLen - sizeof(struct ether_header));
+    ip.ip_id = 0;
+    ip.ip_off = htons(IP_DF);
+    ip.ip_ttl = IPDEFTTL;
+    ip.ip_p = IPPROTO_UDP;
+    ip.ip_src = src->addr;
+    ip.ip_dst = dst->addr;
+    ip.ip_sum = ipsum(&ip);
+    udp.uh_sport = htons(src->port);
+    udp.uh_dport = htons(dst->port);
+    udp.uh_ulen = htons(sizeof(struct udphdr) + len);
+    udp.uh_sum = udpsum(&ip, &udp, payload);
+
+    memcpy(pkt->eth.ether_dhost, dst->mac, ETHER_ADDR_LEN);
+    memcpy(pkt->eth.ether_shost, src->mac, ETHER_ADDR_LEN);
+    pkt->eth.ether_type = htons(ETHERTYPE_IP);
+    memcpy(&pkt->ip, &ip, sizeof(ip));
+    memcpy(&pkt->udp, &udp, sizeof(udp));
+    memcpy(frame + sizeof(PacketHeader), payload, len);
+    return frameLen;
+}
+
+size_t updateFrame(
+    uint8_t *frame, size_t frameLen, const PingEndpoint *src,
+    const PingEndpoint *dst, const void *payload, size_t len)
+{
+    PacketHeader *pkt = (PacketHeader *)frame;
+    uint8_t *data = frame + sizeof(PacketHeader);
+    uint64_t oldIndex, newIndex;
+
+    // successive pings only differ in the index at the start of the payload.
+    // A memcmp of the rest is much cheaper than summing it, and the index
+    // starts on an even offset, so its sum lines up with the checksum's.
+    if (frameLen != sizeof(PacketHeader) + len ||
+        len < sizeof(uint64_t) ||
+        memcmp(pkt->eth.ether_dhost, dst->mac, ETHER_ADDR_LEN) ||
+        pkt->ip.ip_dst.s_addr != dst->addr.s_addr ||
+        pkt->udp.uh_dport != htons(dst->port) ||
+        pkt->ip.ip_src.s_addr != src->addr.s_addr ||
+        pkt->udp.uh_sport != htons(src->port) ||
+        memcmp(data + sizeof(uint64_t), (const uint8_t *)payload +
+            sizeof(uint64_t), len - sizeof(uint64_t))) {
+
+        return buildFrame(frame, src, dst, payload, len);
+    }
+
+    memcpy(&oldIndex, data, sizeof(oldIndex));
+    memcpy(&newIndex, payload, sizeof(newIndex));
+    memcpy(data, &newIndex, sizeof(newIndex));
+    pkt->udp.uh_sum = udpcheck(updateSum(pkt->udp.uh_sum,
+        xsum(&oldIndex, sizeof(oldIndex)), xsum(&newIndex, sizeof(newIndex))));
+    return frameLen;
+}
+
+bool parseFrame(
+    const uint8_t *frame, size_t len, const PingEndpoint *local,
+    PingEndpoint *peer, const uint8_t **payload, size_t *payloadLen)
+{
+    const PacketHeader *pkt = (const PacketHeader *)frame;
+    size_t udpLen;
+
+    if (len < sizeof(PacketHeader) ||
+        ntohs(pkt->eth.ether_type) != ETHERTYPE_IP ||
+        pkt->ip.ip_p != IPPROTO_UDP) {
+
+        return false;
+    }
+
+    if (memcmp(pkt->eth.ether_dhost, local->mac, ETHER_ADDR_LEN)) {
+        return false;
+    }
+
+    if (pkt->ip.ip_dst.s_addr != local->addr.s_addr) {
+        return false;
+    }
+
+    if (ntohs(pkt->udp.uh_dport) != local->port) {
+        return false;
+    }
+
+    udpLen = ntohs(pkt->udp.uh_ulen);
+
+    if (udpLen < sizeof(struct udphdr) ||
+        len < sizeof(PacketHeader) + udpLen - sizeof(struct udphdr)) {
+
+        return false;
+    }
+
+    memcpy(peer->mac, pkt->eth.ether_shost, ETHER_ADDR_LEN);
+    peer->addr = pkt->ip.ip_src;
+    peer->port = ntohs(pkt->udp.uh_sport);
+    *payload = frame + sizeof(PacketHeader);
+    *payloadLen = udpLen - sizeof(struct udphdr);
+    return true;
+}
@@ -0,0 +1,128 @@
+#ifndef NM_PING_PING_H
+#define NM_PING_PING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+
+#define MAC_FORMAT "%02X:%02X:%02X:%02X:%02X:%02X"
+#define MAC_VALUES(v) (v)[0], (v)[1], (v)[2], (v)[3], (v)[4], (v)[5]
+#define IP4_FORMAT "%d.%d.%d.%d"
+#define IP4_VALUES(v) (v)[0], (v)[1], (v)[2], (v)[3]
+
+#define PINGSRV_PORT 10000
+#define MAX_FRAME_SIZE 2048
+// Largest UDP payload that fits an unfragmented 1500 byte MTU.
+#define MAX_PAYLOAD_SIZE 1472
+
+#ifdef DEBUG_LOG
+#define dprintf printf
+#else
+#define dprintf(...)
+#endif
+
+typedef enum TimestampMode
+{
+    TIMESTAMP_NONE,
+    TIMESTAMP_SOFTWARE,
+    TIMESTAMP_HARDWARE,
+} TimestampMode;
+
+typedef struct PingOptions
+{
+    const char *transport;
+    const char *ifname;
+    bool server;
+    struct in_addr dstAddr;
+    uint8_t dstMac[ETHER_ADDR_LEN];
+    bool haveDstMac;
+    uint16_t port;
+    int iterations;
+    int warmup;
+    int payloadSize;
+    const char *csvPath;
+    TimestampMode timestamping;
+} PingOptions;
+
+typedef struct PingEndpoint
+{
+    uint8_t mac[ETHER_ADDR_LEN];
+    struct in_addr addr;
+    uint16_t port;
+} PingEndpoint;
+
+// Per-packet timestamps for the last request and its reply, in CLOCK_REALTIME
+// nanoseconds except for the hardware ones, which come from the NIC clock.
+// Missing timestamps are 0.
+typedef struct PingTimestamps
+{
+    uint64_t userSend;
+    // entered the device queue (SCM_TSTAMP_SCHED).
+    uint64_t txSched;
+    // handed to the driver (SCM_TSTAMP_SND).
+    uint64_t txSoftware;
+    uint64_t txHardware;
+    uint64_t rxSoftware;
+    uint64_t rxHardware;
+    uint64_t userRecv;
+} PingTimestamps;
+
+typedef struct PacketHeader
+{
+    struct ether_header eth;
+    struct ip ip;
+    struct udphdr udp;
+} __attribute__((packed)) PacketHeader;
+
+// A transport moves UDP payloads between the client and server. Clients
+// always send to the configured destination; servers reply to whoever sent
+// the last payload they received.
+typedef struct PingTransport
+{
+    const char *name;
+    const char *description;
+    void *(*open)(const PingOptions *options);
+    bool (*send)(void *state, const void *payload, size_t len);
+    // Returns the payload length, 0 if nothing arrived within timeoutMs or
+    // -1 on error. A timeout of 0 never blocks and -1 blocks indefinitely.
+    int (*receive)(void *state, void *payload, size_t len, int timeoutMs);
+    void (*close)(void *state);
+    // Fetches timestamps for the last send and receive, returning false if
+    // any software timestamp is missing. NULL if timestamping is unsupported.
+    bool (*timestamps)(void *state, PingTimestamps *stamps);
+} PingTransport;
+
+extern const PingTransport gNetmapTransport;
+extern const PingTransport gUdpTransport;
+extern const PingTransport gBusyPollUdpTransport;
+extern const PingTransport gPacketTransport;
+extern const PingTransport gUringTransport;
+
+uint64_t perfTime(void);
+uint64_t realTime(void);
+bool getMacAddress(const char *ifname, uint8_t *mac);
+bool getIPv4Address(const char *ifname, struct in_addr *addr);
+bool getLocalEndpoint(const PingOptions *options, PingEndpoint *local);
+// Binds a UDP socket for the server, or connects one to the server.
+int openUdpSocket(const PingOptions *options);
+size_t buildFrame(
+    uint8_t *frame, const PingEndpoint *src, const PingEndpoint *dst,
+    const void *payload, size_t len);
+// Reuses a frameLen byte frame from an earlier buildFrame or updateFrame
+// call when only the leading 64-bit index of the payload changed, patching
+// the UDP checksum incrementally (RFC 1624). Anything else falls back to
+// buildFrame.
+size_t updateFrame(
+    uint8_t *frame, size_t frameLen, const PingEndpoint *src,
+    const PingEndpoint *dst, const void *payload, size_t len);
+// Checks that frame is a UDP packet addressed to local and returns its
+// payload, filling in the sender.
+bool parseFrame(
+    const uint8_t *frame, size_t len, const PingEndpoint *local,
+    PingEndpoint *peer, const uint8_t **payload, size_t *payloadLen);
+
+#endif // NM_PING_PING_H
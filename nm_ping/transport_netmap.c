@@ -0,0 +1,244 @@
+#ifdef WITH_NETMAP
+
+#include "ping.h"
+
+#define NETMAP_WITH_LIBS
+#include <net/netmap_user.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+typedef struct NetmapState
+{
+    struct nm_desc *netmap;
+    PingEndpoint local;
+    PingEndpoint peer;
+    bool server;
+    uint8_t frame[MAX_FRAME_SIZE];
+    size_t frameLen;
+} NetmapState;
+
+#ifdef DEBUG_LOG
+static void printArp(struct arphdr *arp)
+{
+    uint8_t *sha = (uint8_t *)(arp + 1);
+    uint8_t *spa = sha + arp->ar_hln;
+    uint8_t *tha = spa + arp->ar_pln;
+    uint8_t *tpa = tha + arp->ar_hln;
+
+    printf("ARP(%d): sha=" MAC_FORMAT " spa=" IP4_FORMAT
+        " tha=" MAC_FORMAT " tpa=" IP4_FORMAT "\n",
+        ntohs(arp->ar_op), MAC_VALUES(sha), IP4_VALUES(spa),
+        MAC_VALUES(tha), IP4_VALUES(tpa));
+}
+#endif
+
+static void onArpReceived(NetmapState *state, struct nm_pkthdr *hdr, uint8_t *buf)
+{
+    struct arphdr *arp = (struct arphdr *)(buf + sizeof(struct ether_header));
+
+    if (hdr->len < sizeof(struct ether_header) + sizeof(struct arphdr) ||
+        ntohs(arp->ar_hrd) != ARPHRD_ETHER ||
+        ntohs(arp->ar_pro) != ETHERTYPE_IP ||
+        arp->ar_hln != ETHER_ADDR_LEN ||
+        arp->ar_pln != sizeof(struct in_addr) ||
+        hdr->len < sizeof(struct ether_header) +
+            sizeof(struct arphdr) +
+            arp->ar_hln * 2 +
+            arp->ar_pln * 2) {
+
+        return;
+    }
+
+    uint8_t *sha = (uint8_t *)(arp + 1);
+    uint8_t *spa = sha + ETHER_ADDR_LEN;
+    uint8_t *tpa = spa + sizeof(struct in_addr) + ETHER_ADDR_LEN;
+
+#if DEBUG_LOG
+    printArp(arp);
+#endif
+
+    if (memcmp(tpa, &state->local.addr, sizeof(struct in_addr)) ||
+        ntohs(arp->ar_op) != ARPOP_REQUEST) {
+        return;
+    }
+
+    struct {
+        struct ether_header eth;
+        struct arphdr arp;
+        uint8_t sha[ETHER_ADDR_LEN];
+        struct in_addr spa;
+        uint8_t tha[ETHER_ADDR_LEN];
+        struct in_addr tpa;
+    } __attribute__((packed)) reply;
+
+    memcpy(reply.eth.ether_dhost, sha, ETHER_ADDR_LEN);
+    memcpy(reply.eth.ether_shost, state->local.mac, ETHER_ADDR_LEN);
+    reply.eth.ether_type = htons(ETHERTYPE_ARP);
+    reply.arp.ar_hrd = htons(ARPHRD_ETHER);
+    reply.arp.ar_pro = htons(ETHERTYPE_IP);
+    reply.arp.ar_hln = ETHER_ADDR_LEN;
+    reply.arp.ar_pln = sizeof(struct in_addr);
+    reply.arp.ar_op = htons(ARPOP_REPLY);
+    memcpy(reply.sha, state->local.mac, ETHER_ADDR_LEN);
+    memcpy(&reply.spa, &state->local.addr, sizeof(struct in_addr));
+    memcpy(reply.tha, sha, ETHER_ADDR_LEN);
+    memcpy(&reply.tpa, spa, sizeof(struct in_addr));
+
+#if DEBUG_LOG
+    printf("--> ");
+    printArp(&reply.arp);
+#endif
+
+    if (!nm_inject(state->netmap, &reply, sizeof(reply))) {
+        fprintf(stderr, "Failed to send ARP reply\n");
+    }
+}
+
+static void *netmapOpen(const PingOptions *options)
+{
+    NetmapState *state = calloc(1, sizeof(NetmapState));
+    char ifname[256];
+
+    if (!getLocalEndpoint(options, &state->local)) {
+        free(state);
+        return NULL;
+    }
+
+    if (!options->server) {
+        if (!options->haveDstMac) {
+            fprintf(stderr, "The netmap transport needs a server MAC (-m).\n");
+            free(state);
+            return NULL;
+        }
+
+        memcpy(state->peer.mac, options->dstMac, ETHER_ADDR_LEN);
+        state->peer.addr = options->dstAddr;
+        state->peer.port = options->port;
+    }
+
+    state->server = options->server;
+    snprintf(ifname, sizeof(ifname), "netmap:%s", options->ifname);
+    printf("Opening %s (" MAC_FORMAT ")\n",
+        options->ifname, MAC_VALUES(state->local.mac));
+    state->netmap = nm_open(ifname, 0, 0, 0);
+
+    if (!state->netmap) {
+        printf("Can't access netmap.\n");
+        free(state);
+        return NULL;
+    }
+
+    if (!options->server) {
+        // Give the link a bit of time to come back up after initializing
+        // netmap.
+        sleep(2);
+    }
+
+    return state;
+}
+
+static bool netmapSend(void *opaque, const void *payload, size_t len)
+{
+    NetmapState *state = opaque;
+    size_t frameLen = updateFrame(state->frame, state->frameLen,
+        &state->local, &state->peer, payload, len);
+
+    state->frameLen = frameLen;
+
+    if (!frameLen || !nm_inject(state->netmap, state->frame, frameLen)) {
+        fprintf(stderr, "Failed to write packet to TX ring.\n");
+        return false;
+    }
+
+    return true;
+}
+
+static int netmapNextPayload(NetmapState *state, void *payload, size_t len)
+{
+    struct nm_pkthdr hdr;
+    uint8_t *buf;
+
+    while ((buf = nm_nextpkt(state->netmap, &hdr))) {
+        struct ether_header *eth = (struct ether_header *)buf;
+        const uint8_t *data;
+        size_t dataLen;
+        PingEndpoint sender;
+
+        if (ntohs(eth->ether_type) == ETHERTYPE_ARP) {
+            onArpReceived(state, &hdr, buf);
+            continue;
+        }
+
+        if (!parseFrame(buf, hdr.len, &state->local, &sender,
+            &data, &dataLen)) {
+
+            continue;
+        }
+
+        if (state->server) {
+            state->peer = sender;
+        } else if (memcmp(sender.mac, state->peer.mac, ETHER_ADDR_LEN) ||
+            sender.addr.s_addr != state->peer.addr.s_addr) {
+
+            continue;
+        }
+
+        if (dataLen > len) {
+            dataLen = len;
+        }
+
+        memcpy(payload, data, dataLen);
+        return (int)dataLen;
+    }
+
+    return 0;
+}
+
+static int netmapReceive(void *opaque, void *payload, size_t len, int timeoutMs)
+{
+    NetmapState *state = opaque;
+    int result = netmapNextPayload(state, payload, len);
+
+    if (result) {
+        return result;
+    }
+
+    if (timeoutMs == 0) {
+        ioctl(NETMAP_FD(state->netmap), NIOCTXSYNC);
+        ioctl(NETMAP_FD(state->netmap), NIOCRXSYNC);
+    } else {
+        struct pollfd pfd;
+
+        pfd.fd = NETMAP_FD(state->netmap);
+        pfd.events = POLLIN;
+        poll(&pfd, 1, timeoutMs);
+    }
+
+    return netmapNextPayload(state, payload, len);
+}
+
+static void netmapClose(void *opaque)
+{
+    NetmapState *state = opaque;
+
+    nm_close(state->netmap);
+    free(state);
+}
+
+const PingTransport gNetmapTransport = {
+    "netmap",
+    "raw frames through a netmap port, answering ARP itself",
+    netmapOpen,
+    netmapSend,
+    netmapReceive,
+    netmapClose,
+    NULL,
+};
+
+#endif // WITH_NETMAP
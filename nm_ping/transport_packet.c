@@ -0,0 +1,247 @@
+#ifdef __linux__
+
+#include "ping.h"
+
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+
+// TPACKET_V2 hands over every frame as soon as it lands. V3 batches them
+// into blocks that are only released when full or when the block retire
+// timeout expires, which floored every round trip at about 1ms.
+#define BLOCK_SIZE (1 << 16)
+#define BLOCK_COUNT 16
+#define FRAME_SIZE 2048
+#define FRAME_COUNT (BLOCK_SIZE / FRAME_SIZE * BLOCK_COUNT)
+
+typedef struct PacketState
+{
+    int fd;
+    int ifindex;
+    uint8_t *ring;
+    size_t ringSize;
+    unsigned frameIndex;
+    PingEndpoint local;
+    PingEndpoint peer;
+    bool server;
+    uint8_t frame[MAX_FRAME_SIZE];
+    size_t frameLen;
+} PacketState;
+
+static void *packetOpen(const PingOptions *options)
+{
+    PacketState *state = calloc(1, sizeof(PacketState));
+    struct tpacket_req req = {};
+    struct sockaddr_ll addr = {};
+    int version = TPACKET_V2, ignoreOutgoing = 1;
+
+    state->fd = -1;
+
+    if (!getLocalEndpoint(options, &state->local)) {
+        goto err_out;
+    }
+
+    state->server = options->server;
+
+    // the client and server may share an address on loopback, so the
+    // client listens one port up to avoid seeing its own requests.
+    if (!options->server) {
+        if (!options->haveDstMac) {
+            fprintf(stderr, "The packet transport needs a server MAC (-m).\n");
+            goto err_out;
+        }
+
+        state->local.port = options->port + 1;
+        memcpy(state->peer.mac, options->dstMac, ETHER_ADDR_LEN);
+        state->peer.addr = options->dstAddr;
+        state->peer.port = options->port;
+    }
+
+    state->ifindex = if_nametoindex(options->ifname);
+    state->fd = socket(AF_PACKET, SOCK_RAW, htons(ETHERTYPE_IP));
+
+    if (state->fd < 0) {
+        perror("socket(AF_PACKET)");
+        goto err_out;
+    }
+
+    if (setsockopt(state->fd, SOL_PACKET, PACKET_VERSION,
+        &version, sizeof(version)) < 0) {
+
+        perror("PACKET_VERSION");
+        goto err_out;
+    }
+
+    setsockopt(state->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING,
+        &ignoreOutgoing, sizeof(ignoreOutgoing));
+
+    req.tp_block_size = BLOCK_SIZE;
+    req.tp_block_nr = BLOCK_COUNT;
+    req.tp_frame_size = FRAME_SIZE;
+    req.tp_frame_nr = FRAME_COUNT;
+
+    if (setsockopt(state->fd, SOL_PACKET, PACKET_RX_RING,
+        &req, sizeof(req)) < 0) {
+
+        perror("PACKET_RX_RING");
+        goto err_out;
+    }
+
+    state->ringSize = (size_t)BLOCK_SIZE * BLOCK_COUNT;
+    state->ring = mmap(NULL, state->ringSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_LOCKED, state->fd, 0);
+
+    if (state->ring == MAP_FAILED) {
+        perror("mmap");
+        state->ring = NULL;
+        goto err_out;
+    }
+
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETHERTYPE_IP);
+    addr.sll_ifindex = state->ifindex;
+
+    if (bind(state->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        goto err_out;
+    }
+
+    return state;
+
+err_out:
+    if (state->ring) {
+        munmap(state->ring, state->ringSize);
+    }
+
+    if (state->fd >= 0) {
+        close(state->fd);
+    }
+
+    free(state);
+    return NULL;
+}
+
+static bool packetSend(void *opaque, const void *payload, size_t len)
+{
+    PacketState *state = opaque;
+    struct sockaddr_ll addr = {};
+    size_t frameLen = updateFrame(state->frame, state->frameLen,
+        &state->local, &state->peer, payload, len);
+
+    state->frameLen = frameLen;
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETHERTYPE_IP);
+    addr.sll_ifindex = state->ifindex;
+    addr.sll_halen = ETHER_ADDR_LEN;
+    memcpy(addr.sll_addr, state->peer.mac, ETHER_ADDR_LEN);
+
+    if (!frameLen || sendto(state->fd, state->frame, frameLen, 0,
+        (struct sockaddr *)&addr, sizeof(addr)) != (ssize_t)frameLen) {
+
+        perror("sendto(AF_PACKET)");
+        return false;
+    }
+
+    return true;
+}
+
+static struct tpacket2_hdr *currentFrame(PacketState *state)
+{
+    return (struct tpacket2_hdr *)(
+        state->ring + (size_t)state->frameIndex * FRAME_SIZE);
+}
+
+static int packetNextPayload(PacketState *state, void *payload, size_t len)
+{
+    for (;;) {
+        struct tpacket2_hdr *hdr = currentFrame(state);
+        const uint8_t *data;
+        size_t dataLen;
+        PingEndpoint sender;
+        bool matched;
+
+        if (!(hdr->tp_status & TP_STATUS_USER)) {
+            return 0;
+        }
+
+        __sync_synchronize();
+        matched = parseFrame((uint8_t *)hdr + hdr->tp_mac, hdr->tp_snaplen,
+            &state->local, &sender, &data, &dataLen);
+
+        if (matched && !state->server &&
+            (sender.addr.s_addr != state->peer.addr.s_addr ||
+                sender.port != state->peer.port)) {
+
+            matched = false;
+        }
+
+        if (matched) {
+            if (state->server) {
+                state->peer = sender;
+            }
+
+            if (dataLen > len) {
+                dataLen = len;
+            }
+
+            memcpy(payload, data, dataLen);
+        }
+
+        // hand the frame back and move on to the next one.
+        __sync_synchronize();
+        hdr->tp_status = TP_STATUS_KERNEL;
+        state->frameIndex = (state->frameIndex + 1) % FRAME_COUNT;
+
+        if (matched) {
+            return (int)dataLen;
+        }
+    }
+}
+
+static int packetReceive(void *opaque, void *payload, size_t len, int timeoutMs)
+{
+    PacketState *state = opaque;
+    struct pollfd pfd;
+    int result = packetNextPayload(state, payload, len);
+
+    if (result || timeoutMs == 0) {
+        return result;
+    }
+
+    pfd.fd = state->fd;
+    pfd.events = POLLIN | POLLERR;
+    poll(&pfd, 1, timeoutMs);
+    return packetNextPayload(state, payload, len);
+}
+
+static void packetClose(void *opaque)
+{
+    PacketState *state = opaque;
+
+    munmap(state->ring, state->ringSize);
+    close(state->fd);
+    free(state);
+}
+
+const PingTransport gPacketTransport = {
+    "packet",
+    "AF_PACKET raw frames with a TPACKET_V2 receive ring",
+    packetOpen,
+    packetSend,
+    packetReceive,
+    packetClose,
+    NULL,
+};
+
+#endif // __linux__
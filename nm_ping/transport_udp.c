@@ -0,0 +1,374 @@
+#include "ping.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#endif
+
+// How long the kernel spins on the device queue inside a blocking receive.
+#define BUSY_POLL_USEC 50
+
+typedef struct UdpState
+{
+    int fd;
+    bool server;
+    struct sockaddr_in peer;
+    // datagrams sent, which SOF_TIMESTAMPING_OPT_ID uses to tag TX stamps.
+    uint32_t sends;
+    PingTimestamps stamps;
+} UdpState;
+
+int openUdpSocket(const PingOptions *options)
+{
+    struct sockaddr_in addr = {};
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(options->server ? options->port : 0);
+
+    if (options->ifname && !getIPv4Address(options->ifname, &addr.sin_addr)) {
+        fprintf(stderr, "Unable to get local IP address\n");
+        goto err_out;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        goto err_out;
+    }
+
+    if (!options->server) {
+        addr.sin_addr = options->dstAddr;
+        addr.sin_port = htons(options->port);
+
+        // connecting lets the kernel drop stray datagrams for us.
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            goto err_out;
+        }
+    }
+
+    return fd;
+
+err_out:
+    close(fd);
+    return -1;
+}
+
+#ifdef __linux__
+static uint64_t timespecNs(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static bool udpEnableTimestamping(UdpState *state, const PingOptions *options)
+{
+    int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+        SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_SCHED |
+        SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    if (options->timestamping == TIMESTAMP_HARDWARE) {
+        struct hwtstamp_config config = {};
+        struct ifreq ifr = {};
+
+        if (!options->ifname) {
+            fprintf(stderr, "Hardware timestamps need an interface (-i).\n");
+            return false;
+        }
+
+        config.tx_type = HWTSTAMP_TX_ON;
+        config.rx_filter = HWTSTAMP_FILTER_ALL;
+        strncpy(ifr.ifr_name, options->ifname, IFNAMSIZ - 1);
+        ifr.ifr_data = (void *)&config;
+
+        if (ioctl(state->fd, SIOCSHWTSTAMP, &ifr) < 0) {
+            perror("SIOCSHWTSTAMP");
+            return false;
+        }
+
+        flags |= SOF_TIMESTAMPING_RAW_HARDWARE |
+            SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+#ifdef SOF_TIMESTAMPING_OPT_TX_SWHW
+        // otherwise drivers suppress the software stamp once they take a
+        // hardware one.
+        flags |= SOF_TIMESTAMPING_OPT_TX_SWHW;
+#endif
+    }
+
+    if (setsockopt(state->fd, SOL_SOCKET, SO_TIMESTAMPING,
+        &flags, sizeof(flags)) < 0) {
+
+        perror("SO_TIMESTAMPING");
+        return false;
+    }
+
+    return true;
+}
+
+// TX timestamps are queued on the socket error queue as the packet passes
+// each stage; pick out the ones for the most recent send.
+static void udpReadTxTimestamps(UdpState *state)
+{
+    char control[512];
+
+    while (true) {
+        struct msghdr msg = {};
+        struct scm_timestamping *tss = NULL;
+        struct sock_extended_err *err = NULL;
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(state->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+            cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+            if (cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_TIMESTAMPING) {
+
+                tss = (struct scm_timestamping *)CMSG_DATA(cmsg);
+            } else if (cmsg->cmsg_level == SOL_IP &&
+                cmsg->cmsg_type == IP_RECVERR) {
+
+                err = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            }
+        }
+
+        if (!tss || !err ||
+            err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING ||
+            err->ee_data != state->sends - 1) {
+
+            continue;
+        }
+
+        if (err->ee_info == SCM_TSTAMP_SCHED) {
+            state->stamps.txSched = timespecNs(&tss->ts[0]);
+        } else if (err->ee_info == SCM_TSTAMP_SND) {
+            if (tss->ts[0].tv_sec || tss->ts[0].tv_nsec) {
+                state->stamps.txSoftware = timespecNs(&tss->ts[0]);
+            }
+
+            if (tss->ts[2].tv_sec || tss->ts[2].tv_nsec) {
+                state->stamps.txHardware = timespecNs(&tss->ts[2]);
+            }
+        }
+    }
+}
+
+static void udpReadRxTimestamps(UdpState *state, struct msghdr *msg)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg;
+        cmsg = CMSG_NXTHDR(msg, cmsg)) {
+
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_TIMESTAMPING) {
+
+            struct scm_timestamping *tss =
+                (struct scm_timestamping *)CMSG_DATA(cmsg);
+
+            state->stamps.rxSoftware = timespecNs(&tss->ts[0]);
+            state->stamps.rxHardware = timespecNs(&tss->ts[2]);
+        }
+    }
+}
+#endif
+
+static void *udpOpenCommon(const PingOptions *options, bool busyPoll)
+{
+    UdpState *state = calloc(1, sizeof(UdpState));
+
+    state->server = options->server;
+    state->fd = openUdpSocket(options);
+
+    if (state->fd < 0) {
+        free(state);
+        return NULL;
+    }
+
+    if (options->timestamping != TIMESTAMP_NONE) {
+#ifdef __linux__
+        if (!udpEnableTimestamping(state, options)) {
+            close(state->fd);
+            free(state);
+            return NULL;
+        }
+#else
+        fprintf(stderr, "SO_TIMESTAMPING isn't supported on this platform.\n");
+        close(state->fd);
+        free(state);
+        return NULL;
+#endif
+    }
+
+    if (busyPoll) {
+#ifdef SO_BUSY_POLL
+        int usec = BUSY_POLL_USEC, prefer = 1;
+
+        if (setsockopt(state->fd, SOL_SOCKET, SO_BUSY_POLL,
+            &usec, sizeof(usec)) < 0) {
+
+            perror("SO_BUSY_POLL (needs CAP_NET_ADMIN above "
+                "net.core.busy_poll)");
+        }
+
+        if (setsockopt(state->fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+            &prefer, sizeof(prefer)) < 0) {
+
+            perror("SO_PREFER_BUSY_POLL");
+        }
+#else
+        fprintf(stderr, "SO_BUSY_POLL isn't supported on this platform.\n");
+        close(state->fd);
+        free(state);
+        return NULL;
+#endif
+    }
+
+    return state;
+}
+
+static void *udpOpen(const PingOptions *options)
+{
+    return udpOpenCommon(options, false);
+}
+
+static void *busyPollUdpOpen(const PingOptions *options)
+{
+    return udpOpenCommon(options, true);
+}
+
+static bool udpSend(void *opaque, const void *payload, size_t len)
+{
+    UdpState *state = opaque;
+    ssize_t sent;
+
+    memset(&state->stamps, 0, sizeof(state->stamps));
+    state->stamps.userSend = realTime();
+    state->sends++;
+
+    // servers reply to whoever sent the last request; clients are connected.
+    if (state->server) {
+        sent = sendto(state->fd, payload, len, 0,
+            (struct sockaddr *)&state->peer, sizeof(state->peer));
+    } else {
+        sent = send(state->fd, payload, len, 0);
+    }
+
+    if (sent != (ssize_t)len) {
+        perror("send");
+        return false;
+    }
+
+    return true;
+}
+
+static int udpReceive(void *opaque, void *payload, size_t len, int timeoutMs)
+{
+    UdpState *state = opaque;
+    struct iovec iov = { payload, len };
+    struct msghdr msg = {};
+    char control[256];
+    int flags = 0;
+    ssize_t result;
+
+    if (timeoutMs == 0) {
+        flags = MSG_DONTWAIT;
+    } else if (timeoutMs > 0) {
+        struct pollfd pfd;
+
+        pfd.fd = state->fd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, timeoutMs) <= 0) {
+            return 0;
+        }
+
+        flags = MSG_DONTWAIT;
+    }
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (state->server) {
+        msg.msg_name = &state->peer;
+        msg.msg_namelen = sizeof(state->peer);
+    }
+
+    result = recvmsg(state->fd, &msg, flags);
+
+    if (result < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ?
+            0 : -1;
+    }
+
+    state->stamps.userRecv = realTime();
+#ifdef __linux__
+    udpReadRxTimestamps(state, &msg);
+#endif
+    return (int)result;
+}
+
+static bool udpTimestamps(void *opaque, PingTimestamps *stamps)
+{
+    UdpState *state = opaque;
+
+#ifdef __linux__
+    udpReadTxTimestamps(state);
+#endif
+    *stamps = state->stamps;
+    return stamps->txSched && stamps->txSoftware && stamps->rxSoftware;
+}
+
+static void udpClose(void *opaque)
+{
+    UdpState *state = opaque;
+
+    close(state->fd);
+    free(state);
+}
+
+const PingTransport gUdpTransport = {
+    "udp",
+    "kernel UDP sockets",
+    udpOpen,
+    udpSend,
+    udpReceive,
+    udpClose,
+    udpTimestamps,
+};
+
+const PingTransport gBusyPollUdpTransport = {
+    "udp-busypoll",
+    "kernel UDP sockets with SO_BUSY_POLL/SO_PREFER_BUSY_POLL",
+    busyPollUdpOpen,
+    udpSend,
+    udpReceive,
+    udpClose,
+    udpTimestamps,
+};
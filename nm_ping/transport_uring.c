@@ -0,0 +1,317 @@
+#ifdef WITH_URING
+
+#include "ping.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_ENTRIES 8
+#define RECV_TAG 1
+#define SEND_TAG 2
+
+// Talks to io_uring through the raw syscalls so we don't need liburing.
+typedef struct UringState
+{
+    int fd;
+    int ring;
+    bool server;
+    void *sqPtr;
+    void *cqPtr;
+    size_t sqSize;
+    size_t cqSize;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    struct io_uring_cqe *cqes;
+    struct msghdr recvMsg;
+    struct msghdr sendMsg;
+    struct iovec recvIov;
+    struct iovec sendIov;
+    struct sockaddr_in recvAddr;
+    struct sockaddr_in peer;
+    bool recvReady;
+    int recvResult;
+    bool sendPending;
+    uint8_t recvBuf[MAX_FRAME_SIZE];
+    uint8_t sendBuf[MAX_FRAME_SIZE];
+} UringState;
+
+static int uringEnter(
+    UringState *state, unsigned submit, unsigned wait, int timeoutMs)
+{
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    struct io_uring_getevents_arg arg = {};
+    struct __kernel_timespec ts;
+
+    if (wait && timeoutMs > 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        return (int)syscall(__NR_io_uring_enter, state->ring, submit, wait,
+            flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    return (int)syscall(__NR_io_uring_enter, state->ring, submit, wait,
+        flags, NULL, 0);
+}
+
+static void uringSubmit(
+    UringState *state, uint8_t opcode, struct msghdr *msg, uint64_t tag)
+{
+    unsigned tail = *state->sqTail;
+    unsigned index = tail & *state->sqMask;
+    struct io_uring_sqe *sqe = &state->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = state->fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->user_data = tag;
+    state->sqArray[index] = index;
+    __atomic_store_n(state->sqTail, tail + 1, __ATOMIC_RELEASE);
+    uringEnter(state, 1, 0, 0);
+}
+
+static void uringPostRecv(UringState *state)
+{
+    state->recvMsg.msg_namelen = sizeof(state->recvAddr);
+    uringSubmit(state, IORING_OP_RECVMSG, &state->recvMsg, RECV_TAG);
+}
+
+// Drains the completion queue without entering the kernel.
+static void uringReap(UringState *state)
+{
+    unsigned head = *state->cqHead;
+    unsigned tail = __atomic_load_n(state->cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cqMask];
+
+        if (cqe->user_data == RECV_TAG) {
+            state->recvReady = true;
+            state->recvResult = cqe->res;
+        } else if (cqe->user_data == SEND_TAG) {
+            state->sendPending = false;
+
+            if (cqe->res < 0) {
+                fprintf(stderr, "io_uring send: %s\n", strerror(-cqe->res));
+            }
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(state->cqHead, head, __ATOMIC_RELEASE);
+}
+
+static void *uringOpen(const PingOptions *options)
+{
+    UringState *state = calloc(1, sizeof(UringState));
+    struct io_uring_params params = {};
+
+    state->ring = -1;
+    state->server = options->server;
+    state->fd = openUdpSocket(options);
+
+    if (state->fd < 0) {
+        goto err_out;
+    }
+
+    state->ring = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+
+    if (state->ring < 0) {
+        perror("io_uring_setup");
+        goto err_out;
+    }
+
+    state->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    state->cqSize = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cqSize > state->sqSize) {
+            state->sqSize = state->cqSize;
+        }
+
+        state->cqSize = state->sqSize;
+    }
+
+    state->sqPtr = mmap(NULL, state->sqSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, state->ring, IORING_OFF_SQ_RING);
+
+    if (state->sqPtr == MAP_FAILED) {
+        perror("mmap(sq)");
+        goto err_out;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cqPtr = state->sqPtr;
+    } else {
+        state->cqPtr = mmap(NULL, state->cqSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, state->ring, IORING_OFF_CQ_RING);
+
+        if (state->cqPtr == MAP_FAILED) {
+            perror("mmap(cq)");
+            goto err_out;
+        }
+    }
+
+    state->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL, state->sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, state->ring, IORING_OFF_SQES);
+
+    if (state->sqes == MAP_FAILED) {
+        perror("mmap(sqes)");
+        goto err_out;
+    }
+
+    state->sqTail = (unsigned *)((uint8_t *)state->sqPtr + params.sq_off.tail);
+    state->sqMask = (unsigned *)(
+        (uint8_t *)state->sqPtr + params.sq_off.ring_mask);
+    state->sqArray = (unsigned *)(
+        (uint8_t *)state->sqPtr + params.sq_off.array);
+    state->cqHead = (unsigned *)((uint8_t *)state->cqPtr + params.cq_off.head);
+    state->cqTail = (unsigned *)((uint8_t *)state->cqPtr + params.cq_off.tail);
+    state->cqMask = (unsigned *)(
+        (uint8_t *)state->cqPtr + params.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe *)(
+        (uint8_t *)state->cqPtr + params.cq_off.cqes);
+
+    state->recvIov.iov_base = state->recvBuf;
+    state->recvIov.iov_len = sizeof(state->recvBuf);
+    state->recvMsg.msg_name = &state->recvAddr;
+    state->recvMsg.msg_iov = &state->recvIov;
+    state->recvMsg.msg_iovlen = 1;
+    state->sendMsg.msg_iov = &state->sendIov;
+    state->sendMsg.msg_iovlen = 1;
+    uringPostRecv(state);
+    return state;
+
+err_out:
+    // the kernel tears the mappings down with the ring.
+    if (state->ring >= 0) {
+        close(state->ring);
+    }
+
+    if (state->fd >= 0) {
+        close(state->fd);
+    }
+
+    free(state);
+    return NULL;
+}
+
+static bool uringSend(void *opaque, const void *payload, size_t len)
+{
+    UringState *state = opaque;
+
+    if (len > sizeof(state->sendBuf)) {
+        return false;
+    }
+
+    // ping-pong traffic never has more than one send in flight, so just
+    // wait out the previous one before reusing its buffer.
+    while (state->sendPending) {
+        uringReap(state);
+
+        if (state->sendPending) {
+            uringEnter(state, 0, 1, -1);
+        }
+    }
+
+    memcpy(state->sendBuf, payload, len);
+    state->sendIov.iov_base = state->sendBuf;
+    state->sendIov.iov_len = len;
+
+    if (state->server) {
+        state->sendMsg.msg_name = &state->peer;
+        state->sendMsg.msg_namelen = sizeof(state->peer);
+    }
+
+    state->sendPending = true;
+    uringSubmit(state, IORING_OP_SENDMSG, &state->sendMsg, SEND_TAG);
+    return true;
+}
+
+static int uringReceive(void *opaque, void *payload, size_t len, int timeoutMs)
+{
+    UringState *state = opaque;
+    int result;
+
+    uringReap(state);
+
+    if (!state->recvReady && timeoutMs != 0) {
+        uringEnter(state, 0, 1, timeoutMs);
+        uringReap(state);
+    }
+
+    if (!state->recvReady) {
+        return 0;
+    }
+
+    result = state->recvResult;
+    state->recvReady = false;
+
+    if (result > 0) {
+        if ((size_t)result > len) {
+            result = (int)len;
+        }
+
+        memcpy(payload, state->recvBuf, result);
+
+        if (state->server) {
+            state->peer = state->recvAddr;
+        }
+    }
+
+    uringPostRecv(state);
+
+    if (result < 0) {
+        return result == -EAGAIN || result == -EINTR ? 0 : -1;
+    }
+
+    return result;
+}
+
+static void uringClose(void *opaque)
+{
+    UringState *state = opaque;
+
+    munmap(state->sqes, state->sqesSize);
+
+    if (state->cqPtr != state->sqPtr) {
+        munmap(state->cqPtr, state->cqSize);
+    }
+
+    munmap(state->sqPtr, state->sqSize);
+    close(state->ring);
+    close(state->fd);
+    free(state);
+}
+
+const PingTransport gUringTransport = {
+    "uring",
+    "UDP sockets driven through io_uring RECVMSG/SENDMSG",
+    uringOpen,
+    uringSend,
+    uringReceive,
+    uringClose,
+    NULL,
+};
+
+#endif // WITH_URING